@@ -0,0 +1,99 @@
+/*=========================================================================
+
+  Name:        CommandQueue.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Fixed-size, lock-free, single-producer single-consumer
+               queue for passing commands from the application thread to
+               the servo thread without locking or allocating.
+
+=========================================================================*/
+
+
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+template <class T>
+class CommandQueue {
+public:
+    // Capacity is rounded up to a power of two
+    CommandQueue(int size = 1024) : readIndex(0), writeIndex(0), pendingIndex(0) {
+        int capacity = 1;
+        while (capacity < size) capacity *= 2;
+
+        commands.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    // Application thread: add a command without making it visible to the consumer.
+    // Return false if the queue is full.
+    bool Push(const T& command) {
+        if (pendingIndex - readIndex.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+
+        commands[pendingIndex & mask] = command;
+        pendingIndex++;
+
+        return true;
+    }
+
+    // Application thread: make all pushed commands visible to the consumer at once
+    void Publish() {
+        writeIndex.store(pendingIndex, std::memory_order_release);
+    }
+
+    // Application thread: true if everything published has been consumed
+    bool Empty() const {
+        return readIndex.load(std::memory_order_acquire) == writeIndex.load(std::memory_order_relaxed);
+    }
+
+    // Application thread: number of commands consumed so far
+    uint64_t Consumed() const {
+        return readIndex.load(std::memory_order_acquire);
+    }
+
+    // Application thread: number of commands pushed so far
+    uint64_t Pushed() const {
+        return pendingIndex;
+    }
+
+    // Servo thread: call f on every published command, in order
+    template <class F>
+    void Consume(F f) {
+        uint64_t read = readIndex.load(std::memory_order_relaxed);
+        uint64_t write = writeIndex.load(std::memory_order_acquire);
+
+        for (; read != write; read++) {
+            f(commands[read & mask]);
+        }
+
+        readIndex.store(read, std::memory_order_release);
+    }
+
+protected:
+    // Ring buffer storage, allocated up front
+    std::vector<T> commands;
+    uint64_t mask;
+
+    // Consumer position
+    std::atomic<uint64_t> readIndex;
+
+    // Published producer position
+    std::atomic<uint64_t> writeIndex;
+
+    // Unpublished producer position, only touched by the application thread
+    uint64_t pendingIndex;
+};
+
+
+#endif
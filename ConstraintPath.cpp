@@ -0,0 +1,264 @@
+/*=========================================================================
+
+  Name:        ConstraintPath.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Polylines for path constraints.
+
+=========================================================================*/
+
+
+#include "ConstraintPath.h"
+
+#include "VectorMath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+namespace {
+    // Segments per span between spline control points
+    const int splineSubdivisions = 8;
+
+    // Most segments in a leaf of a path's tree
+    const int leafSize = 4;
+
+    // Points closer than this to the previous one, relative to the path's size, are dropped
+    const double minSpacing = 1e-9;
+
+    // Add distinct points to a vertex list
+    void AddPoint(std::vector<double>& points, const double p[3], double epsilon) {
+        size_t n = points.size();
+        if (n >= 3) {
+            double d[3];
+            VectorSubtract(d, p, &points[n - 3]);
+            if (VectorMagnitude(d) <= epsilon) return;
+        }
+
+        points.insert(points.end(), p, p + 3);
+    }
+
+    // Uniform Catmull-Rom interpolation between p1 and p2
+    void CatmullRom(double result[3], const double p0[3], const double p1[3], const double p2[3], const double p3[3], double t) {
+        double t2 = t * t;
+        double t3 = t2 * t;
+
+        for (int i = 0; i < 3; i++) {
+            result[i] = 0.5 * (2.0 * p1[i] +
+                               (p2[i] - p0[i]) * t +
+                               (2.0 * p0[i] - 5.0 * p1[i] + 4.0 * p2[i] - p3[i]) * t2 +
+                               (3.0 * p1[i] - p0[i] - 3.0 * p2[i] + p3[i]) * t3);
+        }
+    }
+
+    // Fill node index for count segments from first, and add its children
+    void BuildNode(ConstraintPath& path, int index, int first, int count) {
+        PathNode node;
+        node.first = first;
+        node.count = count;
+        node.child = -1;
+        VectorCopy(node.lo, &path.points[first * 3]);
+        VectorCopy(node.hi, &path.points[first * 3]);
+        for (int i = first + 1; i <= first + count; i++) {
+            for (int j = 0; j < 3; j++) {
+                node.lo[j] = std::min(node.lo[j], path.points[i * 3 + j]);
+                node.hi[j] = std::max(node.hi[j], path.points[i * 3 + j]);
+            }
+        }
+
+        if (count > leafSize) {
+            // Children are stored next to each other
+            node.child = (int)path.nodes.size();
+            path.nodes.resize(path.nodes.size() + 2);
+        }
+
+        path.nodes[index] = node;
+
+        if (node.child >= 0) {
+            int half = count / 2;
+            BuildNode(path, node.child, first, half);
+            BuildNode(path, node.child + 1, first + half, count - half);
+        }
+    }
+
+    // Squared distance from p to a node's box
+    double BoxDistanceSquared(const PathNode& node, const double p[3]) {
+        double d2 = 0.0;
+        for (int j = 0; j < 3; j++) {
+            double d = p[j] < node.lo[j] ? node.lo[j] - p[j] : p[j] > node.hi[j] ? p[j] - node.hi[j] : 0.0;
+            d2 += d * d;
+        }
+        return d2;
+    }
+
+    // Keep the closest point on segment i if it is closer than the best so far, given as a squared distance
+    void TestSegment(const ConstraintPath& path, const double p[3], int i, PathPoint& result, double& best) {
+        const double* a = &path.points[i * 3];
+        const double* b = &path.points[i * 3 + 3];
+
+        double ab[3], ap[3];
+        VectorSubtract(ab, b, a);
+        VectorSubtract(ap, p, a);
+
+        double length2 = VectorMagnitudeSquared(ab);
+        double t = VectorDotProduct(ap, ab) / length2;
+        t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+
+        double q[3];
+        VectorScale(q, ab, t);
+        VectorAdd(q, a, q);
+
+        double d[3];
+        VectorSubtract(d, p, q);
+        double d2 = VectorMagnitudeSquared(d);
+        if (d2 >= best) return;
+
+        best = d2;
+
+        double length = std::sqrt(length2);
+        VectorCopy(result.p, q);
+        VectorScale(result.tangent, ab, 1.0 / length);
+        result.s = path.arcLength[i] + t * length;
+        result.segment = i;
+    }
+}
+
+
+bool BuildConstraintPath(ConstraintPath& path, const std::vector<double>& controlPoints, bool spline, bool closed) {
+    size_t n = controlPoints.size() / 3;
+    if (n < 2) return false;
+
+    // Size of the control points, for dropping repeated points
+    double lo[3], hi[3];
+    VectorCopy(lo, &controlPoints[0]);
+    VectorCopy(hi, &controlPoints[0]);
+    for (size_t i = 1; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            lo[j] = std::min(lo[j], controlPoints[i * 3 + j]);
+            hi[j] = std::max(hi[j], controlPoints[i * 3 + j]);
+        }
+    }
+
+    double extent[3];
+    VectorSubtract(extent, hi, lo);
+    double epsilon = VectorMagnitude(extent) * minSpacing;
+
+    std::vector<double> control;
+    for (size_t i = 0; i < n; i++) {
+        AddPoint(control, &controlPoints[i * 3], epsilon);
+    }
+
+    if (closed && control.size() >= 6) {
+        double d[3];
+        VectorSubtract(d, &control[control.size() - 3], &control[0]);
+        if (VectorMagnitude(d) <= epsilon) control.resize(control.size() - 3);
+    }
+
+    n = control.size() / 3;
+    if (n < 2) return false;
+
+    // Vertices, with the first repeated at the end of a closed path
+    std::vector<double> points;
+    if (spline) {
+        size_t spans = closed ? n : n - 1;
+        for (size_t i = 0; i < spans; i++) {
+            const double* p1 = &control[i * 3];
+            const double* p2 = &control[((i + 1) % n) * 3];
+
+            // Reflect the end points of an open path for the missing neighbours
+            double e0[3], e3[3];
+            const double* p0;
+            const double* p3;
+            if (i > 0 || closed) {
+                p0 = &control[((i + n - 1) % n) * 3];
+            }
+            else {
+                VectorScale(e0, p1, 2.0);
+                VectorSubtract(e0, e0, p2);
+                p0 = e0;
+            }
+            if (i + 2 < n || closed) {
+                p3 = &control[((i + 2) % n) * 3];
+            }
+            else {
+                VectorScale(e3, p2, 2.0);
+                VectorSubtract(e3, e3, p1);
+                p3 = e3;
+            }
+
+            for (int j = 0; j < splineSubdivisions; j++) {
+                double q[3];
+                CatmullRom(q, p0, p1, p2, p3, (double)j / splineSubdivisions);
+                AddPoint(points, q, epsilon);
+            }
+        }
+
+        AddPoint(points, closed ? &control[0] : &control[(n - 1) * 3], epsilon);
+    }
+    else {
+        points = control;
+        if (closed) AddPoint(points, &control[0], epsilon);
+    }
+
+    int numSegments = (int)points.size() / 3 - 1;
+    if (numSegments < 1) return false;
+
+    // Arc lengths
+    path.points.swap(points);
+    path.arcLength.resize(numSegments + 1);
+    path.arcLength[0] = 0.0;
+    for (int i = 0; i < numSegments; i++) {
+        double d[3];
+        VectorSubtract(d, &path.points[i * 3 + 3], &path.points[i * 3]);
+        path.arcLength[i + 1] = path.arcLength[i] + VectorMagnitude(d);
+    }
+    path.length = path.arcLength[numSegments];
+
+    // Tree over the segments
+    path.nodes.clear();
+    path.nodes.reserve(2 * (numSegments / leafSize + 1));
+    path.nodes.resize(1);
+    BuildNode(path, 0, 0, numSegments);
+
+    return true;
+}
+
+void ClosestPathPoint(const ConstraintPath& path, const double p[3], int hint, PathPoint& result) {
+    int numSegments = (int)path.arcLength.size() - 1;
+    double best = DBL_MAX;
+
+    if (hint >= 0 && hint < numSegments) {
+        TestSegment(path, p, hint, result, best);
+    }
+
+    // Depth first, nearer child first, skipping nodes whose boxes are farther than the closest point so far.
+    // Halving runs of segments keeps the depth below 32 for any path that fits in memory.
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const PathNode& node = path.nodes[stack[--top]];
+        if (BoxDistanceSquared(node, p) >= best) continue;
+
+        if (node.child < 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                TestSegment(path, p, i, result, best);
+            }
+        }
+        else {
+            int near = node.child;
+            int far = node.child + 1;
+            if (BoxDistanceSquared(path.nodes[far], p) < BoxDistanceSquared(path.nodes[near], p)) {
+                std::swap(near, far);
+            }
+
+            stack[top++] = far;
+            stack[top++] = near;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*=========================================================================
+
+  Name:        ConstraintPath.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Polylines for path constraints, with an arc length table
+               and a bounding volume hierarchy so the servo loop can find
+               the closest point on paths of thousands of segments.
+
+=========================================================================*/
+
+
+#ifndef CONSTRAINTPATH_H
+#define CONSTRAINTPATH_H
+
+
+#include <vector>
+
+
+// Bounding box of a run of consecutive segments, in a binary tree whose root is node 0
+struct PathNode {
+    double lo[3];
+    double hi[3];
+
+    // Segments covered, and the first of two children, or -1 for a leaf
+    int first;
+    int count;
+    int child;
+};
+
+// Polyline in a path's local graphics space. Built once on the application thread, then only read by the servo loop.
+struct ConstraintPath {
+    ConstraintPath() : length(0.0) {}
+
+    // Vertices as x, y, z coordinates, and the arc length at each vertex
+    std::vector<double> points;
+    std::vector<double> arcLength;
+    double length;
+
+    // Bounding volume hierarchy over the segments. Consecutive segments are close together, so splitting runs of them
+    // in half gives tight boxes without sorting.
+    std::vector<PathNode> nodes;
+};
+
+// Closest point on a path to a local point
+struct PathPoint {
+    double p[3];
+
+    // Unit direction of increasing arc length
+    double tangent[3];
+
+    // Arc length, and the segment the point is on
+    double s;
+    int segment;
+};
+
+
+// Fill a path from control points given as x, y, z coordinates, either joined by straight segments or interpolated by
+// a Catmull-Rom spline through them, and optionally closed. Returns false if there are fewer than two distinct points.
+bool BuildConstraintPath(ConstraintPath& path, const std::vector<double>& controlPoints, bool spline, bool closed);
+
+// Servo thread: closest point on the path to local point p. The segment found for the previous tick, or -1, bounds
+// the search, so following the probe usually only visits the nodes around it.
+void ClosestPathPoint(const ConstraintPath& path, const double p[3], int hint, PathPoint& result);
+
+
+#endif
@@ -0,0 +1,53 @@
+/*=========================================================================
+
+  Name:        DeviceBackend.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Compile-time selection of the device backend. Each backend
+               is a plain class with the same methods, so the servo tick
+               calls it directly rather than through a virtual interface:
+
+                 bool Open();
+                 void Close();
+
+                 // (minx, miny, minz, maxx, maxy, maxz), in meters
+                 void GetWorkspace(double workspace[6]);
+
+                 // Call tick(userData) every servo tick, from the
+                 // device's own servo thread or from servoThread
+                 bool StartServo(void (*tick)(void*), void* userData,
+                                 ServoThread& servoThread);
+                 void StopServo(ServoThread& servoThread);
+
+                 // Servo thread: device state, and the force to apply
+                 // for the time step dt
+                 void GetPosition(double p[3]);
+                 int GetButtons();
+                 void SetForce(const double f[3], double dt);
+
+               HDAL is used unless FALCON_NIFALCON_DEVICE (direct USB
+               with libnifalcon) or FALCON_SIMULATED_DEVICE is defined.
+
+=========================================================================*/
+
+
+#ifndef DEVICEBACKEND_H
+#define DEVICEBACKEND_H
+
+
+#if defined(FALCON_SIMULATED_DEVICE)
+#include "SimulatedDevice.h"
+typedef SimulatedDevice DeviceBackend;
+#elif defined(FALCON_NIFALCON_DEVICE)
+#include "NiFalconDevice.h"
+typedef NiFalconDevice DeviceBackend;
+#else
+#include "HdalDevice.h"
+typedef HdalDevice DeviceBackend;
+#endif
+
+
+#endif
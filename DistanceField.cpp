@@ -0,0 +1,370 @@
+/*=========================================================================
+
+  Name:        DistanceField.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Signed distance grids for haptic rendering of solid
+               shapes.
+
+=========================================================================*/
+
+
+#include "DistanceField.h"
+
+#include "VectorMath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+namespace {
+    // Most samples along each axis of a grid built from a mesh
+    const int maxResolution = 256;
+
+    // Cells around each triangle in which distances are computed exactly, before sweeping them outwards
+    const int exactBand = 1;
+
+    // Margin of cells around the mesh
+    const int margin = 2;
+
+    // Squared distance from p to triangle abc, from Ericson, Real-Time Collision Detection, 5.1.5
+    double PointTriangleDistanceSquared(const double p[3], const double a[3], const double b[3], const double c[3]) {
+        double ab[3], ac[3], ap[3], q[3];
+        VectorSubtract(ab, b, a);
+        VectorSubtract(ac, c, a);
+        VectorSubtract(ap, p, a);
+
+        double d1 = VectorDotProduct(ab, ap);
+        double d2 = VectorDotProduct(ac, ap);
+        if (d1 <= 0.0 && d2 <= 0.0) {
+            return VectorMagnitudeSquared(ap);
+        }
+
+        double bp[3];
+        VectorSubtract(bp, p, b);
+        double d3 = VectorDotProduct(ab, bp);
+        double d4 = VectorDotProduct(ac, bp);
+        if (d3 >= 0.0 && d4 <= d3) {
+            return VectorMagnitudeSquared(bp);
+        }
+
+        double vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+            VectorScale(q, ab, d1 / (d1 - d3));
+            VectorAdd(q, a, q);
+        }
+        else {
+            double cp[3];
+            VectorSubtract(cp, p, c);
+            double d5 = VectorDotProduct(ab, cp);
+            double d6 = VectorDotProduct(ac, cp);
+            if (d6 >= 0.0 && d5 <= d6) {
+                return VectorMagnitudeSquared(cp);
+            }
+
+            double vb = d5 * d2 - d1 * d6;
+            double va = d3 * d6 - d5 * d4;
+            if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+                VectorScale(q, ac, d2 / (d2 - d6));
+                VectorAdd(q, a, q);
+            }
+            else if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+                double bc[3];
+                VectorSubtract(bc, c, b);
+                VectorScale(q, bc, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+                VectorAdd(q, b, q);
+            }
+            else {
+                double denom = 1.0 / (va + vb + vc);
+                double u[3], v[3];
+                VectorScale(u, ab, vb * denom);
+                VectorScale(v, ac, vc * denom);
+                VectorAdd(q, a, u);
+                VectorAdd(q, q, v);
+            }
+        }
+
+        double d[3];
+        VectorSubtract(d, p, q);
+        return VectorMagnitudeSquared(d);
+    }
+
+    // Barycentric coordinates of (y, z) in the triangle's projection onto the yz plane. Returns false if outside.
+    bool PointInTriangleYZ(double y, double z, const double a[3], const double b[3], const double c[3], double w[3]) {
+        w[0] = (b[1] - y) * (c[2] - z) - (b[2] - z) * (c[1] - y);
+        w[1] = (c[1] - y) * (a[2] - z) - (c[2] - z) * (a[1] - y);
+        w[2] = (a[1] - y) * (b[2] - z) - (a[2] - z) * (b[1] - y);
+
+        bool negative = w[0] < 0.0 || w[1] < 0.0 || w[2] < 0.0;
+        bool positive = w[0] > 0.0 || w[1] > 0.0 || w[2] > 0.0;
+        if (negative && positive) return false;
+
+        double sum = w[0] + w[1] + w[2];
+        if (sum == 0.0) return false;
+
+        VectorScale(w, w, 1.0 / sum);
+        return true;
+    }
+}
+
+
+bool SampleDistanceGrid(const DistanceGrid& grid, const double p[3], double& distance, double gradient[3]) {
+    if (!grid.ready.load(std::memory_order_acquire)) return false;
+
+    // Cell containing the point, and the position within it
+    int i[3];
+    double t[3];
+    for (int a = 0; a < 3; a++) {
+        double x = (p[a] - grid.origin[a]) / grid.cellSize;
+        if (!(x >= 0.0 && x <= grid.dims[a] - 1)) return false;
+
+        i[a] = std::min((int)x, grid.dims[a] - 2);
+        t[a] = x - i[a];
+    }
+
+    int sy = grid.dims[0];
+    int sz = grid.dims[0] * grid.dims[1];
+    const float* d = &grid.distances[i[0] + i[1] * sy + i[2] * sz];
+
+    double d000 = d[0], d100 = d[1], d010 = d[sy], d110 = d[sy + 1];
+    double d001 = d[sz], d101 = d[sz + 1], d011 = d[sz + sy], d111 = d[sz + sy + 1];
+
+    // Interpolate along x, then y, then z, keeping the differences for the gradient
+    double d00 = d000 + t[0] * (d100 - d000);
+    double d10 = d010 + t[0] * (d110 - d010);
+    double d01 = d001 + t[0] * (d101 - d001);
+    double d11 = d011 + t[0] * (d111 - d011);
+
+    double d0 = d00 + t[1] * (d10 - d00);
+    double d1 = d01 + t[1] * (d11 - d01);
+
+    distance = d0 + t[2] * (d1 - d0);
+
+    double dx0 = (d100 - d000) + t[1] * ((d110 - d010) - (d100 - d000));
+    double dx1 = (d101 - d001) + t[1] * ((d111 - d011) - (d101 - d001));
+    gradient[0] = (dx0 + t[2] * (dx1 - dx0)) / grid.cellSize;
+    gradient[1] = ((d10 - d00) + t[2] * ((d11 - d01) - (d10 - d00))) / grid.cellSize;
+    gradient[2] = (d1 - d0) / grid.cellSize;
+
+    return true;
+}
+
+bool BuildDistanceGrid(DistanceGrid& grid, const std::vector<double>& vertices, const std::vector<int>& triangles, int resolution) {
+    int numVertices = (int)vertices.size() / 3;
+    int numTriangles = (int)triangles.size() / 3;
+    if (numVertices == 0 || numTriangles == 0) return false;
+
+    // Place the grid around the mesh
+    double lo[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+    double hi[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+    for (int v = 0; v < numVertices; v++) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], vertices[v * 3 + a]);
+            hi[a] = std::max(hi[a], vertices[v * 3 + a]);
+        }
+    }
+
+    double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    if (!(extent > 0.0)) return false;
+
+    resolution = std::max(1, std::min(resolution, maxResolution - 2 * margin - 2));
+    double h = extent / resolution;
+
+    int dims[3];
+    for (int a = 0; a < 3; a++) {
+        dims[a] = std::min((int)ceil((hi[a] - lo[a]) / h) + 1 + 2 * margin, maxResolution);
+        grid.origin[a] = lo[a] - margin * h;
+    }
+    int nx = dims[0], ny = dims[1], nz = dims[2];
+    size_t n = (size_t)nx * ny * nz;
+
+    std::vector<double> phi(n, DBL_MAX);
+    std::vector<int> closest(n, -1);
+    std::vector<int> crossings(n, 0);
+
+    // Vertices in grid units
+    std::vector<double> g(vertices.size());
+    for (int v = 0; v < numVertices; v++) {
+        for (int a = 0; a < 3; a++) {
+            g[v * 3 + a] = (vertices[v * 3 + a] - grid.origin[a]) / h;
+        }
+    }
+
+    // Exact distances near each triangle, and crossings of rows along x with it for inside and outside
+    for (int t = 0; t < numTriangles; t++) {
+        if ((t & 1023) == 0 && grid.cancelled.load(std::memory_order_relaxed)) return false;
+
+        const int* tri = &triangles[t * 3];
+        if (tri[0] < 0 || tri[0] >= numVertices || tri[1] < 0 || tri[1] >= numVertices || tri[2] < 0 || tri[2] >= numVertices) continue;
+
+        const double* a = &g[tri[0] * 3];
+        const double* b = &g[tri[1] * 3];
+        const double* c = &g[tri[2] * 3];
+
+        int i0[3], i1[3];
+        for (int ax = 0; ax < 3; ax++) {
+            double mn = std::min(a[ax], std::min(b[ax], c[ax]));
+            double mx = std::max(a[ax], std::max(b[ax], c[ax]));
+            i0[ax] = std::max((int)floor(mn) - exactBand, 0);
+            i1[ax] = std::min((int)ceil(mx) + exactBand, dims[ax] - 1);
+        }
+
+        for (int k = i0[2]; k <= i1[2]; k++) {
+            for (int j = i0[1]; j <= i1[1]; j++) {
+                for (int i = i0[0]; i <= i1[0]; i++) {
+                    double p[3] = { (double)i, (double)j, (double)k };
+                    double d = PointTriangleDistanceSquared(p, a, b, c);
+
+                    size_t index = i + (size_t)nx * (j + (size_t)ny * k);
+                    if (d < phi[index]) {
+                        phi[index] = d;
+                        closest[index] = t;
+                    }
+                }
+            }
+        }
+
+        // Rows are offset slightly so they don't pass exactly through edges and vertices
+        for (int k = i0[2]; k <= i1[2]; k++) {
+            for (int j = i0[1]; j <= i1[1]; j++) {
+                double w[3];
+                if (!PointInTriangleYZ(j + 1.13e-7, k + 2.71e-7, a, b, c, w)) continue;
+
+                double x = w[0] * a[0] + w[1] * b[0] + w[2] * c[0];
+                int i = std::max((int)ceil(x), 0);
+                if (i < nx) {
+                    crossings[i + (size_t)nx * (j + (size_t)ny * k)]++;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (closest[i] >= 0) phi[i] = sqrt(phi[i]);
+    }
+
+    // Sweep the closest triangles outwards in all eight diagonal directions, twice
+    for (int pass = 0; pass < 2; pass++) {
+        for (int dir = 0; dir < 8; dir++) {
+            if (grid.cancelled.load(std::memory_order_relaxed)) return false;
+
+            int di = dir & 1 ? 1 : -1;
+            int dj = dir & 2 ? 1 : -1;
+            int dk = dir & 4 ? 1 : -1;
+
+            int k0 = dk > 0 ? 1 : nz - 2, k1 = dk > 0 ? nz : -1;
+            int j0 = dj > 0 ? 1 : ny - 2, j1 = dj > 0 ? ny : -1;
+            int i0 = di > 0 ? 1 : nx - 2, i1 = di > 0 ? nx : -1;
+
+            for (int k = k0; k != k1; k += dk) {
+                for (int j = j0; j != j1; j += dj) {
+                    for (int i = i0; i != i1; i += di) {
+                        size_t index = i + (size_t)nx * (j + (size_t)ny * k);
+                        double p[3] = { (double)i, (double)j, (double)k };
+
+                        // Check the neighbours already swept past
+                        for (int m = 1; m < 8; m++) {
+                            int ni = m & 1 ? i - di : i;
+                            int nj = m & 2 ? j - dj : j;
+                            int nk = m & 4 ? k - dk : k;
+
+                            int t = closest[ni + (size_t)nx * (nj + (size_t)ny * nk)];
+                            if (t < 0 || t == closest[index]) continue;
+
+                            const int* tri = &triangles[t * 3];
+                            double d = sqrt(PointTriangleDistanceSquared(p, &g[tri[0] * 3], &g[tri[1] * 3], &g[tri[2] * 3]));
+                            if (d < phi[index]) {
+                                phi[index] = d;
+                                closest[index] = t;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Inside where an odd number of crossings are to the left, in local units
+    grid.distances.resize(n);
+    for (int k = 0; k < nz; k++) {
+        for (int j = 0; j < ny; j++) {
+            int total = 0;
+            for (int i = 0; i < nx; i++) {
+                size_t index = i + (size_t)nx * (j + (size_t)ny * k);
+                total += crossings[index];
+
+                double d = phi[index] * h;
+                grid.distances[index] = (float)(total % 2 ? -d : d);
+            }
+        }
+    }
+
+    for (int a = 0; a < 3; a++) {
+        grid.dims[a] = dims[a];
+    }
+    grid.cellSize = h;
+
+    return true;
+}
+
+
+DistanceGridBuilder::DistanceGridBuilder() : stop(false) {
+}
+
+DistanceGridBuilder::~DistanceGridBuilder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].grid->cancelled = true;
+        }
+    }
+    wake.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void DistanceGridBuilder::Build(std::shared_ptr<DistanceGrid> grid, std::vector<double> vertices, std::vector<int> triangles, int resolution) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Job job;
+        job.grid = grid;
+        job.vertices.swap(vertices);
+        job.triangles.swap(triangles);
+        job.resolution = resolution;
+        jobs.push_back(std::move(job));
+
+        if (!thread.joinable()) {
+            thread = std::thread(&DistanceGridBuilder::Run, this);
+        }
+    }
+    wake.notify_one();
+}
+
+void DistanceGridBuilder::Run() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stop || !jobs.empty(); });
+            if (stop) return;
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        if (job.grid->cancelled) continue;
+
+        // The servo loop only reads the grid once it is ready
+        if (BuildDistanceGrid(*job.grid, job.vertices, job.triangles, job.resolution)) {
+            job.grid->ready.store(true, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*=========================================================================
+
+  Name:        DistanceField.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Signed distance grids for haptic rendering of solid
+               shapes. A grid is either uploaded by the application or
+               built from a closed triangle mesh on a background thread,
+               and the servo loop samples distance and gradient with
+               trilinear interpolation, so the cost per tick doesn't
+               depend on the shape.
+
+=========================================================================*/
+
+
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Signed distance grid in a shape's local graphics space, negative inside. Samples are at origin + index * cellSize,
+// with x varying fastest. Filled once, then read by the servo loop without locking once ready is set.
+struct DistanceGrid {
+    DistanceGrid() : ready(false), cancelled(false), cellSize(1.0) {
+        dims[0] = dims[1] = dims[2] = 0;
+        origin[0] = origin[1] = origin[2] = 0.0;
+    }
+
+    std::atomic<bool> ready;
+
+    // Set when the effect using the grid is removed, so a build in progress can stop
+    std::atomic<bool> cancelled;
+
+    int dims[3];
+    double origin[3];
+    double cellSize;
+    std::vector<float> distances;
+};
+
+
+// Servo thread: distance and gradient at a local point, interpolated from the eight surrounding samples.
+// Returns false if the grid isn't ready or the point is outside it.
+bool SampleDistanceGrid(const DistanceGrid& grid, const double p[3], double& distance, double gradient[3]);
+
+// Fill a grid from a closed triangle mesh, with the given number of cells along the mesh's longest side and a margin
+// of two cells all round. Distances are exact; inside and outside are found by ray parity along x.
+// Returns false if cancelled or the mesh is empty.
+bool BuildDistanceGrid(DistanceGrid& grid, const std::vector<double>& vertices, const std::vector<int>& triangles, int resolution);
+
+
+// Builds grids from meshes on a background thread, one at a time, in the order requested
+class DistanceGridBuilder {
+public:
+    DistanceGridBuilder();
+    ~DistanceGridBuilder();
+
+    // Application thread: queue a mesh, given as x, y, z vertex coordinates and three vertex indices per triangle.
+    // The grid is marked ready when built.
+    void Build(std::shared_ptr<DistanceGrid> grid, std::vector<double> vertices, std::vector<int> triangles, int resolution);
+
+protected:
+    struct Job {
+        std::shared_ptr<DistanceGrid> grid;
+        std::vector<double> vertices;
+        std::vector<int> triangles;
+        int resolution;
+    };
+
+    // Started with the first job
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    bool stop;
+
+    void Run();
+};
+
+
+#endif
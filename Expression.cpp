@@ -0,0 +1,587 @@
+/*=========================================================================
+
+  Name:        Expression.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Force expressions for custom effects.
+
+=========================================================================*/
+
+
+#include "Expression.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+
+namespace {
+    // Result of one operation, shared by constant folding and evaluation so both give the same values
+    inline double Apply(int op, double a, double b, double c) {
+        switch (op) {
+        case OpAdd: return a + b;
+        case OpSubtract: return a - b;
+        case OpMultiply: return a * b;
+        case OpDivide: return a / b;
+        case OpPower: return std::pow(a, b);
+        case OpNegate: return -a;
+        case OpLess: return a < b ? 1.0 : 0.0;
+        case OpLessEqual: return a <= b ? 1.0 : 0.0;
+        case OpGreater: return a > b ? 1.0 : 0.0;
+        case OpGreaterEqual: return a >= b ? 1.0 : 0.0;
+        case OpEqual: return a == b ? 1.0 : 0.0;
+        case OpNotEqual: return a != b ? 1.0 : 0.0;
+        case OpAnd: return a != 0.0 && b != 0.0 ? 1.0 : 0.0;
+        case OpOr: return a != 0.0 || b != 0.0 ? 1.0 : 0.0;
+        case OpNot: return a == 0.0 ? 1.0 : 0.0;
+        case OpSelect: return a != 0.0 ? b : c;
+        case OpSin: return std::sin(a);
+        case OpCos: return std::cos(a);
+        case OpTan: return std::tan(a);
+        case OpExp: return std::exp(a);
+        case OpLog: return std::log(a);
+        case OpSqrt: return std::sqrt(a);
+        case OpAbs: return std::fabs(a);
+        case OpFloor: return std::floor(a);
+        case OpMin: return a < b ? a : b;
+        case OpMax: return a > b ? a : b;
+        case OpAtan2: return std::atan2(a, b);
+        case OpClamp: return a < b ? b : a > c ? c : a;
+        default: return 0.0;
+        }
+    }
+
+    struct Function {
+        const char* name;
+        int op;
+        int numArguments;
+    };
+
+    const Function functions[] = {
+        { "sin", OpSin, 1 },
+        { "cos", OpCos, 1 },
+        { "tan", OpTan, 1 },
+        { "exp", OpExp, 1 },
+        { "log", OpLog, 1 },
+        { "sqrt", OpSqrt, 1 },
+        { "abs", OpAbs, 1 },
+        { "floor", OpFloor, 1 },
+        { "min", OpMin, 2 },
+        { "max", OpMax, 2 },
+        { "pow", OpPower, 2 },
+        { "atan2", OpAtan2, 2 },
+        { "clamp", OpClamp, 3 },
+        { "if", OpSelect, 3 }
+    };
+
+    const char* inputNames[NumExpressionInputs] = {
+        "px", "py", "pz", "vx", "vy", "vz", "t", "u0", "u1", "u2", "u3", "u4", "u5", "u6", "u7"
+    };
+
+    const char* outputNames[3] = { "fx", "fy", "fz" };
+
+    // Node of the expression graph. Equal operations on the same arguments share a node.
+    struct Node {
+        // Operation, or -1 for a constant and -2 for an input
+        int op;
+        double value;
+        int input;
+        int args[3];
+
+        // References from reachable nodes and outputs, and the register assigned
+        int uses;
+        int reg;
+    };
+
+    const int constantNode = -1;
+    const int inputNode = -2;
+
+    class Compiler {
+    public:
+        Compiler(const std::string& source) : source(source), pos(0), depth(0) {
+            for (int i = 0; i < NumExpressionInputs; i++) {
+                Node n = NewNode(inputNode);
+                n.input = i;
+                names[inputNames[i]] = Add(n);
+            }
+        }
+
+        bool Compile(ExpressionProgram& program, std::string& message) {
+            int output[3];
+            for (int i = 0; i < 3; i++) {
+                output[i] = -1;
+            }
+
+            // Statements
+            for (;;) {
+                while (Peek() == ';' || Peek() == '\n') pos++;
+                if (Peek() == '\0') break;
+
+                std::string name;
+                if (!ReadName(name)) return Fail(message, "Expected a name");
+
+                if (!Match('=')) return Fail(message, "Expected '=' after " + name);
+
+                int value = ParseExpression();
+                if (value < 0) return Fail(message, error);
+
+                if (Peek() != ';' && Peek() != '\n' && Peek() != '\0') return Fail(message, "Expected the end of the statement");
+
+                int o = OutputIndex(name);
+                if (o >= 0) {
+                    output[o] = value;
+                }
+                else if (IsInput(name) || name == "pi") {
+                    return Fail(message, "Can't assign to " + name);
+                }
+
+                // Outputs can also be read back as variables
+                names[name] = value;
+            }
+
+            if (output[0] < 0 && output[1] < 0 && output[2] < 0) {
+                message = "No force assigned: set fx, fy or fz";
+                return false;
+            }
+
+            for (int i = 0; i < 3; i++) {
+                if (output[i] < 0) output[i] = Constant(0.0);
+            }
+
+            return Generate(program, output, message);
+        }
+
+    protected:
+        const std::string& source;
+        size_t pos;
+
+        // Parenthesis nesting, within which new lines don't end statements
+        int depth;
+
+        std::string error;
+
+        std::vector<Node> nodes;
+        std::map<std::string, int> names;
+        std::map<uint64_t, int> constants;
+        std::map<std::tuple<int, int, int, int>, int> operations;
+
+        // Code generation
+        std::vector<ExpressionInstruction> code;
+        std::vector<int> freeRegisters;
+        int numRegisters;
+
+
+        bool Fail(std::string& message, const std::string& text) {
+            char position[32];
+            snprintf(position, sizeof(position), " at character %d", (int)pos + 1);
+            message = text + position;
+            return false;
+        }
+
+        int SetError(const std::string& text) {
+            if (error.empty()) error = text;
+            return -1;
+        }
+
+        static int OutputIndex(const std::string& name) {
+            for (int i = 0; i < 3; i++) {
+                if (name == outputNames[i]) return i;
+            }
+            return -1;
+        }
+
+        static bool IsInput(const std::string& name) {
+            for (int i = 0; i < NumExpressionInputs; i++) {
+                if (name == inputNames[i]) return true;
+            }
+            return false;
+        }
+
+        // Next character after spaces, and comments to the end of the line
+        char Peek() {
+            for (;;) {
+                char c = pos < source.size() ? source[pos] : '\0';
+                if (c == ' ' || c == '\t' || c == '\r' || (c == '\n' && depth > 0)) {
+                    pos++;
+                }
+                else if (c == '#') {
+                    while (pos < source.size() && source[pos] != '\n') pos++;
+                }
+                else {
+                    return c;
+                }
+            }
+        }
+
+        bool Match(char c) {
+            if (Peek() != c) return false;
+            pos++;
+            return true;
+        }
+
+        // Match a two character operator
+        bool Match(const char* s) {
+            if (Peek() != s[0] || pos + 1 >= source.size() || source[pos + 1] != s[1]) return false;
+            pos += 2;
+            return true;
+        }
+
+        bool ReadName(std::string& name) {
+            char c = Peek();
+            if (!isalpha((unsigned char)c) && c != '_') return false;
+
+            size_t start = pos;
+            while (pos < source.size() && (isalnum((unsigned char)source[pos]) || source[pos] == '_')) pos++;
+            name = source.substr(start, pos - start);
+            return true;
+        }
+
+
+        Node NewNode(int op) {
+            Node n;
+            n.op = op;
+            n.value = 0.0;
+            n.input = -1;
+            n.args[0] = n.args[1] = n.args[2] = -1;
+            n.uses = 0;
+            n.reg = -1;
+            return n;
+        }
+
+        int Add(const Node& n) {
+            nodes.push_back(n);
+            return (int)nodes.size() - 1;
+        }
+
+        bool IsConstant(int n, double value) {
+            return nodes[n].op == constantNode && nodes[n].value == value;
+        }
+
+        int Constant(double value) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+
+            std::map<uint64_t, int>::iterator it = constants.find(bits);
+            if (it != constants.end()) return it->second;
+
+            Node n = NewNode(constantNode);
+            n.value = value;
+            return constants[bits] = Add(n);
+        }
+
+        // Node for an operation, folding constants and simplifying where the result is unchanged
+        int Operation(int op, int a, int b = -1, int c = -1) {
+            bool constant = nodes[a].op == constantNode &&
+                            (b < 0 || nodes[b].op == constantNode) &&
+                            (c < 0 || nodes[c].op == constantNode);
+            if (constant) {
+                return Constant(Apply(op, nodes[a].value, b < 0 ? 0.0 : nodes[b].value, c < 0 ? 0.0 : nodes[c].value));
+            }
+
+            switch (op) {
+            case OpAdd:
+                if (IsConstant(a, 0.0)) return b;
+                if (IsConstant(b, 0.0)) return a;
+                break;
+            case OpSubtract:
+                if (IsConstant(b, 0.0)) return a;
+                if (IsConstant(a, 0.0)) return Operation(OpNegate, b);
+                break;
+            case OpMultiply:
+                if (IsConstant(a, 1.0)) return b;
+                if (IsConstant(b, 1.0)) return a;
+                if (IsConstant(a, -1.0)) return Operation(OpNegate, b);
+                if (IsConstant(b, -1.0)) return Operation(OpNegate, a);
+                break;
+            case OpDivide:
+                if (IsConstant(b, 1.0)) return a;
+                break;
+            case OpPower:
+                if (IsConstant(b, 1.0)) return a;
+                if (IsConstant(b, 2.0)) return Operation(OpMultiply, a, a);
+                if (IsConstant(b, 3.0)) return Operation(OpMultiply, Operation(OpMultiply, a, a), a);
+                break;
+            case OpNegate:
+                if (nodes[a].op == OpNegate) return nodes[a].args[0];
+                break;
+            case OpSelect:
+                if (nodes[a].op == constantNode) return nodes[a].value != 0.0 ? b : c;
+                if (b == c) return b;
+                break;
+            }
+
+            // Reuse an identical operation
+            std::tuple<int, int, int, int> key(op, a, b, c);
+            std::map<std::tuple<int, int, int, int>, int>::iterator it = operations.find(key);
+            if (it != operations.end()) return it->second;
+
+            Node n = NewNode(op);
+            n.args[0] = a;
+            n.args[1] = b;
+            n.args[2] = c;
+            return operations[key] = Add(n);
+        }
+
+
+        // Precedence from lowest: || && comparisons + - * / unary ^
+        int ParseExpression() {
+            int a = ParseAnd();
+            while (a >= 0 && Match("||")) {
+                int b = ParseAnd();
+                if (b < 0) return -1;
+                a = Operation(OpOr, a, b);
+            }
+            return a;
+        }
+
+        int ParseAnd() {
+            int a = ParseComparison();
+            while (a >= 0 && Match("&&")) {
+                int b = ParseComparison();
+                if (b < 0) return -1;
+                a = Operation(OpAnd, a, b);
+            }
+            return a;
+        }
+
+        int ParseComparison() {
+            int a = ParseSum();
+            if (a < 0) return -1;
+
+            int op;
+            if (Match("<=")) op = OpLessEqual;
+            else if (Match(">=")) op = OpGreaterEqual;
+            else if (Match("==")) op = OpEqual;
+            else if (Match("!=")) op = OpNotEqual;
+            else if (Match('<')) op = OpLess;
+            else if (Match('>')) op = OpGreater;
+            else return a;
+
+            int b = ParseSum();
+            if (b < 0) return -1;
+            return Operation(op, a, b);
+        }
+
+        int ParseSum() {
+            int a = ParseProduct();
+            while (a >= 0) {
+                int op;
+                if (Match('+')) op = OpAdd;
+                else if (Match('-')) op = OpSubtract;
+                else break;
+
+                int b = ParseProduct();
+                if (b < 0) return -1;
+                a = Operation(op, a, b);
+            }
+            return a;
+        }
+
+        int ParseProduct() {
+            int a = ParseUnary();
+            while (a >= 0) {
+                int op;
+                if (Match('*')) op = OpMultiply;
+                else if (Match('/')) op = OpDivide;
+                else break;
+
+                int b = ParseUnary();
+                if (b < 0) return -1;
+                a = Operation(op, a, b);
+            }
+            return a;
+        }
+
+        // Unary operators bind looser than ^, so -x^2 is -(x^2)
+        int ParseUnary() {
+            if (Match('-')) {
+                int a = ParseUnary();
+                return a < 0 ? -1 : Operation(OpNegate, a);
+            }
+            if (Match('+')) {
+                return ParseUnary();
+            }
+            if (Peek() == '!' && !(pos + 1 < source.size() && source[pos + 1] == '=')) {
+                pos++;
+                int a = ParseUnary();
+                return a < 0 ? -1 : Operation(OpNot, a);
+            }
+            return ParsePower();
+        }
+
+        // Right associative
+        int ParsePower() {
+            int a = ParsePrimary();
+            if (a >= 0 && Match('^')) {
+                int b = ParseUnary();
+                if (b < 0) return -1;
+                a = Operation(OpPower, a, b);
+            }
+            return a;
+        }
+
+        int ParsePrimary() {
+            char c = Peek();
+
+            if (c == '(') {
+                pos++;
+                depth++;
+                int a = ParseExpression();
+                if (a < 0) return -1;
+                if (!Match(')')) return SetError("Expected ')'");
+                depth--;
+                return a;
+            }
+
+            if (isdigit((unsigned char)c) || (c == '.' && pos + 1 < source.size() && isdigit((unsigned char)source[pos + 1]))) {
+                const char* start = source.c_str() + pos;
+                char* end;
+                double value = strtod(start, &end);
+                pos += end - start;
+                return Constant(value);
+            }
+
+            std::string name;
+            if (!ReadName(name)) return SetError("Expected a value");
+
+            if (Peek() == '(') {
+                return ParseCall(name);
+            }
+
+            if (name == "pi") return Constant(3.14159265358979323846);
+
+            std::map<std::string, int>::iterator it = names.find(name);
+            if (it == names.end()) return SetError("Unknown name " + name);
+
+            return it->second;
+        }
+
+        int ParseCall(const std::string& name) {
+            const Function* function = NULL;
+            for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+                if (name == functions[i].name) function = &functions[i];
+            }
+            if (!function) return SetError("Unknown function " + name);
+
+            pos++;
+            depth++;
+
+            int args[3] = { -1, -1, -1 };
+            for (int i = 0; i < function->numArguments; i++) {
+                if (i > 0 && !Match(',')) return SetError(name + " takes " + std::to_string(function->numArguments) + " arguments");
+                args[i] = ParseExpression();
+                if (args[i] < 0) return -1;
+            }
+
+            if (!Match(')')) return SetError(name + " takes " + std::to_string(function->numArguments) + " arguments");
+            depth--;
+
+            return Operation(function->op, args[0], args[1], args[2]);
+        }
+
+
+        // Count references to nodes reachable from the outputs, giving constants their registers
+        void CountUses(int n) {
+            Node& node = nodes[n];
+            if (node.uses++ > 0) return;
+
+            if (node.op == constantNode) {
+                node.reg = numRegisters++;
+            }
+            for (int i = 0; i < 3 && node.args[i] >= 0; i++) {
+                CountUses(node.args[i]);
+            }
+        }
+
+        // Emit the instructions for a node after its arguments, freeing argument registers after their last use
+        void Emit(int n) {
+            if (nodes[n].reg >= 0) return;
+
+            for (int i = 0; i < 3 && nodes[n].args[i] >= 0; i++) {
+                Emit(nodes[n].args[i]);
+            }
+
+            ExpressionInstruction instruction;
+            instruction.op = (uint8_t)nodes[n].op;
+            instruction.a = instruction.b = instruction.c = 0;
+            uint8_t* operands[3] = { &instruction.a, &instruction.b, &instruction.c };
+
+            for (int i = 0; i < 3 && nodes[n].args[i] >= 0; i++) {
+                Node& arg = nodes[nodes[n].args[i]];
+                *operands[i] = (uint8_t)arg.reg;
+
+                if (--arg.uses == 0 && arg.op >= 0) {
+                    freeRegisters.push_back(arg.reg);
+                }
+            }
+
+            // Operands are read before the result is written, so an argument's register can hold the result
+            int reg;
+            if (!freeRegisters.empty()) {
+                reg = freeRegisters.back();
+                freeRegisters.pop_back();
+            }
+            else {
+                reg = numRegisters++;
+            }
+
+            nodes[n].reg = reg;
+            instruction.dst = (uint8_t)(reg < maxExpressionRegisters ? reg : 0);
+            code.push_back(instruction);
+        }
+
+        bool Generate(ExpressionProgram& program, const int output[3], std::string& message) {
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i].op == inputNode) nodes[i].reg = nodes[i].input;
+            }
+            numRegisters = NumExpressionInputs;
+
+            for (int i = 0; i < 3; i++) {
+                CountUses(output[i]);
+            }
+            for (int i = 0; i < 3; i++) {
+                Emit(output[i]);
+            }
+
+            if (numRegisters > maxExpressionRegisters) {
+                message = "Expression needs too many registers";
+                return false;
+            }
+
+            program.code.swap(code);
+            program.registers.assign(numRegisters, 0.0);
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i].op == constantNode && nodes[i].reg >= 0) program.registers[nodes[i].reg] = nodes[i].value;
+            }
+            for (int i = 0; i < 3; i++) {
+                program.output[i] = nodes[output[i]].reg;
+            }
+
+            return true;
+        }
+    };
+}
+
+
+bool CompileExpression(ExpressionProgram& program, const std::string& source, std::string& error) {
+    program.source = source;
+
+    Compiler compiler(source);
+    return compiler.Compile(program, error);
+}
+
+void EvaluateExpression(const ExpressionProgram& program, double* registers) {
+    const ExpressionInstruction* code = program.code.data();
+    const ExpressionInstruction* end = code + program.code.size();
+
+    for (; code < end; code++) {
+        registers[code->dst] = Apply(code->op, registers[code->a], registers[code->b], registers[code->c]);
+    }
+}
@@ -0,0 +1,119 @@
+/*=========================================================================
+
+  Name:        Expression.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Force expressions for custom effects. Expressions are
+               compiled on the application thread, with constants
+               folded, into a register bytecode the servo loop runs
+               without allocating.
+
+=========================================================================*/
+
+
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Registers addressable by an instruction, and user parameters an expression can read
+const int maxExpressionRegisters = 256;
+const int numExpressionParameters = 8;
+
+// Input registers, filled before each evaluation. Constants and temporaries follow.
+enum ExpressionInput {
+    ExpressionPX = 0,
+    ExpressionPY,
+    ExpressionPZ,
+    ExpressionVX,
+    ExpressionVY,
+    ExpressionVZ,
+    ExpressionTime,
+    ExpressionParameter0,
+
+    NumExpressionInputs = ExpressionParameter0 + numExpressionParameters
+};
+
+enum ExpressionOp {
+    // Arithmetic
+    OpAdd,
+    OpSubtract,
+    OpMultiply,
+    OpDivide,
+    OpPower,
+    OpNegate,
+
+    // Comparisons and logic, giving 1 for true and 0 for false, with any non-zero value true
+    OpLess,
+    OpLessEqual,
+    OpGreater,
+    OpGreaterEqual,
+    OpEqual,
+    OpNotEqual,
+    OpAnd,
+    OpOr,
+    OpNot,
+
+    // b if a is true, otherwise c
+    OpSelect,
+
+    // Functions
+    OpSin,
+    OpCos,
+    OpTan,
+    OpExp,
+    OpLog,
+    OpSqrt,
+    OpAbs,
+    OpFloor,
+    OpMin,
+    OpMax,
+    OpAtan2,
+    OpClamp,
+
+    NumExpressionOps
+};
+
+// dst = op(a, b, c), with unused operands ignored
+struct ExpressionInstruction {
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+};
+
+// Compiled expression. Built once on the application thread, then only read by the servo loop.
+struct ExpressionProgram {
+    // Text compiled, kept for saving scenes
+    std::string source;
+
+    std::vector<ExpressionInstruction> code;
+
+    // Initial register values: zero inputs, then constants, then zero temporaries
+    std::vector<double> registers;
+
+    // Registers holding fx, fy and fz after evaluation
+    int output[3];
+};
+
+
+// Compile statements of the form name = expression, separated by semicolons or new lines. Assigning fx, fy and fz
+// sets the force; other names are variables for later statements. Expressions read the probe position px, py, pz and
+// velocity vx, vy, vz, the time t, and the parameters u0 to u7, and may use + - * / ^, comparisons, && || !, the
+// constant pi, and the functions sin, cos, tan, exp, log, sqrt, abs, floor, min, max, pow, atan2, clamp(x, lo, hi)
+// and if(condition, a, b), which evaluates both a and b. Returns false with a message on error.
+bool CompileExpression(ExpressionProgram& program, const std::string& source, std::string& error);
+
+// Servo thread: run a program on registers filled from program.registers, with the inputs set
+void EvaluateExpression(const ExpressionProgram& program, double* registers);
+
+
+#endif
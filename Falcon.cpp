@@ -13,214 +13,825 @@
 
 #include "Falcon.h"
 
+#include "MappedFile.h"
+#include "Scene.h"
+
+#include "ServoCheck.h"
+#include "ServoClock.h"
+#include "VectorMath.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <iostream>
 
-#include <hdlu/hdlu.h>
-
 
 // Utility functions
-void VectorSet(double result[3], double x, double y, double z) {
-    result[0] = x;
-    result[1] = y;
-    result[2] = z;
+void MatrixRotation(double result[16], const Quaternion& q, const double center[3]) {
+    // Rotation about the given center
+    double r[4] = { q.x, q.y, q.z, q.w };
+    QuaternionToMatrix(result, r);
+
+    double t[3];
+    MatrixDirectionMultiply(t, result, center);
+    result[12] = center[0] - t[0];
+    result[13] = center[1] - t[1];
+    result[14] = center[2] - t[2];
+}
+
+void GenerateWorkspaceTransform(double result[16], const double hapticWorkspace[6], const double graphicsWorkspace[6]) {
+    // Map each axis of the haptic workspace box onto the graphics workspace box, as hdluGenerateHapticToAppWorkspaceTransform
+    // does without uniform scale. A min greater than max flips the axis.
+    MatrixIdentity(result);
+    for (int i = 0; i < 3; i++) {
+        double s = (graphicsWorkspace[i + 3] - graphicsWorkspace[i]) / (hapticWorkspace[i + 3] - hapticWorkspace[i]);
+        result[i * 5] = s;
+        result[12 + i] = graphicsWorkspace[i] - s * hapticWorkspace[i];
+    }
+}
+
+double PointPlaneDistance(const double p1[3], const double p2[3], const double n[3]) {
+    double v[3];
+    VectorSubtract(v, p1, p2);
+
+    return VectorDotProduct(v, n);
 }
 
-void VectorCopy(double result[3], const double v[3]) {
-    result[0] = v[0];
-    result[1] = v[1];
-    result[2] = v[2];
+double ShapePenetration(double n[3], int shape, const double extents[3], const double p[3]) {
+    // Penetration depth of point p into a rigid body or collider shape centered at the origin, and the outward normal
+    VectorSet(n, 0.0, 0.0, 0.0);
+
+    if (shape == RigidBodySphere) {
+        double d = VectorMagnitude(p);
+        VectorNormalize(n, p);
+
+        return extents[0] - d;
+    }
+
+    if (shape == ColliderCapsule) {
+        // Sphere around the closest point on the segment joining the centers of the ends
+        double v[3] = { p[0], p[1] - std::max(-extents[1], std::min(p[1], extents[1])), p[2] };
+        double d = VectorMagnitude(v);
+        VectorNormalize(n, v);
+
+        return extents[0] - d;
+    }
+
+    // Box. Outside, the negated distance to its nearest point, so spheres can compare their radius with it.
+    double q[3];
+    for (int i = 0; i < 3; i++) {
+        q[i] = std::max(fabs(p[i]) - extents[i], 0.0);
+    }
+
+    double outside = VectorMagnitude(q);
+    if (outside > 0.0) {
+        for (int i = 0; i < 3; i++) {
+            n[i] = (p[i] < 0.0 ? -q[i] : q[i]) / outside;
+        }
+
+        return -outside;
+    }
+
+    // Inside, pushing out through the nearest face
+    int axis = -1;
+    double depth = 0.0;
+    for (int i = 0; i < 3; i++) {
+        double di = extents[i] - fabs(p[i]);
+        if (di <= 0.0) return 0.0;
+
+        if (axis < 0 || di < depth) {
+            axis = i;
+            depth = di;
+        }
+    }
+
+    n[axis] = p[axis] < 0.0 ? -1.0 : 1.0;
+
+    return depth;
 }
 
-void VectorAdd(double result[3], const double v1[3], const double v2[3]) {
-    result[0] = v1[0] + v2[0];
-    result[1] = v1[1] + v2[1];
-    result[2] = v1[2] + v2[2];
+// Collider broadphase grid cell of a coordinate, false if it is too far out for one
+bool ColliderCell(int64_t& cell, double x, double scale) {
+    double c = floor(x * scale);
+    if (!(fabs(c) < 1e9)) return false;
+
+    cell = (int64_t)c;
+    return true;
 }
 
-void VectorSubtract(double result[3], const double v1[3], const double v2[3]) {
-    result[0] = v1[0] - v2[0];
-    result[1] = v1[1] - v2[1];
-    result[2] = v1[2] - v2[2];
+int ColliderBucket(int64_t x, int64_t y, int64_t z) {
+    uint64_t h = ((uint64_t)x * 73856093u) ^ ((uint64_t)y * 19349663u) ^ ((uint64_t)z * 83492791u);
+    return (int)(h & (numColliderBuckets - 1));
 }
 
-void VectorScale(double result[3], const double v[3], double s) {
-    result[0] = v[0] * s;
-    result[1] = v[1] * s;
-    result[2] = v[2] * s;
+double SampleRadialProfile(const RadialProfile& profile, double t) {
+    // Force at t samples from zero distance, and zero beyond the last sample
+    const double* f = profile.forces.data();
+    int last = (int)profile.forces.size() - 1;
+    if (t >= last) {
+        return t > last ? 0.0 : f[last];
+    }
+
+    int i = (int)t;
+    double a = t - i;
+
+    if (!profile.cubic) {
+        return f[i] + (f[i + 1] - f[i]) * a;
+    }
+
+    // Catmull-Rom, repeating the end samples
+    double f0 = f[i > 0 ? i - 1 : 0];
+    double f1 = f[i];
+    double f2 = f[i + 1];
+    double f3 = f[i + 2 <= last ? i + 2 : last];
+
+    return f1 + 0.5 * a * (f2 - f0 + a * (2.0 * f0 - 5.0 * f1 + 4.0 * f2 - f3 + a * (3.0 * (f1 - f2) + f3 - f0)));
 }
 
-double VectorMagnitudeSquared(const double v[3]) {
-    return v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+double EnvelopeLevel(const Vibration& v, double t) {
+    // Attack, decay and sustain level t seconds after a trigger, before any release
+    if (t < v.attack) return t / v.attack;
+
+    t -= v.attack;
+    if (t < v.decay) return 1.0 - (1.0 - v.sustain) * t / v.decay;
+
+    return v.sustain;
 }
 
-double VectorMagnitude(const double v[3]) {
-    return sqrt(VectorMagnitudeSquared(v));
+void ResampleWavetable(Wavetable& table, const float* samples, int numSamples) {
+    // Resample one period, wrapping around
+    for (int i = 0; i < wavetableSize; i++) {
+        double x = (double)i * numSamples / wavetableSize;
+        int j = (int)x;
+        double a = x - j;
+        table.samples[i] = (float)(samples[j] + (samples[(j + 1) % numSamples] - samples[j]) * a);
+    }
+    table.samples[wavetableSize] = table.samples[0];
 }
 
-void VectorNormalize(double result[3], const double v[3]) {
-    // Not checking for divide by zero...
-    VectorScale(result, v, 1.0 / VectorMagnitude(v));
+
+// Estimated effect evaluation costs in nanoseconds, used by the compute budget scheduler.
+// Scaled at run time by the ratio of measured to estimated cost.
+const double simpleForceCost = 2.0;
+const double viscosityCost = 5.0;
+const double surfaceCost = 8.0;
+const double springCost = 20.0;
+const double intermolecularForceCost = 25.0;
+const double randomForceCost = 5.0;
+const double rigidBodyCost = 150.0;
+const double distanceFieldCost = 40.0;
+const double pathConstraintCost = 100.0;
+const double radialForceCost = 10.0;
+const double vibrationCost = 10.0;
+const double expressionForceCost = 150.0;
+const double kernelForceCost = 20.0;
+
+// Most colliders are skipped by the broadphase
+const double colliderCost = 1.0;
+
+// Radial forces evaluated together, sized to keep their scratch arrays on the stack
+const int radialForceBatch = 64;
+
+// Longest step a rigid body takes, so a stalled tick doesn't throw bodies across the scene
+const double maxRigidBodyStep = 0.005;
+
+
+// Keep servo state when updating effect parameters
+void UpdateParameters(Viscosity& v, const Viscosity& parameters) {
+    v.c = parameters.c;
+    v.w = parameters.w;
 }
 
-double VectorDotProduct(const double v1[3], const double v2[3]) {
-    return v1[0]*v2[0] + v1[1]*v2[1] + v2[2]*v2[2];
+void UpdateParameters(Surface& s, const Surface& parameters) {
+    s.k = parameters.k;
+    s.c = parameters.c;
+    VectorCopy(s.p, parameters.p);
+    VectorCopy(s.n, parameters.n);
+    s.frame = parameters.frame;
 }
 
-void VectorPrint(const double v[3]) {
-    printf("%f, %f, %f\n", v[0], v[1], v[2]);
+void UpdateParameters(Spring& s, const Spring& parameters) {
+    s.k = parameters.k;
+    s.c = parameters.c;
+    s.r = parameters.r;
+    s.m = parameters.m;
+    VectorCopy(s.p, parameters.p);
+    s.frame = parameters.frame;
+
+    // Re-evaluate on the next tick
+    s.near = true;
 }
 
-void MatrixVectorMultiply(double result[3], const double m[16], const double v[3]) {
-    result[0] = m[0]  * v[0] +
-                m[4]  * v[1] +
-                m[8]  * v[2] +
-                m[12];
-    
-    result[1] = m[1]  * v[0] +
-                m[5]  * v[1] +
-                m[9]  * v[2] +
-                m[13];
+void UpdateParameters(IntermolecularForce& imf, const IntermolecularForce& parameters) {
+    imf.k = parameters.k;
+    imf.c = parameters.c;
+    imf.r = parameters.r;
+    imf.m = parameters.m;
+    VectorCopy(imf.p, parameters.p);
+    imf.frame = parameters.frame;
 
-    result[2] = m[2]  * v[0] +
-                m[6]  * v[1] +
-                m[10] * v[2] +
-                m[14];
+    // Re-evaluate on the next tick
+    imf.near = true;
 }
 
-double PointPlaneDistance(const double p1[3], const double p2[3], const double n[3]) {
-    double v[3];
-    VectorSubtract(v, p1, p2);
+void UpdateParameters(RandomForce& rf, const RandomForce& parameters) {
+    rf.minMag = parameters.minMag;
+    rf.maxMag = parameters.maxMag;
+    rf.minTime = parameters.minTime;
+    rf.maxTime = parameters.maxTime;
+}
 
-    return VectorDotProduct(v, n);
+void UpdateParameters(RigidBody& rb, const RigidBody& parameters) {
+    rb.mass = parameters.mass;
+    VectorCopy(rb.inertia, parameters.inertia);
+    rb.shape = parameters.shape;
+    VectorCopy(rb.extents, parameters.extents);
+    rb.k = parameters.k;
+    rb.c = parameters.c;
+    rb.linearDrag = parameters.linearDrag;
+    rb.angularDrag = parameters.angularDrag;
+    rb.grab = parameters.grab;
+    rb.published = parameters.published;
+
+    // A new pose from the application replaces the simulated one
+    if (parameters.generation != rb.generation) {
+        VectorCopy(rb.p, parameters.p);
+        for (int i = 0; i < 4; i++) {
+            rb.q[i] = parameters.q[i];
+        }
+        rb.generation = parameters.generation;
+
+        VectorSet(rb.v, 0.0, 0.0, 0.0);
+        VectorSet(rb.w, 0.0, 0.0, 0.0);
+        rb.attached = false;
+    }
+}
+
+void UpdateParameters(DistanceField& df, const DistanceField& parameters) {
+    df.k = parameters.k;
+    df.c = parameters.c;
+    VectorCopy(df.p, parameters.p);
+    for (int i = 0; i < 4; i++) {
+        df.q[i] = parameters.q[i];
+    }
+    df.grid = parameters.grid;
+    for (int i = 0; i < 16; i++) {
+        df.toLocal[i] = parameters.toLocal[i];
+    }
 }
 
+void UpdateParameters(Collider& c, const Collider& parameters) {
+    c.shape = parameters.shape;
+    VectorCopy(c.extents, parameters.extents);
+    c.k = parameters.k;
+    c.c = parameters.c;
+    VectorCopy(c.p, parameters.p);
+    for (int i = 0; i < 4; i++) {
+        c.q[i] = parameters.q[i];
+    }
+    for (int i = 0; i < 16; i++) {
+        c.rotation[i] = parameters.rotation[i];
+    }
+    VectorCopy(c.lo, parameters.lo);
+    VectorCopy(c.hi, parameters.hi);
+}
 
-// Random number generator
-double Random(double min, double max) {
-    return min + ((double)rand() / RAND_MAX) * (max - min);
+void UpdateParameters(PathConstraint& pc, const PathConstraint& parameters) {
+    pc.k = parameters.k;
+    pc.c = parameters.c;
+    pc.r = parameters.r;
+    pc.along = parameters.along;
+    VectorCopy(pc.p, parameters.p);
+    for (int i = 0; i < 4; i++) {
+        pc.q[i] = parameters.q[i];
+    }
+    pc.path = parameters.path;
+    for (int i = 0; i < 16; i++) {
+        pc.toLocal[i] = parameters.toLocal[i];
+        pc.toEffect[i] = parameters.toEffect[i];
+    }
 }
 
+void UpdateParameters(RadialForce& rf, const RadialForce& parameters) {
+    rf.scale = parameters.scale;
+    rf.c = parameters.c;
+    VectorCopy(rf.p, parameters.p);
+    rf.profile = parameters.profile;
+    rf.toSample = parameters.toSample;
+}
 
-// Continuous servo callback function
-HDLServoOpExitCode ForceCB(void* userData) {
-    // Get pointer to falcon object
-    Falcon* falcon = static_cast<Falcon*>(userData);
+void UpdateParameters(Vibration& v, const Vibration& parameters) {
+    v.wavetable = parameters.wavetable;
+    VectorCopy(v.direction, parameters.direction);
+    v.amplitude = parameters.amplitude;
+    v.frequency = parameters.frequency;
+    v.attack = parameters.attack;
+    v.decay = parameters.decay;
+    v.sustain = parameters.sustain;
+    v.release = parameters.release;
+
+    // Restart on a new trigger
+    if (parameters.triggerGeneration != v.triggerGeneration) {
+        v.triggerGeneration = parameters.triggerGeneration;
+        v.duration = parameters.duration;
+        v.phase = 0;
+        v.t = 0.0;
+        v.releaseTime = -1.0;
+        v.active = true;
+    }
 
-    // Compute the device force
-    falcon->ComputeForce();
+    // Release from the current level on a new release
+    if (parameters.releaseGeneration != v.releaseGeneration) {
+        v.releaseGeneration = parameters.releaseGeneration;
+        if (v.active && v.releaseTime < 0.0) {
+            v.releaseLevel = EnvelopeLevel(v, v.t);
+            v.releaseTime = v.t;
+        }
+    }
+}
 
-    // Make sure to continue processing
-    return HDL_SERVOOP_CONTINUE;
+void UpdateParameters(ExpressionForce& ef, const ExpressionForce& parameters) {
+    ef.program = parameters.program;
+    for (int i = 0; i < numExpressionParameters; i++) {
+        ef.parameters[i] = parameters.parameters[i];
+    }
+    for (int i = 0; i < 16; i++) {
+        ef.toGraphics[i] = parameters.toGraphics[i];
+    }
+    ef.forceScale = parameters.forceScale;
 }
 
-// Device synchronization callback function
-HDLServoOpExitCode SynchronizeCB(void* userData) {
+
+// Servo tick function, called from the device's servo thread or the plugin's
+void ServoTick(void* userData) {
     // Get pointer to falcon object
     Falcon* falcon = static_cast<Falcon*>(userData);
 
-    // Synchronize device state
-    falcon->SynchronizeState();
-
-    // Stop
-    return HDL_SERVOOP_EXIT;
+    // Compute the device force
+    falcon->ComputeForce();
 }
 
 
 Falcon::Falcon() {
     // Initialize values
-    deviceHandle = HDL_INVALID_HANDLE;
-    servoOp = HDL_INVALID_HANDLE;
+    initialized = false;
+
+    initializeState = InitializeIdle;
+    initializeStart = 0;
+    deviceOpenTime = 0;
+    firstForceTime = 0;
+
+    graphicsCenter.x = graphicsCenter.y = graphicsCenter.z = 0.0f;
+    graphicsSize.x = graphicsSize.y = graphicsSize.z = 2.0f;
+    graphicsRotation.x = graphicsRotation.y = graphicsRotation.z = 0.0f;
+    graphicsRotation.w = 1.0f;
+    deviceWorkspaceKnown = false;
+
+    realTime = false;
+    realTimeCpu = -1;
+    realTimePriority = 0;
 
     VectorSet(pos, 0.0, 0.0, 0.0);
     VectorSet(force, 0.0, 0.0, 0.0);
+    VectorSet(torque, 0.0, 0.0, 0.0);
     buttons = 0;
 
+    publishedStateSequence = 0;
+    for (int i = 0; i < 3; i++) {
+        publishedPos[i] = 0.0;
+        publishedForce[i] = 0.0;
+        publishedTorque[i] = 0.0;
+    }
+    publishedButtons = 0;
+
     useForceFeedback = true;
-    VectorSet(proxyPos, 0.0, 0.0, 0.0);
+    for (int i = 0; i < 3; i++) {
+        proxyPos[i] = 0.0;
+    }
 
     VectorSet(oldPos, 0.0, 0.0, 0.0);
-    oldTime = hdluGetSystemTime();
+    ServoClock::Initialize();
+    oldTime = ServoClock::Now();
+
+    randomState = 0x9E3779B97F4A7C15ull;
+
+    substeps = 1;
+
+    usePassivityControl = false;
+    passivityMaxDamping = 0.0;
+    passivityMaxDampingSource = 0.0f;
+    passivityResetGeneration = 0;
+    passivityGeneration = 0;
+    ResetPassivityObserver();
+
+    useComputeBudget = false;
+    computeBudget = 500000.0;
+    lodRadius = 0.0;
+    lodRadiusSource = 0.0f;
+    lodLevel = 0;
+    lodMask = 0;
+    lodTick = 0;
+    lodCooldown = 0;
+    measuredCost = 0.0;
+    costCalibration = 1.0;
+    numHeldEffects = 0;
+    numFarEffects = 0;
+    farCost = 0.0;
+    fullRateCost = 0.0;
+    useForceCache = false;
+    cachePositionEpsilon = 0.0;
+    cacheVelocityEpsilon = 0.0;
+    cachePositionEpsilonSource = 0.0f;
+    cacheVelocityEpsilonSource = 0.0f;
+    surfaceCache.filled = surfaceCache.valid = false;
+    springCache.filled = springCache.valid = false;
+    intermolecularForceCache.filled = intermolecularForceCache.valid = false;
+    surfaceCache.groupMask = springCache.groupMask = intermolecularForceCache.groupMask = 0;
+    cacheHits = cacheMisses = 0;
+    totalCacheHits = totalCacheMisses = 0;
+    publishedCacheHits = publishedCacheMisses = 0;
+    publishedTotalCacheHits = publishedTotalCacheMisses = 0;
+
+    publishedLodLevel = 0;
+    publishedHeldEffects = 0;
+    publishedFarEffects = 0;
+    publishedMeasuredCost = 0.0;
+    publishedEstimatedCost = 0.0;
+
+    useForceField = false;
+    forceFieldModel = nullptr;
+
+    useTelemetry = false;
+    telemetryResetRequested = false;
+    tickTelemetry = false;
+    telemetryStart = 0;
+    telemetryTicks = 0;
+    publishedTelemetrySequence = 0;
+    publishedTelemetryTicks = 0;
+    for (int i = 0; i < NumEffectTypes; i++) {
+        telemetryTime[i] = telemetryTotalTime[i] = telemetryMaxTime[i] = 0;
+        telemetryEvaluated[i] = 0;
+        VectorSet(telemetryForce[i], 0.0, 0.0, 0.0);
+
+        publishedTelemetryEvaluated[i] = 0;
+        publishedTelemetryTime[i] = 0;
+        publishedTelemetryTotalTime[i] = 0;
+        publishedTelemetryMaxTime[i] = 0;
+        for (int j = 0; j < 3; j++) {
+            publishedTelemetryForce[i][j] = 0.0;
+        }
+    }
+
+    std::fill(colliderBuckets, colliderBuckets + numColliderBuckets, -1);
+    largeColliders = -1;
+    colliderCellSize = 1.0;
+    colliderGridSize = 0;
+
+    tickFrames = &frameSets.Front();
+    numTickFrames = 0;
+    framesMoved = false;
+
+    tickProbe = &probePointSets.Front();
+    probeMoved = false;
+    probeFrame = -1;
+    colliderPad = 0.0;
+
+    numKernels = 0;
+    kernelStatsResetRequested = false;
+    kernelTicks = 0;
+    publishedKernelSequence = 0;
+    publishedKernelTicks = 0;
+    for (int i = 0; i < maxKernels; i++) {
+        kernelBatches[i].count = 0;
+        kernelEvaluated[i] = kernelCalls[i] = 0;
+        kernelTime[i] = kernelTotalTime[i] = kernelMaxTime[i] = 0;
+
+        publishedKernelEvaluated[i] = 0;
+        publishedKernelCalls[i] = 0;
+        publishedKernelTime[i] = 0;
+        publishedKernelTotalTime[i] = 0;
+        publishedKernelMaxTime[i] = 0;
+    }
+
+    groupMask = 0xFFFFFFFFu;
+    tickGroupMask = 0xFFFFFFFFu;
+
+    rigidBodyGeneration = 0;
+    for (int i = 0; i < 3; i++) {
+        rigidBodyGravity[i] = 0.0;
+    }
+    rigidBodyGravitySource.x = rigidBodyGravitySource.y = rigidBodyGravitySource.z = 0.0f;
+
+    // Built in vibration waveforms
+    for (int w = 0; w < NumWaveforms; w++) {
+        std::shared_ptr<Wavetable> table(new Wavetable());
+        for (int i = 0; i < wavetableSize; i++) {
+            double x = (double)i / wavetableSize;
+            table->samples[i] = (float)(w == SineWave ? sin(2.0 * 3.14159265358979 * x) :
+                                        w == SquareWave ? (x < 0.5 ? 1.0 : -1.0) :
+                                        2.0 * x - 1.0);
+        }
+        table->samples[wavetableSize] = table->samples[0];
+        wavetables.push_back(table);
+    }
+
+    MatrixIdentity(haptics2graphics);
+    MatrixIdentity(graphics2haptics);
+    workspaceScale = 1.0;
+    MatrixIdentity(haptics2effect);
+
+    MatrixIdentity(workspaceMaps.Back().toEffect);
+    workspaceMaps.Publish();
+    tickMap = &workspaceMaps.Front();
 }
 
 Falcon::~Falcon() {    
-    // Shutdown HDL
-    if (servoOp != HDL_INVALID_HANDLE) {
-        hdlDestroyServoOp(servoOp);
-        servoOp = HDL_INVALID_HANDLE;
+    // Finish opening the device before closing it
+    if (initializeThread.joinable()) {
+        initializeThread.join();
     }
 
-    hdlStop();
+    // Stop the servo loop and close the device
+    device.StopServo(servoThread);
+    device.Close();
 
-    if (deviceHandle != HDL_INVALID_HANDLE) {
-        hdlUninitDevice(deviceHandle);
-        deviceHandle = HDL_INVALID_HANDLE;
-    }
+    SetSynchronous(true);
 }
 
 bool Falcon::Initialize() {
-    // Initialize the device
-    deviceHandle = hdlInitNamedDevice("DEFAULT");
+    if (initialized || initializeThread.joinable()) return false;
 
-    if (deviceHandle == HDL_INVALID_HANDLE) {
-        std::cout << "Could not open device" << std::endl;
+    initializeStart = ServoClock::NowNanoseconds();
+    initializeState = InitializeOpening;
+
+    if (!OpenDevice()) {
+        initializeState = InitializeFailed;
         return false;
     }
 
-        
-    // Now that the device is initialized, start the servo thread.
-    hdlStart();
+    initializeState = InitializeStarting;
 
-    if (hdlGetError() != HDL_NO_ERROR) {
-        std::cout << "Could not start the servo thread" << std::endl;
+    if (!StartServo()) {
+        initializeState = InitializeFailed;
         return false;
     }
 
-        
-    // Set up callback function
-    servoOp = hdlCreateServoOp(ForceCB, this, false);
-    if (servoOp == HDL_INVALID_HANDLE) {
-        std::cout << "Invalid servo op handle" << std::endl;
+    // Wait for the first tick, so the device state is current on return
+    int64_t timeout = ServoClock::NowNanoseconds() + 1000000000;
+    while (firstForceTime.load(std::memory_order_acquire) == 0 && ServoClock::NowNanoseconds() < timeout) {
+        std::this_thread::yield();
     }
 
-    if (hdlGetError() != HDL_NO_ERROR) {
-        std::cout << "Could not create servo op" << std::endl;
-        return false;
+    initializeState = InitializeReady;
+    return true;
+}
+
+bool Falcon::InitializeAsync() {
+    if (initialized || initializeThread.joinable()) return false;
+
+    initializeStart = ServoClock::NowNanoseconds();
+    initializeState = InitializeOpening;
+
+    initializeThread = std::thread([this]() {
+        initializeState = OpenDevice() ? InitializeStarting : InitializeFailed;
+    });
+
+    return true;
+}
+
+InitializeStatus Falcon::GetInitializeStatus() {
+    int state = initializeState.load();
+
+    // Once the device is open, start the servo loop here on the application thread
+    if (state != InitializeOpening && initializeThread.joinable()) {
+        initializeThread.join();
+
+        if (state == InitializeStarting && !StartServo()) {
+            state = InitializeFailed;
+            initializeState = state;
+        }
+    }
+
+    if (state == InitializeStarting && firstForceTime.load(std::memory_order_acquire) != 0) {
+        state = InitializeReady;
+        initializeState = state;
     }
 
+    InitializeStatus status;
+    status.state = state;
+    status.openTime = (float)(deviceOpenTime.load() * 1e-6);
 
-    // Make the device current.  All subsequent calls will be directed to the current device.
-    hdlMakeCurrent(deviceHandle);
+    int64_t first = firstForceTime.load(std::memory_order_acquire);
+    status.firstForceTime = first != 0 ? (float)((first - initializeStart) * 1e-6) : 0.0f;
 
-    if (hdlGetError() != HDL_NO_ERROR) {
-        std::cout << "Could not make device current" << std::endl;
+    return status;
+}
+
+bool Falcon::OpenDevice() {
+    // Initialize the device
+    if (!device.Open()) {
+        std::cout << "Could not open device" << std::endl;
         return false;
     }
 
-
     // Get the extents of the device workspace
-    hdlDeviceWorkspace(workspace);
+    device.GetWorkspace(workspace);
+
+    deviceOpenTime = ServoClock::NowNanoseconds() - initializeStart;
+    return true;
+}
 
-    if (hdlGetError() != HDL_NO_ERROR) {
-        std::cout << "Could not get device workspace" << std::endl;
+bool Falcon::StartServo() {
+    // Map the graphics workspace now that the device workspace is known
+    deviceWorkspaceKnown = true;
+    SetGraphicsWorkspace(graphicsCenter, graphicsSize, graphicsRotation);
+
+    // Start the servo loop, on the device's own servo thread if it has one. Real-time options only apply to ours.
+    if (realTime) {
+        servoThread.SetRealTime(realTimeCpu, realTimePriority, true);
+    }
+
+    SetSynchronous(false);
+
+    if (!device.StartServo(ServoTick, this, servoThread)) {
+        SetSynchronous(true);
+        std::cout << "Could not start the servo loop" << std::endl;
         return false;
     }
 
-    
-    // Set default graphics workspace
-    Vector3 center = { 0.0, 0.0, 0.0 };
-    Vector3 size = { 2.0, 2.0, 2.0 };
-    SetGraphicsWorkspace(center, size);
+    initialized = true;
+    return true;
+}
+
+bool Falcon::IsInitialized() {
+    return initialized;
+}
+
+void Falcon::SetRealTime(bool enable, int cpu, int priority) {
+    realTime = enable;
+    realTimeCpu = cpu;
+    realTimePriority = priority;
+}
 
+void Falcon::SetServoRate(float hz) {
+    hz = hz < 1000.0f ? 1000.0f : hz > 10000.0f ? 10000.0f : hz;
+    servoThread.SetRate(hz);
+}
 
-    // Synchronize state
-    hdlCreateServoOp(SynchronizeCB, this, true);
+void Falcon::SetSubsteps(int n) {
+    substeps = n < 1 ? 1 : n;
+}
 
+void Falcon::SetPassivityControl(bool enable, float maxDamping) {
+    passivityMaxDampingSource = maxDamping;
+    passivityMaxDamping = maxDamping * workspaceScale;
 
-    return true;
+    // Start the observer over when turning the controller on, as the energy it saw before no longer applies
+    if (enable && !usePassivityControl.load()) {
+        passivityResetGeneration++;
+    }
+    usePassivityControl = enable;
+}
+
+PassivityStats Falcon::GetPassivityStats() {
+    PassivityStats stats;
+    stats.observedEnergy = (float)publishedPassivity[0].load();
+    stats.tickDissipated = (float)publishedPassivity[1].load();
+    stats.totalDissipated = (float)publishedPassivity[2].load();
+    stats.damping = (float)publishedPassivity[3].load();
+    stats.maxDampingApplied = (float)publishedPassivity[4].load();
+    stats.activeTicks = publishedPassivityActiveTicks.load();
+
+    return stats;
+}
+
+void Falcon::SetComputeBudget(bool enable, float budget, float nearRadius) {
+    computeBudget = budget * 1000.0;
+    lodRadiusSource = nearRadius;
+    lodRadius = nearRadius / workspaceScale;
+    useComputeBudget = enable;
+}
+
+void Falcon::SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon) {
+    cachePositionEpsilonSource = positionEpsilon;
+    cacheVelocityEpsilonSource = velocityEpsilon;
+    cachePositionEpsilon = positionEpsilon / workspaceScale;
+    cacheVelocityEpsilon = velocityEpsilon / workspaceScale;
+    useForceCache = enable;
+}
+
+ForceCacheStats Falcon::GetForceCacheStats() {
+    ForceCacheStats stats;
+    stats.hits = publishedCacheHits.load();
+    stats.misses = publishedCacheMisses.load();
+    stats.hitRate = stats.hits + stats.misses > 0 ? (float)stats.hits / (stats.hits + stats.misses) : 0.0f;
+
+    int64_t hits = publishedTotalCacheHits.load();
+    int64_t misses = publishedTotalCacheMisses.load();
+    stats.totalHitRate = hits + misses > 0 ? (float)((double)hits / (hits + misses)) : 0.0f;
+
+    return stats;
+}
+
+SchedulerStats Falcon::GetSchedulerStats() {
+    SchedulerStats stats;
+    stats.level = publishedLodLevel.load();
+    stats.heldEffects = publishedHeldEffects.load();
+    stats.farEffects = publishedFarEffects.load();
+    stats.tickCost = (float)(publishedMeasuredCost.load() * 1e-3);
+    stats.estimatedCost = (float)(publishedEstimatedCost.load() * 1e-3);
+    stats.budget = (float)(computeBudget.load() * 1e-3);
+
+    return stats;
+}
+
+ServoStats Falcon::GetServoStats() {
+    return servoThread.GetStats();
+}
+
+void Falcon::ResetServoStats() {
+    servoThread.ResetStats();
+    kernelStatsResetRequested = true;
+}
+
+void Falcon::SetTelemetry(bool enable) {
+    useTelemetry = enable;
+}
+
+EffectTelemetry Falcon::GetEffectTelemetry(int type) {
+    EffectTelemetry t = {};
+    if (type < 0 || type >= NumEffectTypes) return t;
+
+    // Retry if the servo thread was writing
+    double f[3];
+    int64_t total;
+    for (;;) {
+        unsigned int sequence = publishedTelemetrySequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        t.ticks = publishedTelemetryTicks.load(std::memory_order_relaxed);
+        t.evaluated = publishedTelemetryEvaluated[type].load(std::memory_order_relaxed);
+        t.tickTime = (float)(publishedTelemetryTime[type].load(std::memory_order_relaxed) * 1e-3);
+        t.maxTime = (float)(publishedTelemetryMaxTime[type].load(std::memory_order_relaxed) * 1e-3);
+        total = publishedTelemetryTotalTime[type].load(std::memory_order_relaxed);
+        for (int i = 0; i < 3; i++) {
+            f[i] = publishedTelemetryForce[type][i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (publishedTelemetrySequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    t.meanTime = t.ticks > 0 ? (float)(total * 1e-3 / t.ticks) : 0.0f;
+
+    // Effect space forces are graphics forces, as GetForce() returns them
+    t.force.x = (float)f[0];
+    t.force.y = (float)f[1];
+    t.force.z = (float)f[2];
+
+    return t;
+}
+
+void Falcon::ResetTelemetry() {
+    telemetryResetRequested = true;
+}
+
+void Falcon::SetSynchronous(bool sync) {
+    simpleForces.SetSynchronous(sync);
+    viscosities.SetSynchronous(sync);
+    surfaces.SetSynchronous(sync);
+    springs.SetSynchronous(sync);
+    intermolecularForces.SetSynchronous(sync);
+    randomForces.SetSynchronous(sync);
+    rigidBodies.SetSynchronous(sync);
+    distanceFields.SetSynchronous(sync);
+    pathConstraints.SetSynchronous(sync);
+    radialForces.SetSynchronous(sync);
+    vibrations.SetSynchronous(sync);
+    expressionForces.SetSynchronous(sync);
+    kernelForces.SetSynchronous(sync);
+    colliders.SetSynchronous(sync);
 }
 
 
 void Falcon::SetGraphicsWorkspace(Vector3 center, Vector3 size) {
+    Quaternion rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+    SetGraphicsWorkspace(center, size, rotation);
+}
+
+void Falcon::SetGraphicsWorkspace(Vector3 center, Vector3 size, Quaternion rotation) {
+    graphicsCenter = center;
+    graphicsSize = size;
+    graphicsRotation = rotation;
+
+    // Applied when the servo loop starts
+    if (!deviceWorkspaceKnown) return;
+
     // Graphics workspace should be given as (minx, miny, minz, maxx, maxy, maxz)
     // Flip z here to match Unity
     double graphicsWorkspace[6];
@@ -231,40 +842,79 @@ void Falcon::SetGraphicsWorkspace(Vector3 center, Vector3 size) {
     graphicsWorkspace[4] = center.y + size.y / 2.0;
     graphicsWorkspace[5] = center.z - size.z / 2.0;
 
-    // Generate the transform from haptic space to graphics space
-    bool useUniformScale = false;
-    hdluGenerateHapticToAppWorkspaceTransform(workspace,
-                                              graphicsWorkspace,
-                                              useUniformScale,
-                                              haptics2graphics);
-
-	// Create tranform to match direction of graphics space to haptic space for forces
-	
-	std::cout << std::endl;
-	for (int i = 0; i < 16; i++) {
-		if (i % 4 == 0) std::cout << std::endl;
-		std::cout << haptics2graphics[i] << "\t";
-	}
-
-	for (int i = 0; i < 16; i++) {
-		// Only use diagonal for scale
-		if (i % 4 == i / 4) {
-			double v = haptics2graphics[i];
-			graphics2haptics[i] = v == 0.0 ? 0.0 : v / fabs(v);
-		}
-		else {
-			graphics2haptics[i] = 0.0;
-		}
-	}
-
-	std::cout << std::endl;
-	for (int i = 0; i < 16; i++) {
-		if (i % 4 == 0) std::cout << std::endl;
-		std::cout << graphics2haptics[i] << "\t";
-	}
-
-    // Synchronize state
-    hdlCreateServoOp(SynchronizeCB, this, true);
+    // Generate the transform from haptic space to the axis-aligned graphics space
+    double alignedTransform[16];
+    GenerateWorkspaceTransform(alignedTransform, workspace, graphicsWorkspace);
+
+    // Rotate the graphics workspace about its center
+    double c[3];
+    VectorSet(c, center.x, center.y, center.z);
+
+    double rotationTransform[16];
+    MatrixRotation(rotationTransform, rotation, c);
+
+    MatrixMultiply(haptics2graphics, rotationTransform, alignedTransform);
+
+    // Full affine inverse for transforming positions to device space
+    MatrixInvertAffine(graphics2haptics, haptics2graphics);
+
+    // Mean scale, exact when the scale is uniform
+    double oldScale = workspaceScale;
+    workspaceScale = std::cbrt(fabs(MatrixDeterminant(haptics2graphics)));
+
+    // Device space to effect space, for the servo thread
+    for (int i = 0; i < 15; i++) {
+        haptics2effect[i] = haptics2graphics[i] / workspaceScale;
+    }
+    haptics2effect[15] = 1.0;
+
+    std::copy(haptics2effect, haptics2effect + 16, workspaceMaps.Back().toEffect);
+    workspaceMaps.Publish();
+
+    // Get rigid body poses in graphics space before switching scales. Rotations are the same in both spaces.
+    rigidBodies.ForEachSource([&](int, RigidBody& s) {
+        double p[3], q[4];
+        if (ReadRigidBodyPose(s, p, q)) {
+            VectorScale(s.p, p, oldScale);
+            for (int i = 0; i < 4; i++) {
+                s.q[i] = q[i];
+            }
+        }
+        s.generation = ++rigidBodyGeneration;
+    });
+
+    passivityMaxDamping = passivityMaxDampingSource * workspaceScale;
+    lodRadius = lodRadiusSource / workspaceScale;
+    cachePositionEpsilon = cachePositionEpsilonSource / workspaceScale;
+    cacheVelocityEpsilon = cacheVelocityEpsilonSource / workspaceScale;
+    SetRigidBodyGravity(rigidBodyGravitySource);
+
+    double effect2graphics[16];
+    MatrixScale(effect2graphics, workspaceScale);
+    forceField.SetTransform(effect2graphics, workspaceScale);
+
+    // Re-transform force effects here and send them to the servo thread
+    simpleForces.Transform([this](SimpleForce& d, const SimpleForce& s) { TransformEffect(d, s); });
+    viscosities.Transform([this](Viscosity& d, const Viscosity& s) { TransformEffect(d, s); });
+    surfaces.Transform([this](Surface& d, const Surface& s) { TransformEffect(d, s); });
+    springs.Transform([this](Spring& d, const Spring& s) { TransformEffect(d, s); });
+    intermolecularForces.Transform([this](IntermolecularForce& d, const IntermolecularForce& s) { TransformEffect(d, s); });
+    randomForces.Transform([this](RandomForce& d, const RandomForce& s) { TransformEffect(d, s); });
+    rigidBodies.Transform([this](RigidBody& d, const RigidBody& s) { TransformEffect(d, s); });
+    distanceFields.Transform([this](DistanceField& d, const DistanceField& s) { TransformEffect(d, s); });
+    pathConstraints.Transform([this](PathConstraint& d, const PathConstraint& s) { TransformEffect(d, s); });
+    radialForces.Transform([this](RadialForce& d, const RadialForce& s) { TransformEffect(d, s); });
+    vibrations.Transform([this](Vibration& d, const Vibration& s) { TransformEffect(d, s); });
+    expressionForces.Transform([this](ExpressionForce& d, const ExpressionForce& s) { TransformEffect(d, s); });
+    kernelForces.Transform([this](KernelForce& d, const KernelForce& s) { TransformEffect(d, s); });
+    colliders.Transform([this](Collider& d, const Collider& s) { TransformEffect(d, s); });
+
+    // Frame transforms and probe points include the workspace transform
+    PublishFrames();
+    PublishProbePoints();
+
+    // Every effect changed, so start the passivity observer over
+    passivityResetGeneration++;
 }
 
 
@@ -276,32 +926,75 @@ void Falcon::ResetForces() {
 	RemoveSprings();
 	RemoveIntermolecularForces();
 	RemoveRandomForces();
+	RemoveRigidBodies();
+	RemoveDistanceFields();
+	RemovePathConstraints();
+	RemoveRadialForces();
+	RemoveVibrations();
+	RemoveExpressionForces();
+	RemoveKernelForces();
+	RemoveColliders();
+	RemoveFrames();
+
+	// Energy the removed effects put in or took out of the device doesn't carry over to new ones
+	passivityResetGeneration++;
 }
 
 
 Vector3 Falcon::GetPosition() {
-    Vector3 p = { (float)pos[0], (float)pos[1], (float)pos[2] };
+    DeviceState state;
+    ReadState(state);
+
+    double gp[3];
+    MatrixVectorMultiply(gp, haptics2graphics, state.pos);
+
+    Vector3 p = { (float)gp[0], (float)gp[1], (float)gp[2] };
     return p;
 }
 
 bool Falcon::GetButton(int button) {
     // Bit-shift and mask to get button state
     int b = 1 << button;
-    return (buttons & b) == b;
+    return (publishedButtons.load(std::memory_order_relaxed) & b) == b;
 }
 
 Vector3 Falcon::GetForce() {
-    Vector3 f = { (float)force[0], (float)force[1], (float)force[2] };
+    DeviceState state;
+    ReadState(state);
+
+    // Return force in graphics space
+    double gf[3];
+    DeviceToGraphicsForce(gf, state.force);
+
+    Vector3 f = { (float)gf[0], (float)gf[1], (float)gf[2] };
     return f;
 }
 
+Vector3 Falcon::GetTorque() {
+    // Offsets in effect space are graphics offsets divided by the mean scale, and forces are graphics forces
+    DeviceState state;
+    ReadState(state);
+
+    double gt[3];
+    VectorScale(gt, state.torque, workspaceScale);
+
+    Vector3 t = { (float)gt[0], (float)gt[1], (float)gt[2] };
+    return t;
+}
+
 
 void Falcon::UseForceFeedback(bool use) { 
     useForceFeedback = use;
 }
 
 void Falcon::SetProxyPosition(Vector3 p) {
-    VectorSet(proxyPos, p.x, p.y, p.z);
+    double gp[3], dp[3];
+    VectorSet(gp, p.x, p.y, p.z);
+    MatrixVectorMultiply(dp, graphics2haptics, gp);
+
+    for (int i = 0; i < 3; i++) {
+        proxyPos[i].store(dp[i], std::memory_order_relaxed);
+    }
 }
 
 
@@ -310,12 +1003,21 @@ int Falcon::AddSimpleForce(Vector3 f) {
 	SimpleForce sf;
     VectorSet(sf.f, f.x, f.y, f.z);
 
-    return simpleForces.Add(sf);
+    SimpleForce d;
+    TransformEffect(d, sf);
+
+    return simpleForces.Add(sf, d);
 }
 
 void Falcon::UpdateSimpleForce(int i, Vector3 f) {
-	SimpleForce* sf = simpleForces.Get(i);
+	SimpleForce* sf = simpleForces.GetSource(i);
+    if (!sf) return;
+
     VectorSet(sf->f, f.x, f.y, f.z);
+
+    SimpleForce d;
+    TransformEffect(d, *sf);
+    simpleForces.Update(i, d);
 }
 
 void Falcon::RemoveSimpleForce(int i) {
@@ -333,13 +1035,22 @@ int Falcon::AddViscosity(float c, float w) {
     v.w = w;
 	VectorSet(v.oldForce, 0.0, 0.0, 0.0);
 
-    return viscosities.Add(v);
+    Viscosity d = v;
+    TransformEffect(d, v);
+
+    return viscosities.Add(v, d);
 }
 
 void Falcon::UpdateViscosity(int i, float c, float w) {
-    Viscosity* v = viscosities.Get(i);
+    Viscosity* v = viscosities.GetSource(i);
+    if (!v) return;
+
     v->c = c;
     v->w = w;
+
+    Viscosity d;
+    TransformEffect(d, *v);
+    viscosities.Update(i, d);
 }
 
 void Falcon::RemoveViscosity(int i) {
@@ -357,16 +1068,28 @@ int Falcon::AddSurface(Vector3 p, Vector3 n, float k, float c) {
     s.c = c;
     VectorSet(s.p, p.x, p.y, p.z);
     VectorSet(s.n, n.x, n.y, n.z);
+    s.frame = -1;
 
-    return surfaces.Add(s);
+    Surface d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    VectorSet(d.t, 0.0, 0.0, 0.0);
+
+    return surfaces.Add(s, d);
 }
 
 void Falcon::UpdateSurface(int i, Vector3 p, Vector3 n, float k, float c) {
-    Surface* s = surfaces.Get(i);
+    Surface* s = surfaces.GetSource(i);
+    if (!s) return;
+
     s->k = k;
     s->c = c;
     VectorSet(s->p, p.x, p.y, p.z);
     VectorSet(s->n, n.x, n.y, n.z);
+
+    Surface d;
+    TransformEffect(d, *s);
+    surfaces.Update(i, d);
 }
 
 void Falcon::RemoveSurface(int i) {
@@ -385,17 +1108,30 @@ int Falcon::AddSpring(Vector3 p, float k, float c, float r, float m) {
     s.r = r;
     s.m = m;
     VectorSet(s.p, p.x, p.y, p.z);
+    s.frame = -1;
+
+    Spring d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    VectorSet(d.t, 0.0, 0.0, 0.0);
+    d.near = true;
 
-    return springs.Add(s);
+    return springs.Add(s, d);
 }
 
 void Falcon::UpdateSpring(int i, Vector3 p, float k, float c, float r, float m) {
-    Spring* s = springs.Get(i);
+    Spring* s = springs.GetSource(i);
+    if (!s) return;
+
     s->k = k;
     s->c = c;
     s->r = r;
     s->m = m;
     VectorSet(s->p, p.x, p.y, p.z);
+
+    Spring d;
+    TransformEffect(d, *s);
+    springs.Update(i, d);
 }
 
 void Falcon::RemoveSpring(int i) {
@@ -414,17 +1150,30 @@ int Falcon::AddIntermolecularForce(Vector3 p, float k, float c, float r, float m
     imf.r = r;
     imf.m = m;
     VectorSet(imf.p, p.x, p.y, p.z);
+    imf.frame = -1;
 
-    return intermolecularForces.Add(imf);
+    IntermolecularForce d;
+    TransformEffect(d, imf);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    VectorSet(d.t, 0.0, 0.0, 0.0);
+    d.near = true;
+
+    return intermolecularForces.Add(imf, d);
 }
 
 void Falcon::UpdateIntermolecularForce(int i, Vector3 p, float k, float c, float r, float m) {
-    IntermolecularForce* imf = intermolecularForces.Get(i);
+    IntermolecularForce* imf = intermolecularForces.GetSource(i);
+    if (!imf) return;
+
     imf->k = k;
     imf->c = c;
     imf->r = r;
     imf->m = m;
     VectorSet(imf->p, p.x, p.y, p.z);
+
+    IntermolecularForce d;
+    TransformEffect(d, *imf);
+    intermolecularForces.Update(i, d);
 }
 
 void Falcon::RemoveIntermolecularForce(int i) {
@@ -442,16 +1191,28 @@ int Falcon::AddRandomForce(float minMag, float maxMag, float minTime, float maxT
     rf.maxMag = maxMag;
     rf.minTime = minTime;
     rf.maxTime = maxTime;
+    VectorSet(rf.f, 0.0, 0.0, 0.0);
+    rf.t = 0.0;
+    rf.tStart = 0.0;
+
+    RandomForce d = rf;
+    TransformEffect(d, rf);
 
-    return randomForces.Add(rf);
+    return randomForces.Add(rf, d);
 }
 
 void Falcon::UpdateRandomForce(int i, float minMag, float maxMag, float minTime, float maxTime) {
-    RandomForce* rf = randomForces.Get(i);
+    RandomForce* rf = randomForces.GetSource(i);
+    if (!rf) return;
+
     rf->minMag = minMag;
     rf->maxMag = maxMag;
     rf->minTime = minTime;
     rf->maxTime = maxTime;
+
+    RandomForce d;
+    TransformEffect(d, *rf);
+    randomForces.Update(i, d);
 }
 
 void Falcon::RemoveRandomForce(int i) {
@@ -463,132 +1224,3550 @@ void Falcon::RemoveRandomForces() {
 }
 
 
-void Falcon::ComputeForce() {
-    // Get current state
-    SynchronizeState();
-
-    // Get time delta
-    double time = hdluGetSystemTime();
-    double dt = time - oldTime;
-
-    // Adjusting this affects "kicking" when changing viscosity
- //   if (dt <= 1e-4) return;
-
-    // Set position to use for force calculations
-    // If using force feedback, use device position
-    // Else use proxy position
-    double p[3];
-    if (useForceFeedback) {
-        VectorCopy(p, pos);
-    }
-    else {
-        VectorCopy(p, proxyPos);
+// Rigid bodies
+int Falcon::AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+    RigidBody rb;
+    rb.mass = mass;
+    VectorSet(rb.inertia, inertia.x, inertia.y, inertia.z);
+    rb.shape = shape;
+    VectorSet(rb.extents, extents.x, extents.y, extents.z);
+    rb.k = k;
+    rb.c = c;
+    rb.linearDrag = linearDrag;
+    rb.angularDrag = angularDrag;
+    rb.grab = false;
+    VectorSet(rb.p, p.x, p.y, p.z);
+    rb.q[0] = r.x;
+    rb.q[1] = r.y;
+    rb.q[2] = r.z;
+    rb.q[3] = r.w;
+    rb.generation = ++rigidBodyGeneration;
+    rb.published = nullptr;
+    VectorSet(rb.v, 0.0, 0.0, 0.0);
+    VectorSet(rb.w, 0.0, 0.0, 0.0);
+    rb.attached = false;
+    VectorSet(rb.grabOffset, 0.0, 0.0, 0.0);
+
+    RigidBody d = rb;
+    TransformEffect(d, rb);
+
+    int id = rigidBodies.Add(rb, d);
+
+    // Published poses are allocated here and reused with the id, so the servo thread never writes to freed memory
+    std::unique_ptr<PublishedPose>& published = rigidBodyPoses[id];
+    if (!published) {
+        published.reset(new PublishedPose());
+        published->sequence = 0;
+        published->generation = -1;
     }
 
-    // Compute current velocity
-    double velocity[3];
-    VectorSubtract(velocity, p, oldPos);
-    VectorScale(velocity, velocity, 1.0 / dt);
+    // Send the servo thread where to publish the pose
+    RigidBody* s = rigidBodies.GetSource(id);
+    s->published = published.get();
 
-    // Initialize force
-    VectorSet(force, 0.0, 0.0, 0.0);
-    
-    // Add simple forces
-    for (auto it = simpleForces.Begin(); it != simpleForces.End(); ++it) {
-        VectorAdd(force, force, it->second.f);
-    }
+    TransformEffect(d, *s);
+    rigidBodies.Update(id, d);
 
-    // Add viscous forces
-    for (auto it = viscosities.Begin(); it != viscosities.End(); ++it) {
-        double vf[3];
-        ComputeViscousForce(vf, it->second, velocity);
-        VectorAdd(force, force, vf);
-    }
+    return id;
+}
 
-    // Add surface forces
-    for (auto it = surfaces.Begin(); it != surfaces.End(); ++it) {
-        double sf[3];
-        ComputeSurfaceForce(sf, it->second, velocity);
-        VectorAdd(force, force, sf);
-    }
+void Falcon::UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+    RigidBody* rb = rigidBodies.GetSource(i);
+    if (!rb) return;
+
+    rb->mass = mass;
+    VectorSet(rb->inertia, inertia.x, inertia.y, inertia.z);
+    rb->shape = shape;
+    VectorSet(rb->extents, extents.x, extents.y, extents.z);
+    rb->k = k;
+    rb->c = c;
+    rb->linearDrag = linearDrag;
+    rb->angularDrag = angularDrag;
+
+    RigidBody d;
+    TransformEffect(d, *rb);
+    rigidBodies.Update(i, d);
+}
 
-    // Add spring forces
-    for (auto it = springs.Begin(); it != springs.End(); ++it) {
-        double sf[3];
-        ComputeSpringForce(sf, it->second, velocity);
-        VectorAdd(force, force, sf);
-    }
-    
-    // Add intermolecular forces
-    for (auto it = intermolecularForces.Begin(); it != intermolecularForces.End(); ++it) {
-        double imf[3];
-        ComputeIntermolecularForce(imf, it->second, velocity);
-        VectorAdd(force, force, imf);
-    }
-    
-    // Add random forces
-    for (auto it = randomForces.Begin(); it != randomForces.End(); ++it) {
-        double rf[3];
-        ComputeRandomForce(rf, it->second, time);
-        VectorAdd(force, force, rf);
-    }
+void Falcon::SetRigidBodyPose(int i, Vector3 p, Quaternion r) {
+    RigidBody* rb = rigidBodies.GetSource(i);
+    if (!rb) return;
 
-	// Tranform force
-	MatrixVectorMultiply(force, graphics2haptics, force);
-  
+    VectorSet(rb->p, p.x, p.y, p.z);
+    rb->q[0] = r.x;
+    rb->q[1] = r.y;
+    rb->q[2] = r.z;
+    rb->q[3] = r.w;
+    rb->generation = ++rigidBodyGeneration;
 
-    // Set force
-    if (useForceFeedback) {
-        // Set force
-        hdlSetToolForce(force);
+    RigidBody d;
+    TransformEffect(d, *rb);
+    rigidBodies.Update(i, d);
+}
+
+RigidBodyPose Falcon::GetRigidBodyPose(int i) {
+    RigidBodyPose pose = {};
+    pose.rotation.w = 1.0f;
+
+    RigidBody* rb = rigidBodies.GetSource(i);
+    if (!rb) return pose;
+
+    double p[3], q[4];
+    if (ReadRigidBodyPose(*rb, p, q)) {
+        pose.position.x = (float)(p[0] * workspaceScale);
+        pose.position.y = (float)(p[1] * workspaceScale);
+        pose.position.z = (float)(p[2] * workspaceScale);
+        pose.rotation.x = (float)q[0];
+        pose.rotation.y = (float)q[1];
+        pose.rotation.z = (float)q[2];
+        pose.rotation.w = (float)q[3];
     }
     else {
-        double f[3];
-        VectorSet(f, 0.0, 0.0, 0.0);
-        hdlSetToolForce(f);
+        // Not simulated yet, so return the pose that was set
+        pose.position.x = (float)rb->p[0];
+        pose.position.y = (float)rb->p[1];
+        pose.position.z = (float)rb->p[2];
+        pose.rotation.x = (float)rb->q[0];
+        pose.rotation.y = (float)rb->q[1];
+        pose.rotation.z = (float)rb->q[2];
+        pose.rotation.w = (float)rb->q[3];
     }
 
-        
-    // Save state
-    VectorCopy(oldPos, p);
-    oldTime = time;
+    return pose;
 }
 
+void Falcon::GrabRigidBody(int i, bool grab) {
+    RigidBody* rb = rigidBodies.GetSource(i);
+    if (!rb) return;
 
-void Falcon::SynchronizeState() {
-    // Get current state
-    double toolPos[3];
-    hdlToolPosition(toolPos);
-    MatrixVectorMultiply(pos, haptics2graphics, toolPos);
+    rb->grab = grab;
 
-    hdlToolButtons(&(buttons));
+    RigidBody d;
+    TransformEffect(d, *rb);
+    rigidBodies.Update(i, d);
 }
 
+void Falcon::RemoveRigidBody(int i) {
+    rigidBodies.Remove(i);
+}
 
-void Falcon::ComputeViscousForce(double force[3], Viscosity& v, const double velocity[3]) {
-    // Compute viscous force
-    VectorScale(force, velocity, -v.c);
+void Falcon::RemoveRigidBodies() {
+    rigidBodies.RemoveAll();
+}
 
-    // Interpolate between previous force magnitude and current force magnitude to reduce vibrations
-    VectorScale(force, force, v.w);
-    VectorScale(v.oldForce, v.oldForce, 1.0 - v.w);
-    VectorAdd(force, force, v.oldForce);
+void Falcon::SetRigidBodyGravity(Vector3 g) {
+    rigidBodyGravitySource = g;
 
-    // Save old viscous force
-    VectorCopy(v.oldForce, force);
+    // Accelerations scale like positions
+    rigidBodyGravity[0] = g.x / workspaceScale;
+    rigidBodyGravity[1] = g.y / workspaceScale;
+    rigidBodyGravity[2] = g.z / workspaceScale;
 }
 
 
-void Falcon::ComputeSurfaceForce(double force[3], const Surface s, const double velocity[3]) {
-    // Compute distance to proxy position
-    double d = PointPlaneDistance(pos, s.p, s.n);
+// Distance fields
+int Falcon::AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c) {
+    if (!distances || nx < 2 || ny < 2 || nz < 2 || !(cellSize > 0.0f)) return -1;
 
-    // Check above or below plane
-    if (d > 0.0) {
-        return;
-    }
+    std::shared_ptr<DistanceGrid> grid(new DistanceGrid());
+    grid->dims[0] = nx;
+    grid->dims[1] = ny;
+    grid->dims[2] = nz;
+    VectorSet(grid->origin, origin.x, origin.y, origin.z);
+    grid->cellSize = cellSize;
+    grid->distances.assign(distances, distances + (size_t)nx * ny * nz);
+    grid->ready = true;
 
-    // Compute spring force along surface normal
+    return AddDistanceFieldGrid(grid, p, r, k, c);
+}
+
+int Falcon::AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c) {
+    if (!vertices || !triangles || numVertices <= 0 || numTriangles <= 0) return -1;
+
+    std::vector<double> v(numVertices * 3);
+    for (int i = 0; i < numVertices; i++) {
+        VectorSet(&v[i * 3], vertices[i].x, vertices[i].y, vertices[i].z);
+    }
+
+    std::shared_ptr<DistanceGrid> grid(new DistanceGrid());
+    distanceGridBuilder.Build(grid, std::move(v), std::vector<int>(triangles, triangles + numTriangles * 3), resolution);
+
+    return AddDistanceFieldGrid(grid, p, r, k, c);
+}
+
+int Falcon::AddDistanceFieldGrid(std::shared_ptr<DistanceGrid> grid, Vector3 p, Quaternion r, float k, float c) {
+    DistanceField s;
+    s.k = k;
+    s.c = c;
+    VectorSet(s.p, p.x, p.y, p.z);
+    s.q[0] = r.x;
+    s.q[1] = r.y;
+    s.q[2] = r.z;
+    s.q[3] = r.w;
+    s.grid = grid.get();
+
+    DistanceField d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+
+    int id = distanceFields.Add(s, d);
+    distanceGrids[id] = grid;
+
+    return id;
+}
+
+void Falcon::UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c) {
+    DistanceField* s = distanceFields.GetSource(i);
+    if (!s) return;
+
+    s->k = k;
+    s->c = c;
+    VectorSet(s->p, p.x, p.y, p.z);
+    s->q[0] = r.x;
+    s->q[1] = r.y;
+    s->q[2] = r.z;
+    s->q[3] = r.w;
+
+    DistanceField d;
+    TransformEffect(d, *s);
+    distanceFields.Update(i, d);
+}
+
+bool Falcon::IsDistanceFieldReady(int i) {
+    DistanceField* s = distanceFields.GetSource(i);
+    return s && s->grid->ready.load(std::memory_order_acquire);
+}
+
+void Falcon::RemoveDistanceField(int i) {
+    if (!distanceFields.GetSource(i)) return;
+
+    distanceFields.Remove(i);
+    RetireDistanceGrid(i);
+}
+
+void Falcon::RemoveDistanceFields() {
+    distanceFields.RemoveAll();
+    while (!distanceGrids.empty()) {
+        RetireDistanceGrid(distanceGrids.begin()->first);
+    }
+}
+
+void Falcon::RetireDistanceGrid(int i) {
+    std::unordered_map<int, std::shared_ptr<DistanceGrid> >::iterator it = distanceGrids.find(i);
+    if (it == distanceGrids.end()) return;
+
+    // Stop building it, and free it once the servo thread has applied the removal
+    it->second->cancelled = true;
+    distanceFields.Retire(it->second);
+    distanceGrids.erase(it);
+}
+
+
+// Path constraints
+int Falcon::AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+    if (!points || numPoints < 2) return -1;
+
+    std::vector<double> controlPoints(numPoints * 3);
+    for (int i = 0; i < numPoints; i++) {
+        VectorSet(&controlPoints[i * 3], points[i].x, points[i].y, points[i].z);
+    }
+
+    std::shared_ptr<ConstraintPath> path(new ConstraintPath());
+    if (!BuildConstraintPath(*path, controlPoints, spline, closed)) return -1;
+
+    PathConstraint s;
+    s.k = k;
+    s.c = c;
+    s.r = radius;
+    s.along = along;
+    VectorSet(s.p, p.x, p.y, p.z);
+    s.q[0] = r.x;
+    s.q[1] = r.y;
+    s.q[2] = r.z;
+    s.q[3] = r.w;
+    s.path = path.get();
+
+    PathConstraint d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    d.segment = -1;
+
+    int id = pathConstraints.Add(s, d);
+    constraintPaths[id] = path;
+
+    return id;
+}
+
+void Falcon::UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+    PathConstraint* s = pathConstraints.GetSource(i);
+    if (!s) return;
+
+    s->k = k;
+    s->c = c;
+    s->r = radius;
+    s->along = along;
+    VectorSet(s->p, p.x, p.y, p.z);
+    s->q[0] = r.x;
+    s->q[1] = r.y;
+    s->q[2] = r.z;
+    s->q[3] = r.w;
+
+    PathConstraint d;
+    TransformEffect(d, *s);
+    pathConstraints.Update(i, d);
+}
+
+void Falcon::RemovePathConstraint(int i) {
+    if (!pathConstraints.GetSource(i)) return;
+
+    pathConstraints.Remove(i);
+    RetireConstraintPath(i);
+}
+
+void Falcon::RemovePathConstraints() {
+    pathConstraints.RemoveAll();
+    while (!constraintPaths.empty()) {
+        RetireConstraintPath(constraintPaths.begin()->first);
+    }
+}
+
+void Falcon::RetireConstraintPath(int i) {
+    std::unordered_map<int, std::shared_ptr<ConstraintPath> >::iterator it = constraintPaths.find(i);
+    if (it == constraintPaths.end()) return;
+
+    pathConstraints.Retire(it->second);
+    constraintPaths.erase(it);
+}
+
+
+// Radial forces
+int Falcon::AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic) {
+    if (!forces || numSamples < 2 || !(maxDistance > 0.0f)) return -1;
+
+    std::shared_ptr<RadialProfile> profile(new RadialProfile());
+    profile->forces.assign(forces, forces + numSamples);
+    profile->maxDistance = maxDistance;
+    profile->cubic = cubic;
+
+    // Reuse the lowest free id
+    int id = 0;
+    while (id < (int)radialProfiles.size() && radialProfiles[id]) id++;
+
+    if (id == (int)radialProfiles.size()) {
+        radialProfiles.push_back(profile);
+    }
+    else {
+        radialProfiles[id] = profile;
+    }
+
+    return id;
+}
+
+void Falcon::RemoveRadialProfile(int profile) {
+    if (profile < 0 || profile >= (int)radialProfiles.size()) return;
+
+    // Radial forces using it keep their own reference
+    radialProfiles[profile].reset();
+}
+
+int Falcon::AddRadialForce(Vector3 p, int profile, float scale, float c) {
+    if (profile < 0 || profile >= (int)radialProfiles.size() || !radialProfiles[profile]) return -1;
+
+    RadialForce s;
+    s.scale = scale;
+    s.c = c;
+    VectorSet(s.p, p.x, p.y, p.z);
+    s.profile = radialProfiles[profile].get();
+
+    RadialForce d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+
+    int id = radialForces.Add(s, d);
+    radialForceProfiles[id] = radialProfiles[profile];
+
+    return id;
+}
+
+void Falcon::UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c) {
+    RadialForce* s = radialForces.GetSource(i);
+    if (!s || profile < 0 || profile >= (int)radialProfiles.size() || !radialProfiles[profile]) return;
+
+    s->scale = scale;
+    s->c = c;
+    VectorSet(s->p, p.x, p.y, p.z);
+    s->profile = radialProfiles[profile].get();
+
+    RadialForce d;
+    TransformEffect(d, *s);
+    radialForces.Update(i, d);
+
+    // Free the old profile once the servo thread has switched, if nothing else uses it
+    std::shared_ptr<RadialProfile>& current = radialForceProfiles[i];
+    if (current != radialProfiles[profile]) {
+        radialForces.Retire(current);
+        current = radialProfiles[profile];
+    }
+}
+
+void Falcon::RemoveRadialForce(int i) {
+    if (!radialForces.GetSource(i)) return;
+
+    radialForces.Remove(i);
+    radialForces.Retire(radialForceProfiles[i]);
+    radialForceProfiles.erase(i);
+}
+
+void Falcon::RemoveRadialForces() {
+    radialForces.RemoveAll();
+    for (std::unordered_map<int, std::shared_ptr<RadialProfile> >::iterator it = radialForceProfiles.begin(); it != radialForceProfiles.end(); ++it) {
+        radialForces.Retire(it->second);
+    }
+    radialForceProfiles.clear();
+}
+
+
+// Vibrations
+int Falcon::AddWavetable(const float* samples, int numSamples) {
+    if (!samples || numSamples < 2) return -1;
+
+    std::shared_ptr<Wavetable> table(new Wavetable());
+    ResampleWavetable(*table, samples, numSamples);
+
+    // Reuse the lowest free id
+    int id = NumWaveforms;
+    while (id < (int)wavetables.size() && wavetables[id]) id++;
+
+    if (id == (int)wavetables.size()) {
+        wavetables.push_back(table);
+    }
+    else {
+        wavetables[id] = table;
+    }
+
+    return id;
+}
+
+void Falcon::RemoveWavetable(int wavetable) {
+    if (wavetable < NumWaveforms || wavetable >= (int)wavetables.size()) return;
+
+    // Vibrations using it keep their own reference
+    wavetables[wavetable].reset();
+}
+
+int Falcon::AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+    if (wavetable < 0 || wavetable >= (int)wavetables.size() || !wavetables[wavetable]) return -1;
+
+    Vibration s;
+    s.wavetable = wavetables[wavetable].get();
+    VectorSet(s.direction, direction.x, direction.y, direction.z);
+    s.amplitude = amplitude;
+    s.frequency = frequency;
+    s.attack = attack;
+    s.decay = decay;
+    s.sustain = sustain;
+    s.release = release;
+    s.triggerGeneration = 0;
+    s.releaseGeneration = 0;
+    s.duration = 0.0;
+
+    // Silent until triggered
+    Vibration d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    d.phase = 0;
+    d.t = 0.0;
+    d.releaseTime = -1.0;
+    d.releaseLevel = 0.0;
+    d.active = false;
+
+    int id = vibrations.Add(s, d);
+    vibrationWavetables[id] = wavetables[wavetable];
+
+    return id;
+}
+
+void Falcon::UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+    Vibration* s = vibrations.GetSource(i);
+    if (!s || wavetable < 0 || wavetable >= (int)wavetables.size() || !wavetables[wavetable]) return;
+
+    s->wavetable = wavetables[wavetable].get();
+    VectorSet(s->direction, direction.x, direction.y, direction.z);
+    s->amplitude = amplitude;
+    s->frequency = frequency;
+    s->attack = attack;
+    s->decay = decay;
+    s->sustain = sustain;
+    s->release = release;
+
+    Vibration d;
+    TransformEffect(d, *s);
+    vibrations.Update(i, d);
+
+    // Free the old wavetable once the servo thread has switched, if nothing else uses it
+    std::shared_ptr<Wavetable>& current = vibrationWavetables[i];
+    if (current != wavetables[wavetable]) {
+        vibrations.Retire(current);
+        current = wavetables[wavetable];
+    }
+}
+
+void Falcon::TriggerVibration(int i, float duration) {
+    Vibration* s = vibrations.GetSource(i);
+    if (!s) return;
+
+    s->triggerGeneration++;
+    s->duration = duration;
+
+    Vibration d;
+    TransformEffect(d, *s);
+    vibrations.Update(i, d);
+}
+
+void Falcon::ReleaseVibration(int i) {
+    Vibration* s = vibrations.GetSource(i);
+    if (!s) return;
+
+    s->releaseGeneration++;
+
+    Vibration d;
+    TransformEffect(d, *s);
+    vibrations.Update(i, d);
+}
+
+void Falcon::RemoveVibration(int i) {
+    if (!vibrations.GetSource(i)) return;
+
+    vibrations.Remove(i);
+    vibrations.Retire(vibrationWavetables[i]);
+    vibrationWavetables.erase(i);
+}
+
+void Falcon::RemoveVibrations() {
+    vibrations.RemoveAll();
+    for (std::unordered_map<int, std::shared_ptr<Wavetable> >::iterator it = vibrationWavetables.begin(); it != vibrationWavetables.end(); ++it) {
+        vibrations.Retire(it->second);
+    }
+    vibrationWavetables.clear();
+}
+
+
+// Expression forces
+int Falcon::AddExpressionForce(const char* expression) {
+    if (!expression) return -1;
+
+    // Compile here, so the servo thread only runs the result
+    std::shared_ptr<ExpressionProgram> program(new ExpressionProgram());
+    std::string error;
+    if (!CompileExpression(*program, expression, error)) {
+        std::cout << "Could not compile expression: " << error << std::endl;
+        return -1;
+    }
+
+    ExpressionForce s;
+    s.program = program.get();
+    for (int i = 0; i < numExpressionParameters; i++) {
+        s.parameters[i] = 0.0;
+    }
+
+    ExpressionForce d;
+    TransformEffect(d, s);
+    VectorSet(d.f, 0.0, 0.0, 0.0);
+    d.t = 0.0;
+
+    int id = expressionForces.Add(s, d);
+    expressionPrograms[id] = program;
+
+    return id;
+}
+
+void Falcon::SetExpressionParameters(int i, const float* parameters, int numParameters) {
+    ExpressionForce* s = expressionForces.GetSource(i);
+    if (!s || !parameters) return;
+
+    for (int j = 0; j < numParameters && j < numExpressionParameters; j++) {
+        s->parameters[j] = parameters[j];
+    }
+
+    ExpressionForce d;
+    TransformEffect(d, *s);
+    expressionForces.Update(i, d);
+}
+
+void Falcon::RemoveExpressionForce(int i) {
+    if (!expressionForces.GetSource(i)) return;
+
+    expressionForces.Remove(i);
+    expressionForces.Retire(expressionPrograms[i]);
+    expressionPrograms.erase(i);
+}
+
+void Falcon::RemoveExpressionForces() {
+    expressionForces.RemoveAll();
+    for (std::unordered_map<int, std::shared_ptr<ExpressionProgram> >::iterator it = expressionPrograms.begin(); it != expressionPrograms.end(); ++it) {
+        expressionForces.Retire(it->second);
+    }
+    expressionPrograms.clear();
+}
+
+
+// External kernel forces
+int Falcon::LoadKernelLibrary(const char* fileName) {
+    if (!fileName) return -1;
+
+    std::unique_ptr<SharedLibrary> library(new SharedLibrary());
+    if (!library->Open(fileName)) {
+        std::cout << "Could not load kernel library " << fileName << std::endl;
+        return -1;
+    }
+
+    FalconGetKernelsFunction getKernels = (FalconGetKernelsFunction)library->Symbol(FALCON_GET_KERNELS);
+    if (!getKernels) {
+        std::cout << fileName << " doesn't export " << FALCON_GET_KERNELS << std::endl;
+        return -1;
+    }
+
+    FalconKernel found[maxKernels];
+    int n = getKernels(FALCON_KERNEL_VERSION, found, maxKernels);
+    if (n < 0) {
+        std::cout << fileName << " doesn't support kernel version " << FALCON_KERNEL_VERSION << std::endl;
+        return -1;
+    }
+
+    int registered = 0;
+    for (int i = 0; i < n && i < maxKernels; i++) {
+        if (RegisterKernel(found[i]) >= 0) registered++;
+    }
+
+    // Kept until shut down, as the servo thread may be calling its kernels
+    if (registered > 0) kernelLibraries.push_back(std::move(library));
+
+    return registered;
+}
+
+int Falcon::RegisterKernel(const FalconKernel& kernel) {
+    int n = numKernels.load(std::memory_order_relaxed);
+    if (n >= maxKernels || !kernel.name || !kernel.compute ||
+        kernel.numParameters < 0 || kernel.numParameters > FALCON_KERNEL_MAX_PARAMETERS) {
+        std::cout << "Could not register kernel " << (kernel.name ? kernel.name : "") << std::endl;
+        return -1;
+    }
+    if (FindKernel(kernel.name) >= 0) return -1;
+
+    kernelNames[n] = kernel.name;
+    kernels[n] = kernel;
+    kernels[n].name = kernelNames[n].c_str();
+
+    // Publish the kernel before any effect can use it
+    numKernels.store(n + 1, std::memory_order_release);
+
+    return n;
+}
+
+int Falcon::FindKernel(const char* name) {
+    if (!name) return -1;
+
+    int n = numKernels.load(std::memory_order_relaxed);
+    for (int i = 0; i < n; i++) {
+        if (kernelNames[i] == name) return i;
+    }
+
+    return -1;
+}
+
+int Falcon::AddKernelForce(int kernel, const float* parameters, int numParameters) {
+    if (kernel < 0 || kernel >= numKernels.load(std::memory_order_relaxed)) return -1;
+
+    KernelForce s;
+    s.kernel = kernel;
+    for (int i = 0; i < FALCON_KERNEL_MAX_PARAMETERS; i++) {
+        s.parameters[i] = parameters && i < numParameters ? parameters[i] : 0.0;
+    }
+
+    KernelForce d;
+    TransformEffect(d, s);
+
+    return kernelForces.Add(s, d);
+}
+
+void Falcon::UpdateKernelForce(int i, const float* parameters, int numParameters) {
+    KernelForce* s = kernelForces.GetSource(i);
+    if (!s || !parameters) return;
+
+    for (int j = 0; j < FALCON_KERNEL_MAX_PARAMETERS; j++) {
+        s->parameters[j] = j < numParameters ? parameters[j] : 0.0;
+    }
+
+    KernelForce d;
+    TransformEffect(d, *s);
+    kernelForces.Update(i, d);
+}
+
+void Falcon::RemoveKernelForce(int i) {
+    kernelForces.Remove(i);
+}
+
+void Falcon::RemoveKernelForces() {
+    kernelForces.RemoveAll();
+}
+
+KernelStats Falcon::GetKernelStats(int kernel) {
+    KernelStats stats = {};
+    if (kernel < 0 || kernel >= maxKernels) return stats;
+
+    // Retry if the servo thread was writing
+    int64_t total;
+    for (;;) {
+        unsigned int sequence = publishedKernelSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        stats.ticks = publishedKernelTicks.load(std::memory_order_relaxed);
+        stats.evaluated = publishedKernelEvaluated[kernel].load(std::memory_order_relaxed);
+        stats.calls = publishedKernelCalls[kernel].load(std::memory_order_relaxed);
+        stats.tickTime = (float)(publishedKernelTime[kernel].load(std::memory_order_relaxed) * 1e-3);
+        stats.maxTime = (float)(publishedKernelMaxTime[kernel].load(std::memory_order_relaxed) * 1e-3);
+        total = publishedKernelTotalTime[kernel].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (publishedKernelSequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    stats.meanTime = stats.ticks > 0 ? (float)(total * 1e-3 / stats.ticks) : 0.0f;
+
+    return stats;
+}
+
+
+// Primitive colliders
+int Falcon::AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+    if (shape < ColliderSphere || shape > ColliderCapsule) return -1;
+
+    Collider s;
+    s.shape = shape;
+    VectorSet(s.extents, extents.x, extents.y, extents.z);
+    s.k = k;
+    s.c = c;
+    VectorSet(s.p, p.x, p.y, p.z);
+    s.q[0] = r.x;
+    s.q[1] = r.y;
+    s.q[2] = r.z;
+    s.q[3] = r.w;
+
+    Collider d;
+    TransformEffect(d, s);
+
+    return colliders.Add(s, d);
+}
+
+void Falcon::UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+    Collider* s = colliders.GetSource(i);
+    if (!s || shape < ColliderSphere || shape > ColliderCapsule) return;
+
+    s->shape = shape;
+    VectorSet(s->extents, extents.x, extents.y, extents.z);
+    s->k = k;
+    s->c = c;
+    VectorSet(s->p, p.x, p.y, p.z);
+    s->q[0] = r.x;
+    s->q[1] = r.y;
+    s->q[2] = r.z;
+    s->q[3] = r.w;
+
+    Collider d;
+    TransformEffect(d, *s);
+    colliders.Update(i, d);
+}
+
+void Falcon::RemoveCollider(int i) {
+    colliders.Remove(i);
+}
+
+void Falcon::RemoveColliders() {
+    colliders.RemoveAll();
+}
+
+
+// Frames
+int Falcon::AddFrame(int parent) {
+    if (parent < 0 || parent >= (int)frames.size() || !frames[parent].used) parent = -1;
+
+    int id;
+    if (!freeFrames.empty()) {
+        id = freeFrames.back();
+        freeFrames.pop_back();
+    }
+    else if ((int)frames.size() < maxFrames) {
+        id = (int)frames.size();
+        frames.push_back(Frame());
+    }
+    else {
+        return -1;
+    }
+
+    Frame& frame = frames[id];
+    frame.parent = parent;
+    frame.used = true;
+    MatrixIdentity(frame.local);
+
+    PublishFrames();
+
+    return id;
+}
+
+void Falcon::SetFrames(const int* ids, const float* matrices, int n) {
+    if (!ids || !matrices) return;
+
+    for (int i = 0; i < n; i++) {
+        int id = ids[i];
+        if (id < 0 || id >= (int)frames.size() || !frames[id].used) continue;
+
+        for (int j = 0; j < 16; j++) {
+            frames[id].local[j] = matrices[i * 16 + j];
+        }
+    }
+
+    PublishFrames();
+}
+
+void Falcon::RemoveFrame(int frame) {
+    if (frame < 0 || frame >= (int)frames.size() || !frames[frame].used) return;
+
+    MoveFrameContents(frame, frames[frame].parent);
+
+    frames[frame].used = false;
+    freeFrames.push_back(frame);
+
+    PublishFrames();
+}
+
+void Falcon::RemoveFrames() {
+    if (frames.empty()) return;
+
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (frames[i].used) MoveFrameEffects(i, -1, frames[i].world);
+    }
+
+    frames.clear();
+    freeFrames.clear();
+
+    PublishFrames();
+}
+
+void Falcon::SetEffectFrame(int type, int i, int frame) {
+    if (frame < 0 || frame >= (int)frames.size() || !frames[frame].used) frame = -1;
+
+    switch (type) {
+    case SurfaceEffect:
+        if (Surface* s = surfaces.GetSource(i)) {
+            s->frame = frame;
+
+            Surface d;
+            TransformEffect(d, *s);
+            surfaces.Update(i, d);
+        }
+        break;
+
+    case SpringEffect:
+        if (Spring* s = springs.GetSource(i)) {
+            s->frame = frame;
+
+            Spring d;
+            TransformEffect(d, *s);
+            springs.Update(i, d);
+        }
+        break;
+
+    case IntermolecularForceEffect:
+        if (IntermolecularForce* imf = intermolecularForces.GetSource(i)) {
+            imf->frame = frame;
+
+            IntermolecularForce d;
+            TransformEffect(d, *imf);
+            intermolecularForces.Update(i, d);
+        }
+        break;
+    }
+}
+
+void Falcon::MoveFrameContents(int frame, int parent) {
+    const double* local = frames[frame].local;
+
+    for (Frame& child : frames) {
+        if (!child.used || child.parent != frame) continue;
+
+        double m[16];
+        MatrixMultiply(m, local, child.local);
+        std::copy(m, m + 16, child.local);
+        child.parent = parent;
+    }
+
+    MoveFrameEffects(frame, parent, local);
+}
+
+void Falcon::MoveFrameEffects(int frame, int parent, const double transform[16]) {
+    // Planes transform by the inverse transpose, keeping the normal's length
+    double inverse[16];
+    MatrixInvertAffine(inverse, transform);
+
+    surfaces.ForEachSource([&](int id, Surface& s) {
+        if (s.frame != frame) return;
+
+        double length = VectorMagnitude(s.n);
+        MatrixVectorMultiply(s.p, transform, s.p);
+        MatrixTransposeDirectionMultiply(s.n, inverse, s.n);
+        VectorNormalize(s.n, s.n);
+        VectorScale(s.n, s.n, length);
+
+        SetEffectFrame(SurfaceEffect, id, parent);
+    });
+    springs.ForEachSource([&](int id, Spring& s) {
+        if (s.frame != frame) return;
+
+        MatrixVectorMultiply(s.p, transform, s.p);
+        SetEffectFrame(SpringEffect, id, parent);
+    });
+    intermolecularForces.ForEachSource([&](int id, IntermolecularForce& imf) {
+        if (imf.frame != frame) return;
+
+        MatrixVectorMultiply(imf.p, transform, imf.p);
+        SetEffectFrame(IntermolecularForceEffect, id, parent);
+    });
+}
+
+void Falcon::PublishFrames() {
+    // Compose each frame with its parents, walking up to the first composed ancestor and back down. Parents exist
+    // before their children are added, so there are no cycles.
+    std::vector<char> composed(frames.size(), 0);
+    std::vector<int> chain;
+
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (!frames[i].used) continue;
+
+        chain.clear();
+        for (int j = i; j >= 0 && !composed[j]; j = frames[j].parent) {
+            chain.push_back(j);
+        }
+
+        for (int k = (int)chain.size() - 1; k >= 0; k--) {
+            Frame& frame = frames[chain[k]];
+            if (frame.parent < 0) {
+                std::copy(frame.local, frame.local + 16, frame.world);
+            }
+            else {
+                MatrixMultiply(frame.world, frames[frame.parent].world, frame.local);
+            }
+            composed[chain[k]] = 1;
+        }
+    }
+
+    // Effect parameters in a frame are transformed to effect space as if they were in graphics space, so the
+    // frame's transform in effect space is the world transform with the mean scale divided out on the left and
+    // multiplied in on the right, and the servo loop moves the probe into the frame with its inverse
+    FrameSet& set = frameSets.Back();
+    set.transforms.resize(frames.size() * 32);
+
+    for (int i = 0; i < (int)frames.size(); i++) {
+        double* toLocal = &set.transforms[i * 32];
+        double* toEffect = toLocal + 16;
+
+        if (!frames[i].used) {
+            MatrixIdentity(toLocal);
+            MatrixIdentity(toEffect);
+            continue;
+        }
+
+        FrameToEffect(toEffect, i);
+        MatrixInvertAffine(toLocal, toEffect);
+    }
+
+    frameSets.Publish();
+}
+
+void Falcon::FrameToEffect(double toEffect[16], int frame) {
+    double scale[16];
+    MatrixScale(scale, workspaceScale);
+    MatrixMultiply(toEffect, frames[frame].world, scale);
+
+    MatrixScale(scale, 1.0 / workspaceScale);
+    MatrixMultiply(toEffect, scale, toEffect);
+}
+
+
+// Force queries
+int Falcon::EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads) {
+    if (!points || !forces || n <= 0) return 0;
+
+    ForceQuery query;
+    BuildForceQuery(query);
+
+    if (numThreads <= 0) {
+        int hardware = (int)std::thread::hardware_concurrency();
+        numThreads = hardware > 3 ? hardware - 2 : 1;
+    }
+
+    // Whole blocks per thread
+    int numBlocks = (n + forceQueryBlock - 1) / forceQueryBlock;
+    numThreads = std::min(numThreads, numBlocks);
+
+    auto evaluate = [&](int thread) {
+        for (int block = thread; block < numBlocks; block += numThreads) {
+            int first = block * forceQueryBlock;
+            EvaluateForceQuery(query, points + first, forces + first, std::min(forceQueryBlock, n - first));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < numThreads; i++) {
+        workers.push_back(std::thread(evaluate, i));
+    }
+    evaluate(0);
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    return n;
+}
+
+void Falcon::BuildForceQuery(ForceQuery& query) {
+    uint32_t mask = groupMask.load(std::memory_order_relaxed);
+
+    std::vector<double> toEffect(frames.size() * 16);
+    query.frameTransforms.resize(frames.size() * 32);
+    for (int i = 0; i < (int)frames.size(); i++) {
+        if (frames[i].used) {
+            FrameToEffect(&toEffect[i * 16], i);
+        }
+        else {
+            MatrixIdentity(&toEffect[i * 16]);
+        }
+
+        double* transforms = &query.frameTransforms[i * 32];
+        MatrixInvertAffine(transforms, &toEffect[i * 16]);
+        std::copy(&toEffect[i * 16], &toEffect[i * 16] + 16, transforms + 16);
+    }
+
+    VectorSet(query.simpleForce, 0.0, 0.0, 0.0);
+    simpleForces.ForEachSource([&](int id, SimpleForce& s) {
+        if (!(mask & (1u << simpleForces.GetGroup(id)))) return;
+
+        SimpleForce d;
+        TransformEffect(d, s);
+        VectorAdd(query.simpleForce, query.simpleForce, d.f);
+    });
+
+    surfaces.ForEachSource([&](int id, Surface& s) {
+        if (!(mask & (1u << surfaces.GetGroup(id)))) return;
+
+        Surface d;
+        TransformEffect(d, s);
+        if (d.frame >= 0) {
+            const double* m = &toEffect[d.frame * 16];
+            MatrixVectorMultiply(d.p, m, d.p);
+            MatrixDirectionMultiply(d.n, m, d.n);
+            VectorNormalize(d.n, d.n);
+        }
+        query.surfaces.push_back(d);
+    });
+
+    springs.ForEachSource([&](int id, Spring& s) {
+        if (!(mask & (1u << springs.GetGroup(id)))) return;
+
+        Spring d;
+        TransformEffect(d, s);
+        if (d.frame >= 0) {
+            MatrixVectorMultiply(d.p, &toEffect[d.frame * 16], d.p);
+        }
+        query.springs.push_back(d);
+    });
+
+    intermolecularForces.ForEachSource([&](int id, IntermolecularForce& s) {
+        if (!(mask & (1u << intermolecularForces.GetGroup(id)))) return;
+
+        IntermolecularForce d;
+        TransformEffect(d, s);
+        query.intermolecularForces.push_back(d);
+    });
+
+    distanceFields.ForEachSource([&](int id, DistanceField& s) {
+        if (!(mask & (1u << distanceFields.GetGroup(id)))) return;
+
+        DistanceField d;
+        TransformEffect(d, s);
+        query.distanceFields.push_back(d);
+    });
+
+    pathConstraints.ForEachSource([&](int id, PathConstraint& s) {
+        if (!(mask & (1u << pathConstraints.GetGroup(id)))) return;
+
+        PathConstraint d;
+        TransformEffect(d, s);
+        query.pathConstraints.push_back(d);
+    });
+
+    radialForces.ForEachSource([&](int id, RadialForce& s) {
+        if (!(mask & (1u << radialForces.GetGroup(id)))) return;
+
+        RadialForce d;
+        TransformEffect(d, s);
+        query.radialForces.push_back(d);
+    });
+
+    colliders.ForEachSource([&](int id, Collider& s) {
+        if (!(mask & (1u << colliders.GetGroup(id)))) return;
+
+        Collider d;
+        TransformEffect(d, s);
+        query.colliders.push_back(d);
+    });
+}
+
+
+// Multi-point probes
+void Falcon::SetProbePoints(const Vector3* offsets, const float* radii, int n) {
+    if (!offsets) n = 0;
+    n = std::max(0, std::min(n, maxProbePoints));
+
+    probeOffsets.assign(offsets, offsets + n);
+    if (radii) {
+        probeRadii.assign(radii, radii + n);
+    }
+    else {
+        probeRadii.assign(n, 0.0f);
+    }
+
+    PublishProbePoints();
+}
+
+void Falcon::PublishProbePoints() {
+    ProbePoints& points = probePointSets.Back();
+    points.n = (int)probeOffsets.size();
+    points.extent = 0.0;
+    points.maxRadius = 0.0;
+
+    // Offsets scale like positions
+    for (int i = 0; i < points.n; i++) {
+        double o[3];
+        VectorSet(o, probeOffsets[i].x, probeOffsets[i].y, probeOffsets[i].z);
+        VectorScale(o, o, 1.0 / workspaceScale);
+
+        points.x[i] = o[0];
+        points.y[i] = o[1];
+        points.z[i] = o[2];
+        points.radius[i] = std::max(0.0, (double)probeRadii[i]) / workspaceScale;
+
+        points.extent = std::max(points.extent, VectorMagnitude(o) + points.radius[i]);
+        points.maxRadius = std::max(points.maxRadius, points.radius[i]);
+    }
+
+    probePointSets.Publish();
+}
+
+
+// Effect groups
+void Falcon::SetEffectGroup(int type, int i, int group) {
+    switch (type) {
+    case SimpleForceEffect: simpleForces.SetGroup(i, group); break;
+    case ViscosityEffect: viscosities.SetGroup(i, group); break;
+    case SurfaceEffect: surfaces.SetGroup(i, group); break;
+    case SpringEffect: springs.SetGroup(i, group); break;
+    case IntermolecularForceEffect: intermolecularForces.SetGroup(i, group); break;
+    case RandomForceEffect: randomForces.SetGroup(i, group); break;
+    case RigidBodyEffect: rigidBodies.SetGroup(i, group); break;
+    case DistanceFieldEffect: distanceFields.SetGroup(i, group); break;
+    case PathConstraintEffect: pathConstraints.SetGroup(i, group); break;
+    case RadialForceEffect: radialForces.SetGroup(i, group); break;
+    case VibrationEffect: vibrations.SetGroup(i, group); break;
+    case ExpressionForceEffect: expressionForces.SetGroup(i, group); break;
+    case KernelForceEffect: kernelForces.SetGroup(i, group); break;
+    case ColliderEffect: colliders.SetGroup(i, group); break;
+    }
+}
+
+void Falcon::SetGroupMask(unsigned int mask) {
+    groupMask.store(mask, std::memory_order_relaxed);
+}
+
+void Falcon::SetGroupEnabled(int group, bool enable) {
+    if (group < 0 || group >= numEffectGroups) return;
+
+    if (enable) {
+        groupMask.fetch_or(1u << group, std::memory_order_relaxed);
+    }
+    else {
+        groupMask.fetch_and(~(1u << group), std::memory_order_relaxed);
+    }
+}
+
+unsigned int Falcon::GetGroupMask() {
+    return groupMask.load(std::memory_order_relaxed);
+}
+
+// Molecular force field
+void Falcon::SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+    std::vector<ForceFieldAtom> atoms(n > 0 ? n : 0);
+    for (int i = 0; i < n; i++) {
+        VectorSet(atoms[i].p, p[i].x, p[i].y, p[i].z);
+        atoms[i].sigma = sigma[i];
+        atoms[i].epsilon = epsilon[i];
+        atoms[i].charge = charge[i];
+    }
+
+    forceField.SetReceptor(atoms);
+}
+
+void Falcon::SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+    std::vector<ForceFieldAtom> atoms(n > 0 ? n : 0);
+    for (int i = 0; i < n; i++) {
+        VectorSet(atoms[i].p, p[i].x, p[i].y, p[i].z);
+        atoms[i].sigma = sigma[i];
+        atoms[i].epsilon = epsilon[i];
+        atoms[i].charge = charge[i];
+    }
+
+    forceField.SetLigand(atoms);
+}
+
+void Falcon::SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads) {
+    forceField.SetParameters(cutoff, coulombConstant, forceScale, maxForce, maxStiffness, c);
+
+    if (enable) {
+        forceField.Start(numThreads);
+    }
+    else {
+        forceField.Stop();
+    }
+
+    useForceField = enable;
+}
+
+ForceFieldStats Falcon::GetForceFieldStats() {
+    return forceField.GetStats();
+}
+
+
+// Scenes
+static_assert(sizeof(SceneExpressionForce().parameters) / sizeof(float) == numExpressionParameters, "Scene expression records must hold every parameter");
+
+template <class R>
+R ReadSceneRecord(const unsigned char* scene, const SceneSection& section, int i) {
+    // Records may not be aligned in a caller's buffer, and may be longer in later versions or shorter in earlier ones
+    R r;
+    memset(&r, 0, sizeof(R));
+    memcpy(&r, scene + section.offset + (size_t)i * section.recordSize, std::min((size_t)section.recordSize, sizeof(R)));
+    return r;
+}
+
+// Read just the group of an effect record, 0 if the record has none
+template <class R>
+int ReadSceneGroup(const unsigned char* scene, const SceneSection& section, int i) {
+    if (section.recordSize < offsetof(R, group) + sizeof(int32_t)) return 0;
+
+    int32_t group;
+    memcpy(&group, scene + section.offset + (size_t)i * section.recordSize + offsetof(R, group), sizeof(int32_t));
+    return group;
+}
+
+// Frame of an effect record, -1 if the record has none
+template <class R>
+int ReadSceneFrame(const SceneSection& section, const R& r) {
+    return section.recordSize < offsetof(R, frame) + sizeof(int32_t) ? -1 : r.frame;
+}
+
+// Write the records of a section with effects in id order, returning the end of the records.
+// record(id, effect) gives the value-initialized record for an effect, whose group is set here.
+template <class R, class T, class F>
+unsigned char* WriteSceneRecords(unsigned char* scene, unsigned char* p, SceneSection& section, int type, ForceContainer<T>& effects, F record) {
+    section.type = type;
+    section.count = (uint32_t)effects.Count();
+    section.recordSize = sizeof(R);
+    section.offset = (uint32_t)(p - scene);
+
+    effects.ForEachSource([&](int id, T& effect) {
+        R r = record(id, effect);
+        r.group = effects.GetGroup(id);
+        memcpy(p, &r, sizeof(R));
+        p += sizeof(R);
+    });
+
+    return p;
+}
+
+// Bytes taken in the data section by size bytes of data, keeping the next data aligned
+uint64_t SceneDataSize(uint64_t size) {
+    return (size + 3) & ~(uint64_t)3;
+}
+
+// Whether size bytes at offset are within the data section
+bool SceneDataFits(const SceneSection& data, uint64_t offset, uint64_t size) {
+    return offset % 4 == 0 && offset + size <= (uint64_t)data.count * data.recordSize;
+}
+
+// Read n floats at offset in the data section
+template <class T>
+void ReadSceneFloats(const unsigned char* scene, const SceneSection& data, uint32_t offset, T* values, size_t n) {
+    const unsigned char* p = scene + data.offset + offset;
+    for (size_t i = 0; i < n; i++) {
+        float v;
+        memcpy(&v, p + i * sizeof(float), sizeof(float));
+        values[i] = v;
+    }
+}
+
+// Append n values to the data section starting at data as floats, returning their offset there
+template <class T>
+uint32_t WriteSceneFloats(const unsigned char* data, unsigned char*& end, const T* values, size_t n) {
+    uint32_t offset = (uint32_t)(end - data);
+    for (size_t i = 0; i < n; i++) {
+        float v = (float)values[i];
+        memcpy(end, &v, sizeof(float));
+        end += sizeof(float);
+    }
+    return offset;
+}
+
+// Append size bytes to the data section starting at data, padded to keep the next data aligned, returning their offset
+// there
+uint32_t WriteSceneBytes(const unsigned char* data, unsigned char*& end, const void* bytes, size_t size) {
+    uint32_t offset = (uint32_t)(end - data);
+    memcpy(end, bytes, size);
+    memset(end + size, 0, SceneDataSize(size) - size);
+    end += SceneDataSize(size);
+    return offset;
+}
+
+// Whether a distance field record's grid is empty, or has its samples in the data section
+bool SceneGridValid(const SceneSection& data, const SceneDistanceField& r) {
+    if (r.dims[0] == 0 && r.dims[1] == 0 && r.dims[2] == 0) return true;
+    if (!(r.cellSize > 0.0f)) return false;
+
+    uint64_t n = 1;
+    for (int i = 0; i < 3; i++) {
+        if (r.dims[i] < 2) return false;
+
+        n *= r.dims[i];
+        if (n > (uint64_t)data.count * data.recordSize) return false;
+    }
+
+    return SceneDataFits(data, r.samples, n * sizeof(float));
+}
+
+bool FalconInterface::LoadScene(const char* fileName) {
+    MappedFile file;
+    if (!file.Open(fileName) || file.Size() > INT_MAX) {
+        std::cout << "Could not open scene file " << fileName << std::endl;
+        return false;
+    }
+
+    return LoadSceneData(file.Data(), (int)file.Size());
+}
+
+bool FalconInterface::SaveScene(const char* fileName) {
+    // The scene can grow between calls, as when a distance grid finishes building
+    std::vector<unsigned char> scene;
+    int size = SaveSceneData(nullptr, 0);
+    while (size > (int)scene.size()) {
+        scene.resize(size);
+        size = SaveSceneData(scene.data(), size);
+    }
+    if (size <= 0) return false;
+
+    FILE* file = fopen(fileName, "wb");
+    if (!file) {
+        std::cout << "Could not write scene file " << fileName << std::endl;
+        return false;
+    }
+
+    bool written = fwrite(scene.data(), 1, size, file) == (size_t)size;
+    written = fclose(file) == 0 && written;
+
+    return written;
+}
+
+bool Falcon::LoadSceneData(const void* data, int size) {
+    const unsigned char* scene = static_cast<const unsigned char*>(data);
+
+    // Check everything before changing the scene
+    SceneHeader header;
+    if (!scene || size < (int)sizeof(SceneHeader)) return false;
+    memcpy(&header, scene, sizeof(SceneHeader));
+
+    if (header.magic != sceneMagic || header.version != sceneVersion) {
+        std::cout << "Not a scene, or a scene from a different version" << std::endl;
+        return false;
+    }
+
+    if (sizeof(SceneHeader) + (uint64_t)header.numSections * sizeof(SceneSection) > (uint64_t)size) return false;
+
+    // Types without a section are empty. Effect records may be without their group.
+    const size_t recordSizes[NumSceneSectionTypes] = {
+        sizeof(SceneSimpleForce), sizeof(SceneViscosity), sizeof(SceneSurface), sizeof(SceneSpring),
+        sizeof(SceneSpring), sizeof(SceneRandomForce), sizeof(SceneRigidBody), sizeof(SceneGravity),
+        sizeof(SceneCollider), 1, sizeof(SceneDistanceField), sizeof(ScenePathConstraint),
+        sizeof(SceneRadialProfile), sizeof(SceneRadialForce), sizeof(SceneWavetable), sizeof(SceneVibration),
+        sizeof(SceneExpressionForce), sizeof(SceneFrame)
+    };
+    const size_t minRecordSizes[NumSceneSectionTypes] = {
+        offsetof(SceneSimpleForce, group), offsetof(SceneViscosity, group), offsetof(SceneSurface, group),
+        offsetof(SceneSpring, group), offsetof(SceneSpring, group), offsetof(SceneRandomForce, group),
+        offsetof(SceneRigidBody, group), sizeof(SceneGravity), offsetof(SceneCollider, group), 1,
+        offsetof(SceneDistanceField, group), offsetof(ScenePathConstraint, group), sizeof(SceneRadialProfile),
+        offsetof(SceneRadialForce, group), sizeof(SceneWavetable), offsetof(SceneVibration, group),
+        offsetof(SceneExpressionForce, group), sizeof(SceneFrame)
+    };
+
+    SceneSection sections[NumSceneSectionTypes];
+    bool found[NumSceneSectionTypes];
+    for (int i = 0; i < NumSceneSectionTypes; i++) {
+        sections[i].type = i;
+        sections[i].count = 0;
+        sections[i].recordSize = (uint32_t)recordSizes[i];
+        sections[i].offset = 0;
+        found[i] = false;
+    }
+
+    for (uint32_t i = 0; i < header.numSections; i++) {
+        SceneSection section;
+        memcpy(&section, scene + sizeof(SceneHeader) + i * sizeof(SceneSection), sizeof(SceneSection));
+
+        // Skip section types from later versions
+        if (section.type >= (uint32_t)NumSceneSectionTypes) continue;
+
+        if (found[section.type] ||
+            section.recordSize < minRecordSizes[section.type] ||
+            section.count > (uint32_t)INT_MAX ||
+            section.offset + (uint64_t)section.count * section.recordSize > (uint64_t)size) {
+            std::cout << "Invalid scene section " << section.type << std::endl;
+            return false;
+        }
+
+        sections[section.type] = section;
+        found[section.type] = true;
+    }
+
+    // Frames must have used parents, without cycles, and effects must be in used frames
+    const SceneSection& fs = sections[SceneFrames];
+    std::vector<SceneFrame> sceneFrames(fs.count);
+    bool framesValid = fs.count <= (uint32_t)maxFrames;
+    for (uint32_t i = 0; i < fs.count && framesValid; i++) {
+        sceneFrames[i] = ReadSceneRecord<SceneFrame>(scene, fs, i);
+    }
+    for (uint32_t i = 0; i < fs.count && framesValid; i++) {
+        if (!sceneFrames[i].used) continue;
+
+        int depth = 0;
+        for (int j = sceneFrames[i].parent; j >= 0 && framesValid; j = sceneFrames[j].parent) {
+            framesValid = j < (int)fs.count && sceneFrames[j].used && ++depth <= (int)fs.count;
+        }
+    }
+    if (!framesValid) {
+        std::cout << "Invalid scene section " << SceneFrames << std::endl;
+        return false;
+    }
+
+    auto frameValid = [&](int frame) {
+        return frame == -1 || (frame >= 0 && frame < (int)fs.count && sceneFrames[frame].used);
+    };
+
+    const SceneSection& ss = sections[SceneSurfaces];
+    for (uint32_t i = 0; i < ss.count; i++) {
+        if (!frameValid(ReadSceneFrame(ss, ReadSceneRecord<SceneSurface>(scene, ss, i)))) {
+            std::cout << "Invalid scene section " << SceneSurfaces << std::endl;
+            return false;
+        }
+    }
+
+    const SceneSection& sps = sections[SceneSprings];
+    const SceneSection& ims = sections[SceneIntermolecularForces];
+    for (int type = SceneSprings; type <= SceneIntermolecularForces; type++) {
+        const SceneSection& section = sections[type];
+        for (uint32_t i = 0; i < section.count; i++) {
+            if (!frameValid(ReadSceneFrame(section, ReadSceneRecord<SceneSpring>(scene, section, i)))) {
+                std::cout << "Invalid scene section " << type << std::endl;
+                return false;
+            }
+        }
+    }
+
+    // Check the data that records refer to
+    const SceneSection& ds = sections[SceneData];
+
+    const SceneSection& dfs = sections[SceneDistanceFields];
+    for (uint32_t i = 0; i < dfs.count; i++) {
+        if (!SceneGridValid(ds, ReadSceneRecord<SceneDistanceField>(scene, dfs, i))) {
+            std::cout << "Invalid scene section " << SceneDistanceFields << std::endl;
+            return false;
+        }
+    }
+
+    // Paths are built here, as a path can fail to build
+    const SceneSection& pcs = sections[ScenePathConstraints];
+    std::vector<std::shared_ptr<ConstraintPath> > paths(pcs.count);
+    for (uint32_t i = 0; i < pcs.count; i++) {
+        ScenePathConstraint r = ReadSceneRecord<ScenePathConstraint>(scene, pcs, i);
+
+        std::vector<double> points;
+        if (SceneDataFits(ds, r.points, (uint64_t)r.numPoints * 3 * sizeof(float))) {
+            points.resize((size_t)r.numPoints * 3);
+            ReadSceneFloats(scene, ds, r.points, points.data(), points.size());
+        }
+
+        paths[i].reset(new ConstraintPath());
+        if (!BuildConstraintPath(*paths[i], points, false, false)) {
+            std::cout << "Invalid scene section " << ScenePathConstraints << std::endl;
+            return false;
+        }
+    }
+
+    // Profiles are built here too, with empty ones for removed ids, and the pool ends after the last pooled profile
+    const SceneSection& rps = sections[SceneRadialProfiles];
+    std::vector<std::shared_ptr<RadialProfile> > profiles(rps.count);
+    int numPooledProfiles = 0;
+    for (uint32_t i = 0; i < rps.count; i++) {
+        SceneRadialProfile r = ReadSceneRecord<SceneRadialProfile>(scene, rps, i);
+        if (r.numSamples == 0 && !r.pooled) continue;
+
+        if (r.numSamples < 2 || !(r.maxDistance > 0.0f) ||
+            !SceneDataFits(ds, r.forces, (uint64_t)r.numSamples * sizeof(float))) {
+            std::cout << "Invalid scene section " << SceneRadialProfiles << std::endl;
+            return false;
+        }
+
+        profiles[i].reset(new RadialProfile());
+        profiles[i]->forces.resize(r.numSamples);
+        ReadSceneFloats(scene, ds, r.forces, profiles[i]->forces.data(), r.numSamples);
+        profiles[i]->maxDistance = r.maxDistance;
+        profiles[i]->cubic = r.cubic != 0;
+
+        if (r.pooled) numPooledProfiles = i + 1;
+    }
+
+    const SceneSection& rfos = sections[SceneRadialForces];
+    for (uint32_t i = 0; i < rfos.count; i++) {
+        SceneRadialForce r = ReadSceneRecord<SceneRadialForce>(scene, rfos, i);
+        if (r.profile >= rps.count || !profiles[r.profile]) {
+            std::cout << "Invalid scene section " << SceneRadialForces << std::endl;
+            return false;
+        }
+    }
+
+    // Likewise wavetables, with the built in ones kept
+    const SceneSection& wts = sections[SceneWavetables];
+    std::vector<std::shared_ptr<Wavetable> > tables(std::max(wts.count, (uint32_t)NumWaveforms));
+    std::copy(wavetables.begin(), wavetables.begin() + NumWaveforms, tables.begin());
+    int numPooledWavetables = NumWaveforms;
+    for (uint32_t i = NumWaveforms; i < wts.count; i++) {
+        SceneWavetable r = ReadSceneRecord<SceneWavetable>(scene, wts, i);
+        if (r.numSamples == 0 && !r.pooled) continue;
+
+        if (r.numSamples < 2 || r.numSamples > (uint32_t)INT_MAX ||
+            !SceneDataFits(ds, r.samples, (uint64_t)r.numSamples * sizeof(float))) {
+            std::cout << "Invalid scene section " << SceneWavetables << std::endl;
+            return false;
+        }
+
+        std::vector<float> samples(r.numSamples);
+        ReadSceneFloats(scene, ds, r.samples, samples.data(), samples.size());
+        tables[i].reset(new Wavetable());
+        ResampleWavetable(*tables[i], samples.data(), (int)r.numSamples);
+
+        if (r.pooled) numPooledWavetables = i + 1;
+    }
+
+    const SceneSection& vbs = sections[SceneVibrations];
+    for (uint32_t i = 0; i < vbs.count; i++) {
+        SceneVibration r = ReadSceneRecord<SceneVibration>(scene, vbs, i);
+        if (r.wavetable >= tables.size() || !tables[r.wavetable]) {
+            std::cout << "Invalid scene section " << SceneVibrations << std::endl;
+            return false;
+        }
+    }
+
+    // Expressions are compiled here, as one can fail to compile
+    const SceneSection& efs = sections[SceneExpressionForces];
+    std::vector<std::shared_ptr<ExpressionProgram> > programs(efs.count);
+    for (uint32_t i = 0; i < efs.count; i++) {
+        SceneExpressionForce r = ReadSceneRecord<SceneExpressionForce>(scene, efs, i);
+
+        std::string error = "Text outside the data section";
+        programs[i].reset(new ExpressionProgram());
+        if (!SceneDataFits(ds, r.text, r.length) ||
+            !CompileExpression(*programs[i], std::string((const char*)scene + ds.offset + r.text, r.length), error)) {
+            std::cout << "Invalid scene section " << SceneExpressionForces << ": " << error << std::endl;
+            return false;
+        }
+    }
+
+
+    // Frames first, so effects are never in missing frames
+    frames.assign(fs.count, Frame());
+    freeFrames.clear();
+    for (int i = (int)fs.count - 1; i >= 0; i--) {
+        Frame& frame = frames[i];
+        frame.used = sceneFrames[i].used != 0;
+        frame.parent = frame.used ? sceneFrames[i].parent : -1;
+        for (int j = 0; j < 16; j++) {
+            frame.local[j] = sceneFrames[i].local[j];
+        }
+
+        if (!frame.used) freeFrames.push_back(i);
+    }
+    PublishFrames();
+
+    // Build each effect store directly, as the Add calls would
+    const SceneSection& sf = sections[SceneSimpleForces];
+    simpleForces.Load(sf.count, [&](int i) { return ReadSceneGroup<SceneSimpleForce>(scene, sf, i); }, [&](int i, SimpleForce& s, SimpleForce& d) {
+        SceneSimpleForce r = ReadSceneRecord<SceneSimpleForce>(scene, sf, i);
+        VectorSet(s.f, r.f[0], r.f[1], r.f[2]);
+
+        TransformEffect(d, s);
+    });
+
+    const SceneSection& vs = sections[SceneViscosities];
+    viscosities.Load(vs.count, [&](int i) { return ReadSceneGroup<SceneViscosity>(scene, vs, i); }, [&](int i, Viscosity& v, Viscosity& d) {
+        SceneViscosity r = ReadSceneRecord<SceneViscosity>(scene, vs, i);
+        v.c = r.c;
+        v.w = r.w;
+        VectorSet(v.oldForce, 0.0, 0.0, 0.0);
+
+        d = v;
+        TransformEffect(d, v);
+    });
+
+    surfaces.Load(ss.count, [&](int i) { return ReadSceneGroup<SceneSurface>(scene, ss, i); }, [&](int i, Surface& s, Surface& d) {
+        SceneSurface r = ReadSceneRecord<SceneSurface>(scene, ss, i);
+        s.k = r.k;
+        s.c = r.c;
+        VectorSet(s.p, r.p[0], r.p[1], r.p[2]);
+        VectorSet(s.n, r.n[0], r.n[1], r.n[2]);
+        s.frame = ReadSceneFrame(ss, r);
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        VectorSet(d.t, 0.0, 0.0, 0.0);
+    });
+
+    springs.Load(sps.count, [&](int i) { return ReadSceneGroup<SceneSpring>(scene, sps, i); }, [&](int i, Spring& s, Spring& d) {
+        SceneSpring r = ReadSceneRecord<SceneSpring>(scene, sps, i);
+        s.k = r.k;
+        s.c = r.c;
+        s.r = r.r;
+        s.m = r.m;
+        VectorSet(s.p, r.p[0], r.p[1], r.p[2]);
+        s.frame = ReadSceneFrame(sps, r);
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        VectorSet(d.t, 0.0, 0.0, 0.0);
+        d.near = true;
+    });
+
+    intermolecularForces.Load(ims.count, [&](int i) { return ReadSceneGroup<SceneSpring>(scene, ims, i); }, [&](int i, IntermolecularForce& imf, IntermolecularForce& d) {
+        SceneSpring r = ReadSceneRecord<SceneSpring>(scene, ims, i);
+        imf.k = r.k;
+        imf.c = r.c;
+        imf.r = r.r;
+        imf.m = r.m;
+        VectorSet(imf.p, r.p[0], r.p[1], r.p[2]);
+        imf.frame = ReadSceneFrame(ims, r);
+
+        TransformEffect(d, imf);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        VectorSet(d.t, 0.0, 0.0, 0.0);
+        d.near = true;
+    });
+
+    const SceneSection& rfs = sections[SceneRandomForces];
+    randomForces.Load(rfs.count, [&](int i) { return ReadSceneGroup<SceneRandomForce>(scene, rfs, i); }, [&](int i, RandomForce& rf, RandomForce& d) {
+        SceneRandomForce r = ReadSceneRecord<SceneRandomForce>(scene, rfs, i);
+        rf.minMag = r.minMag;
+        rf.maxMag = r.maxMag;
+        rf.minTime = r.minTime;
+        rf.maxTime = r.maxTime;
+        VectorSet(rf.f, 0.0, 0.0, 0.0);
+        rf.t = 0.0;
+        rf.tStart = 0.0;
+
+        d = rf;
+        TransformEffect(d, rf);
+    });
+
+    const SceneSection& rbs = sections[SceneRigidBodies];
+    rigidBodies.Load(rbs.count, [&](int i) { return ReadSceneGroup<SceneRigidBody>(scene, rbs, i); }, [&](int i, RigidBody& rb, RigidBody& d) {
+        SceneRigidBody r = ReadSceneRecord<SceneRigidBody>(scene, rbs, i);
+        rb.mass = r.mass;
+        VectorSet(rb.inertia, r.inertia[0], r.inertia[1], r.inertia[2]);
+        rb.shape = r.shape;
+        VectorSet(rb.extents, r.extents[0], r.extents[1], r.extents[2]);
+        rb.k = r.k;
+        rb.c = r.c;
+        rb.linearDrag = r.linearDrag;
+        rb.angularDrag = r.angularDrag;
+        rb.grab = false;
+        VectorSet(rb.p, r.p[0], r.p[1], r.p[2]);
+        for (int j = 0; j < 4; j++) {
+            rb.q[j] = r.q[j];
+        }
+        rb.generation = ++rigidBodyGeneration;
+        VectorSet(rb.v, 0.0, 0.0, 0.0);
+        VectorSet(rb.w, 0.0, 0.0, 0.0);
+        rb.attached = false;
+        VectorSet(rb.grabOffset, 0.0, 0.0, 0.0);
+
+        // Reuse the published pose for the id, as AddRigidBody() does
+        std::unique_ptr<PublishedPose>& published = rigidBodyPoses[i];
+        if (!published) {
+            published.reset(new PublishedPose());
+            published->sequence = 0;
+            published->generation = -1;
+        }
+        rb.published = published.get();
+
+        d = rb;
+        TransformEffect(d, rb);
+    });
+
+    Vector3 g = { 0.0f, 0.0f, 0.0f };
+    const SceneSection& gs = sections[SceneRigidBodyGravity];
+    if (gs.count > 0) {
+        SceneGravity r = ReadSceneRecord<SceneGravity>(scene, gs, 0);
+        g.x = r.g[0];
+        g.y = r.g[1];
+        g.z = r.g[2];
+    }
+    SetRigidBodyGravity(g);
+
+    const SceneSection& cs = sections[SceneColliders];
+    colliders.Load(cs.count, [&](int i) { return ReadSceneGroup<SceneCollider>(scene, cs, i); }, [&](int i, Collider& c, Collider& d) {
+        SceneCollider r = ReadSceneRecord<SceneCollider>(scene, cs, i);
+        c.shape = r.shape < ColliderSphere || r.shape > ColliderCapsule ? ColliderSphere : r.shape;
+        VectorSet(c.extents, r.extents[0], r.extents[1], r.extents[2]);
+        c.k = r.k;
+        c.c = r.c;
+        VectorSet(c.p, r.p[0], r.p[1], r.p[2]);
+        for (int j = 0; j < 4; j++) {
+            c.q[j] = r.q[j];
+        }
+
+        TransformEffect(d, c);
+    });
+
+    // Grids are rebuilt from their samples, and the old ones freed once the servo thread has switched
+    std::unordered_map<int, std::shared_ptr<DistanceGrid> > oldGrids;
+    oldGrids.swap(distanceGrids);
+
+    distanceFields.Load(dfs.count, [&](int i) { return ReadSceneGroup<SceneDistanceField>(scene, dfs, i); }, [&](int i, DistanceField& s, DistanceField& d) {
+        SceneDistanceField r = ReadSceneRecord<SceneDistanceField>(scene, dfs, i);
+
+        std::shared_ptr<DistanceGrid> grid(new DistanceGrid());
+        if (r.dims[0] > 0) {
+            for (int j = 0; j < 3; j++) {
+                grid->dims[j] = r.dims[j];
+            }
+            VectorSet(grid->origin, r.origin[0], r.origin[1], r.origin[2]);
+            grid->cellSize = r.cellSize;
+            grid->distances.resize((size_t)r.dims[0] * r.dims[1] * r.dims[2]);
+            ReadSceneFloats(scene, ds, r.samples, grid->distances.data(), grid->distances.size());
+            grid->ready = true;
+        }
+        distanceGrids[i] = grid;
+
+        s.k = r.k;
+        s.c = r.c;
+        VectorSet(s.p, r.p[0], r.p[1], r.p[2]);
+        for (int j = 0; j < 4; j++) {
+            s.q[j] = r.q[j];
+        }
+        s.grid = grid.get();
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+    });
+
+    for (std::unordered_map<int, std::shared_ptr<DistanceGrid> >::iterator it = oldGrids.begin(); it != oldGrids.end(); ++it) {
+        it->second->cancelled = true;
+        distanceFields.Retire(it->second);
+    }
+
+    std::unordered_map<int, std::shared_ptr<ConstraintPath> > oldPaths;
+    oldPaths.swap(constraintPaths);
+
+    pathConstraints.Load(pcs.count, [&](int i) { return ReadSceneGroup<ScenePathConstraint>(scene, pcs, i); }, [&](int i, PathConstraint& s, PathConstraint& d) {
+        ScenePathConstraint r = ReadSceneRecord<ScenePathConstraint>(scene, pcs, i);
+        constraintPaths[i] = paths[i];
+
+        s.k = r.k;
+        s.c = r.c;
+        s.r = r.r;
+        s.along = r.along;
+        VectorSet(s.p, r.p[0], r.p[1], r.p[2]);
+        for (int j = 0; j < 4; j++) {
+            s.q[j] = r.q[j];
+        }
+        s.path = paths[i].get();
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        d.segment = -1;
+    });
+
+    for (std::unordered_map<int, std::shared_ptr<ConstraintPath> >::iterator it = oldPaths.begin(); it != oldPaths.end(); ++it) {
+        pathConstraints.Retire(it->second);
+    }
+
+    radialProfiles.assign(numPooledProfiles, std::shared_ptr<RadialProfile>());
+    for (int i = 0; i < numPooledProfiles; i++) {
+        if (ReadSceneRecord<SceneRadialProfile>(scene, rps, i).pooled) radialProfiles[i] = profiles[i];
+    }
+
+    std::unordered_map<int, std::shared_ptr<RadialProfile> > oldProfiles;
+    oldProfiles.swap(radialForceProfiles);
+
+    radialForces.Load(rfos.count, [&](int i) { return ReadSceneGroup<SceneRadialForce>(scene, rfos, i); }, [&](int i, RadialForce& s, RadialForce& d) {
+        SceneRadialForce r = ReadSceneRecord<SceneRadialForce>(scene, rfos, i);
+        radialForceProfiles[i] = profiles[r.profile];
+
+        s.scale = r.scale;
+        s.c = r.c;
+        VectorSet(s.p, r.p[0], r.p[1], r.p[2]);
+        s.profile = profiles[r.profile].get();
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+    });
+
+    for (std::unordered_map<int, std::shared_ptr<RadialProfile> >::iterator it = oldProfiles.begin(); it != oldProfiles.end(); ++it) {
+        radialForces.Retire(it->second);
+    }
+
+    wavetables.assign(tables.begin(), tables.begin() + NumWaveforms);
+    for (int i = NumWaveforms; i < numPooledWavetables; i++) {
+        wavetables.push_back(ReadSceneRecord<SceneWavetable>(scene, wts, i).pooled ? tables[i] : std::shared_ptr<Wavetable>());
+    }
+
+    std::unordered_map<int, std::shared_ptr<Wavetable> > oldTables;
+    oldTables.swap(vibrationWavetables);
+
+    // Silent until triggered, as when added
+    vibrations.Load(vbs.count, [&](int i) { return ReadSceneGroup<SceneVibration>(scene, vbs, i); }, [&](int i, Vibration& s, Vibration& d) {
+        SceneVibration r = ReadSceneRecord<SceneVibration>(scene, vbs, i);
+        vibrationWavetables[i] = tables[r.wavetable];
+
+        s.wavetable = tables[r.wavetable].get();
+        VectorSet(s.direction, r.direction[0], r.direction[1], r.direction[2]);
+        s.amplitude = r.amplitude;
+        s.frequency = r.frequency;
+        s.attack = r.attack;
+        s.decay = r.decay;
+        s.sustain = r.sustain;
+        s.release = r.release;
+        s.triggerGeneration = 0;
+        s.releaseGeneration = 0;
+        s.duration = 0.0;
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        d.phase = 0;
+        d.t = 0.0;
+        d.releaseTime = -1.0;
+        d.releaseLevel = 0.0;
+        d.active = false;
+    });
+
+    for (std::unordered_map<int, std::shared_ptr<Wavetable> >::iterator it = oldTables.begin(); it != oldTables.end(); ++it) {
+        vibrations.Retire(it->second);
+    }
+
+    std::unordered_map<int, std::shared_ptr<ExpressionProgram> > oldPrograms;
+    oldPrograms.swap(expressionPrograms);
+
+    expressionForces.Load(efs.count, [&](int i) { return ReadSceneGroup<SceneExpressionForce>(scene, efs, i); }, [&](int i, ExpressionForce& s, ExpressionForce& d) {
+        SceneExpressionForce r = ReadSceneRecord<SceneExpressionForce>(scene, efs, i);
+        expressionPrograms[i] = programs[i];
+
+        s.program = programs[i].get();
+        for (int j = 0; j < numExpressionParameters; j++) {
+            s.parameters[j] = r.parameters[j];
+        }
+
+        TransformEffect(d, s);
+        VectorSet(d.f, 0.0, 0.0, 0.0);
+        d.t = 0.0;
+    });
+
+    for (std::unordered_map<int, std::shared_ptr<ExpressionProgram> >::iterator it = oldPrograms.begin(); it != oldPrograms.end(); ++it) {
+        expressionForces.Retire(it->second);
+    }
+
+    // Kernels belong to the process that registered them, so their effects aren't part of a scene
+    kernelForces.RemoveAll();
+
+    return true;
+}
+
+int Falcon::SaveSceneData(void* data, int size) {
+    // Grids are saved only if ready, decided once here in case one finishes building while saving
+    std::vector<bool> readyGrids;
+    uint64_t dataSize = 0;
+    distanceFields.ForEachSource([&](int, DistanceField& s) {
+        bool ready = s.grid->ready.load(std::memory_order_acquire);
+        readyGrids.push_back(ready);
+        if (ready) dataSize += SceneDataSize(s.grid->distances.size() * sizeof(float));
+    });
+    pathConstraints.ForEachSource([&](int, PathConstraint& s) {
+        dataSize += SceneDataSize(s.path->points.size() * sizeof(float));
+    });
+
+    // The profile pool, with null for removed ids, then profiles only radial forces still use, and the record of each
+    std::vector<const RadialProfile*> profiles;
+    std::unordered_map<const RadialProfile*, uint32_t> profileRecords;
+    for (size_t i = 0; i < radialProfiles.size(); i++) {
+        profiles.push_back(radialProfiles[i].get());
+        if (radialProfiles[i]) profileRecords[radialProfiles[i].get()] = (uint32_t)i;
+    }
+    radialForces.ForEachSource([&](int, RadialForce& s) {
+        if (profileRecords.insert(std::make_pair(s.profile, (uint32_t)profiles.size())).second) profiles.push_back(s.profile);
+    });
+    for (size_t i = 0; i < profiles.size(); i++) {
+        if (profiles[i]) dataSize += SceneDataSize(profiles[i]->forces.size() * sizeof(float));
+    }
+
+    // Likewise wavetables, with null for the built in ones, which are known by their records
+    std::vector<const Wavetable*> tables(NumWaveforms, nullptr);
+    std::unordered_map<const Wavetable*, uint32_t> tableRecords;
+    for (size_t i = 0; i < wavetables.size(); i++) {
+        if (i >= NumWaveforms) tables.push_back(wavetables[i].get());
+        if (wavetables[i]) tableRecords[wavetables[i].get()] = (uint32_t)i;
+    }
+    vibrations.ForEachSource([&](int, Vibration& s) {
+        if (tableRecords.insert(std::make_pair(s.wavetable, (uint32_t)tables.size())).second) tables.push_back(s.wavetable);
+    });
+    for (size_t i = 0; i < tables.size(); i++) {
+        if (tables[i]) dataSize += SceneDataSize(wavetableSize * sizeof(float));
+    }
+
+    expressionForces.ForEachSource([&](int, ExpressionForce& s) {
+        dataSize += SceneDataSize(s.program->source.size());
+    });
+
+    // One section per type
+    uint64_t sceneSize = sizeof(SceneHeader) + NumSceneSectionTypes * sizeof(SceneSection) +
+                         (uint64_t)simpleForces.Count() * sizeof(SceneSimpleForce) +
+                         (uint64_t)viscosities.Count() * sizeof(SceneViscosity) +
+                         (uint64_t)surfaces.Count() * sizeof(SceneSurface) +
+                         (uint64_t)springs.Count() * sizeof(SceneSpring) +
+                         (uint64_t)intermolecularForces.Count() * sizeof(SceneSpring) +
+                         (uint64_t)randomForces.Count() * sizeof(SceneRandomForce) +
+                         (uint64_t)rigidBodies.Count() * sizeof(SceneRigidBody) +
+                         sizeof(SceneGravity) +
+                         (uint64_t)colliders.Count() * sizeof(SceneCollider) +
+                         (uint64_t)distanceFields.Count() * sizeof(SceneDistanceField) +
+                         (uint64_t)pathConstraints.Count() * sizeof(ScenePathConstraint) +
+                         (uint64_t)profiles.size() * sizeof(SceneRadialProfile) +
+                         (uint64_t)radialForces.Count() * sizeof(SceneRadialForce) +
+                         (uint64_t)tables.size() * sizeof(SceneWavetable) +
+                         (uint64_t)vibrations.Count() * sizeof(SceneVibration) +
+                         (uint64_t)expressionForces.Count() * sizeof(SceneExpressionForce) +
+                         (uint64_t)frames.size() * sizeof(SceneFrame) +
+                         dataSize;
+
+    if (sceneSize > INT_MAX) {
+        std::cout << "Scene too large to save" << std::endl;
+        return 0;
+    }
+
+    if (!data || (int)sceneSize > size) return (int)sceneSize;
+
+
+    unsigned char* scene = static_cast<unsigned char*>(data);
+
+    SceneHeader header;
+    header.magic = sceneMagic;
+    header.version = sceneVersion;
+    header.numSections = NumSceneSectionTypes;
+    header.reserved = 0;
+    memcpy(scene, &header, sizeof(SceneHeader));
+
+    SceneSection sections[NumSceneSectionTypes];
+    unsigned char* p = scene + sizeof(SceneHeader) + NumSceneSectionTypes * sizeof(SceneSection);
+
+    p = WriteSceneRecords<SceneSimpleForce>(scene, p, sections[SceneSimpleForces], SceneSimpleForces, simpleForces, [](int, const SimpleForce& s) {
+        SceneSimpleForce r = {};
+        for (int i = 0; i < 3; i++) {
+            r.f[i] = (float)s.f[i];
+        }
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneViscosity>(scene, p, sections[SceneViscosities], SceneViscosities, viscosities, [](int, const Viscosity& v) {
+        SceneViscosity r = {};
+        r.c = (float)v.c;
+        r.w = (float)v.w;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneSurface>(scene, p, sections[SceneSurfaces], SceneSurfaces, surfaces, [](int, const Surface& s) {
+        SceneSurface r = {};
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)s.p[i];
+            r.n[i] = (float)s.n[i];
+        }
+        r.k = (float)s.k;
+        r.c = (float)s.c;
+        r.frame = s.frame;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneSpring>(scene, p, sections[SceneSprings], SceneSprings, springs, [](int, const Spring& s) {
+        SceneSpring r = {};
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)s.p[i];
+        }
+        r.k = (float)s.k;
+        r.c = (float)s.c;
+        r.r = (float)s.r;
+        r.m = (float)s.m;
+        r.frame = s.frame;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneSpring>(scene, p, sections[SceneIntermolecularForces], SceneIntermolecularForces, intermolecularForces, [](int, const IntermolecularForce& imf) {
+        SceneSpring r = {};
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)imf.p[i];
+        }
+        r.k = (float)imf.k;
+        r.c = (float)imf.c;
+        r.r = (float)imf.r;
+        r.m = (float)imf.m;
+        r.frame = imf.frame;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneRandomForce>(scene, p, sections[SceneRandomForces], SceneRandomForces, randomForces, [](int, const RandomForce& rf) {
+        SceneRandomForce r = {};
+        r.minMag = (float)rf.minMag;
+        r.maxMag = (float)rf.maxMag;
+        r.minTime = (float)rf.minTime;
+        r.maxTime = (float)rf.maxTime;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneRigidBody>(scene, p, sections[SceneRigidBodies], SceneRigidBodies, rigidBodies, [this](int id, const RigidBody& rb) {
+        RigidBodyPose pose = GetRigidBodyPose(id);
+
+        SceneRigidBody r = {};
+        r.p[0] = pose.position.x;
+        r.p[1] = pose.position.y;
+        r.p[2] = pose.position.z;
+        r.q[0] = pose.rotation.x;
+        r.q[1] = pose.rotation.y;
+        r.q[2] = pose.rotation.z;
+        r.q[3] = pose.rotation.w;
+        r.mass = (float)rb.mass;
+        for (int i = 0; i < 3; i++) {
+            r.inertia[i] = (float)rb.inertia[i];
+            r.extents[i] = (float)rb.extents[i];
+        }
+        r.shape = rb.shape;
+        r.k = (float)rb.k;
+        r.c = (float)rb.c;
+        r.linearDrag = (float)rb.linearDrag;
+        r.angularDrag = (float)rb.angularDrag;
+        return r;
+    });
+
+    SceneSection& gs = sections[SceneRigidBodyGravity];
+    gs.type = SceneRigidBodyGravity;
+    gs.count = 1;
+    gs.recordSize = sizeof(SceneGravity);
+    gs.offset = (uint32_t)(p - scene);
+
+    SceneGravity g = {};
+    g.g[0] = rigidBodyGravitySource.x;
+    g.g[1] = rigidBodyGravitySource.y;
+    g.g[2] = rigidBodyGravitySource.z;
+    memcpy(p, &g, sizeof(SceneGravity));
+    p += sizeof(SceneGravity);
+
+    p = WriteSceneRecords<SceneCollider>(scene, p, sections[SceneColliders], SceneColliders, colliders, [](int, const Collider& c) {
+        SceneCollider r = {};
+        r.shape = c.shape;
+        for (int i = 0; i < 3; i++) {
+            r.extents[i] = (float)c.extents[i];
+            r.p[i] = (float)c.p[i];
+        }
+        for (int i = 0; i < 4; i++) {
+            r.q[i] = (float)c.q[i];
+        }
+        r.k = (float)c.k;
+        r.c = (float)c.c;
+        return r;
+    });
+
+    // The data section goes last, filled in as the records referring to it are written
+    unsigned char* sceneData = scene + sceneSize - dataSize;
+    unsigned char* dataEnd = sceneData;
+
+    int grid = 0;
+    p = WriteSceneRecords<SceneDistanceField>(scene, p, sections[SceneDistanceFields], SceneDistanceFields, distanceFields, [&](int, const DistanceField& s) {
+        SceneDistanceField r = {};
+        if (readyGrids[grid++]) {
+            for (int i = 0; i < 3; i++) {
+                r.dims[i] = s.grid->dims[i];
+                r.origin[i] = (float)s.grid->origin[i];
+            }
+            r.cellSize = (float)s.grid->cellSize;
+            r.samples = WriteSceneFloats(sceneData, dataEnd, s.grid->distances.data(), s.grid->distances.size());
+        }
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)s.p[i];
+        }
+        for (int i = 0; i < 4; i++) {
+            r.q[i] = (float)s.q[i];
+        }
+        r.k = (float)s.k;
+        r.c = (float)s.c;
+        return r;
+    });
+
+    p = WriteSceneRecords<ScenePathConstraint>(scene, p, sections[ScenePathConstraints], ScenePathConstraints, pathConstraints, [&](int, const PathConstraint& s) {
+        ScenePathConstraint r = {};
+        r.numPoints = (uint32_t)(s.path->points.size() / 3);
+        r.points = WriteSceneFloats(sceneData, dataEnd, s.path->points.data(), s.path->points.size());
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)s.p[i];
+        }
+        for (int i = 0; i < 4; i++) {
+            r.q[i] = (float)s.q[i];
+        }
+        r.k = (float)s.k;
+        r.c = (float)s.c;
+        r.r = (float)s.r;
+        r.along = (float)s.along;
+        return r;
+    });
+
+    SceneSection& rps = sections[SceneRadialProfiles];
+    rps.type = SceneRadialProfiles;
+    rps.count = (uint32_t)profiles.size();
+    rps.recordSize = sizeof(SceneRadialProfile);
+    rps.offset = (uint32_t)(p - scene);
+
+    for (size_t i = 0; i < profiles.size(); i++) {
+        SceneRadialProfile r = {};
+        if (profiles[i]) {
+            r.pooled = i < radialProfiles.size();
+            r.numSamples = (uint32_t)profiles[i]->forces.size();
+            r.forces = WriteSceneFloats(sceneData, dataEnd, profiles[i]->forces.data(), profiles[i]->forces.size());
+            r.maxDistance = (float)profiles[i]->maxDistance;
+            r.cubic = profiles[i]->cubic;
+        }
+        memcpy(p, &r, sizeof(SceneRadialProfile));
+        p += sizeof(SceneRadialProfile);
+    }
+
+    p = WriteSceneRecords<SceneRadialForce>(scene, p, sections[SceneRadialForces], SceneRadialForces, radialForces, [&](int, const RadialForce& s) {
+        SceneRadialForce r = {};
+        for (int i = 0; i < 3; i++) {
+            r.p[i] = (float)s.p[i];
+        }
+        r.profile = profileRecords[s.profile];
+        r.scale = (float)s.scale;
+        r.c = (float)s.c;
+        return r;
+    });
+
+    SceneSection& wts = sections[SceneWavetables];
+    wts.type = SceneWavetables;
+    wts.count = (uint32_t)tables.size();
+    wts.recordSize = sizeof(SceneWavetable);
+    wts.offset = (uint32_t)(p - scene);
+
+    for (size_t i = 0; i < tables.size(); i++) {
+        SceneWavetable r = {};
+        if (tables[i]) {
+            r.pooled = i < wavetables.size();
+            r.numSamples = wavetableSize;
+            r.samples = WriteSceneFloats(sceneData, dataEnd, tables[i]->samples, wavetableSize);
+        }
+        memcpy(p, &r, sizeof(SceneWavetable));
+        p += sizeof(SceneWavetable);
+    }
+
+    p = WriteSceneRecords<SceneVibration>(scene, p, sections[SceneVibrations], SceneVibrations, vibrations, [&](int, const Vibration& s) {
+        SceneVibration r = {};
+        r.wavetable = tableRecords[s.wavetable];
+        for (int i = 0; i < 3; i++) {
+            r.direction[i] = (float)s.direction[i];
+        }
+        r.amplitude = (float)s.amplitude;
+        r.frequency = (float)s.frequency;
+        r.attack = (float)s.attack;
+        r.decay = (float)s.decay;
+        r.sustain = (float)s.sustain;
+        r.release = (float)s.release;
+        return r;
+    });
+
+    p = WriteSceneRecords<SceneExpressionForce>(scene, p, sections[SceneExpressionForces], SceneExpressionForces, expressionForces, [&](int, const ExpressionForce& s) {
+        SceneExpressionForce r = {};
+        r.length = (uint32_t)s.program->source.size();
+        r.text = WriteSceneBytes(sceneData, dataEnd, s.program->source.data(), s.program->source.size());
+        for (int i = 0; i < numExpressionParameters; i++) {
+            r.parameters[i] = (float)s.parameters[i];
+        }
+        return r;
+    });
+
+    SceneSection& fs = sections[SceneFrames];
+    fs.type = SceneFrames;
+    fs.count = (uint32_t)frames.size();
+    fs.recordSize = sizeof(SceneFrame);
+    fs.offset = (uint32_t)(p - scene);
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        SceneFrame r = {};
+        r.used = frames[i].used;
+        r.parent = frames[i].used ? frames[i].parent : -1;
+        for (int j = 0; j < 16; j++) {
+            r.local[j] = (float)frames[i].local[j];
+        }
+        memcpy(p, &r, sizeof(SceneFrame));
+        p += sizeof(SceneFrame);
+    }
+
+    SceneSection& ds = sections[SceneData];
+    ds.type = SceneData;
+    ds.count = (uint32_t)dataSize;
+    ds.recordSize = 1;
+    ds.offset = (uint32_t)(sceneData - scene);
+
+    memcpy(scene + sizeof(SceneHeader), sections, sizeof(sections));
+
+    return (int)sceneSize;
+}
+
+bool Falcon::ReadRigidBodyPose(const RigidBody& rb, double p[3], double q[4]) {
+    const PublishedPose* published = rb.published;
+    if (!published) return false;
+
+    // Retry if the servo thread was writing
+    int generation;
+    for (;;) {
+        unsigned int sequence = published->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        generation = published->generation.load(std::memory_order_relaxed);
+        for (int i = 0; i < 3; i++) {
+            p[i] = published->p[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < 4; i++) {
+            q[i] = published->q[i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (published->sequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    return generation == rb.generation;
+}
+
+
+void Falcon::GraphicsToEffectPoint(double result[3], const Vector3& p) {
+    VectorSet(result, p.x, p.y, p.z);
+    VectorScale(result, result, 1.0 / workspaceScale);
+}
+
+void Falcon::DeviceToGraphicsForce(double result[3], const double f[3]) {
+    // The servo loop maps effect forces to the device with the transpose of haptics2graphics divided by the mean
+    // scale, so the inverse is the transpose of graphics2haptics times the mean scale
+    MatrixTransposeDirectionMultiply(result, graphics2haptics, f);
+    VectorScale(result, result, workspaceScale);
+}
+
+void Falcon::TransformEffect(SimpleForce& device, const SimpleForce& source) {
+    // Effect space forces are graphics forces
+    VectorCopy(device.f, source.f);
+}
+
+void Falcon::TransformEffect(Viscosity& device, const Viscosity& source) {
+    device.c = source.c * workspaceScale;
+    device.w = source.w;
+}
+
+void Falcon::TransformEffect(Surface& device, const Surface& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    GraphicsToEffectPoint(device.p, p);
+    VectorNormalize(device.n, source.n);
+    device.frame = source.frame;
+}
+
+void Falcon::TransformEffect(Spring& device, const Spring& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    device.r = source.r / workspaceScale;
+    device.m = source.m > 0.0 ? source.m / workspaceScale : source.m;
+    GraphicsToEffectPoint(device.p, p);
+    device.frame = source.frame;
+}
+
+void Falcon::TransformEffect(IntermolecularForce& device, const IntermolecularForce& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    device.r = source.r / workspaceScale;
+    device.m = source.m / workspaceScale;
+    GraphicsToEffectPoint(device.p, p);
+    device.frame = source.frame;
+    VectorSet(device.z, 0.0, 0.0, 1.0);
+}
+
+void Falcon::TransformEffect(RandomForce& device, const RandomForce& source) {
+    // Random directions are isotropic and magnitudes are in force units, so nothing to scale
+    device.minMag = source.minMag;
+    device.maxMag = source.maxMag;
+    device.minTime = source.minTime;
+    device.maxTime = source.maxTime;
+}
+
+
+void Falcon::TransformEffect(RigidBody& device, const RigidBody& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    // Mass scales like spring constants, and moments of inertia like mass times length squared
+    device.mass = source.mass * workspaceScale;
+    VectorScale(device.inertia, source.inertia, 1.0 / workspaceScale);
+    device.shape = source.shape;
+    VectorScale(device.extents, source.extents, 1.0 / workspaceScale);
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    device.linearDrag = source.linearDrag * workspaceScale;
+    device.angularDrag = source.angularDrag / workspaceScale;
+    device.grab = source.grab;
+
+    GraphicsToEffectPoint(device.p, p);
+    for (int i = 0; i < 4; i++) {
+        device.q[i] = source.q[i];
+    }
+    device.generation = source.generation;
+    device.published = source.published;
+
+    VectorSet(device.v, 0.0, 0.0, 0.0);
+    VectorSet(device.w, 0.0, 0.0, 0.0);
+    device.attached = false;
+    VectorSet(device.grabOffset, 0.0, 0.0, 0.0);
+}
+
+void Falcon::TransformEffect(DistanceField& device, const DistanceField& source) {
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    VectorCopy(device.p, source.p);
+    for (int i = 0; i < 4; i++) {
+        device.q[i] = source.q[i];
+    }
+    device.grid = source.grid;
+
+    // Effect space to graphics space, then into the grid's local space
+    double placement[16];
+    QuaternionToMatrix(placement, source.q);
+    placement[12] = source.p[0];
+    placement[13] = source.p[1];
+    placement[14] = source.p[2];
+
+    double inverse[16], scale[16];
+    MatrixInvertAffine(inverse, placement);
+    MatrixScale(scale, workspaceScale);
+    MatrixMultiply(device.toLocal, inverse, scale);
+}
+
+void Falcon::TransformEffect(PathConstraint& device, const PathConstraint& source) {
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+    device.r = source.r / workspaceScale;
+    device.along = source.along;
+    VectorCopy(device.p, source.p);
+    for (int i = 0; i < 4; i++) {
+        device.q[i] = source.q[i];
+    }
+    device.path = source.path;
+
+    // Effect space to graphics space, then into the path's local space, and back
+    double placement[16];
+    QuaternionToMatrix(placement, source.q);
+    placement[12] = source.p[0];
+    placement[13] = source.p[1];
+    placement[14] = source.p[2];
+
+    double scale[16];
+    MatrixScale(scale, 1.0 / workspaceScale);
+    MatrixMultiply(device.toEffect, scale, placement);
+    MatrixInvertAffine(device.toLocal, device.toEffect);
+}
+
+void Falcon::TransformEffect(RadialForce& device, const RadialForce& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    device.scale = source.scale;
+    device.c = source.c * workspaceScale;
+    GraphicsToEffectPoint(device.p, p);
+    device.profile = source.profile;
+
+    // Effect distance to graphics distance, then to samples
+    device.toSample = workspaceScale * (source.profile->forces.size() - 1) / source.profile->maxDistance;
+}
+
+void Falcon::TransformEffect(Vibration& device, const Vibration& source) {
+    device.wavetable = source.wavetable;
+    VectorCopy(device.direction, source.direction);
+    if (VectorMagnitude(device.direction) > 0.0) {
+        VectorNormalize(device.direction, device.direction);
+    }
+    device.amplitude = source.amplitude;
+    device.frequency = source.frequency;
+    device.attack = source.attack;
+    device.decay = source.decay;
+    device.sustain = source.sustain;
+    device.release = source.release;
+    device.triggerGeneration = source.triggerGeneration;
+    device.releaseGeneration = source.releaseGeneration;
+    device.duration = source.duration;
+}
+
+void Falcon::TransformEffect(ExpressionForce& device, const ExpressionForce& source) {
+    device.program = source.program;
+    for (int i = 0; i < numExpressionParameters; i++) {
+        device.parameters[i] = source.parameters[i];
+    }
+    MatrixScale(device.toGraphics, workspaceScale);
+
+    // Graphics forces mapped by the transpose of the scale are effect space forces times the scale
+    device.forceScale = 1.0 / workspaceScale;
+}
+
+void Falcon::TransformEffect(Collider& device, const Collider& source) {
+    Vector3 p = { (float)source.p[0], (float)source.p[1], (float)source.p[2] };
+
+    device.shape = source.shape;
+    VectorScale(device.extents, source.extents, 1.0 / workspaceScale);
+    device.k = source.k * workspaceScale;
+    device.c = source.c * workspaceScale;
+
+    GraphicsToEffectPoint(device.p, p);
+    for (int i = 0; i < 4; i++) {
+        device.q[i] = source.q[i];
+    }
+    QuaternionToMatrix(device.rotation, device.q);
+
+    // Bounds of the rotated box around the shape
+    const double* e = device.extents;
+    double box[3];
+    if (device.shape == ColliderSphere) {
+        VectorSet(box, e[0], e[0], e[0]);
+    }
+    else if (device.shape == ColliderCapsule) {
+        VectorSet(box, e[0], e[1] + e[0], e[0]);
+    }
+    else {
+        VectorCopy(box, e);
+    }
+
+    const double* m = device.rotation;
+    for (int i = 0; i < 3; i++) {
+        double h = fabs(m[i]) * box[0] + fabs(m[4 + i]) * box[1] + fabs(m[8 + i]) * box[2];
+        device.lo[i] = device.p[i] - h;
+        device.hi[i] = device.p[i] + h;
+    }
+
+    // Set when the collider is listed in the broadphase grid
+    device.numBuckets = 0;
+    device.groupBit = 0;
+}
+
+void Falcon::TransformEffect(KernelForce& device, const KernelForce& source) {
+    device.kernel = source.kernel;
+    for (int i = 0; i < FALCON_KERNEL_MAX_PARAMETERS; i++) {
+        device.parameters[i] = source.parameters[i];
+    }
+    MatrixScale(device.toGraphics, workspaceScale);
+    device.forceScale = 1.0 / workspaceScale;
+}
+
+
+void Falcon::ComputeForce() {
+    // Apply effect changes from the application thread
+    simpleForces.Synchronize();
+    viscosities.Synchronize();
+    surfaces.Synchronize();
+    springs.Synchronize();
+    intermolecularForces.Synchronize();
+    randomForces.Synchronize();
+    rigidBodies.Synchronize();
+    distanceFields.Synchronize();
+    pathConstraints.Synchronize();
+    radialForces.Synchronize();
+    vibrations.Synchronize();
+    expressionForces.Synchronize();
+    kernelForces.Synchronize();
+    colliders.Synchronize();
+
+    // Take the latest frame transforms
+    framesMoved = frameSets.Update();
+    tickFrames = &frameSets.Front();
+    numTickFrames = (int)tickFrames->transforms.size() / 32;
+
+    // Take the latest probe points
+    probeMoved = probePointSets.Update();
+    tickProbe = &probePointSets.Front();
+
+    // Take the latest workspace map. Effects swapped in with it are transformed to match.
+    workspaceMaps.Update();
+    tickMap = &workspaceMaps.Front();
+
+    // Use the same groups for the whole tick
+    tickGroupMask = groupMask.load(std::memory_order_relaxed);
+
+    // Get current state
+    SynchronizeState();
+
+    // Set position to use for force calculations
+    // If using force feedback, use device position
+    // Else use proxy position
+    bool feedback = useForceFeedback.load(std::memory_order_relaxed);
+
+    double devicePos[3];
+    if (feedback) {
+        VectorCopy(devicePos, pos);
+    }
+    else {
+        for (int i = 0; i < 3; i++) {
+            devicePos[i] = proxyPos[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Start from the current position on the first tick, with a nominal time step
+    bool firstTick = firstForceTime.load(std::memory_order_relaxed) == 0;
+    if (firstTick) {
+        VectorCopy(oldPos, devicePos);
+        oldTime = ServoClock::Now() - 0.001;
+    }
+
+    // Get time delta
+    double time = ServoClock::Now();
+    double dt = time - oldTime;
+
+    // Adjusting this affects "kicking" when changing viscosity
+ //   if (dt <= 1e-4) return;
+
+    // Compute current velocity
+    double deviceVelocity[3];
+    VectorSubtract(deviceVelocity, devicePos, oldPos);
+    VectorScale(deviceVelocity, deviceVelocity, 1.0 / dt);
+
+    // Probe position, last position and velocity in effect space
+    const double* toEffect = tickMap->toEffect;
+
+    double p[3], old[3], velocity[3];
+    MatrixVectorMultiply(p, toEffect, devicePos);
+    MatrixVectorMultiply(old, toEffect, oldPos);
+    MatrixDirectionMultiply(velocity, toEffect, deviceVelocity);
+
+    // Hand the probe position to the force field workers and take their latest model
+    forceFieldModel = nullptr;
+    if (useForceField.load(std::memory_order_relaxed)) {
+        int64_t now = ServoClock::NowNanoseconds();
+        forceField.SetProbePosition(p, now);
+
+        forceFieldModel = &forceField.GetModel();
+        forceField.SetModelAge(forceFieldModel->valid ? now - forceFieldModel->time : 0);
+    }
+
+    StartTelemetry();
+    StartKernelStats();
+
+    // Reuse cached forces of effects that haven't changed while the probe is still
+    cacheHits = 0;
+    cacheMisses = 0;
+    TransformProbeToFrames(p, velocity);
+    PlaceProbePoints(p);
+
+    UpdateForceCache(surfaces, surfaceCache, p, velocity, [&](Surface& s) {
+        ProbeSurface(s, p, velocity);
+    });
+    RecordTelemetry(SurfaceEffect, surfaceCache.valid ? cacheMisses : 0, nullptr);
+
+    int misses = cacheMisses;
+    UpdateForceCache(springs, springCache, p, velocity, [&](Spring& s) {
+        ProbeSpring(s, p, velocity);
+    });
+    RecordTelemetry(SpringEffect, springCache.valid ? cacheMisses - misses : 0, nullptr);
+
+    misses = cacheMisses;
+    UpdateForceCache(intermolecularForces, intermolecularForceCache, p, velocity, [&](IntermolecularForce& imf) {
+        ProbeIntermolecularForce(imf, p, velocity);
+    });
+    RecordTelemetry(IntermolecularForceEffect, intermolecularForceCache.valid ? cacheMisses - misses : 0, nullptr);
+
+    totalCacheHits += cacheHits;
+    totalCacheMisses += cacheMisses;
+    publishedCacheHits.store(cacheHits, std::memory_order_relaxed);
+    publishedCacheMisses.store(cacheMisses, std::memory_order_relaxed);
+    publishedTotalCacheHits.store(totalCacheHits, std::memory_order_relaxed);
+    publishedTotalCacheMisses.store(totalCacheMisses, std::memory_order_relaxed);
+
+    // Evaluate effects once at the current position
+    int n = substeps.load(std::memory_order_relaxed);
+    double subDt = dt / n;
+
+    double f[3], t[3];
+
+    numHeldEffects = 0;
+    numFarEffects = 0;
+    int64_t computeStart = ServoClock::NowNanoseconds();
+
+    ComputeEffectForces(f, t, p, velocity, time, dt);
+
+    // Step effects that integrate over time in sub-steps, with the probe moving across the tick, and send the force
+    // at the end of the last one
+    double sf[3];
+    for (int i = 1; i <= n; i++) {
+        double sp[3];
+        VectorLerp(sp, old, p, (double)i / n);
+
+        StepEffectForces(sf, sp, velocity, subDt, i == n);
+    }
+    VectorAdd(f, f, sf);
+
+    // Publish rigid body poses
+    rigidBodies.ForEach(tickGroupMask, [&](RigidBody& rb, int) { PublishRigidBodyPose(rb); });
+    RecordTelemetry(RigidBodyEffect, 0, nullptr);
+
+    PublishTelemetry();
+    PublishKernelStats();
+
+    // Degrade gracefully if over budget
+    UpdateLevelOfDetail((double)(ServoClock::NowNanoseconds() - computeStart), n);
+
+    // Map the force to the device with the transpose of the map to effect space, so it does the same work
+    MatrixTransposeDirectionMultiply(f, toEffect, f);
+
+    // Start the passivity observer over when the application asks
+    int generation = passivityResetGeneration.load(std::memory_order_relaxed);
+    if (generation != passivityGeneration) {
+        passivityGeneration = generation;
+        ResetPassivityObserver();
+    }
+
+    // Keep the device passive
+    if (feedback && usePassivityControl.load(std::memory_order_relaxed)) {
+        double displacement[3];
+        VectorSubtract(displacement, devicePos, oldPos);
+        ApplyPassivityControl(f, displacement, deviceVelocity, dt);
+    }
+
+    VectorCopy(force, f);
+    VectorCopy(torque, t);
+    PublishState();
+
+    // Set force
+    if (!feedback) {
+        VectorSet(f, 0.0, 0.0, 0.0);
+    }
+
+    device.SetForce(f, dt);
+    VectorCopy(sentForce, f);
+
+    // Cold start ends with the first force sent
+    if (firstTick) {
+        firstForceTime.store(ServoClock::NowNanoseconds(), std::memory_order_release);
+    }
+
+        
+    // Save state
+    VectorCopy(oldPos, devicePos);
+    oldTime = time;
+}
+
+
+template <class T, class F>
+void Falcon::UpdateForceCache(ForceContainer<T>& effects, ForceCache& cache, const double p[3], const double velocity[3], F compute) {
+    double dp[3];
+    VectorSubtract(dp, p, cache.pos);
+
+    double dv[3];
+    VectorSubtract(dv, velocity, cache.vel);
+
+    double e = cachePositionEpsilon.load(std::memory_order_relaxed);
+    double ev = cacheVelocityEpsilon.load(std::memory_order_relaxed);
+
+    // Valid if the probe hasn't moved, no effects were removed or moved, no frames or probe points moved, and the
+    // same groups are enabled
+    cache.valid = useForceCache.load(std::memory_order_relaxed) && cache.filled && !effects.AllDirty() &&
+                  !framesMoved && !probeMoved && cache.groupMask == tickGroupMask &&
+                  VectorMagnitudeSquared(dp) <= e * e && VectorMagnitudeSquared(dv) <= ev * ev;
+
+    if (cache.valid) {
+        // Re-evaluate effects added or updated since, replacing their old contribution in the sum. Effects in disabled
+        // groups aren't in the sum.
+        for (int i = 0; i < effects.NumDirty(); i++) {
+            if (!(tickGroupMask & (1u << effects.DirtyGroup(i)))) continue;
+
+            T* effect = effects.Dirty(i);
+
+            double old[3], oldTorque[3];
+            VectorCopy(old, effect->f);
+            VectorCopy(oldTorque, effect->t);
+            compute(*effect);
+
+            VectorSubtract(old, effect->f, old);
+            VectorAdd(cache.sum, cache.sum, old);
+
+            VectorSubtract(oldTorque, effect->t, oldTorque);
+            VectorAdd(cache.torque, cache.torque, oldTorque);
+        }
+
+        cacheHits += effects.Size(tickGroupMask) - effects.NumDirty();
+        cacheMisses += effects.NumDirty();
+    }
+    else {
+        cacheMisses += effects.Size(tickGroupMask);
+    }
+
+    effects.ClearDirty();
+}
+
+void Falcon::FillForceCache(ForceCache& cache, const double sum[3], const double torque[3], const double p[3], const double velocity[3]) {
+    // Held forces are stale, so only cache when evaluating everything
+    cache.filled = lodMask == 0;
+    cache.groupMask = tickGroupMask;
+    VectorCopy(cache.sum, sum);
+    VectorCopy(cache.torque, torque);
+    VectorCopy(cache.pos, p);
+    VectorCopy(cache.vel, velocity);
+}
+
+void Falcon::TransformProbeToFrames(const double p[3], const double velocity[3]) {
+    for (int i = 0; i < numTickFrames; i++) {
+        const double* toLocal = &tickFrames->transforms[i * 32];
+        MatrixVectorMultiply(framePos[i], toLocal, p);
+        MatrixDirectionMultiply(frameVel[i], toLocal, velocity);
+    }
+}
+
+void Falcon::FrameProbe(int frame, const double*& p, const double*& velocity) {
+    if (frame < 0 || frame >= numTickFrames) return;
+
+    p = framePos[frame];
+    velocity = frameVel[frame];
+}
+
+void Falcon::FrameForce(int frame, double f[3]) {
+    if (frame < 0 || frame >= numTickFrames) return;
+
+    // Forces along the local offset to an anchor stay along the offset, matching the effect with its anchor moved
+    // out of the frame
+    MatrixDirectionMultiply(f, &tickFrames->transforms[frame * 32 + 16], f);
+}
+
+void Falcon::PlaceProbePoints(const double p[3]) {
+    const ProbePoints& probe = *tickProbe;
+    for (int i = 0; i < probe.n; i++) {
+        probeX[i] = p[0] + probe.x[i];
+        probeY[i] = p[1] + probe.y[i];
+        probeZ[i] = p[2] + probe.z[i];
+    }
+
+    // Moved into frames as effects in them are evaluated
+    probeFrame = -1;
+}
+
+void Falcon::FrameProbePoints(int frame, const double*& x, const double*& y, const double*& z) {
+    if (frame < 0 || frame >= numTickFrames) {
+        x = probeX;
+        y = probeY;
+        z = probeZ;
+        return;
+    }
+
+    // Effects in a frame are usually evaluated together, so keep the points of the last frame
+    if (frame != probeFrame) {
+        const ProbePoints& probe = *tickProbe;
+        const double* m = &tickFrames->transforms[frame * 32];
+        const double* origin = framePos[frame];
+
+        for (int i = 0; i < probe.n; i++) {
+            probeLocalX[i] = origin[0] + m[0] * probe.x[i] + m[4] * probe.y[i] + m[8] * probe.z[i];
+            probeLocalY[i] = origin[1] + m[1] * probe.x[i] + m[5] * probe.y[i] + m[9] * probe.z[i];
+            probeLocalZ[i] = origin[2] + m[2] * probe.x[i] + m[6] * probe.y[i] + m[10] * probe.z[i];
+        }
+
+        probeFrame = frame;
+    }
+
+    x = probeLocalX;
+    y = probeLocalY;
+    z = probeLocalZ;
+}
+
+void Falcon::SumProbeForces(double force[3], double torque[3], double* fx, double* fy, double* fz, int frame) {
+    const ProbePoints& probe = *tickProbe;
+    int n = probe.n;
+
+    if (frame >= 0 && frame < numTickFrames) {
+        const double* m = &tickFrames->transforms[frame * 32 + 16];
+
+        for (int i = 0; i < n; i++) {
+            double x = fx[i], y = fy[i], z = fz[i];
+            fx[i] = m[0] * x + m[4] * y + m[8] * z;
+            fy[i] = m[1] * x + m[5] * y + m[9] * z;
+            fz[i] = m[2] * x + m[6] * y + m[10] * z;
+        }
+    }
+
+    double f[3] = { 0.0, 0.0, 0.0 };
+    double t[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < n; i++) {
+        f[0] += fx[i];
+        f[1] += fy[i];
+        f[2] += fz[i];
+
+        t[0] += probe.y[i] * fz[i] - probe.z[i] * fy[i];
+        t[1] += probe.z[i] * fx[i] - probe.x[i] * fz[i];
+        t[2] += probe.x[i] * fy[i] - probe.y[i] * fx[i];
+    }
+
+    VectorCopy(force, f);
+    VectorCopy(torque, t);
+}
+
+void Falcon::ProbeSurface(Surface& s, const double p[3], const double velocity[3]) {
+    const double* fp = p;
+    const double* fv = velocity;
+    FrameProbe(s.frame, fp, fv);
+
+    int n = tickProbe->n;
+    if (n == 0) {
+        ComputeSurfaceForce(s.f, s, fp, fv);
+        FrameForce(s.frame, s.f);
+        VectorSet(s.t, 0.0, 0.0, 0.0);
+        return;
+    }
+
+    VectorSet(s.f, 0.0, 0.0, 0.0);
+    VectorSet(s.t, 0.0, 0.0, 0.0);
+
+    // No point touches a surface further above the probe than its extent, which is only known outside frames
+    if (fp == p && PointPlaneDistance(p, s.p, s.n) > tickProbe->extent) return;
+
+    const double* x;
+    const double* y;
+    const double* z;
+    FrameProbePoints(s.frame, x, y, z);
+    const double* r = tickProbe->radius;
+
+    // Spring force along the normal and damping at each point below the surface, or sphere touching it, with the
+    // effect's parameters in locals and constants selected rather than forces so the loop vectorizes
+    const double nx = s.n[0], ny = s.n[1], nz = s.n[2];
+    const double offset = VectorDotProduct(s.p, s.n);
+    const double k = s.k, c = s.c;
+    const double vx = fv[0], vy = fv[1], vz = fv[2];
+
+    double fx[maxProbePoints], fy[maxProbePoints], fz[maxProbePoints];
+    for (int i = 0; i < n; i++) {
+        double d = x[i] * nx + y[i] * ny + z[i] * nz - offset - r[i];
+        double m = std::max(-d, 0.0) * k;
+        double damping = d <= 0.0 ? c : 0.0;
+
+        fx[i] = m * nx - damping * vx;
+        fy[i] = m * ny - damping * vy;
+        fz[i] = m * nz - damping * vz;
+    }
+
+    SumProbeForces(s.f, s.t, fx, fy, fz, s.frame);
+}
+
+void Falcon::ProbeSpring(Spring& s, const double p[3], const double velocity[3]) {
+    const double* fp = p;
+    const double* fv = velocity;
+    FrameProbe(s.frame, fp, fv);
+
+    int n = tickProbe->n;
+    if (n == 0) {
+        ComputeSpringForce(s.f, s, fp, fv);
+        FrameForce(s.frame, s.f);
+        VectorSet(s.t, 0.0, 0.0, 0.0);
+        return;
+    }
+
+    VectorSet(s.f, 0.0, 0.0, 0.0);
+    VectorSet(s.t, 0.0, 0.0, 0.0);
+
+    // Every point is past the max length of a spring further from the probe than the max length and its extent
+    if (fp == p && s.m > 0.0) {
+        double d[3];
+        VectorSubtract(d, p, s.p);
+        double reach = s.m + tickProbe->extent;
+        if (VectorMagnitudeSquared(d) > reach * reach) return;
+    }
+
+    const double* x;
+    const double* y;
+    const double* z;
+    FrameProbePoints(s.frame, x, y, z);
+
+    const double ax = s.p[0], ay = s.p[1], az = s.p[2];
+    const double k = s.k, rest = s.r;
+    const double maxLength = s.m > 0.0 ? s.m : HUGE_VAL;
+    const double c = s.c;
+    const double vx = fv[0], vy = fv[1], vz = fv[2];
+
+    // Spring forces, then damping at the points that aren't broken off, in separate passes as the compiler only
+    // vectorizes them apart
+    double fx[maxProbePoints], fy[maxProbePoints], fz[maxProbePoints];
+    double on[maxProbePoints];
+    for (int i = 0; i < n; i++) {
+        double dx = x[i] - ax;
+        double dy = y[i] - ay;
+        double dz = z[i] - az;
+        double d = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+        // Broken past the max length, as for a single point
+        on[i] = d <= maxLength ? 1.0 : 0.0;
+        double m = on[i] * (rest - d) * k / std::max(d, 1e-12);
+
+        fx[i] = m * dx;
+        fy[i] = m * dy;
+        fz[i] = m * dz;
+    }
+
+    if (c != 0.0) {
+        for (int i = 0; i < n; i++) {
+            fx[i] -= on[i] * c * vx;
+            fy[i] -= on[i] * c * vy;
+            fz[i] -= on[i] * c * vz;
+        }
+    }
+
+    SumProbeForces(s.f, s.t, fx, fy, fz, s.frame);
+}
+
+void Falcon::ProbeIntermolecularForce(IntermolecularForce& imf, const double p[3], const double velocity[3]) {
+    const double* fp = p;
+    const double* fv = velocity;
+    FrameProbe(imf.frame, fp, fv);
+
+    int n = tickProbe->n;
+    if (n == 0) {
+        ComputeIntermolecularForce(imf.f, imf, fp, fv);
+        FrameForce(imf.frame, imf.f);
+        VectorSet(imf.t, 0.0, 0.0, 0.0);
+        return;
+    }
+
+    const double* x;
+    const double* y;
+    const double* z;
+    FrameProbePoints(imf.frame, x, y, z);
+
+    // One point at a time, as the force curve branches
+    double fx[maxProbePoints], fy[maxProbePoints], fz[maxProbePoints];
+    for (int i = 0; i < n; i++) {
+        double q[3] = { x[i], y[i], z[i] };
+        double f[3];
+        ComputeIntermolecularForce(f, imf, q, fv);
+
+        fx[i] = f[0];
+        fy[i] = f[1];
+        fz[i] = f[2];
+    }
+
+    SumProbeForces(imf.f, imf.t, fx, fy, fz, imf.frame);
+}
+
+bool Falcon::HoldEffect(bool& near, const double a[3], const double p[3], int index) {
+    if (!near) {
+        numFarEffects++;
+
+        // Far effects are evaluated round-robin, every 2^level ticks
+        if ((index + lodTick) & lodMask) {
+            numHeldEffects++;
+            return true;
+        }
+    }
+
+    // Evaluating, so update whether the effect is near the probe, or near any probe point
+    double r = lodRadius.load(std::memory_order_relaxed) + tickProbe->extent;
+    double d[3];
+    VectorSubtract(d, p, a);
+    near = VectorMagnitudeSquared(d) <= r * r;
+
+    return false;
+}
+
+void Falcon::UpdateLevelOfDetail(double cost, int n) {
+    // Estimate the full cost of this tick from the counts of enabled effects, with rigid bodies and vibrations
+    // stepped n times
+    uint32_t mask = tickGroupMask;
+    int numSprings = springs.Size(mask);
+    int numIntermolecularForces = intermolecularForces.Size(mask);
+
+    double estimate = simpleForces.Size(mask) * simpleForceCost +
+                      viscosities.Size(mask) * viscosityCost +
+                      surfaces.Size(mask) * surfaceCost +
+                      numSprings * springCost +
+                      numIntermolecularForces * intermolecularForceCost +
+                      randomForces.Size(mask) * randomForceCost +
+                      distanceFields.Size(mask) * distanceFieldCost +
+                      pathConstraints.Size(mask) * pathConstraintCost +
+                      radialForces.Size(mask) * radialForceCost +
+                      expressionForces.Size(mask) * expressionForceCost +
+                      kernelForces.Size(mask) * kernelForceCost +
+                      colliders.Size(mask) * colliderCost +
+                      (rigidBodies.Size(mask) * rigidBodyCost + vibrations.Size(mask) * vibrationCost) * n;
+
+    // Far effects only, assuming they are split like the total
+    int numAnchored = numSprings + numIntermolecularForces;
+    double anchoredCost = numSprings * springCost + numIntermolecularForces * intermolecularForceCost;
+    farCost = numAnchored > 0 ? anchoredCost * numFarEffects / numAnchored : 0.0;
+    fullRateCost = estimate - farCost;
+
+    // Calibrate the estimate against the measured cost, smoothed over roughly 100 ticks.
+    // The estimate for this tick only counts effects actually evaluated.
+    double evaluated = fullRateCost + farCost / (lodMask + 1);
+    if (evaluated > 0.0) {
+        costCalibration += 0.01 * (cost / evaluated - costCalibration);
+    }
+    measuredCost += 0.1 * (cost - measuredCost);
+
+    if (useComputeBudget.load(std::memory_order_relaxed)) {
+        double budget = computeBudget.load(std::memory_order_relaxed);
+
+        // Change level at most every 32 ticks, raising it on the measured cost and lowering it only when the
+        // estimated cost at the lower level fits comfortably
+        if (lodCooldown > 0) {
+            lodCooldown--;
+        }
+        else if (measuredCost > 0.9 * budget && lodLevel < 4 && numFarEffects > 0) {
+            lodLevel++;
+            lodCooldown = 32;
+        }
+        else if (lodLevel > 0 && (fullRateCost + farCost / (1 << (lodLevel - 1))) * costCalibration < 0.6 * budget) {
+            lodLevel--;
+            lodCooldown = 32;
+        }
+    }
+    else {
+        lodLevel = 0;
+    }
+
+    lodMask = (1u << lodLevel) - 1;
+    lodTick++;
+
+    // Publish statistics
+    publishedLodLevel.store(lodLevel, std::memory_order_relaxed);
+    publishedHeldEffects.store(numHeldEffects, std::memory_order_relaxed);
+    publishedFarEffects.store(numFarEffects, std::memory_order_relaxed);
+    publishedMeasuredCost.store(measuredCost, std::memory_order_relaxed);
+    publishedEstimatedCost.store((fullRateCost + farCost / (lodMask + 1)) * costCalibration, std::memory_order_relaxed);
+}
+
+
+void Falcon::ApplyPassivityControl(double f[3], const double displacement[3], const double velocity[3], double dt) {
+    // Energy absorbed by the environment over the last tick. The device held the force sent at its start the whole
+    // time, so this is exact for a zero-order hold, where the force about to be sent would make a sampled spring look
+    // dissipative. The force acts on the user, so the environment absorbs energy when the force opposes the motion.
+    passivityEnergy -= VectorDotProduct(sentForce, displacement);
+
+    // Passive as long as the environment has absorbed at least as much energy as it has returned
+    double dissipated = 0.0;
+    double damping = 0.0;
+
+    double v2 = VectorMagnitudeSquared(velocity);
+    if (passivityEnergy < 0.0 && v2 > 1e-12 && dt > 0.0) {
+        // Damping needed to dissipate the excess over the next tick if the velocity holds, limited for stability
+        damping = -passivityEnergy / (dt * v2);
+
+        double maxDamping = passivityMaxDamping.load(std::memory_order_relaxed);
+        if (damping > maxDamping) damping = maxDamping;
+
+        double fd[3];
+        VectorScale(fd, velocity, -damping);
+        VectorAdd(f, f, fd);
+
+        // Observed next tick, through the force sent
+        dissipated = damping * v2 * dt;
+        passivityTotalDissipated += dissipated;
+        passivityActiveTicks++;
+
+        if (damping > passivityMaxDampingApplied) passivityMaxDampingApplied = damping;
+    }
+
+    // Publish statistics
+    publishedPassivity[0].store(passivityEnergy, std::memory_order_relaxed);
+    publishedPassivity[1].store(dissipated, std::memory_order_relaxed);
+    publishedPassivity[2].store(passivityTotalDissipated, std::memory_order_relaxed);
+    publishedPassivity[3].store(damping, std::memory_order_relaxed);
+    publishedPassivity[4].store(passivityMaxDampingApplied, std::memory_order_relaxed);
+    publishedPassivityActiveTicks.store(passivityActiveTicks, std::memory_order_relaxed);
+}
+
+void Falcon::ResetPassivityObserver() {
+    VectorSet(sentForce, 0.0, 0.0, 0.0);
+    passivityEnergy = 0.0;
+    passivityTotalDissipated = 0.0;
+    passivityMaxDampingApplied = 0.0;
+    passivityActiveTicks = 0;
+
+    for (int i = 0; i < 5; i++) {
+        publishedPassivity[i].store(0.0, std::memory_order_relaxed);
+    }
+    publishedPassivityActiveTicks.store(0, std::memory_order_relaxed);
+}
+
+
+void Falcon::ComputeEffectForces(double force[3], double torque[3], const double p[3], const double velocity[3], double time, double dt) {
+    // Initialize force, and torque from a multi-point probe
+    double f[3], t[3];
+    VectorSet(f, 0.0, 0.0, 0.0);
+    VectorSet(t, 0.0, 0.0, 0.0);
+    
+    // Effects in disabled groups are skipped
+    uint32_t mask = tickGroupMask;
+
+    // Each type is summed on its own, for telemetry
+    double sum[3], torqueSum[3];
+
+    // Probe in each frame, for effects in frames, and probe points
+    TransformProbeToFrames(p, velocity);
+    PlaceProbePoints(p);
+
+    // Add simple forces
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    simpleForces.ForEach(mask, [&](SimpleForce& sf, int) {
+        VectorAdd(sum, sum, sf.f);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(SimpleForceEffect, simpleForces.Size(mask), sum);
+
+    // Add viscous forces
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    viscosities.ForEach(mask, [&](Viscosity& v, int) {
+        double vf[3];
+        ComputeViscousForce(vf, v, velocity);
+        VectorAdd(sum, sum, vf);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(ViscosityEffect, viscosities.Size(mask), sum);
+
+    // Add surface forces, from the cache if valid
+    if (surfaceCache.valid) {
+        VectorCopy(sum, surfaceCache.sum);
+        VectorCopy(torqueSum, surfaceCache.torque);
+        RecordTelemetry(SurfaceEffect, 0, sum);
+    }
+    else {
+        VectorSet(sum, 0.0, 0.0, 0.0);
+        VectorSet(torqueSum, 0.0, 0.0, 0.0);
+
+        surfaces.ForEach(mask, [&](Surface& s, int) {
+            ProbeSurface(s, p, velocity);
+            VectorAdd(sum, sum, s.f);
+            VectorAdd(torqueSum, torqueSum, s.t);
+        });
+
+        FillForceCache(surfaceCache, sum, torqueSum, p, velocity);
+        RecordTelemetry(SurfaceEffect, surfaces.Size(mask), sum);
+    }
+    VectorAdd(f, f, sum);
+    VectorAdd(t, t, torqueSum);
+
+    // Add spring forces from the cache if valid, otherwise holding the last force of far springs when running at
+    // reduced rate
+    if (springCache.valid) {
+        VectorCopy(sum, springCache.sum);
+        VectorCopy(torqueSum, springCache.torque);
+        RecordTelemetry(SpringEffect, 0, sum);
+    }
+    else {
+        VectorSet(sum, 0.0, 0.0, 0.0);
+        VectorSet(torqueSum, 0.0, 0.0, 0.0);
+
+        int held = numHeldEffects;
+        springs.ForEach(mask, [&](Spring& s, int index) {
+            const double* fp = p;
+            const double* fv = velocity;
+            FrameProbe(s.frame, fp, fv);
+            if (!HoldEffect(s.near, s.p, fp, index)) {
+                ProbeSpring(s, p, velocity);
+            }
+            VectorAdd(sum, sum, s.f);
+            VectorAdd(torqueSum, torqueSum, s.t);
+        });
+
+        FillForceCache(springCache, sum, torqueSum, p, velocity);
+        RecordTelemetry(SpringEffect, springs.Size(mask) - (numHeldEffects - held), sum);
+    }
+    VectorAdd(f, f, sum);
+    VectorAdd(t, t, torqueSum);
+    
+    // Add intermolecular forces from the cache if valid, otherwise holding the last force of far effects when
+    // running at reduced rate
+    if (intermolecularForceCache.valid) {
+        VectorCopy(sum, intermolecularForceCache.sum);
+        VectorCopy(torqueSum, intermolecularForceCache.torque);
+        RecordTelemetry(IntermolecularForceEffect, 0, sum);
+    }
+    else {
+        VectorSet(sum, 0.0, 0.0, 0.0);
+        VectorSet(torqueSum, 0.0, 0.0, 0.0);
+
+        int held = numHeldEffects;
+        intermolecularForces.ForEach(mask, [&](IntermolecularForce& imf, int index) {
+            const double* fp = p;
+            const double* fv = velocity;
+            FrameProbe(imf.frame, fp, fv);
+            if (!HoldEffect(imf.near, imf.p, fp, index)) {
+                ProbeIntermolecularForce(imf, p, velocity);
+            }
+            VectorAdd(sum, sum, imf.f);
+            VectorAdd(torqueSum, torqueSum, imf.t);
+        });
+
+        FillForceCache(intermolecularForceCache, sum, torqueSum, p, velocity);
+        RecordTelemetry(IntermolecularForceEffect, intermolecularForces.Size(mask) - (numHeldEffects - held), sum);
+    }
+    VectorAdd(f, f, sum);
+    VectorAdd(t, t, torqueSum);
+    
+    // Add random forces
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    randomForces.ForEach(mask, [&](RandomForce& r, int) {
+        double rf[3];
+        ComputeRandomForce(rf, r, time);
+        VectorAdd(sum, sum, rf);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(RandomForceEffect, randomForces.Size(mask), sum);
+
+    // Add expression forces
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    expressionForces.ForEach(mask, [&](ExpressionForce& ef, int) {
+        ComputeExpressionForce(ef.f, ef, p, velocity, dt);
+        VectorAdd(sum, sum, ef.f);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(ExpressionForceEffect, expressionForces.Size(mask), sum);
+
+    // Add external kernel forces
+    int evaluated = ComputeKernelForces(sum, p, velocity, time, dt);
+    VectorAdd(f, f, sum);
+    RecordTelemetry(KernelForceEffect, evaluated, sum);
+
+    // Add collider forces
+    int tested = ComputeColliderForces(sum, torqueSum, p, velocity);
+    VectorAdd(f, f, sum);
+    VectorAdd(t, t, torqueSum);
+    RecordTelemetry(ColliderEffect, tested, sum);
+
+    // Add distance field forces, at each probe point
+    const ProbePoints& probe = *tickProbe;
+
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    distanceFields.ForEach(mask, [&](DistanceField& df, int) {
+        if (probe.n == 0) {
+            ComputeDistanceFieldForce(df.f, df, p, velocity, 0.0);
+        }
+        else {
+            VectorSet(df.f, 0.0, 0.0, 0.0);
+            for (int i = 0; i < probe.n; i++) {
+                double q[3] = { probeX[i], probeY[i], probeZ[i] };
+                double o[3] = { probe.x[i], probe.y[i], probe.z[i] };
+
+                double pf[3], pt[3];
+                ComputeDistanceFieldForce(pf, df, q, velocity, probe.radius[i]);
+                VectorAdd(df.f, df.f, pf);
+
+                VectorCrossProduct(pt, o, pf);
+                VectorAdd(t, t, pt);
+            }
+        }
+        VectorAdd(sum, sum, df.f);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(DistanceFieldEffect, distanceFields.Size(mask), sum);
+
+    // Add path constraint forces
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    pathConstraints.ForEach(mask, [&](PathConstraint& pc, int) {
+        ComputePathConstraintForce(pc.f, pc, p, velocity);
+        VectorAdd(sum, sum, pc.f);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(PathConstraintEffect, pathConstraints.Size(mask), sum);
+
+    // Add radial forces, at each probe point in turn, as they vectorize across effects
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    if (probe.n == 0) {
+        radialForces.ForEachRun(mask, [&](RadialForce* rf, int count) {
+            ComputeRadialForces(sum, rf, count, p, velocity);
+        });
+    }
+    else {
+        for (int i = 0; i < probe.n; i++) {
+            double q[3] = { probeX[i], probeY[i], probeZ[i] };
+            double o[3] = { probe.x[i], probe.y[i], probe.z[i] };
+
+            double pf[3] = { 0.0, 0.0, 0.0 };
+            radialForces.ForEachRun(mask, [&](RadialForce* rf, int count) {
+                ComputeRadialForces(pf, rf, count, q, velocity);
+            });
+            VectorAdd(sum, sum, pf);
+
+            double pt[3];
+            VectorCrossProduct(pt, o, pf);
+            VectorAdd(t, t, pt);
+        }
+    }
+    VectorAdd(f, f, sum);
+    RecordTelemetry(RadialForceEffect, radialForces.Size(mask), sum);
+
+    // Add molecular force field force
+    if (forceFieldModel) {
+        double ff[3];
+        ComputeForceFieldForce(ff, *forceFieldModel, p, velocity);
+        VectorAdd(f, f, ff);
+        RecordTelemetry(ForceFieldEffect, 1, ff);
+    }
+
+    VectorCopy(force, f);
+    VectorCopy(torque, t);
+}
+
+void Falcon::StepEffectForces(double force[3], const double p[3], const double velocity[3], double dt, bool last) {
+    double f[3];
+    VectorSet(f, 0.0, 0.0, 0.0);
+
+    uint32_t mask = tickGroupMask;
+    double sum[3];
+
+    // Add vibrations
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    vibrations.ForEach(mask, [&](Vibration& v, int) {
+        ComputeVibrationForce(v.f, v, dt);
+        VectorAdd(sum, sum, v.f);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(VibrationEffect, vibrations.Size(mask), last ? sum : nullptr);
+
+    // Add rigid body forces, stepping the bodies. Bodies in disabled groups are frozen.
+    VectorSet(sum, 0.0, 0.0, 0.0);
+    rigidBodies.ForEach(mask, [&](RigidBody& rb, int) {
+        double bf[3];
+        ComputeRigidBodyForce(bf, rb, p, velocity, dt);
+        VectorAdd(sum, sum, bf);
+    });
+    VectorAdd(f, f, sum);
+    RecordTelemetry(RigidBodyEffect, rigidBodies.Size(mask), last ? sum : nullptr);
+
+    VectorCopy(force, f);
+}
+
+
+void Falcon::StartTelemetry() {
+    tickTelemetry = useTelemetry.load(std::memory_order_relaxed);
+    if (!tickTelemetry) return;
+
+    if (telemetryResetRequested.exchange(false, std::memory_order_relaxed)) {
+        telemetryTicks = 0;
+        for (int i = 0; i < NumEffectTypes; i++) {
+            telemetryTotalTime[i] = telemetryMaxTime[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < NumEffectTypes; i++) {
+        telemetryTime[i] = 0;
+        telemetryEvaluated[i] = 0;
+        VectorSet(telemetryForce[i], 0.0, 0.0, 0.0);
+    }
+
+    telemetryStart = ServoClock::NowNanoseconds();
+}
+
+void Falcon::RecordTelemetry(int type, int evaluated, const double f[3]) {
+    if (!tickTelemetry) return;
+
+    int64_t now = ServoClock::NowNanoseconds();
+    telemetryTime[type] += now - telemetryStart;
+    telemetryStart = now;
+
+    telemetryEvaluated[type] += evaluated;
+    if (f) {
+        VectorAdd(telemetryForce[type], telemetryForce[type], f);
+    }
+}
+
+void Falcon::PublishTelemetry() {
+    if (!tickTelemetry) return;
+
+    telemetryTicks++;
+
+    // Odd sequence while writing
+    unsigned int sequence = publishedTelemetrySequence.load(std::memory_order_relaxed);
+    publishedTelemetrySequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    publishedTelemetryTicks.store(telemetryTicks, std::memory_order_relaxed);
+    for (int i = 0; i < NumEffectTypes; i++) {
+        telemetryTotalTime[i] += telemetryTime[i];
+        telemetryMaxTime[i] = std::max(telemetryMaxTime[i], telemetryTime[i]);
+
+        publishedTelemetryEvaluated[i].store(telemetryEvaluated[i], std::memory_order_relaxed);
+        publishedTelemetryTime[i].store(telemetryTime[i], std::memory_order_relaxed);
+        publishedTelemetryTotalTime[i].store(telemetryTotalTime[i], std::memory_order_relaxed);
+        publishedTelemetryMaxTime[i].store(telemetryMaxTime[i], std::memory_order_relaxed);
+        for (int j = 0; j < 3; j++) {
+            publishedTelemetryForce[i][j].store(telemetryForce[i][j], std::memory_order_relaxed);
+        }
+    }
+
+    publishedTelemetrySequence.store(sequence + 2, std::memory_order_release);
+}
+
+void Falcon::StartKernelStats() {
+    if (kernelStatsResetRequested.exchange(false, std::memory_order_relaxed)) {
+        kernelTicks = 0;
+        for (int i = 0; i < maxKernels; i++) {
+            kernelTotalTime[i] = kernelMaxTime[i] = 0;
+        }
+    }
+
+    int n = numKernels.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        kernelTime[i] = 0;
+        kernelEvaluated[i] = kernelCalls[i] = 0;
+    }
+}
+
+void Falcon::PublishKernelStats() {
+    int n = numKernels.load(std::memory_order_relaxed);
+    if (n == 0) return;
+
+    kernelTicks++;
+
+    // Odd sequence while writing
+    unsigned int sequence = publishedKernelSequence.load(std::memory_order_relaxed);
+    publishedKernelSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    publishedKernelTicks.store(kernelTicks, std::memory_order_relaxed);
+    for (int i = 0; i < n; i++) {
+        kernelTotalTime[i] += kernelTime[i];
+        kernelMaxTime[i] = std::max(kernelMaxTime[i], kernelTime[i]);
+
+        publishedKernelEvaluated[i].store(kernelEvaluated[i], std::memory_order_relaxed);
+        publishedKernelCalls[i].store(kernelCalls[i], std::memory_order_relaxed);
+        publishedKernelTime[i].store(kernelTime[i], std::memory_order_relaxed);
+        publishedKernelTotalTime[i].store(kernelTotalTime[i], std::memory_order_relaxed);
+        publishedKernelMaxTime[i].store(kernelMaxTime[i], std::memory_order_relaxed);
+    }
+
+    publishedKernelSequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+void Falcon::SynchronizeState() {
+    // Get current state, in device space
+    device.GetPosition(pos);
+    buttons = device.GetButtons();
+}
+
+void Falcon::PublishState() {
+    // Odd sequence while writing
+    unsigned int sequence = publishedStateSequence.load(std::memory_order_relaxed);
+    publishedStateSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int i = 0; i < 3; i++) {
+        publishedPos[i].store(pos[i], std::memory_order_relaxed);
+        publishedForce[i].store(force[i], std::memory_order_relaxed);
+        publishedTorque[i].store(torque[i], std::memory_order_relaxed);
+    }
+    publishedButtons.store(buttons, std::memory_order_relaxed);
+
+    publishedStateSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void Falcon::ReadState(DeviceState& state) {
+    // Retry if the servo thread was writing
+    for (;;) {
+        unsigned int sequence = publishedStateSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            state.pos[i] = publishedPos[i].load(std::memory_order_relaxed);
+            state.force[i] = publishedForce[i].load(std::memory_order_relaxed);
+            state.torque[i] = publishedTorque[i].load(std::memory_order_relaxed);
+        }
+        state.buttons = publishedButtons.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (publishedStateSequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+}
+
+
+double Falcon::Random(double min, double max) {
+    // xorshift64*, which unlike rand() never takes a lock
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    uint64_t r = randomState * 0x2545F4914F6CDD1Dull;
+
+    return min + (double)(r >> 11) * (1.0 / 9007199254740992.0) * (max - min);
+}
+
+
+void Falcon::ComputeViscousForce(double force[3], Viscosity& v, const double velocity[3]) {
+    // Compute viscous force
+    VectorScale(force, velocity, -v.c);
+
+    // Interpolate between previous force magnitude and current force magnitude to reduce vibrations
+    VectorScale(force, force, v.w);
+    VectorScale(v.oldForce, v.oldForce, 1.0 - v.w);
+    VectorAdd(force, force, v.oldForce);
+
+    // Save old viscous force
+    VectorCopy(v.oldForce, force);
+}
+
+
+void Falcon::ComputeSurfaceForce(double force[3], const Surface& s, const double p[3], const double velocity[3]) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    // Compute distance to proxy position
+    double d = PointPlaneDistance(p, s.p, s.n);
+
+    // Check above or below plane
+    if (d > 0.0) {
+        return;
+    }
+
+    // Compute spring force along surface normal
     VectorScale(force, s.n, -d * s.k);
 
     // Add damping
@@ -598,10 +4777,12 @@ void Falcon::ComputeSurfaceForce(double force[3], const Surface s, const double
     VectorAdd(force, force, fd);
 }
 
-void Falcon::ComputeSpringForce(double force[3], const Spring s, const double velocity[3]) { 
+void Falcon::ComputeSpringForce(double force[3], const Spring& s, const double p[3], const double velocity[3]) { 
+    VectorSet(force, 0.0, 0.0, 0.0);
+
     // Get direction vector from spring to probe
     double dv[3];
-    VectorSubtract(dv, pos, s.p);
+    VectorSubtract(dv, p, s.p);
 
     // Get distance from spring
     double d = VectorMagnitude(dv);
@@ -628,11 +4809,11 @@ void Falcon::ComputeSpringForce(double force[3], const Spring s, const double ve
     VectorAdd(force, force, fd);
 }
 
-void Falcon::ComputeIntermolecularForce(double force[3], const IntermolecularForce imf, const double velocity[3]) { 
-    // Get direction vector from molecule to probe
+void Falcon::ComputeIntermolecularForce(double force[3], const IntermolecularForce& imf, const double p[3], const double velocity[3]) { 
+    // Get direction vector from molecule to probe, in the graphics x-y plane
     double dv[3];
-    VectorSubtract(dv, pos, imf.p);
-    dv[2] = 0.0;
+    VectorSubtract(dv, p, imf.p);
+    VectorRemoveComponent(dv, dv, imf.z);
 
     // Get distance from spring
     double d = VectorMagnitude(dv);
@@ -663,7 +4844,7 @@ void Falcon::ComputeIntermolecularForce(double force[3], const IntermolecularFor
 
     VectorAdd(force, force, fd);
 
-    force[2] = 0.0;
+    VectorRemoveComponent(force, force, imf.z);
 }
 
 void Falcon::ComputeRandomForce(double force[3], RandomForce& rf, double t) {
@@ -681,4 +4862,834 @@ void Falcon::ComputeRandomForce(double force[3], RandomForce& rf, double t) {
 
     // Apply force
     VectorCopy(force, rf.f);
-}
\ No newline at end of file
+}
+
+void Falcon::ComputeVibrationForce(double force[3], Vibration& v, double dt) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    if (!v.active) return;
+
+    // Release at the end of a timed trigger
+    if (v.releaseTime < 0.0 && v.duration > 0.0 && v.t >= v.duration) {
+        v.releaseLevel = EnvelopeLevel(v, v.duration);
+        v.releaseTime = v.duration;
+    }
+
+    // Envelope level, ending after the release, or after the decay with no sustain
+    double level;
+    if (v.releaseTime >= 0.0) {
+        double r = v.t - v.releaseTime;
+        if (r >= v.release) {
+            v.active = false;
+            return;
+        }
+        level = v.releaseLevel * (1.0 - r / v.release);
+    }
+    else {
+        if (v.sustain <= 0.0 && v.t >= v.attack + v.decay) {
+            v.active = false;
+            return;
+        }
+        level = EnvelopeLevel(v, v.t);
+    }
+
+    // Waveform at the current phase, interpolated between samples. The top 8 bits of the phase index the samples.
+    static_assert(wavetableSize == 256, "Wavetable size must match the phase bits");
+    const float* samples = v.wavetable->samples;
+    int i = v.phase >> 24;
+    double a = (v.phase & 0xFFFFFF) * (1.0 / 16777216.0);
+    double w = samples[i] + (samples[i + 1] - samples[i]) * a;
+
+    VectorScale(force, v.direction, v.amplitude * level * w);
+
+    // Advance, wrapping the phase at one period
+    double cycles = v.frequency * dt;
+    cycles -= floor(cycles);
+    v.phase += (uint32_t)(uint64_t)(cycles * 4294967296.0);
+    v.t += dt;
+}
+
+void Falcon::ComputeExpressionForce(double force[3], ExpressionForce& ef, const double p[3], const double velocity[3], double dt) {
+    const ExpressionProgram& program = *ef.program;
+
+    // Constants and inputs, in graphics space
+    double* r = expressionRegisters;
+    std::copy(program.registers.begin(), program.registers.end(), r);
+    MatrixVectorMultiply(&r[ExpressionPX], ef.toGraphics, p);
+    MatrixDirectionMultiply(&r[ExpressionVX], ef.toGraphics, velocity);
+    r[ExpressionTime] = ef.t;
+    for (int i = 0; i < numExpressionParameters; i++) {
+        r[ExpressionParameter0 + i] = ef.parameters[i];
+    }
+
+    EvaluateExpression(program, r);
+
+    double f[3] = { r[program.output[0]], r[program.output[1]], r[program.output[2]] };
+    if (std::isfinite(f[0]) && std::isfinite(f[1]) && std::isfinite(f[2])) {
+        MatrixTransposeDirectionMultiply(force, ef.toGraphics, f);
+        VectorScale(force, force, ef.forceScale);
+    }
+    else {
+        VectorSet(force, 0.0, 0.0, 0.0);
+    }
+
+    ef.t += dt;
+}
+
+int Falcon::ComputeKernelForces(double force[3], const double p[3], const double velocity[3], double t, double dt) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    uint32_t mask = tickGroupMask;
+    int count = kernelForces.Size(mask);
+    if (count == 0) return 0;
+
+    // Probe in graphics space, with the workspace transform the effects were given
+    const KernelForce& first = *kernelForces.Begin();
+    FalconKernelProbe probe;
+    MatrixVectorMultiply(probe.position, first.toGraphics, p);
+    MatrixDirectionMultiply(probe.velocity, first.toGraphics, velocity);
+    probe.time = t;
+    probe.dt = dt;
+
+    // Gather parameters into each kernel's batch, running it whenever its batch fills
+    double sum[3];
+    VectorSet(sum, 0.0, 0.0, 0.0);
+
+    kernelForces.ForEachRun(mask, [&](KernelForce* effects, int n) {
+        for (int i = 0; i < n; i++) {
+            const KernelForce& kf = effects[i];
+            KernelBatch& batch = kernelBatches[kf.kernel];
+
+            int numParameters = kernels[kf.kernel].numParameters;
+            for (int j = 0; j < numParameters; j++) {
+                batch.parameters[j][batch.count] = kf.parameters[j];
+            }
+
+            if (++batch.count == FALCON_KERNEL_BATCH_SIZE) {
+                RunKernel(kf.kernel, probe, sum);
+            }
+        }
+    });
+
+    int n = numKernels.load(std::memory_order_relaxed);
+    for (int k = 0; k < n; k++) {
+        if (kernelBatches[k].count > 0) RunKernel(k, probe, sum);
+    }
+
+    MatrixTransposeDirectionMultiply(force, first.toGraphics, sum);
+    VectorScale(force, force, first.forceScale);
+
+    return count;
+}
+
+void Falcon::RunKernel(int kernel, const FalconKernelProbe& probe, double sum[3]) {
+    KernelBatch& batch = kernelBatches[kernel];
+    const FalconKernel& k = kernels[kernel];
+
+    FalconKernelBatch b;
+    b.count = batch.count;
+    for (int j = 0; j < FALCON_KERNEL_MAX_PARAMETERS; j++) {
+        b.parameters[j] = batch.parameters[j];
+    }
+    for (int j = 0; j < 3; j++) {
+        b.force[j] = batch.force[j];
+        std::fill(batch.force[j], batch.force[j] + batch.count, 0.0);
+    }
+
+    int64_t start = ServoClock::NowNanoseconds();
+    k.compute(k.context, &probe, &b);
+    kernelTime[kernel] += ServoClock::NowNanoseconds() - start;
+    kernelEvaluated[kernel] += batch.count;
+    kernelCalls[kernel]++;
+
+    // Drop the batch if the kernel gave a force that isn't finite
+    double f[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < batch.count; i++) {
+        f[0] += batch.force[0][i];
+        f[1] += batch.force[1][i];
+        f[2] += batch.force[2][i];
+    }
+    if (std::isfinite(f[0]) && std::isfinite(f[1]) && std::isfinite(f[2])) {
+        VectorAdd(sum, sum, f);
+    }
+
+    batch.count = 0;
+}
+
+void Falcon::ComputeForceFieldForce(double force[3], const ForceFieldModel& model, const double p[3], const double velocity[3]) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    if (!model.valid) return;
+
+    // Displacement from where the model was computed, limited to where it is valid
+    double d[3];
+    VectorSubtract(d, p, model.x0);
+
+    double m = VectorMagnitude(d);
+    if (m > model.radius) {
+        VectorScale(d, d, model.radius / m);
+    }
+
+    // Linear model
+    for (int i = 0; i < 3; i++) {
+        force[i] = model.f0[i] + model.k[i * 3] * d[0] + model.k[i * 3 + 1] * d[1] + model.k[i * 3 + 2] * d[2];
+    }
+
+    // Limit magnitude
+    m = VectorMagnitude(force);
+    if (m > model.maxForce) {
+        VectorScale(force, force, model.maxForce / m);
+    }
+
+    // Add damping
+    double fd[3];
+    VectorScale(fd, velocity, -model.c);
+
+    VectorAdd(force, force, fd);
+}
+
+void Falcon::ComputeRigidBodyForce(double force[3], RigidBody& rb, const double p[3], const double velocity[3], double dt) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    if (dt <= 0.0 || rb.mass <= 0.0) return;
+    if (dt > maxRigidBodyStep) dt = maxRigidBodyStep;
+
+    // Limit stiffness and damping to what explicit integration of this mass can handle at this step
+    double maxK = 0.25 * rb.mass / (dt * dt);
+    double maxC = 0.5 * rb.mass / dt;
+    double k = rb.k < maxK ? rb.k : maxK;
+    double c = rb.c < maxC ? rb.c : maxC;
+
+    double rotation[16];
+    QuaternionToMatrix(rotation, rb.q);
+
+    // Total force and torque on the body
+    double bf[3];
+    VectorScale(bf, rb.v, -rb.linearDrag);
+
+    double torque[3];
+    VectorScale(torque, rb.w, -rb.angularDrag);
+
+    // Probe relative to the body
+    double r[3];
+    VectorSubtract(r, p, rb.p);
+
+    // Grab at the probe's current point on the body
+    if (rb.grab && !rb.attached) {
+        MatrixTransposeDirectionMultiply(rb.grabOffset, rotation, r);
+        rb.attached = true;
+    }
+    else if (!rb.grab) {
+        rb.attached = false;
+    }
+
+    // Force on the body from the probe, and where it acts
+    double f[3];
+    double arm[3];
+    VectorSet(f, 0.0, 0.0, 0.0);
+
+    if (rb.attached) {
+        // Virtual spring-damper between the probe and the grab point
+        MatrixDirectionMultiply(arm, rotation, rb.grabOffset);
+
+        double stretch[3];
+        VectorSubtract(stretch, r, arm);
+        VectorScale(f, stretch, k);
+
+        double pointVelocity[3];
+        VectorCrossProduct(pointVelocity, rb.w, arm);
+        VectorAdd(pointVelocity, pointVelocity, rb.v);
+
+        double fd[3];
+        VectorSubtract(fd, velocity, pointVelocity);
+        VectorScale(fd, fd, c);
+        VectorAdd(f, f, fd);
+    }
+    else {
+        // Contact between the probe and the collision shape
+        VectorCopy(arm, r);
+
+        double local[3];
+        MatrixTransposeDirectionMultiply(local, rotation, r);
+
+        double n[3];
+        double depth = ShapePenetration(n, rb.shape, rb.extents, local);
+
+        if (depth > 0.0) {
+            MatrixDirectionMultiply(n, rotation, n);
+
+            double pointVelocity[3];
+            VectorCrossProduct(pointVelocity, rb.w, arm);
+            VectorAdd(pointVelocity, pointVelocity, rb.v);
+
+            double relativeVelocity[3];
+            VectorSubtract(relativeVelocity, velocity, pointVelocity);
+
+            // Push the probe out along the normal, never pulling
+            double fn = k * depth - c * VectorDotProduct(relativeVelocity, n);
+            if (fn > 0.0) {
+                VectorScale(f, n, -fn);
+            }
+        }
+    }
+
+    // The probe feels the opposite force
+    VectorScale(force, f, -1.0);
+
+    double t[3];
+    VectorCrossProduct(t, arm, f);
+    VectorAdd(bf, bf, f);
+    VectorAdd(torque, torque, t);
+
+    // Contact with enabled surfaces, at the sphere's lowest point or each box corner
+    surfaces.ForEach(tickGroupMask, [&](Surface& s, int) {
+        if (rb.shape == RigidBodySphere) {
+            VectorScale(arm, s.n, -rb.extents[0]);
+            AddSurfaceContact(bf, torque, rb, s, arm, maxK, maxC);
+        }
+        else {
+            for (int corner = 0; corner < 8; corner++) {
+                double local[3];
+                VectorSet(local, corner & 1 ? rb.extents[0] : -rb.extents[0],
+                                 corner & 2 ? rb.extents[1] : -rb.extents[1],
+                                 corner & 4 ? rb.extents[2] : -rb.extents[2]);
+                MatrixDirectionMultiply(arm, rotation, local);
+                AddSurfaceContact(bf, torque, rb, s, arm, maxK, maxC);
+            }
+        }
+    });
+
+    // Gravity
+    double g[3];
+    for (int i = 0; i < 3; i++) {
+        g[i] = rigidBodyGravity[i].load(std::memory_order_relaxed);
+    }
+    VectorScale(g, g, rb.mass);
+    VectorAdd(bf, bf, g);
+
+    // Semi-implicit Euler step
+    double a[3];
+    VectorScale(a, bf, dt / rb.mass);
+    VectorAdd(rb.v, rb.v, a);
+
+    double dp[3];
+    VectorScale(dp, rb.v, dt);
+    VectorAdd(rb.p, rb.p, dp);
+
+    // Angular acceleration about the body axes, ignoring the gyroscopic term
+    double localTorque[3];
+    MatrixTransposeDirectionMultiply(localTorque, rotation, torque);
+    for (int i = 0; i < 3; i++) {
+        localTorque[i] = rb.inertia[i] > 0.0 ? localTorque[i] * dt / rb.inertia[i] : 0.0;
+    }
+
+    double dw[3];
+    MatrixDirectionMultiply(dw, rotation, localTorque);
+    VectorAdd(rb.w, rb.w, dw);
+
+    QuaternionIntegrate(rb.q, rb.w, dt);
+}
+
+void Falcon::BuildColliderGrid() {
+    std::fill(colliderBuckets, colliderBuckets + numColliderBuckets, -1);
+    largeColliders = -1;
+
+    Collider* begin = colliders.Begin();
+    int n = colliders.Size();
+    colliderGridSize = n;
+    if (n == 0) return;
+
+    // Cells twice the size of the average collider, so colliders up to twice the average overlap at most two cells
+    // along each axis
+    double size = 0.0;
+    for (int i = 0; i < n; i++) {
+        const Collider& c = begin[i];
+        size += std::max(c.hi[0] - c.lo[0], std::max(c.hi[1] - c.lo[1], c.hi[2] - c.lo[2]));
+    }
+    colliderCellSize = size > 0.0 && std::isfinite(size) ? 2.0 * size / n : 1.0;
+
+    for (int g = 0; g < numEffectGroups; g++) {
+        colliders.ForEach(1u << g, [this, g](Collider& c, int i) {
+            c.groupBit = 1u << g;
+            LinkCollider(i);
+        });
+    }
+}
+
+void Falcon::LinkCollider(int index) {
+    Collider& c = colliders.Begin()[index];
+    c.numBuckets = 0;
+
+    double scale = 1.0 / colliderCellSize;
+    int64_t lo[3], hi[3];
+    int64_t cells = 1;
+    for (int j = 0; j < 3; j++) {
+        if (!ColliderCell(lo[j], c.lo[j] - colliderPad, scale) || !ColliderCell(hi[j], c.hi[j] + colliderPad, scale)) {
+            cells = maxColliderCells + 1;
+            break;
+        }
+        cells *= hi[j] - lo[j] + 1;
+    }
+
+    if (cells > maxColliderCells) {
+        c.buckets[0] = -1;
+        c.next[0] = largeColliders;
+        largeColliders = index * maxColliderCells;
+        c.numBuckets = 1;
+        return;
+    }
+
+    // List the collider once in each bucket, as cells can hash to the same one
+    for (int64_t x = lo[0]; x <= hi[0]; x++) {
+        for (int64_t y = lo[1]; y <= hi[1]; y++) {
+            for (int64_t z = lo[2]; z <= hi[2]; z++) {
+                int b = ColliderBucket(x, y, z);
+                if (std::find(c.buckets, c.buckets + c.numBuckets, b) != c.buckets + c.numBuckets) continue;
+
+                int k = c.numBuckets++;
+                c.buckets[k] = b;
+                c.next[k] = colliderBuckets[b];
+                colliderBuckets[b] = index * maxColliderCells + k;
+            }
+        }
+    }
+}
+
+void Falcon::UnlinkCollider(int index) {
+    Collider* begin = colliders.Begin();
+    Collider& c = begin[index];
+
+    for (int k = 0; k < c.numBuckets; k++) {
+        // Find the link to this entry and skip over it
+        int entry = index * maxColliderCells + k;
+        int* link = c.buckets[k] < 0 ? &largeColliders : &colliderBuckets[c.buckets[k]];
+        while (*link >= 0 && *link != entry) {
+            link = &begin[*link / maxColliderCells].next[*link % maxColliderCells];
+        }
+        if (*link == entry) *link = c.next[k];
+    }
+
+    c.numBuckets = 0;
+}
+
+int Falcon::ComputeColliderForces(double force[3], double torque[3], const double p[3], const double velocity[3]) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+    VectorSet(torque, 0.0, 0.0, 0.0);
+
+    // Colliders added, removed or moved between groups can move others in the dense array, so rebuild the grid, as
+    // when many were updated, such as by a workspace change, or when the largest probe radius changed. Otherwise
+    // relist just the colliders that were updated.
+    const ProbePoints& probe = *tickProbe;
+    int numDirty = colliders.NumDirty();
+    if (colliders.AllDirty() || colliders.Size() != colliderGridSize || numDirty > colliderGridSize / 4 ||
+        colliderPad != probe.maxRadius) {
+        colliderPad = probe.maxRadius;
+        BuildColliderGrid();
+    }
+    else {
+        for (int i = 0; i < numDirty; i++) {
+            int index = (int)(colliders.Dirty(i) - colliders.Begin());
+            UnlinkCollider(index);
+            LinkCollider(index);
+        }
+    }
+    colliders.ClearDirty();
+
+    uint32_t mask = tickGroupMask;
+    const Collider* begin = colliders.Begin();
+    int tested = 0;
+
+    // Each probe point on its own, or the probe position for a single point
+    double q[3], o[3], radius;
+    double pf[3];
+
+    auto test = [&](const Collider& c) {
+        if (!(c.groupBit & mask) ||
+            q[0] < c.lo[0] - radius || q[0] > c.hi[0] + radius ||
+            q[1] < c.lo[1] - radius || q[1] > c.hi[1] + radius ||
+            q[2] < c.lo[2] - radius || q[2] > c.hi[2] + radius) {
+            return;
+        }
+
+        double f[3];
+        ComputeColliderForce(f, c, q, velocity, radius);
+        VectorAdd(pf, pf, f);
+        tested++;
+    };
+
+    double scale = 1.0 / colliderCellSize;
+    for (int i = 0; i < std::max(probe.n, 1); i++) {
+        if (probe.n == 0) {
+            VectorCopy(q, p);
+            VectorSet(o, 0.0, 0.0, 0.0);
+            radius = 0.0;
+        }
+        else {
+            VectorSet(q, probeX[i], probeY[i], probeZ[i]);
+            VectorSet(o, probe.x[i], probe.y[i], probe.z[i]);
+            radius = probe.radius[i];
+        }
+
+        VectorSet(pf, 0.0, 0.0, 0.0);
+
+        // Colliders listed in the bucket of the point's cell, which may also be in other cells hashed to it. Colliders
+        // are listed in the cells their bounds padded by the largest probe radius overlap, so spheres find them too.
+        int64_t cell[3];
+        if (ColliderCell(cell[0], q[0], scale) && ColliderCell(cell[1], q[1], scale) && ColliderCell(cell[2], q[2], scale)) {
+            for (int e = colliderBuckets[ColliderBucket(cell[0], cell[1], cell[2])]; e >= 0;) {
+                const Collider& c = begin[e / maxColliderCells];
+                test(c);
+                e = c.next[e % maxColliderCells];
+            }
+        }
+
+        for (int e = largeColliders; e >= 0;) {
+            const Collider& c = begin[e / maxColliderCells];
+            test(c);
+            e = c.next[0];
+        }
+
+        double pt[3];
+        VectorCrossProduct(pt, o, pf);
+        VectorAdd(torque, torque, pt);
+        VectorAdd(force, force, pf);
+    }
+
+    return tested;
+}
+
+void Falcon::ComputeColliderForce(double force[3], const Collider& c, const double p[3], const double velocity[3], double radius) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    // Probe in the collider's local space
+    double r[3], local[3];
+    VectorSubtract(r, p, c.p);
+    MatrixTransposeDirectionMultiply(local, c.rotation, r);
+
+    double n[3];
+    double depth = ShapePenetration(n, c.shape, c.extents, local) + radius;
+    if (!(depth > 0.0)) {
+        return;
+    }
+
+    // Compute spring force along the normal, as for a surface
+    MatrixDirectionMultiply(n, c.rotation, n);
+    VectorScale(force, n, depth * c.k);
+
+    // Add damping
+    double fd[3];
+    VectorScale(fd, velocity, -c.c);
+
+    VectorAdd(force, force, fd);
+}
+
+void Falcon::ComputeDistanceFieldForce(double force[3], const DistanceField& df, const double p[3], const double velocity[3], double radius) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    // Sample the grid at the probe, in local space
+    double local[3];
+    MatrixVectorMultiply(local, df.toLocal, p);
+
+    double d;
+    double gradient[3];
+    if (!SampleDistanceGrid(*df.grid, local, d, gradient) || (d > 0.0 && radius <= 0.0)) {
+        return;
+    }
+
+    // Gradient in effect space, whose length converts local distance to effect space distance
+    double n[3];
+    MatrixTransposeDirectionMultiply(n, df.toLocal, gradient);
+    double length = VectorMagnitude(n);
+    if (length <= 0.0) {
+        return;
+    }
+    VectorScale(n, n, 1.0 / length);
+
+    // Depth in effect space, of a sphere of the given radius
+    double depth = radius - d / length;
+    if (depth < 0.0) {
+        return;
+    }
+
+    // Compute spring force along the normal, as for a surface
+    VectorScale(force, n, depth * df.k);
+
+    // Add damping
+    double fd[3];
+    VectorScale(fd, velocity, -df.c);
+
+    VectorAdd(force, force, fd);
+}
+
+void Falcon::ComputePathConstraintForce(double force[3], PathConstraint& pc, const double p[3], const double velocity[3]) {
+    VectorSet(force, 0.0, 0.0, 0.0);
+
+    // Closest point on the path, found in local space, starting from last tick's segment
+    double local[3];
+    MatrixVectorMultiply(local, pc.toLocal, p);
+
+    PathPoint closest;
+    ClosestPathPoint(*pc.path, local, pc.segment, closest);
+    pc.segment = closest.segment;
+
+    double cp[3], tangent[3];
+    MatrixVectorMultiply(cp, pc.toEffect, closest.p);
+    MatrixDirectionMultiply(tangent, pc.toEffect, closest.tangent);
+    VectorNormalize(tangent, tangent);
+
+    // Compute spring force towards the path, outside the free radius
+    double dv[3];
+    VectorSubtract(dv, cp, p);
+    double d = VectorMagnitude(dv);
+    if (d > pc.r && d > 0.0) {
+        VectorScale(force, dv, (d - pc.r) / d * pc.k);
+
+        // Add damping across the path only, so motion along it is free
+        double across[3];
+        VectorRemoveComponent(across, velocity, tangent);
+
+        double fd[3];
+        VectorScale(fd, across, -pc.c);
+        VectorAdd(force, force, fd);
+    }
+
+    // Add force along the path
+    double fa[3];
+    VectorScale(fa, tangent, pc.along);
+    VectorAdd(force, force, fa);
+}
+
+void Falcon::ComputeRadialForces(double sum[3], RadialForce* rf, int count, const double p[3], const double velocity[3]) {
+    // Batches, in separate passes so the arithmetic vectorizes apart from the profile lookups
+    double dx[radialForceBatch];
+    double dy[radialForceBatch];
+    double dz[radialForceBatch];
+    double t[radialForceBatch];
+    double m[radialForceBatch];
+    double c[radialForceBatch];
+
+    for (int first = 0; first < count; first += radialForceBatch) {
+        RadialForce* b = rf + first;
+        int n = std::min(radialForceBatch, count - first);
+
+        // Unit direction from the center to the probe, and distance in profile samples
+        for (int i = 0; i < n; i++) {
+            dx[i] = p[0] - b[i].p[0];
+            dy[i] = p[1] - b[i].p[1];
+            dz[i] = p[2] - b[i].p[2];
+
+            double d = std::sqrt(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+            double s = d > 0.0 ? 1.0 / d : 0.0;
+            dx[i] *= s;
+            dy[i] *= s;
+            dz[i] *= s;
+            t[i] = d * b[i].toSample;
+        }
+
+        // Force magnitudes, with damping only in range of the profile. Neighbouring effects usually share a profile.
+        const RadialProfile* profile = nullptr;
+        double last = 0.0;
+        for (int i = 0; i < n; i++) {
+            if (b[i].profile != profile) {
+                profile = b[i].profile;
+                last = (double)(profile->forces.size() - 1);
+            }
+
+            m[i] = SampleRadialProfile(*profile, t[i]) * b[i].scale;
+            c[i] = t[i] <= last ? b[i].c : 0.0;
+        }
+
+        for (int i = 0; i < n; i++) {
+            b[i].f[0] = dx[i] * m[i] - c[i] * velocity[0];
+            b[i].f[1] = dy[i] * m[i] - c[i] * velocity[1];
+            b[i].f[2] = dz[i] * m[i] - c[i] * velocity[2];
+
+            sum[0] += b[i].f[0];
+            sum[1] += b[i].f[1];
+            sum[2] += b[i].f[2];
+        }
+    }
+}
+
+void Falcon::EvaluateForceQuery(const ForceQuery& query, const Vector3* points, Vector3* forces, int n) {
+    // Points and forces in effect space, in arrays of their own so the compiler knows they don't overlap
+    double px[forceQueryBlock], py[forceQueryBlock], pz[forceQueryBlock];
+    double fx[forceQueryBlock], fy[forceQueryBlock], fz[forceQueryBlock];
+
+    for (int i = 0; i < n; i++) {
+        double p[3];
+        GraphicsToEffectPoint(p, points[i]);
+        px[i] = p[0];
+        py[i] = p[1];
+        pz[i] = p[2];
+
+        fx[i] = query.simpleForce[0];
+        fy[i] = query.simpleForce[1];
+        fz[i] = query.simpleForce[2];
+    }
+
+    // Surfaces, springs and radial forces loop over points for each effect, with the effect's parameters in locals,
+    // so the arithmetic vectorizes
+    for (const Surface& s : query.surfaces) {
+        const double nx = s.n[0], ny = s.n[1], nz = s.n[2];
+        const double offset = VectorDotProduct(s.p, s.n);
+        const double k = s.k;
+
+        for (int i = 0; i < n; i++) {
+            double d = px[i] * nx + py[i] * ny + pz[i] * nz - offset;
+            double m = std::max(-d, 0.0) * k;
+
+            fx[i] += m * nx;
+            fy[i] += m * ny;
+            fz[i] += m * nz;
+        }
+    }
+
+    for (const Spring& s : query.springs) {
+        const double ax = s.p[0], ay = s.p[1], az = s.p[2];
+        const double k = s.k, r = s.r;
+        const double maxLength = s.m > 0.0 ? s.m : HUGE_VAL;
+
+        for (int i = 0; i < n; i++) {
+            double dx = px[i] - ax;
+            double dy = py[i] - ay;
+            double dz = pz[i] - az;
+            double d = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+            // Broken past the max length, and zero on the anchor. Selecting constants rather than the force keeps the
+            // loop free of branches.
+            double on = d > 0.0 && d <= maxLength ? 1.0 : 0.0;
+            double m = on * (r - d) * k / std::max(d, 1e-12);
+
+            fx[i] += m * dx;
+            fy[i] += m * dy;
+            fz[i] += m * dz;
+        }
+    }
+
+    double distance[forceQueryBlock];
+    for (const RadialForce& rf : query.radialForces) {
+        for (int i = 0; i < n; i++) {
+            double dx = px[i] - rf.p[0];
+            double dy = py[i] - rf.p[1];
+            double dz = pz[i] - rf.p[2];
+            distance[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+
+        // Profile lookups apart, as they don't vectorize
+        for (int i = 0; i < n; i++) {
+            double d = distance[i];
+            double m = d > 0.0 ? SampleRadialProfile(*rf.profile, d * rf.toSample) * rf.scale / d : 0.0;
+
+            fx[i] += m * (px[i] - rf.p[0]);
+            fy[i] += m * (py[i] - rf.p[1]);
+            fz[i] += m * (pz[i] - rf.p[2]);
+        }
+    }
+
+    // Other effects one point at a time, with a still probe
+    double zero[3] = { 0.0, 0.0, 0.0 };
+
+    for (int i = 0; i < n; i++) {
+        double p[3] = { px[i], py[i], pz[i] };
+        double sum[3] = { 0.0, 0.0, 0.0 };
+        double f[3];
+
+        for (const IntermolecularForce& imf : query.intermolecularForces) {
+            if (imf.frame >= 0) {
+                const double* transforms = &query.frameTransforms[imf.frame * 32];
+                double local[3];
+                MatrixVectorMultiply(local, transforms, p);
+                ComputeIntermolecularForce(f, imf, local, zero);
+                MatrixDirectionMultiply(f, transforms + 16, f);
+            }
+            else {
+                ComputeIntermolecularForce(f, imf, p, zero);
+            }
+            VectorAdd(sum, sum, f);
+        }
+
+        for (const DistanceField& df : query.distanceFields) {
+            ComputeDistanceFieldForce(f, df, p, zero, 0.0);
+            VectorAdd(sum, sum, f);
+        }
+
+        // Searching the whole path, as consecutive points may be far apart
+        for (const PathConstraint& path : query.pathConstraints) {
+            PathConstraint pc = path;
+            pc.segment = -1;
+            ComputePathConstraintForce(f, pc, p, zero);
+            VectorAdd(sum, sum, f);
+        }
+
+        for (const Collider& c : query.colliders) {
+            if (p[0] < c.lo[0] || p[0] > c.hi[0] || p[1] < c.lo[1] || p[1] > c.hi[1] || p[2] < c.lo[2] || p[2] > c.hi[2]) continue;
+
+            ComputeColliderForce(f, c, p, zero, 0.0);
+            VectorAdd(sum, sum, f);
+        }
+
+        fx[i] += sum[0];
+        fy[i] += sum[1];
+        fz[i] += sum[2];
+    }
+
+    // To the device force the servo loop would send with the probe at each point, and back as GetForce() reports it
+    for (int i = 0; i < n; i++) {
+        double f[3] = { fx[i], fy[i], fz[i] };
+        MatrixTransposeDirectionMultiply(f, haptics2effect, f);
+        DeviceToGraphicsForce(f, f);
+
+        forces[i].x = (float)f[0];
+        forces[i].y = (float)f[1];
+        forces[i].z = (float)f[2];
+    }
+}
+
+void Falcon::AddSurfaceContact(double force[3], double torque[3], const RigidBody& rb, const Surface& s, const double arm[3], double maxK, double maxC) {
+    // Penetration of the body point at arm from the center
+    double cp[3];
+    VectorAdd(cp, rb.p, arm);
+
+    double d = PointPlaneDistance(cp, s.p, s.n);
+    if (d >= 0.0) return;
+
+    double pointVelocity[3];
+    VectorCrossProduct(pointVelocity, rb.w, arm);
+    VectorAdd(pointVelocity, pointVelocity, rb.v);
+
+    double k = s.k < maxK ? s.k : maxK;
+    double c = s.c < maxC ? s.c : maxC;
+
+    // Push out along the normal, never pulling
+    double fn = -d * k - c * VectorDotProduct(pointVelocity, s.n);
+    if (fn <= 0.0) return;
+
+    double f[3];
+    VectorScale(f, s.n, fn);
+    VectorAdd(force, force, f);
+
+    double t[3];
+    VectorCrossProduct(t, arm, f);
+    VectorAdd(torque, torque, t);
+}
+
+void Falcon::PublishRigidBodyPose(const RigidBody& rb) {
+    PublishedPose* published = rb.published;
+    if (!published) return;
+
+    // Odd sequence while writing
+    unsigned int sequence = published->sequence.load(std::memory_order_relaxed);
+    published->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    published->generation.store(rb.generation, std::memory_order_relaxed);
+    for (int i = 0; i < 3; i++) {
+        published->p[i].store(rb.p[i], std::memory_order_relaxed);
+    }
+    for (int i = 0; i < 4; i++) {
+        published->q[i].store(rb.q[i], std::memory_order_relaxed);
+    }
+
+    published->sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -15,12 +15,24 @@
 #define FALCON_H
 
 
-#include <hdl/hdl.h>
-
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "DeviceBackend.h"
+#include "ConstraintPath.h"
+#include "DistanceField.h"
+#include "Expression.h"
+#include "FalconKernel.h"
 #include "ForceContainer.h"
+#include "ForceField.h"
+#include "ServoThread.h"
+#include "SharedLibrary.h"
+#include "TripleBuffer.h"
 
 
 // Struct to use for sending info between the plugin and Unity
@@ -30,6 +42,195 @@ struct Vector3 {
     float z;
 };
 
+// Struct to use for sending rotations between the plugin and Unity. Same layout as Unity's Quaternion
+struct Quaternion {
+    float x;
+    float y;
+    float z;
+    float w;
+};
+
+
+// Struct to use for sending initialization status to Unity
+struct InitializeStatus {
+    // InitializeState
+    int state;
+
+    // Time taken to open the device, and from the start of initialization to the first force sent (cold start),
+    // in milliseconds. Zero until reached.
+    float openTime;
+    float firstForceTime;
+};
+
+// Initialization stages
+enum InitializeState {
+    InitializeIdle = 0,
+    InitializeOpening = 1,
+    InitializeStarting = 2,
+    InitializeReady = 3,
+    InitializeFailed = 4
+};
+
+
+// Struct to use for sending passivity controller statistics to Unity. Energies in Joules.
+struct PassivityStats {
+    // Energy absorbed by the virtual environment so far. Negative when it has been generating energy.
+    float observedEnergy;
+
+    // Energy the controller's damping dissipates over the last tick at its velocity, and in total. The observer measures
+    // what it actually dissipated in the next tick.
+    float tickDissipated;
+    float totalDissipated;
+
+    // Damping applied in the last tick, and the largest applied, in device units (Ns/m)
+    float damping;
+    float maxDampingApplied;
+
+    // Number of ticks in which the controller added damping
+    int activeTicks;
+};
+
+
+// Struct to use for sending compute budget scheduler statistics to Unity
+struct SchedulerStats {
+    // Degradation level. Far effects are evaluated every 2^level ticks; 0 is full rate.
+    int level;
+
+    // Effects using held forces in the last tick, and effects eligible for reduced rate
+    int heldEffects;
+    int farEffects;
+
+    // Measured and estimated effect evaluation time per tick, and the budget, in microseconds
+    float tickCost;
+    float estimatedCost;
+    float budget;
+};
+
+
+// Struct to use for sending force cache statistics to Unity
+struct ForceCacheStats {
+    // Fraction of cacheable effects reusing their cached force, in the last tick and since enabled
+    float hitRate;
+    float totalHitRate;
+
+    // Cacheable effects reused and evaluated in the last tick
+    int hits;
+    int misses;
+};
+
+// Struct to use for sending per effect type telemetry to Unity. Times are servo clock time, in microseconds.
+struct EffectTelemetry {
+    // Ticks measured since telemetry was enabled or reset
+    int ticks;
+
+    // Effects evaluated in the last tick, counting each sub-step of rigid bodies and vibrations, and not counting cached
+    // or held effects
+    int evaluated;
+
+    // Time spent on the effect type in the last tick, on average, and in the slowest tick
+    float tickTime;
+    float meanTime;
+    float maxTime;
+
+    // Force contribution in the last tick, in graphics space
+    Vector3 force;
+};
+
+// Struct to use for sending external kernel timing to Unity. Times are servo clock time, in microseconds.
+struct KernelStats {
+    // Ticks measured since the servo stats were reset
+    int ticks;
+
+    // Effects evaluated and calls to the kernel in the last tick
+    int evaluated;
+    int calls;
+
+    // Time spent in the kernel in the last tick, on average, and in the slowest tick
+    float tickTime;
+    float meanTime;
+    float maxTime;
+};
+
+// Cached sum of one effect type's forces, and the probe state it was computed for
+struct ForceCache {
+    bool filled;
+    bool valid;
+    uint32_t groupMask;
+    double sum[3];
+    double torque[3];
+    double pos[3];
+    double vel[3];
+};
+
+// Device position, force and buttons, in device space, and torque in effect space, as last published by the servo
+// thread
+struct DeviceState {
+    double pos[3];
+    double force[3];
+    double torque[3];
+    int buttons;
+};
+
+
+// Struct to use for sending rigid body poses to Unity
+struct RigidBodyPose {
+    Vector3 position;
+    Quaternion rotation;
+};
+
+// Effect types, for calls that apply to any type
+enum EffectType {
+    SimpleForceEffect = 0,
+    ViscosityEffect = 1,
+    SurfaceEffect = 2,
+    SpringEffect = 3,
+    IntermolecularForceEffect = 4,
+    RandomForceEffect = 5,
+    RigidBodyEffect = 6,
+    DistanceFieldEffect = 7,
+    PathConstraintEffect = 8,
+    RadialForceEffect = 9,
+    VibrationEffect = 10,
+    ExpressionForceEffect = 11,
+    KernelForceEffect = 12,
+    ColliderEffect = 13,
+
+    // The molecular force field, for telemetry only as it has no groups
+    ForceFieldEffect = 14,
+
+    NumEffectTypes
+};
+
+// Built in vibration wavetables, with ids before any added
+enum Waveform {
+    SineWave = 0,
+    SquareWave = 1,
+    SawtoothWave = 2,
+
+    NumWaveforms
+};
+
+// Rigid body collision shapes
+enum RigidBodyShape {
+    RigidBodySphere = 0,
+    RigidBodyBox = 1
+};
+
+// Collider shapes, numbered as the rigid body shapes they share
+enum ColliderShape {
+    ColliderSphere = 0,
+    ColliderBox = 1,
+    ColliderCapsule = 2
+};
+
+// Rigid body pose in effect space, written by the servo thread and read by the application thread with a sequence lock
+struct PublishedPose {
+    std::atomic<unsigned int> sequence;
+    std::atomic<int> generation;
+    std::atomic<double> p[3];
+    std::atomic<double> q[4];
+};
+
 
 // Struct for simple force
 struct SimpleForce {
@@ -53,6 +254,13 @@ struct Surface {
     double c;
     double p[3];
     double n[3];
+
+    // Frame the parameters are in, or -1 for none
+    int frame;
+
+    // State, with the torque of the force about the device position from a multi-point probe
+    double f[3];
+    double t[3];
 };
 
 // Struct for spring
@@ -63,6 +271,14 @@ struct Spring {
     double r;
     double m;
     double p[3];
+
+    // Frame the parameters are in, or -1 for none
+    int frame;
+
+    // State, with the torque of the force about the device position from a multi-point probe
+    double f[3];
+    double t[3];
+    bool near;
 };
 
 // Struct for intermolecular force
@@ -73,6 +289,17 @@ struct IntermolecularForce {
     double r;
     double m;
     double p[3];
+
+    // Frame the parameters are in, or -1 for none
+    int frame;
+
+    // Graphics z axis in effect space, set when transformed, which the force is kept perpendicular to
+    double z[3];
+
+    // State, with the torque of the force about the device position from a multi-point probe
+    double f[3];
+    double t[3];
+    bool near;
 };
 
 // Struct for random force
@@ -89,17 +316,498 @@ struct RandomForce {
     double tStart;
 };
 
+// Struct for rigid body
+struct RigidBody {
+    // Parameters
+    double mass;
+    double inertia[3];
+    int shape;
+    double extents[3];
+    double k;
+    double c;
+    double linearDrag;
+    double angularDrag;
+    bool grab;
+
+    // Pose, with rotation as a quaternion (x, y, z, w). Only applied to the servo state when the generation changes.
+    double p[3];
+    double q[4];
+    int generation;
+
+    // Where the servo thread publishes the pose
+    PublishedPose* published;
+
+    // State
+    double v[3];
+    double w[3];
+    bool attached;
+    double grabOffset[3];
+};
+
+// Struct for signed distance field volume
+struct DistanceField {
+    // Parameters
+    double k;
+    double c;
+
+    // Placement of the grid's local space, with rotation as a quaternion (x, y, z, w)
+    double p[3];
+    double q[4];
+
+    // Grid, owned by the application thread, and the transform from effect space to the grid's local space
+    const DistanceGrid* grid;
+    double toLocal[16];
+
+    // State
+    double f[3];
+};
+
+// Struct for path constraint
+struct PathConstraint {
+    // Parameters
+    double k;
+    double c;
+    double r;
+    double along;
+
+    // Placement of the path's local space, with rotation as a quaternion (x, y, z, w)
+    double p[3];
+    double q[4];
+
+    // Path, owned by the application thread, and the transforms between effect space and the path's local space
+    const ConstraintPath* path;
+    double toLocal[16];
+    double toEffect[16];
+
+    // State
+    double f[3];
+    int segment;
+};
+
+// Force against distance shared by radial forces, sampled uniformly from zero to maxDistance in graphics units.
+// Positive forces push away from the center.
+struct RadialProfile {
+    std::vector<double> forces;
+    double maxDistance;
+    bool cubic;
+};
+
+// Struct for radial force
+struct RadialForce {
+    // Parameters
+    double scale;
+    double c;
+    double p[3];
+
+    // Profile, owned by the application thread, and the scale from effect space distance to profile sample index
+    const RadialProfile* profile;
+    double toSample;
+
+    // State
+    double f[3];
+};
+
+// One period of a vibration waveform, sampled uniformly, with the first sample repeated at the end for interpolation
+const int wavetableSize = 256;
+
+struct Wavetable {
+    float samples[wavetableSize + 1];
+};
+
+// Struct for vibration
+struct Vibration {
+    // Parameters
+    const Wavetable* wavetable;
+    double direction[3];
+    double amplitude;
+    double frequency;
+    double attack;
+    double decay;
+    double sustain;
+    double release;
+
+    // Trigger and release requests, applied to the servo state only when their generations change, and how long a
+    // trigger lasts
+    int triggerGeneration;
+    int releaseGeneration;
+    double duration;
+
+    // State. The phase wraps at 2^32 for one period.
+    double f[3];
+    uint32_t phase;
+    double t;
+    double releaseTime;
+    double releaseLevel;
+    bool active;
+};
+
+// Struct for expression force
+struct ExpressionForce {
+    // Parameters
+    const ExpressionProgram* program;
+    double parameters[numExpressionParameters];
+
+    // Transform from effect space to graphics space for the position and velocity, and the scale from graphics forces
+    // mapped by its transpose to effect space forces
+    double toGraphics[16];
+    double forceScale;
+
+    // State. Time since the effect was added.
+    double f[3];
+    double t;
+};
+
+// Most external kernels registered
+const int maxKernels = 16;
+
+// Struct for external kernel force
+struct KernelForce {
+    // Parameters
+    int kernel;
+    double parameters[FALCON_KERNEL_MAX_PARAMETERS];
+
+    // Transform from effect space to graphics space for the probe, and the scale for forces, as for expression forces
+    double toGraphics[16];
+    double forceScale;
+};
+
+// Cells of the collider broadphase grid one collider can be listed in, with larger colliders always tested, and
+// buckets the cells are hashed into
+const int maxColliderCells = 8;
+const int numColliderBuckets = 4096;
+
+// Struct for primitive collider
+struct Collider {
+    // Parameters
+    int shape;
+    double extents[3];
+    double k;
+    double c;
+
+    // Position and rotation as a quaternion (x, y, z, w)
+    double p[3];
+    double q[4];
+
+    // Rotation as a matrix, and bounds, in effect space
+    double rotation[16];
+    double lo[3];
+    double hi[3];
+
+    // Broadphase state. The grid buckets the collider is listed in, -1 for the list of large colliders, the next
+    // entry in each of those lists, and the bit of the collider's group.
+    int buckets[maxColliderCells];
+    int next[maxColliderCells];
+    int numBuckets;
+    uint32_t groupBit;
+};
+
+// Most frames, so the servo loop can keep each frame's probe without allocating
+const int maxFrames = 1024;
+
+// Frame for effects, application thread only
+struct Frame {
+    // Parent frame, or -1 for graphics space
+    int parent;
+    bool used;
+
+    // Transforms from the frame to its parent and to graphics space
+    double local[16];
+    double world[16];
+};
+
+// Frame transforms published to the servo thread as a whole. Each frame has 32 values, the transform from effect
+// space to the frame's local effect space, then the transform back.
+struct FrameSet {
+    std::vector<double> transforms;
+};
+
+// Transform from device space to effect space, published to the servo thread when the graphics workspace changes
+struct WorkspaceMap {
+    double toEffect[16];
+};
+
+// Points evaluated together by force queries, in structure of arrays form so the arithmetic vectorizes across them
+const int forceQueryBlock = 256;
+
+// Effects evaluated by force queries, copied in effect space from the application thread's effects. Surfaces and
+// springs are moved out of their frames; intermolecular forces keep them, with the frame transforms as for FrameSet.
+struct ForceQuery {
+    double simpleForce[3];
+    std::vector<Surface> surfaces;
+    std::vector<Spring> springs;
+    std::vector<IntermolecularForce> intermolecularForces;
+    std::vector<DistanceField> distanceFields;
+    std::vector<PathConstraint> pathConstraints;
+    std::vector<RadialForce> radialForces;
+    std::vector<Collider> colliders;
+    std::vector<double> frameTransforms;
+};
+
+// Sample points of a multi-point probe
+const int maxProbePoints = 64;
+
+// Probe points published to the servo thread, as offsets from the probe position and sphere radii in effect space,
+// in structure of arrays form so effects vectorize across them. No points for a single point probe.
+struct ProbePoints {
+    int n;
+    double x[maxProbePoints];
+    double y[maxProbePoints];
+    double z[maxProbePoints];
+    double radius[maxProbePoints];
+
+    // Largest distance from the probe position to the edge of a sphere, and the largest radius
+    double extent;
+    double maxRadius;
+};
+
+// Keep servo state when updating effect parameters
+void UpdateParameters(Viscosity& v, const Viscosity& parameters);
+void UpdateParameters(Surface& s, const Surface& parameters);
+void UpdateParameters(Spring& s, const Spring& parameters);
+void UpdateParameters(IntermolecularForce& imf, const IntermolecularForce& parameters);
+void UpdateParameters(RandomForce& rf, const RandomForce& parameters);
+void UpdateParameters(RigidBody& rb, const RigidBody& parameters);
+void UpdateParameters(DistanceField& df, const DistanceField& parameters);
+void UpdateParameters(PathConstraint& pc, const PathConstraint& parameters);
+void UpdateParameters(RadialForce& rf, const RadialForce& parameters);
+void UpdateParameters(Vibration& v, const Vibration& parameters);
+void UpdateParameters(ExpressionForce& ef, const ExpressionForce& parameters);
+void UpdateParameters(Collider& c, const Collider& parameters);
+
+// Application interface to the device, implemented in this process by Falcon, and by FalconClient when a haptic
+// server process owns the device. See Falcon for descriptions of the parameters.
+class FalconInterface {
+public:
+    virtual ~FalconInterface() {}
+
+    virtual bool Initialize() = 0;
+    virtual bool IsInitialized() = 0;
+    virtual bool InitializeAsync() = 0;
+    virtual InitializeStatus GetInitializeStatus() = 0;
+
+    virtual void SetRealTime(bool enable, int cpu, int priority) = 0;
+    virtual void SetServoRate(float hz) = 0;
+    virtual void SetSubsteps(int n) = 0;
+
+    virtual void SetPassivityControl(bool enable, float maxDamping) = 0;
+    virtual PassivityStats GetPassivityStats() = 0;
+
+    virtual void SetComputeBudget(bool enable, float budget, float nearRadius) = 0;
+    virtual SchedulerStats GetSchedulerStats() = 0;
+
+    virtual void SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon) = 0;
+    virtual ForceCacheStats GetForceCacheStats() = 0;
+
+    virtual ServoStats GetServoStats() = 0;
+    virtual void ResetServoStats() = 0;
+
+    virtual void SetTelemetry(bool enable) = 0;
+    virtual EffectTelemetry GetEffectTelemetry(int type) = 0;
+    virtual void ResetTelemetry() = 0;
+
+    virtual void SetGraphicsWorkspace(Vector3 center, Vector3 size) = 0;
+    virtual void SetGraphicsWorkspace(Vector3 center, Vector3 size, Quaternion rotation) = 0;
+
+    virtual void ResetForces() = 0;
+
+    virtual Vector3 GetPosition() = 0;
+    virtual Vector3 GetForce() = 0;
+    virtual Vector3 GetTorque() = 0;
+    virtual bool GetButton(int button) = 0;
+
+    virtual void UseForceFeedback(bool use) = 0;
+    virtual void SetProxyPosition(Vector3 p) = 0;
+
+    virtual int AddSimpleForce(Vector3 f) = 0;
+    virtual void UpdateSimpleForce(int i, Vector3 f) = 0;
+    virtual void RemoveSimpleForce(int i) = 0;
+    virtual void RemoveSimpleForces() = 0;
+
+    virtual int AddViscosity(float c, float w) = 0;
+    virtual void UpdateViscosity(int i, float c, float w) = 0;
+    virtual void RemoveViscosity(int i) = 0;
+    virtual void RemoveViscosities() = 0;
+
+    virtual int AddSurface(Vector3 p, Vector3 n, float k, float c) = 0;
+    virtual void UpdateSurface(int i, Vector3 p, Vector3 n, float k, float c) = 0;
+    virtual void RemoveSurface(int i) = 0;
+    virtual void RemoveSurfaces() = 0;
+
+    virtual int AddSpring(Vector3 p, float k, float c, float r, float m) = 0;
+    virtual void UpdateSpring(int i, Vector3 p, float k, float c, float r, float m) = 0;
+    virtual void RemoveSpring(int i) = 0;
+    virtual void RemoveSprings() = 0;
+
+    virtual int AddIntermolecularForce(Vector3 p, float k, float c, float r, float m) = 0;
+    virtual void UpdateIntermolecularForce(int i, Vector3 p, float k, float c, float r, float m) = 0;
+    virtual void RemoveIntermolecularForce(int i) = 0;
+    virtual void RemoveIntermolecularForces() = 0;
+
+    virtual int AddRandomForce(float minMag, float maxMag, float minTime, float maxTime) = 0;
+    virtual void UpdateRandomForce(int i, float minMag, float maxMag, float minTime, float maxTime) = 0;
+    virtual void RemoveRandomForce(int i) = 0;
+    virtual void RemoveRandomForces() = 0;
+
+    virtual int AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) = 0;
+    virtual void UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) = 0;
+    virtual void SetRigidBodyPose(int i, Vector3 p, Quaternion r) = 0;
+    virtual RigidBodyPose GetRigidBodyPose(int i) = 0;
+    virtual void GrabRigidBody(int i, bool grab) = 0;
+    virtual void RemoveRigidBody(int i) = 0;
+    virtual void RemoveRigidBodies() = 0;
+    virtual void SetRigidBodyGravity(Vector3 g) = 0;
+
+    virtual int AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c) = 0;
+    virtual int AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c) = 0;
+    virtual void UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c) = 0;
+    virtual bool IsDistanceFieldReady(int i) = 0;
+    virtual void RemoveDistanceField(int i) = 0;
+    virtual void RemoveDistanceFields() = 0;
+
+    virtual int AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along) = 0;
+    virtual void UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along) = 0;
+    virtual void RemovePathConstraint(int i) = 0;
+    virtual void RemovePathConstraints() = 0;
+
+    virtual int AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic) = 0;
+    virtual void RemoveRadialProfile(int profile) = 0;
+    virtual int AddRadialForce(Vector3 p, int profile, float scale, float c) = 0;
+    virtual void UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c) = 0;
+    virtual void RemoveRadialForce(int i) = 0;
+    virtual void RemoveRadialForces() = 0;
+
+    virtual int AddWavetable(const float* samples, int numSamples) = 0;
+    virtual void RemoveWavetable(int wavetable) = 0;
+    virtual int AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) = 0;
+    virtual void UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) = 0;
+    virtual void TriggerVibration(int i, float duration) = 0;
+    virtual void ReleaseVibration(int i) = 0;
+    virtual void RemoveVibration(int i) = 0;
+    virtual void RemoveVibrations() = 0;
+
+    virtual int AddExpressionForce(const char* expression) = 0;
+    virtual void SetExpressionParameters(int i, const float* parameters, int numParameters) = 0;
+    virtual void RemoveExpressionForce(int i) = 0;
+    virtual void RemoveExpressionForces() = 0;
+
+    virtual int LoadKernelLibrary(const char* fileName) = 0;
+    virtual int FindKernel(const char* name) = 0;
+    virtual int AddKernelForce(int kernel, const float* parameters, int numParameters) = 0;
+    virtual void UpdateKernelForce(int i, const float* parameters, int numParameters) = 0;
+    virtual void RemoveKernelForce(int i) = 0;
+    virtual void RemoveKernelForces() = 0;
+    virtual KernelStats GetKernelStats(int kernel) = 0;
+
+    virtual int AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) = 0;
+    virtual void UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) = 0;
+    virtual void RemoveCollider(int i) = 0;
+    virtual void RemoveColliders() = 0;
+
+    virtual int AddFrame(int parent) = 0;
+    virtual void SetFrames(const int* frames, const float* matrices, int n) = 0;
+    virtual void RemoveFrame(int frame) = 0;
+    virtual void RemoveFrames() = 0;
+    virtual void SetEffectFrame(int type, int i, int frame) = 0;
+
+    virtual int EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads) = 0;
+
+    virtual void SetProbePoints(const Vector3* offsets, const float* radii, int n) = 0;
+
+    virtual void SetEffectGroup(int type, int i, int group) = 0;
+    virtual void SetGroupMask(unsigned int mask) = 0;
+    virtual void SetGroupEnabled(int group, bool enable) = 0;
+    virtual unsigned int GetGroupMask() = 0;
+
+    virtual void SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) = 0;
+    virtual void SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) = 0;
+    virtual void SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads) = 0;
+    virtual ForceFieldStats GetForceFieldStats() = 0;
+
+    virtual bool LoadSceneData(const void* data, int size) = 0;
+    virtual int SaveSceneData(void* data, int size) = 0;
+
+    // Memory-map a scene file and load it, or save the current scene to a file
+    bool LoadScene(const char* fileName);
+    bool SaveScene(const char* fileName);
+};
+
 // The class encapsulating the Falcon device
-class Falcon {
+class Falcon : public FalconInterface {
 public:
     Falcon();
     virtual ~Falcon();
 
-    // Initialize HDL library
+    // Open the device and start the servo loop
     bool Initialize();
-
-    // Set the workspace of the graphics scene that will be mapped to the device workspace
+    bool IsInitialized();
+
+    // Initialize without blocking. The device is opened on another thread, and polling GetInitializeStatus() from the
+    // application thread starts the servo loop once it is open. Effects and the graphics workspace can be set while
+    // initializing, and take effect when the servo loop starts. Returns false if already initializing or initialized.
+    bool InitializeAsync();
+    InitializeStatus GetInitializeStatus();
+
+    // Real-time servo thread, for devices without their own servo thread. Set before Initialize().
+    // cpu: CPU to pin the servo thread to. Negative for no affinity.
+    // priority: SCHED_FIFO priority, 1 to 99.
+    // Also locks and pre-faults memory. Linux only; ignored when the device provides its own servo thread, as HDAL does.
+    void SetRealTime(bool enable, int cpu = -1, int priority = 80);
+
+    // Servo tick rate in Hz, from 1 to 10 kHz. Only for devices without their own servo thread; HDAL runs at 1 kHz.
+    void SetServoRate(float hz);
+
+    // Number of physics sub-steps per servo tick. Rigid bodies and vibrations, which integrate over time, are stepped
+    // this many times per tick, with the probe moving across the tick, and the force at the end of the last sub-step
+    // is sent. Other effects only depend on the probe, so are evaluated once per tick at its current position.
+    void SetSubsteps(int n);
+
+    // Passivity observer and controller. Tracks the energy flowing through the device each tick and, when the virtual
+    // environment has generated energy, adds just enough damping to dissipate the excess, so stiff effects stay stable
+    // under tick jitter. The observer starts over when the controller is turned on, when forces are reset and when the
+    // graphics workspace changes.
+    // maxDamping: Maximum damping coefficient the controller may add, in graphics units like other damping coefficients
+    void SetPassivityControl(bool enable, float maxDamping = 1.0f);
+    PassivityStats GetPassivityStats();
+
+    // Per-tick compute budget with effect level of detail. When the measured effect evaluation time approaches the
+    // budget, springs and intermolecular forces farther than nearRadius from the probe are evaluated round-robin at
+    // reduced rates, holding their last force in between. Effects near or in contact with the probe, and all other
+    // effect types, stay at full rate.
+    // budget: Effect evaluation time per tick, in microseconds
+    // nearRadius: Distance from the probe within which effects always run at full rate, in graphics units
+    void SetComputeBudget(bool enable, float budget = 500.0f, float nearRadius = 1.0f);
+    SchedulerStats GetSchedulerStats();
+
+    // Force caching. Surfaces, springs and intermolecular forces keep their last force, and while the probe position
+    // and velocity stay within the given epsilons of where those forces were computed, only effects whose parameters
+    // have changed are re-evaluated. Not used while the compute budget scheduler is degrading.
+    // positionEpsilon: In graphics units
+    // velocityEpsilon: In graphics units per second
+    void SetForceCache(bool enable, float positionEpsilon = 0.001f, float velocityEpsilon = 0.01f);
+    ForceCacheStats GetForceCacheStats();
+
+    // Servo tick timing statistics, including requested and achieved tick rate
+    ServoStats GetServoStats();
+    void ResetServoStats();
+
+    // Per effect type telemetry. When enabled, the servo loop times each effect type and keeps its force contribution,
+    // publishing them every tick. The contributions sum to the force before passivity control. Off by default, as
+    // reading the clock for every type adds to each tick.
+    // type: EffectType, including ForceFieldEffect
+    void SetTelemetry(bool enable);
+    EffectTelemetry GetEffectTelemetry(int type);
+    void ResetTelemetry();
+
+    // Set the workspace of the graphics scene that will be mapped to the device workspace.
+    // The rotation is applied to the graphics workspace about its center.
+    // Force effects are transformed to effect space when added or updated, so changing the workspace
+    // re-transforms all effects off the servo thread and swaps them in at the next servo tick, without waiting for it.
+    // Before the device is open the workspace is kept, and applied when the servo loop starts.
+    // Effect space is graphics space with lengths, spring constants and damping coefficients scaled by the mean
+    // workspace scale. The servo loop maps the device position into it and the force back out along each axis, so
+    // effects act as they would in graphics space even when the workspaces have different proportions.
     void SetGraphicsWorkspace(Vector3 center, Vector3 size);
+    void SetGraphicsWorkspace(Vector3 center, Vector3 size, Quaternion rotation);
 
 	// Reset forces
 	void ResetForces();
@@ -111,6 +819,10 @@ public:
     // Get the displayed force
     Vector3 GetForce();
 
+    // Get the torque of the displayed force about the device position, from a multi-point probe. The device can't
+    // render it, but the application can apply it to the tool it draws.
+    Vector3 GetTorque();
+
     // Get the device buttons
     bool GetButton(int button);
 
@@ -192,27 +904,415 @@ public:
     void RemoveRandomForce(int i);
     void RemoveRandomForces();
 
+    // Rigid bodies
+    // Simulated in the servo loop. The probe pushes a body through contact with its collision shape, and while grabbed
+    // is coupled to the point it grabbed through a virtual spring-damper. Bodies also rest on and collide with contact
+    // surfaces. Coupling stiffness is limited to what the body's mass can integrate stably at the servo rate; use
+    // sub-steps for light bodies with stiff coupling.
+    // p: Position
+    // r: Rotation
+    // mass: Mass
+    // inertia: Principal moments of inertia, about the body axes
+    // shape: RigidBodySphere with radius extents.x, or RigidBodyBox with half extents
+    // k: Coupling and contact spring constant
+    // c: Coupling and contact damping coefficient
+    // linearDrag: Damping coefficient on the body's velocity
+    // angularDrag: Damping coefficient on the body's angular velocity
+    int AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag = 0.0f, float angularDrag = 0.0f);
+    void UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag = 0.0f, float angularDrag = 0.0f);
+    void SetRigidBodyPose(int i, Vector3 p, Quaternion r);
+    RigidBodyPose GetRigidBodyPose(int i);
+    void GrabRigidBody(int i, bool grab);
+    void RemoveRigidBody(int i);
+    void RemoveRigidBodies();
+
+    // Acceleration of gravity for rigid bodies, in graphics units
+    void SetRigidBodyGravity(Vector3 g);
+
+    // Signed distance fields
+    // Solid shapes given by a grid of signed distances, negative inside, in the shape's local space. Contact is
+    // rendered like a surface, from the distance and gradient interpolated at the probe, so the cost per tick doesn't
+    // depend on the shape. The probe feels nothing outside the grid. Scenes save the grid's samples, or an empty grid
+    // for one still being built from a mesh.
+    // distances: nx * ny * nz samples, x varying fastest, at origin + index * cellSize in local space
+    // p: Position of the local space
+    // r: Rotation of the local space
+    // k: Spring constant
+    // c: Damping coefficient
+    int AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c);
+
+    // Build the grid from a closed triangle mesh in local space on a background thread. The effect renders no force
+    // until the grid is ready.
+    // triangles: Three vertex indices per triangle
+    // resolution: Grid cells along the longest side of the mesh, at most 250
+    int AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c);
+    void UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c);
+    bool IsDistanceFieldReady(int i);
+    void RemoveDistanceField(int i);
+    void RemoveDistanceFields();
+
+    // Path constraints
+    // Pull the probe towards the closest point on a path, for guiding motion along it. Paths are given in their local
+    // space by control points, joined by straight segments or by a spline through them. The closest point is found
+    // from a tree of segment bounds, so the cost per tick depends on how many segments are nearly as close as the
+    // closest, which is few when the probe is near the path. Scenes save the path as built, so a spline path loads as
+    // the straight segments it was divided into.
+    // spline: Interpolate the points with a Catmull-Rom spline
+    // closed: Join the last point to the first
+    // p: Position of the local space
+    // r: Rotation of the local space
+    // k: Spring constant
+    // c: Damping coefficient, across the path only
+    // radius: Distance from the path within which the probe moves freely
+    // along: Force pushing the probe along the path, towards the last point if positive
+    int AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+    void UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+    void RemovePathConstraint(int i);
+    void RemovePathConstraints();
+
+    // Radial forces
+    // Forces along the line from a point to the probe, with magnitude looked up from a profile of force against
+    // distance, for Lennard-Jones-like curves and custom falloffs. A profile is uploaded once and shared by any number
+    // of radial forces, which the servo loop evaluates in batches. Scenes save the profiles with their ids.
+    // forces: numSamples forces at distances evenly spaced from 0 to maxDistance, positive pushing away. The force
+    //         is zero beyond maxDistance.
+    // cubic: Interpolate samples with a Catmull-Rom spline instead of linearly
+    // Returns the profile id, kept until removed. Removing a profile doesn't affect radial forces using it.
+    int AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic);
+    void RemoveRadialProfile(int profile);
+
+    // p: Position
+    // profile: Profile id
+    // scale: Multiplies the profile's forces
+    // c: Damping coefficient
+    int AddRadialForce(Vector3 p, int profile, float scale, float c);
+    void UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c);
+    void RemoveRadialForce(int i);
+    void RemoveRadialForces();
+
+    // Vibrations
+    // Periodic forces generated in the servo loop, so frequencies up to half the servo rate are possible, shaped by an
+    // attack, decay, sustain, release envelope. A vibration is silent until triggered. Scenes save the wavetables with
+    // their ids, and vibrations load untriggered.
+    // samples: One period of a custom waveform, resampled to wavetableSize samples
+    // Returns the wavetable id, after the built in Waveform ids, kept until removed. Removing a wavetable doesn't
+    // affect vibrations using it.
+    int AddWavetable(const float* samples, int numSamples);
+    void RemoveWavetable(int wavetable);
+
+    // wavetable: Waveform or added wavetable id
+    // direction: Direction of the force
+    // amplitude: Peak force
+    // frequency: Frequency in Hz
+    // attack: Time to rise to full amplitude after a trigger
+    // decay: Time to fall from full amplitude to the sustain level
+    // sustain: Level held until release, from 0 to 1. With 0 the vibration ends after its decay.
+    // release: Time to fall to silence after release
+    // Changing parameters keeps the phase and envelope, so there are no clicks.
+    int AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+    void UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+
+    // Restart the envelope and waveform at the next servo tick, releasing after duration seconds, or when released if
+    // duration is 0
+    void TriggerVibration(int i, float duration);
+    void ReleaseVibration(int i);
+    void RemoveVibration(int i);
+    void RemoveVibrations();
+
+    // Expression forces
+    // Custom forces given by expressions of the probe position and velocity in graphics space, the time since the
+    // effect was added and up to numExpressionParameters user parameters, giving the force in graphics space. See
+    // CompileExpression for the syntax; for example a spring to the origin is "fx = -u0 * px; fy = -u0 * py;
+    // fz = -u0 * pz". Expressions are compiled here and run as bytecode in the servo loop, roughly 5 to 10 times slower
+    // than the equivalent built in effect (see FalconTest -benchmark). A force that isn't finite is zero. Scenes save
+    // the expression's text, which is compiled again when loaded.
+    // Returns the effect id, or -1 if the expression doesn't compile, printing the error.
+    int AddExpressionForce(const char* expression);
+
+    // Set parameters u0 to u7 from the first numParameters values, leaving the others unchanged. All are 0 when added.
+    void SetExpressionParameters(int i, const float* parameters, int numParameters);
+    void RemoveExpressionForce(int i);
+    void RemoveExpressionForces();
+
+    // External kernel forces
+    // Forces computed by kernels from shared libraries, for force models that aren't built in, without changing the
+    // plugin. Each tick a kernel is called with the probe in graphics space and batches of up to
+    // FALCON_KERNEL_BATCH_SIZE of its effects, each parameter in its own array; see FalconKernel.h. Kernels stay
+    // registered until the plugin is shut down. Kernels are functions of the process that registered them, so kernel
+    // forces aren't saved in scenes, and loading a scene removes them.
+    // Load a library exporting FalconGetKernels and register its kernels, skipping any with the name of one already
+    // registered. Returns the number registered, or -1 if the library can't be loaded.
+    int LoadKernelLibrary(const char* fileName);
+
+    // Register a kernel from this process, returning its id, or -1 if there is no room or the name is taken
+    int RegisterKernel(const FalconKernel& kernel);
+
+    // Id of the kernel with the given name, or -1
+    int FindKernel(const char* name);
+
+    // kernel: Kernel id
+    // parameters: The kernel's parameters, with any not given 0
+    int AddKernelForce(int kernel, const float* parameters, int numParameters);
+    void UpdateKernelForce(int i, const float* parameters, int numParameters);
+    void RemoveKernelForce(int i);
+    void RemoveKernelForces();
+
+    // Time spent in a kernel, measured every tick and reset with the servo stats
+    KernelStats GetKernelStats(int kernel);
+
+    // Primitive colliders
+    // Solid spheres, boxes and capsules, rendered like surfaces from the closed form distance and normal at the probe,
+    // for scenes built from primitive colliders. Colliders are kept in a grid by their bounds, so each tick only the
+    // few near the probe are tested, and scenes of thousands cost little more than a few. Updated colliders are moved
+    // in the grid in the next servo tick, but adding, removing or regrouping colliders rebuilds it, taking roughly
+    // 60 ns per collider, so load large scenes of them with LoadScene rather than adding them one at a time.
+    // shape: ColliderSphere with radius extents.x, ColliderBox with half extents, or ColliderCapsule with radius
+    //        extents.x and half the distance between the centers of its ends extents.y, along its local y axis
+    // p: Position of the local space
+    // r: Rotation of the local space
+    // k: Spring constant
+    // c: Damping coefficient
+    int AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+    void UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+    void RemoveCollider(int i);
+    void RemoveColliders();
+
+    // Frames
+    // Surfaces, springs and intermolecular forces can be placed in a frame, a transform the application moves for all
+    // of their effects at once. Their parameters are then in the frame's local space, and the servo loop transforms
+    // the probe into each frame rather than moving every effect. Frames can have a parent frame, so articulated
+    // objects only update the joints that moved. Springs in frames match springs with their anchors moved out of the
+    // frame, and other effects do too when the frame's transform is rigid. Planar intermolecular forces use the
+    // frame's xy plane. Moving frames refills the force caches. Scenes save frames with their ids, and effects with
+    // their frames.
+    // parent: Parent frame, or -1 for graphics space
+    // Returns the frame id, or -1 if there are already maxFrames frames
+    int AddFrame(int parent);
+
+    // Set frame transforms, relative to their parents, in one call
+    // frames: Frame ids
+    // matrices: Column-major 4x4 transforms, 16 values per frame, as laid out by Unity's Matrix4x4. Effects are
+    //           scaled with any scale in the transform.
+    void SetFrames(const int* frames, const float* matrices, int n);
+
+    // Children and effects of a removed frame move to its parent. The frame's transform is folded into the children's
+    // transforms and the effects' positions and surface normals, so they stay in place, but any scale in it no longer
+    // scales the effects, and planar intermolecular forces use the parent's xy plane.
+    void RemoveFrame(int frame);
+    void RemoveFrames();
+
+    // type: EffectType of the effect. Other types than surfaces, springs and intermolecular forces are ignored.
+    // i: Id of the effect
+    // frame: Frame, or -1 for graphics space
+    void SetEffectFrame(int type, int i, int frame);
+
+    // Force queries
+    // Evaluate the forces of the current effects at many points in one call, on worker threads, for drawing force
+    // fields. The servo loop and its effects are left alone. Simple forces, surfaces, springs, intermolecular forces,
+    // distance fields, path constraints, radial forces and colliders in enabled groups are evaluated, as seen by a
+    // still probe, so damping doesn't contribute. Effects with state of their own, expressions, kernels, rigid bodies
+    // and the molecular force field are left out.
+    // points: Points in graphics space
+    // forces: Forces at the points in graphics space, as from GetForce()
+    // numThreads: Worker threads. Zero for all but two hardware threads.
+    // Returns the number of points evaluated
+    int EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads);
+
+    // Multi-point probes
+    // Sample the probe at points or spheres rigidly attached to the device, for tools with extent such as a scalpel
+    // blade or a stylus tip and shaft. Surfaces, springs, intermolecular forces, distance fields, radial forces and
+    // colliders are evaluated at every point and their forces summed, so an effect acting on several points is as
+    // strong as one effect per point. Surfaces, distance fields and colliders push spheres out by their radius, so
+    // surfaces no longer need dilating by the proxy radius. Other effects act at the device position. Points keep
+    // their offsets in graphics space as the device moves; set them again to turn the tool. Radii aren't scaled by
+    // frames.
+    // offsets: Offsets from the device position in graphics space
+    // radii: Sphere radii in graphics units, or null for points
+    // n: Number of points, up to maxProbePoints. Zero for a single point at the device position.
+    void SetProbePoints(const Vector3* offsets, const float* radii, int n);
+
+    // Effect groups
+    // Every effect is in one of 32 groups, group 0 when added, and only effects in enabled groups are evaluated. Turning
+    // a group off keeps its effects and their state, and its effects cost nothing in the servo loop until it is turned
+    // back on. Rigid bodies in disabled groups are frozen. All groups are enabled to start with.
+    // type: EffectType of the effect
+    // i: Id of the effect
+    // group: Group from 0 to 31
+    void SetEffectGroup(int type, int i, int group);
+
+    // Enable the groups whose bits are set in mask, in a single change seen by the next servo tick
+    void SetGroupMask(unsigned int mask);
+    void SetGroupEnabled(int group, bool enable);
+    unsigned int GetGroupMask();
+
+    // Molecular force field
+    // Lennard-Jones and Coulomb interactions in 3D between a ligand attached to the probe and a receptor, summed on
+    // worker threads and rendered at servo rate from the latest local linear model of force and stiffness.
+    // p: Atom positions. Ligand positions are relative to the probe.
+    // sigma: Lennard-Jones radius
+    // epsilon: Lennard-Jones well depth
+    // charge: Partial charge
+    void SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n);
+    void SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n);
+
+    // cutoff: Distance beyond which atom pairs are ignored
+    // coulombConstant: Coulomb constant divided by the dielectric constant, in force field units
+    // forceScale: Scale from force field units to graphics force units
+    // maxForce: Largest force rendered
+    // maxStiffness: Largest stiffness rendered, in graphics units like other spring constants
+    // c: Damping coefficient
+    // numThreads: Worker threads. Zero for all but two hardware threads.
+    void SetForceField(bool enable, float cutoff = 10.0f, float coulombConstant = 332.06f, float forceScale = 0.01f, float maxForce = 5.0f, float maxStiffness = 10.0f, float c = 0.0f, int numThreads = 0);
+    ForceFieldStats GetForceFieldStats();
+
+    // Scenes
+    // Replace all effects and the rigid body gravity with a scene in the binary format of Scene.h. The effect stores
+    // are built directly rather than adding effects one at a time, and effects of each type get ids 0 to n - 1 in the
+    // order they are stored. The force field isn't part of a scene, and nor are kernel forces, which are removed.
+    // Returns false, keeping the current scene, if the data isn't a valid scene.
+    bool LoadSceneData(const void* data, int size);
+
+    // Write the current scene, with effects of each type in id order and rigid bodies at their current pose. Returns
+    // the size of the scene in bytes, and only writes it if that is no more than size, so a null buffer gets the size.
+    int SaveSceneData(void* data, int size);
+
 protected:    
     // Define callback functions as friends
-    friend HDLServoOpExitCode ForceCB(void* userData);
-    friend HDLServoOpExitCode SynchronizeCB(void* userData);
+    friend void ServoTick(void* userData);
 
 
-    // Device information
+    // Device information, in device space with the torque in effect space, servo thread only
     double pos[3];
     double force[3];
+    double torque[3];
     int buttons;
 
+    // Device information published from the servo thread with a sequence lock
+    std::atomic<unsigned int> publishedStateSequence;
+    std::atomic<double> publishedPos[3];
+    std::atomic<double> publishedForce[3];
+    std::atomic<double> publishedTorque[3];
+    std::atomic<int> publishedButtons;
 
-    // Non-force-feedback mode
-    bool useForceFeedback;
-    double proxyPos[3];
 
+    // Non-force-feedback mode, in device space
+    std::atomic<bool> useForceFeedback;
+    std::atomic<double> proxyPos[3];
 
-    // For velocity calculation
+
+    // For velocity calculation, in device space
     double oldPos[3]; 
     double oldTime;
 
+    // Random number generator state, so the servo loop doesn't call rand()
+    uint64_t randomState;
+
+    // Physics sub-steps per servo tick
+    std::atomic<int> substeps;
+
+
+    // Passivity controller, with maximum damping in device space
+    std::atomic<bool> usePassivityControl;
+    std::atomic<double> passivityMaxDamping;
+    float passivityMaxDampingSource;
+
+    // Passivity observer state, servo thread only, with the force sent to the device last tick, which acted over the
+    // displacement the observer measures
+    double sentForce[3];
+    double passivityEnergy;
+    double passivityTotalDissipated;
+    double passivityMaxDampingApplied;
+    int passivityActiveTicks;
+
+    // Bumped by the application thread to start the observer over, when the controller is enabled and when forces are
+    // reset or the workspace changes, and the generation the servo thread last started over for
+    std::atomic<int> passivityResetGeneration;
+    int passivityGeneration;
+
+    // Passivity statistics published from the servo thread
+    std::atomic<double> publishedPassivity[5];
+    std::atomic<int> publishedPassivityActiveTicks;
+
+
+    // Compute budget scheduler settings, with budget in nanoseconds and near radius in effect space
+    std::atomic<bool> useComputeBudget;
+    std::atomic<double> computeBudget;
+    std::atomic<double> lodRadius;
+    float lodRadiusSource;
+
+    // Scheduler state, servo thread only
+    int lodLevel;
+    unsigned int lodMask;
+    unsigned int lodTick;
+    int lodCooldown;
+    double measuredCost;
+    double costCalibration;
+
+    // Per-tick scheduler counts, servo thread only
+    int numHeldEffects;
+    int numFarEffects;
+    double farCost;
+    double fullRateCost;
+
+    // Force cache settings, with epsilons in effect space
+    std::atomic<bool> useForceCache;
+    std::atomic<double> cachePositionEpsilon;
+    std::atomic<double> cacheVelocityEpsilon;
+    float cachePositionEpsilonSource;
+    float cacheVelocityEpsilonSource;
+
+    // Force caches, servo thread only
+    ForceCache surfaceCache;
+    ForceCache springCache;
+    ForceCache intermolecularForceCache;
+
+    // Force cache counts, servo thread only
+    int cacheHits;
+    int cacheMisses;
+    int64_t totalCacheHits;
+    int64_t totalCacheMisses;
+
+    // Force cache statistics published from the servo thread
+    std::atomic<int> publishedCacheHits;
+    std::atomic<int> publishedCacheMisses;
+    std::atomic<int64_t> publishedTotalCacheHits;
+    std::atomic<int64_t> publishedTotalCacheMisses;
+
+    // Scheduler statistics published from the servo thread
+    std::atomic<int> publishedLodLevel;
+    std::atomic<int> publishedHeldEffects;
+    std::atomic<int> publishedFarEffects;
+    std::atomic<double> publishedMeasuredCost;
+    std::atomic<double> publishedEstimatedCost;
+
+
+    // Telemetry settings, and whether it is on for the current tick
+    std::atomic<bool> useTelemetry;
+    std::atomic<bool> telemetryResetRequested;
+    bool tickTelemetry;
+
+    // Telemetry for the current tick and since reset, servo thread only. Times in nanoseconds, forces in effect space.
+    int64_t telemetryStart;
+    int64_t telemetryTime[NumEffectTypes];
+    int64_t telemetryTotalTime[NumEffectTypes];
+    int64_t telemetryMaxTime[NumEffectTypes];
+    int telemetryEvaluated[NumEffectTypes];
+    double telemetryForce[NumEffectTypes][3];
+    int telemetryTicks;
+
+    // Telemetry published from the servo thread with a sequence lock
+    std::atomic<unsigned int> publishedTelemetrySequence;
+    std::atomic<int> publishedTelemetryTicks;
+    std::atomic<int> publishedTelemetryEvaluated[NumEffectTypes];
+    std::atomic<int64_t> publishedTelemetryTime[NumEffectTypes];
+    std::atomic<int64_t> publishedTelemetryTotalTime[NumEffectTypes];
+    std::atomic<int64_t> publishedTelemetryMaxTime[NumEffectTypes];
+    std::atomic<double> publishedTelemetryForce[NumEffectTypes][3];
+
+
+    // Enabled effect groups, and the mask used for the current tick
+    std::atomic<uint32_t> groupMask;
+    uint32_t tickGroupMask;
 
     // Haptic effects 
     ForceContainer<SimpleForce> simpleForces;
@@ -221,44 +1321,384 @@ protected:
     ForceContainer<Spring> springs;
     ForceContainer<IntermolecularForce> intermolecularForces;
     ForceContainer<RandomForce> randomForces;
+    ForceContainer<RigidBody> rigidBodies;
+    ForceContainer<DistanceField> distanceFields;
+    ForceContainer<PathConstraint> pathConstraints;
+    ForceContainer<RadialForce> radialForces;
+    ForceContainer<Vibration> vibrations;
+    ForceContainer<ExpressionForce> expressionForces;
+    ForceContainer<KernelForce> kernelForces;
+    ForceContainer<Collider> colliders;
+
+    // Molecular force field, and the model used in the current tick
+    ForceField forceField;
+    std::atomic<bool> useForceField;
+    const ForceFieldModel* forceFieldModel;
+
+    // Published rigid body poses by id, kept for reuse with the id
+    std::unordered_map<int, std::unique_ptr<PublishedPose> > rigidBodyPoses;
+    int rigidBodyGeneration;
+
+    // Distance field grids by effect id, and the thread building grids from meshes
+    std::unordered_map<int, std::shared_ptr<DistanceGrid> > distanceGrids;
+    DistanceGridBuilder distanceGridBuilder;
+
+    // Path constraint paths by effect id
+    std::unordered_map<int, std::shared_ptr<ConstraintPath> > constraintPaths;
+
+    // Radial profiles by profile id, with empty slots for removed ids, and the profile of each radial force by effect id
+    std::vector<std::shared_ptr<RadialProfile> > radialProfiles;
+    std::unordered_map<int, std::shared_ptr<RadialProfile> > radialForceProfiles;
+
+    // Vibration wavetables by id, built in ones first, with empty slots for removed ids, and the wavetable of each
+    // vibration by effect id
+    std::vector<std::shared_ptr<Wavetable> > wavetables;
+    std::unordered_map<int, std::shared_ptr<Wavetable> > vibrationWavetables;
+
+    // Expression force programs by effect id, and registers for evaluating them, servo thread only
+    std::unordered_map<int, std::shared_ptr<ExpressionProgram> > expressionPrograms;
+    double expressionRegisters[maxExpressionRegisters];
+
+    // Registered kernels, each written before numKernels includes it, and the libraries they came from
+    FalconKernel kernels[maxKernels];
+    std::string kernelNames[maxKernels];
+    std::atomic<int> numKernels;
+    std::vector<std::unique_ptr<SharedLibrary> > kernelLibraries;
+
+    // Batch being filled for each kernel, servo thread only
+    struct KernelBatch {
+        double parameters[FALCON_KERNEL_MAX_PARAMETERS][FALCON_KERNEL_BATCH_SIZE];
+        double force[3][FALCON_KERNEL_BATCH_SIZE];
+        int count;
+    };
+    KernelBatch kernelBatches[maxKernels];
+
+    // Kernel timing for the current tick and since reset, servo thread only, in nanoseconds
+    std::atomic<bool> kernelStatsResetRequested;
+    int kernelTicks;
+    int kernelEvaluated[maxKernels];
+    int kernelCalls[maxKernels];
+    int64_t kernelTime[maxKernels];
+    int64_t kernelTotalTime[maxKernels];
+    int64_t kernelMaxTime[maxKernels];
+
+    // Kernel timing published from the servo thread with a sequence lock
+    std::atomic<unsigned int> publishedKernelSequence;
+    std::atomic<int> publishedKernelTicks;
+    std::atomic<int> publishedKernelEvaluated[maxKernels];
+    std::atomic<int> publishedKernelCalls[maxKernels];
+    std::atomic<int64_t> publishedKernelTime[maxKernels];
+    std::atomic<int64_t> publishedKernelTotalTime[maxKernels];
+    std::atomic<int64_t> publishedKernelMaxTime[maxKernels];
+
+    // Collider broadphase, servo thread only. Each bucket starts a list of the colliders overlapping grid cells hashed
+    // to it, through Collider::next, with entries numbered collider index * maxColliderCells + cell, or -1 at the end.
+    int colliderBuckets[numColliderBuckets];
+    int largeColliders;
+    double colliderCellSize;
+
+    // Colliders when the grid was last rebuilt
+    int colliderGridSize;
+
+    // Frames, application thread only, with ids of removed frames to reuse
+    std::vector<Frame> frames;
+    std::vector<int> freeFrames;
+
+    // Frame transforms for the servo thread
+    TripleBuffer<FrameSet> frameSets;
+
+    // Frames for this tick, whether they changed since the last tick, and the probe position and velocity in each
+    // frame's local effect space for the current tick, servo thread only
+    const FrameSet* tickFrames;
+    int numTickFrames;
+    bool framesMoved;
+    double framePos[maxFrames][3];
+    double frameVel[maxFrames][3];
+
+    // Multi-point probe, application thread only, in graphics space
+    std::vector<Vector3> probeOffsets;
+    std::vector<float> probeRadii;
+
+    // Probe points for the servo thread
+    TripleBuffer<ProbePoints> probePointSets;
+
+    // Probe points for this tick and whether they changed since the last tick, with the points in effect space, and
+    // in the local effect space of the last frame they were moved to, for the current tick, servo thread only
+    const ProbePoints* tickProbe;
+    bool probeMoved;
+    double probeX[maxProbePoints];
+    double probeY[maxProbePoints];
+    double probeZ[maxProbePoints];
+    int probeFrame;
+    double probeLocalX[maxProbePoints];
+    double probeLocalY[maxProbePoints];
+    double probeLocalZ[maxProbePoints];
+
+    // Largest probe radius the collider broadphase grid was padded for
+    double colliderPad;
+
+    // Rigid body gravity in effect space
+    std::atomic<double> rigidBodyGravity[3];
+    Vector3 rigidBodyGravitySource;
 
 
     // Device workspace dimensions
     double workspace[6];
 
-    // Transforms
+    // Affine transforms between device space and graphics space
     double haptics2graphics[16];
-	double graphics2haptics[16];
+    double graphics2haptics[16];
+
+    // Mean scale from device space to graphics space, used for lengths, spring constants and damping
+    double workspaceScale;
+
+    // Effects are evaluated in effect space, graphics space divided by the mean scale, so they keep their graphics
+    // proportions in any workspace. The servo loop maps the device position into effect space with haptics2graphics
+    // divided by the mean scale, and the force back with the transpose of its linear part, which preserves work.
+    double haptics2effect[16];
+
+    // Workspace map for the servo thread, and the one for the current tick, servo thread only
+    TripleBuffer<WorkspaceMap> workspaceMaps;
+    const WorkspaceMap* tickMap;
+
 
+    // Device backend, chosen at compile time
+    DeviceBackend device;
 
-    // Handle to device
-    HDLDeviceHandle deviceHandle;
+    // Set once Initialize() succeeds
+    bool initialized;
 
-    // Handle to haptic callback 
-    HDLServoOpExitCode servoOp;
+    // Asynchronous initialization. The thread only opens the device; the servo loop is started on the application thread.
+    std::thread initializeThread;
+    std::atomic<int> initializeState;
+    int64_t initializeStart;
+
+    // Time taken to open the device, and servo clock time of the first force sent, in nanoseconds
+    std::atomic<int64_t> deviceOpenTime;
+    std::atomic<int64_t> firstForceTime;
+
+    // Graphics workspace last set, and whether the device workspace is known so it can be applied
+    Vector3 graphicsCenter;
+    Vector3 graphicsSize;
+    Quaternion graphicsRotation;
+    bool deviceWorkspaceKnown;
+
+    // Servo thread and timing statistics
+    ServoThread servoThread;
+    bool realTime;
+    int realTimeCpu;
+    int realTimePriority;
+
+
+    // Apply effect changes immediately, when there is no servo thread running
+    void SetSynchronous(bool sync);
 
 
     // Compute device force, called from force callback
     void ComputeForce();
 
+    // Decide whether an effect type's cached force sum can be used this tick, re-evaluating only dirty effects with
+    // compute(effect) if so
+    template <class T, class F>
+    void UpdateForceCache(ForceContainer<T>& effects, ForceCache& cache, const double p[3], const double velocity[3], F compute);
+
+    // Fill an effect type's force cache after evaluating all its effects
+    void FillForceCache(ForceCache& cache, const double sum[3], const double torque[3], const double p[3], const double velocity[3]);
+
+    // Compose frames with their parents and publish their transforms to the servo thread
+    void PublishFrames();
+
+    // Move the children and effects of a frame to its parent, folding the frame's transform into theirs
+    void MoveFrameContents(int frame, int parent);
+
+    // Move the effects of a frame to another frame, transforming their positions and normals
+    void MoveFrameEffects(int frame, int parent, const double transform[16]);
+
+    // Transform from a frame's local effect space to effect space
+    void FrameToEffect(double toEffect[16], int frame);
+
+    // Copy the effects force queries evaluate, in enabled groups
+    void BuildForceQuery(ForceQuery& query);
+
+    // Evaluate a force query at up to forceQueryBlock points, in graphics space
+    void EvaluateForceQuery(const ForceQuery& query, const Vector3* points, Vector3* forces, int n);
+
+    // Transform the probe into each frame's local effect space
+    void TransformProbeToFrames(const double p[3], const double velocity[3]);
+
+    // Probe position and velocity in an effect's frame, leaving them for effects not in a frame
+    void FrameProbe(int frame, const double*& p, const double*& velocity);
+
+    // Transform a force computed in an effect's frame back to effect space
+    void FrameForce(int frame, double f[3]);
+
+    // Transform the probe points to effect space, if sampling the probe at more than one point, with offsets in
+    // graphics space for the application thread
+    void PublishProbePoints();
+
+    // Place the probe points around the probe position for the current tick
+    void PlaceProbePoints(const double p[3]);
+
+    // Probe points in an effect's frame, moving them into it if they aren't already
+    void FrameProbePoints(int frame, const double*& x, const double*& y, const double*& z);
+
+    // Sum forces at the probe points, computed in an effect's frame, to a force and its torque about the probe
+    // position in effect space
+    void SumProbeForces(double force[3], double torque[3], double* fx, double* fy, double* fz, int frame);
+
+    // Evaluate an effect at the probe, in its frame and at each probe point, setting its force and torque
+    void ProbeSurface(Surface& s, const double p[3], const double velocity[3]);
+    void ProbeSpring(Spring& s, const double p[3], const double velocity[3]);
+    void ProbeIntermolecularForce(IntermolecularForce& imf, const double p[3], const double velocity[3]);
+
+    // Choose the level of detail for the next tick from the measured effect evaluation time, with n sub-steps
+    void UpdateLevelOfDetail(double cost, int n);
+
+    // True if an effect anchored at a should run at reduced rate this tick, given the probe position p.
+    // Updates the effect's near flag when it is evaluated.
+    bool HoldEffect(bool& near, const double a[3], const double p[3], int index);
+
+    // Observe the energy that flowed through the device as it moved by displacement under the force sent last tick, and
+    // add damping for the given velocity to the force f about to be sent, to keep the device passive over the next tick
+    void ApplyPassivityControl(double f[3], const double displacement[3], const double velocity[3], double dt);
+
+    // Servo thread: clear the passivity observer's energy, the force sent last tick and the published statistics
+    void ResetPassivityObserver();
+
+    // Telemetry, servo thread only. Attribute the time since the last call, or since the start of the tick, to an
+    // effect type, along with effects evaluated and their force, which may be null.
+    void RecordTelemetry(int type, int evaluated, const double f[3]);
+
+    // Clear telemetry for a new tick, and publish it at the end of the tick
+    void StartTelemetry();
+    void PublishTelemetry();
+
+    // Servo thread: clear kernel timing for a tick, and publish it at the end
+    void StartKernelStats();
+    void PublishKernelStats();
+
+    // Sum the forces from all effects that only depend on the probe at position p, and their torque about p, for a
+    // tick ending at time t with length dt
+    void ComputeEffectForces(double force[3], double torque[3], const double p[3], const double velocity[3], double t, double dt);
+
+    // Step rigid bodies and vibrations over a sub-step of length dt with the probe at position p, summing their forces.
+    // Telemetry gets their forces from the last sub-step.
+    void StepEffectForces(double force[3], const double p[3], const double velocity[3], double dt, bool last);
+
+    // Open the device and read its workspace. Doesn't touch effects, so it can run on another thread.
+    bool OpenDevice();
+
+    // Application thread: apply the graphics workspace and start the servo loop
+    bool StartServo();
+
     // Synchronize device state
     void SynchronizeState();
 
+    // Servo thread: publish the device position, force, torque and buttons for the application thread
+    void PublishState();
+
+    // Read the last published device state
+    void ReadState(DeviceState& state);
+
+    // Random number in [min, max]
+    double Random(double min, double max);
+
+
+    // Transform a position from graphics space to effect space. Directions and rotations are the same in both.
+    void GraphicsToEffectPoint(double result[3], const Vector3& p);
+
+    // Transform a force sent to the device back to graphics space, the inverse of the servo loop's map
+    void DeviceToGraphicsForce(double result[3], const double f[3]);
+
+    // Read the last pose published for a rigid body, returning false if it is older than the body's generation
+    bool ReadRigidBodyPose(const RigidBody& rb, double p[3], double q[4]);
+
+    // Transform force effect parameters from graphics space to effect space, keeping servo state
+    void TransformEffect(SimpleForce& device, const SimpleForce& source);
+    void TransformEffect(Viscosity& device, const Viscosity& source);
+    void TransformEffect(Surface& device, const Surface& source);
+    void TransformEffect(Spring& device, const Spring& source);
+    void TransformEffect(IntermolecularForce& device, const IntermolecularForce& source);
+    void TransformEffect(RandomForce& device, const RandomForce& source);
+    void TransformEffect(RigidBody& device, const RigidBody& source);
+    void TransformEffect(DistanceField& device, const DistanceField& source);
+    void TransformEffect(PathConstraint& device, const PathConstraint& source);
+    void TransformEffect(RadialForce& device, const RadialForce& source);
+    void TransformEffect(Vibration& device, const Vibration& source);
+    void TransformEffect(ExpressionForce& device, const ExpressionForce& source);
+    void TransformEffect(KernelForce& device, const KernelForce& source);
+    void TransformEffect(Collider& device, const Collider& source);
+
+    // Add a distance field effect using the given grid
+    int AddDistanceFieldGrid(std::shared_ptr<DistanceGrid> grid, Vector3 p, Quaternion r, float k, float c);
+
+    // Free the grids of removed distance fields and paths of removed path constraints once the servo thread has
+    // stopped using them
+    void RetireDistanceGrid(int i);
+    void RetireConstraintPath(int i);
+
 
     // Compute viscous force
     void ComputeViscousForce(double force[3], Viscosity& v, const double velocity[3]);
 
     // Compute surface force
-    void ComputeSurfaceForce(double force[3], const Surface s, const double velocity[3]);
+    void ComputeSurfaceForce(double force[3], const Surface& s, const double p[3], const double velocity[3]);
     
     // Compute spring force
-    void ComputeSpringForce(double force[3], const Spring s, const double velocity[3]);
+    void ComputeSpringForce(double force[3], const Spring& s, const double p[3], const double velocity[3]);
 
     // Compute intermolecular force
-    void ComputeIntermolecularForce(double force[3], const IntermolecularForce imf, const double velocity[3]);
+    void ComputeIntermolecularForce(double force[3], const IntermolecularForce& imf, const double p[3], const double velocity[3]);
 
     // Compute random force
     void ComputeRandomForce(double force[3], RandomForce& r, double t);
+
+    // Compute vibration force, advancing its waveform and envelope over dt
+    void ComputeVibrationForce(double force[3], Vibration& v, double dt);
+
+    // Compute expression force, advancing its time by dt
+    void ComputeExpressionForce(double force[3], ExpressionForce& ef, const double p[3], const double velocity[3], double dt);
+
+    // Compute the forces of all kernel forces in enabled groups, batched by kernel, returning how many were evaluated
+    int ComputeKernelForces(double force[3], const double p[3], const double velocity[3], double t, double dt);
+
+    // Call a kernel on its batch, adding the graphics space forces to sum and emptying the batch
+    void RunKernel(int kernel, const FalconKernelProbe& probe, double sum[3]);
+
+    // Rebuild the collider broadphase grid from the colliders' bounds, sizing its cells to them
+    void BuildColliderGrid();
+
+    // List the collider at the given index in the grid buckets of the cells its bounds overlap, or remove it from them
+    void LinkCollider(int index);
+    void UnlinkCollider(int index);
+
+    // Compute the forces of the colliders in enabled groups near the probe, at each probe point, and their torque about
+    // the probe position, returning how many were tested
+    int ComputeColliderForces(double force[3], double torque[3], const double p[3], const double velocity[3]);
+
+    // Compute collider force on a sphere of the given radius at p, zero for a point
+    void ComputeColliderForce(double force[3], const Collider& c, const double p[3], const double velocity[3], double radius);
+
+    // Compute the force of a rigid body on the probe, and step the body over dt
+    void ComputeRigidBodyForce(double force[3], RigidBody& rb, const double p[3], const double velocity[3], double dt);
+
+    // Compute distance field force on a sphere of the given radius at p, zero for a point
+    void ComputeDistanceFieldForce(double force[3], const DistanceField& df, const double p[3], const double velocity[3], double radius);
+
+    // Compute path constraint force, updating the segment closest to the probe
+    void ComputePathConstraintForce(double force[3], PathConstraint& pc, const double p[3], const double velocity[3]);
+
+    // Compute the forces of a run of radial forces, adding them to sum
+    void ComputeRadialForces(double sum[3], RadialForce* rf, int count, const double p[3], const double velocity[3]);
+
+    // Add the contact force and torque on a rigid body from a surface, at the body point arm from its center
+    void AddSurfaceContact(double force[3], double torque[3], const RigidBody& rb, const Surface& s, const double arm[3], double maxK, double maxC);
+
+    // Compute molecular force field force from the current model
+    void ComputeForceFieldForce(double force[3], const ForceFieldModel& model, const double p[3], const double velocity[3]);
+
+    // Publish a rigid body's pose for the application thread
+    void PublishRigidBodyPose(const RigidBody& rb);
 };
 
 #endif
\ No newline at end of file
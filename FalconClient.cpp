@@ -0,0 +1,914 @@
+/*=========================================================================
+
+  Name:        FalconClient.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Client for an out-of-process haptic server. Initializing
+               maps the server's shared memory instead of opening the
+               device. Calls without a result are queued for the server
+               without waiting; calls with a result wait for its reply.
+               Device state is read from the shared state block.
+
+=========================================================================*/
+
+
+#include "FalconClient.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+
+// Time without a server heartbeat after which the server is considered gone, in seconds
+const double serverTimeout = 5.0;
+
+
+FalconClient::FalconClient(const char* serverName) : name(serverName), shared(nullptr), initialized(false), initializeState(InitializeIdle), connectTime(0.0f), write(0) {
+#if defined(_WIN32)
+    processId = (uint32_t)GetCurrentProcessId();
+#else
+    processId = (uint32_t)getpid();
+#endif
+}
+
+FalconClient::~FalconClient() {
+    if (initialized) {
+        // End the session, clearing this application's effects, and wait for the server to take it
+        Send(DisconnectCall);
+        WaitForServer(write);
+    }
+
+    memory.Close();
+}
+
+bool FalconClient::Initialize() {
+    if (initialized) return false;
+
+    auto start = std::chrono::steady_clock::now();
+    initializeState = InitializeFailed;
+
+    if (!memory.Open(name.c_str(), sizeof(ServerShared))) {
+        std::cout << "Could not find haptic server " << name << std::endl;
+        return false;
+    }
+
+    shared = static_cast<ServerShared*>(memory.Data());
+
+    if (shared->magic != serverMagic || shared->version != serverVersion) {
+        std::cout << "Haptic server " << name << " is not ready or is a different version" << std::endl;
+        memory.Close();
+        shared = nullptr;
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Take the session, replacing a client that has stopped responding
+    uint32_t owner = 0;
+    if (!shared->owner.compare_exchange_strong(owner, processId) && owner != processId) {
+        if (!shared->clientStale.load() || !shared->owner.compare_exchange_strong(owner, processId)) {
+            std::cout << "Another application is connected to haptic server " << name << std::endl;
+            memory.Close();
+            shared = nullptr;
+            return false;
+        }
+    }
+
+    Heartbeat();
+
+    // Continue after the calls of any previous session
+    write = shared->callWrite.load(std::memory_order_acquire);
+
+    initialized = Call<bool>(ConnectCall);
+    if (!initialized) {
+        shared->owner.store(0);
+        memory.Close();
+        shared = nullptr;
+        return false;
+    }
+
+    initializeState = InitializeReady;
+    connectTime = (float)std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    return true;
+}
+
+bool FalconClient::IsInitialized() {
+    return initialized;
+}
+
+bool FalconClient::InitializeAsync() {
+    return Initialize();
+}
+
+InitializeStatus FalconClient::GetInitializeStatus() {
+    InitializeStatus status;
+    status.state = initializeState;
+    status.openTime = connectTime;
+    status.firstForceTime = connectTime;
+
+    return status;
+}
+
+void FalconClient::SetRealTime(bool, int, int) {
+}
+
+void FalconClient::SetServoRate(float hz) {
+    Send(SetServoRateCall, hz);
+}
+
+void FalconClient::SetSubsteps(int n) {
+    Send(SetSubstepsCall, n);
+}
+
+void FalconClient::SetPassivityControl(bool enable, float maxDamping) {
+    Send(SetPassivityControlCall, enable, maxDamping);
+}
+
+PassivityStats FalconClient::GetPassivityStats() {
+    return Call<PassivityStats>(GetPassivityStatsCall);
+}
+
+void FalconClient::SetComputeBudget(bool enable, float budget, float nearRadius) {
+    Send(SetComputeBudgetCall, enable, budget, nearRadius);
+}
+
+SchedulerStats FalconClient::GetSchedulerStats() {
+    return Call<SchedulerStats>(GetSchedulerStatsCall);
+}
+
+void FalconClient::SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon) {
+    Send(SetForceCacheCall, enable, positionEpsilon, velocityEpsilon);
+}
+
+ForceCacheStats FalconClient::GetForceCacheStats() {
+    return Call<ForceCacheStats>(GetForceCacheStatsCall);
+}
+
+ServoStats FalconClient::GetServoStats() {
+    return Call<ServoStats>(GetServoStatsCall);
+}
+
+void FalconClient::ResetServoStats() {
+    Send(ResetServoStatsCall);
+}
+
+void FalconClient::SetTelemetry(bool enable) {
+    Send(SetTelemetryCall, enable);
+}
+
+EffectTelemetry FalconClient::GetEffectTelemetry(int type) {
+    return Call<EffectTelemetry>(GetEffectTelemetryCall, type);
+}
+
+void FalconClient::ResetTelemetry() {
+    Send(ResetTelemetryCall);
+}
+
+void FalconClient::SetGraphicsWorkspace(Vector3 center, Vector3 size) {
+    Send(SetGraphicsWorkspaceCall, center, size);
+}
+
+void FalconClient::SetGraphicsWorkspace(Vector3 center, Vector3 size, Quaternion rotation) {
+    Send(SetGraphicsWorkspaceRotatedCall, center, size, rotation);
+}
+
+void FalconClient::ResetForces() {
+    Send(ResetForcesCall);
+}
+
+
+Vector3 FalconClient::GetPosition() {
+    Vector3 p = { 0.0f, 0.0f, 0.0f };
+    if (!initialized) return p;
+
+    Heartbeat();
+
+    // Retry if the server was writing
+    for (;;) {
+        unsigned int sequence = shared->stateSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        p.x = shared->position[0].load(std::memory_order_relaxed);
+        p.y = shared->position[1].load(std::memory_order_relaxed);
+        p.z = shared->position[2].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->stateSequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    return p;
+}
+
+Vector3 FalconClient::GetForce() {
+    Vector3 f = { 0.0f, 0.0f, 0.0f };
+    if (!initialized) return f;
+
+    Heartbeat();
+
+    for (;;) {
+        unsigned int sequence = shared->stateSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        f.x = shared->force[0].load(std::memory_order_relaxed);
+        f.y = shared->force[1].load(std::memory_order_relaxed);
+        f.z = shared->force[2].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->stateSequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    return f;
+}
+
+Vector3 FalconClient::GetTorque() {
+    Vector3 t = { 0.0f, 0.0f, 0.0f };
+    if (!initialized) return t;
+
+    Heartbeat();
+
+    for (;;) {
+        unsigned int sequence = shared->stateSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        t.x = shared->torque[0].load(std::memory_order_relaxed);
+        t.y = shared->torque[1].load(std::memory_order_relaxed);
+        t.z = shared->torque[2].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->stateSequence.load(std::memory_order_relaxed) == sequence) break;
+    }
+
+    return t;
+}
+
+bool FalconClient::GetButton(int button) {
+    if (!initialized || button < 0 || button > 3) return false;
+
+    Heartbeat();
+
+    return (shared->buttons.load(std::memory_order_relaxed) & (1 << button)) != 0;
+}
+
+
+void FalconClient::UseForceFeedback(bool use) {
+    Send(UseForceFeedbackCall, use);
+}
+
+void FalconClient::SetProxyPosition(Vector3 p) {
+    Send(SetProxyPositionCall, p);
+}
+
+
+// Simple forces
+int FalconClient::AddSimpleForce(Vector3 f) {
+    return Call<int>(AddSimpleForceCall, f);
+}
+
+void FalconClient::UpdateSimpleForce(int i, Vector3 f) {
+    Send(UpdateSimpleForceCall, i, f);
+}
+
+void FalconClient::RemoveSimpleForce(int i) {
+    Send(RemoveSimpleForceCall, i);
+}
+
+void FalconClient::RemoveSimpleForces() {
+    Send(RemoveSimpleForcesCall);
+}
+
+
+// Viscosities
+int FalconClient::AddViscosity(float c, float w) {
+    return Call<int>(AddViscosityCall, c, w);
+}
+
+void FalconClient::UpdateViscosity(int i, float c, float w) {
+    Send(UpdateViscosityCall, i, c, w);
+}
+
+void FalconClient::RemoveViscosity(int i) {
+    Send(RemoveViscosityCall, i);
+}
+
+void FalconClient::RemoveViscosities() {
+    Send(RemoveViscositiesCall);
+}
+
+
+// Contact surfaces
+int FalconClient::AddSurface(Vector3 p, Vector3 n, float k, float c) {
+    return Call<int>(AddSurfaceCall, p, n, k, c);
+}
+
+void FalconClient::UpdateSurface(int i, Vector3 p, Vector3 n, float k, float c) {
+    Send(UpdateSurfaceCall, i, p, n, k, c);
+}
+
+void FalconClient::RemoveSurface(int i) {
+    Send(RemoveSurfaceCall, i);
+}
+
+void FalconClient::RemoveSurfaces() {
+    Send(RemoveSurfacesCall);
+}
+
+
+// Springs
+int FalconClient::AddSpring(Vector3 p, float k, float c, float r, float m) {
+    return Call<int>(AddSpringCall, p, k, c, r, m);
+}
+
+void FalconClient::UpdateSpring(int i, Vector3 p, float k, float c, float r, float m) {
+    Send(UpdateSpringCall, i, p, k, c, r, m);
+}
+
+void FalconClient::RemoveSpring(int i) {
+    Send(RemoveSpringCall, i);
+}
+
+void FalconClient::RemoveSprings() {
+    Send(RemoveSpringsCall);
+}
+
+
+// Intermolecular forces
+int FalconClient::AddIntermolecularForce(Vector3 p, float k, float c, float r, float m) {
+    return Call<int>(AddIntermolecularForceCall, p, k, c, r, m);
+}
+
+void FalconClient::UpdateIntermolecularForce(int i, Vector3 p, float k, float c, float r, float m) {
+    Send(UpdateIntermolecularForceCall, i, p, k, c, r, m);
+}
+
+void FalconClient::RemoveIntermolecularForce(int i) {
+    Send(RemoveIntermolecularForceCall, i);
+}
+
+void FalconClient::RemoveIntermolecularForces() {
+    Send(RemoveIntermolecularForcesCall);
+}
+
+
+// Random forces
+int FalconClient::AddRandomForce(float minMag, float maxMag, float minTime, float maxTime) {
+    return Call<int>(AddRandomForceCall, minMag, maxMag, minTime, maxTime);
+}
+
+void FalconClient::UpdateRandomForce(int i, float minMag, float maxMag, float minTime, float maxTime) {
+    Send(UpdateRandomForceCall, i, minMag, maxMag, minTime, maxTime);
+}
+
+void FalconClient::RemoveRandomForce(int i) {
+    Send(RemoveRandomForceCall, i);
+}
+
+void FalconClient::RemoveRandomForces() {
+    Send(RemoveRandomForcesCall);
+}
+
+
+// Rigid bodies
+int FalconClient::AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+    return Call<int>(AddRigidBodyCall, p, r, mass, inertia, shape, extents, k, c, linearDrag, angularDrag);
+}
+
+void FalconClient::UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+    Send(UpdateRigidBodyCall, i, mass, inertia, shape, extents, k, c, linearDrag, angularDrag);
+}
+
+void FalconClient::SetRigidBodyPose(int i, Vector3 p, Quaternion r) {
+    Send(SetRigidBodyPoseCall, i, p, r);
+}
+
+RigidBodyPose FalconClient::GetRigidBodyPose(int i) {
+    return Call<RigidBodyPose>(GetRigidBodyPoseCall, i);
+}
+
+void FalconClient::GrabRigidBody(int i, bool grab) {
+    Send(GrabRigidBodyCall, i, grab);
+}
+
+void FalconClient::RemoveRigidBody(int i) {
+    Send(RemoveRigidBodyCall, i);
+}
+
+void FalconClient::RemoveRigidBodies() {
+    Send(RemoveRigidBodiesCall);
+}
+
+void FalconClient::SetRigidBodyGravity(Vector3 g) {
+    Send(SetRigidBodyGravityCall, g);
+}
+
+
+// Effect groups
+void FalconClient::SetEffectGroup(int type, int i, int group) {
+    Send(SetEffectGroupCall, type, i, group);
+}
+
+void FalconClient::SetGroupMask(unsigned int mask) {
+    Send(SetGroupMaskCall, mask);
+}
+
+void FalconClient::SetGroupEnabled(int group, bool enable) {
+    Send(SetGroupEnabledCall, group, enable);
+}
+
+unsigned int FalconClient::GetGroupMask() {
+    return Call<unsigned int>(GetGroupMaskCall);
+}
+
+
+// Distance fields
+int FalconClient::AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c) {
+    if (!shared || !distances || nx < 2 || ny < 2 || nz < 2) return -1;
+
+    size_t size = (size_t)nx * ny * nz * sizeof(float);
+    if (size > serverBulkSize) {
+        std::cout << "Distance field too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    // The bulk area is free, as the last call using it returned
+    memcpy(shared->bulk, distances, size);
+
+    return Call<int>(AddDistanceFieldCall, nx, ny, nz, origin, cellSize, p, r, k, c);
+}
+
+int FalconClient::AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c) {
+    if (!shared || !vertices || !triangles || numVertices <= 0 || numTriangles <= 0) return -1;
+
+    size_t size = numVertices * sizeof(Vector3) + numTriangles * 3 * sizeof(int);
+    if (size > serverBulkSize) {
+        std::cout << "Mesh too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    memcpy(shared->bulk, vertices, numVertices * sizeof(Vector3));
+    memcpy(shared->bulk + numVertices * sizeof(Vector3), triangles, numTriangles * 3 * sizeof(int));
+
+    return Call<int>(AddDistanceFieldMeshCall, numVertices, numTriangles, resolution, p, r, k, c);
+}
+
+void FalconClient::UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c) {
+    Send(UpdateDistanceFieldCall, i, p, r, k, c);
+}
+
+bool FalconClient::IsDistanceFieldReady(int i) {
+    return Call<bool>(IsDistanceFieldReadyCall, i);
+}
+
+void FalconClient::RemoveDistanceField(int i) {
+    Send(RemoveDistanceFieldCall, i);
+}
+
+void FalconClient::RemoveDistanceFields() {
+    Send(RemoveDistanceFieldsCall);
+}
+
+
+// Path constraints
+int FalconClient::AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+    if (!shared || !points || numPoints < 2) return -1;
+
+    size_t size = numPoints * sizeof(Vector3);
+    if (size > serverBulkSize) {
+        std::cout << "Path too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    memcpy(shared->bulk, points, size);
+
+    return Call<int>(AddPathConstraintCall, numPoints, spline, closed, p, r, k, c, radius, along);
+}
+
+void FalconClient::UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+    Send(UpdatePathConstraintCall, i, p, r, k, c, radius, along);
+}
+
+void FalconClient::RemovePathConstraint(int i) {
+    Send(RemovePathConstraintCall, i);
+}
+
+void FalconClient::RemovePathConstraints() {
+    Send(RemovePathConstraintsCall);
+}
+
+
+// Radial forces
+int FalconClient::AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic) {
+    if (!shared || !forces || numSamples < 2) return -1;
+
+    size_t size = numSamples * sizeof(float);
+    if (size > serverBulkSize) {
+        std::cout << "Radial profile too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    memcpy(shared->bulk, forces, size);
+
+    return Call<int>(AddRadialProfileCall, numSamples, maxDistance, cubic);
+}
+
+void FalconClient::RemoveRadialProfile(int profile) {
+    Send(RemoveRadialProfileCall, profile);
+}
+
+int FalconClient::AddRadialForce(Vector3 p, int profile, float scale, float c) {
+    return Call<int>(AddRadialForceCall, p, profile, scale, c);
+}
+
+void FalconClient::UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c) {
+    Send(UpdateRadialForceCall, i, p, profile, scale, c);
+}
+
+void FalconClient::RemoveRadialForce(int i) {
+    Send(RemoveRadialForceCall, i);
+}
+
+void FalconClient::RemoveRadialForces() {
+    Send(RemoveRadialForcesCall);
+}
+
+
+// Vibrations
+int FalconClient::AddWavetable(const float* samples, int numSamples) {
+    if (!shared || !samples || numSamples < 2) return -1;
+
+    size_t size = numSamples * sizeof(float);
+    if (size > serverBulkSize) {
+        std::cout << "Wavetable too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    memcpy(shared->bulk, samples, size);
+
+    return Call<int>(AddWavetableCall, numSamples);
+}
+
+void FalconClient::RemoveWavetable(int wavetable) {
+    Send(RemoveWavetableCall, wavetable);
+}
+
+int FalconClient::AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+    return Call<int>(AddVibrationCall, wavetable, direction, amplitude, frequency, attack, decay, sustain, release);
+}
+
+void FalconClient::UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+    Send(UpdateVibrationCall, i, wavetable, direction, amplitude, frequency, attack, decay, sustain, release);
+}
+
+void FalconClient::TriggerVibration(int i, float duration) {
+    Send(TriggerVibrationCall, i, duration);
+}
+
+void FalconClient::ReleaseVibration(int i) {
+    Send(ReleaseVibrationCall, i);
+}
+
+void FalconClient::RemoveVibration(int i) {
+    Send(RemoveVibrationCall, i);
+}
+
+void FalconClient::RemoveVibrations() {
+    Send(RemoveVibrationsCall);
+}
+
+
+// Expression forces
+int FalconClient::AddExpressionForce(const char* expression) {
+    if (!shared || !expression) return -1;
+
+    size_t size = strlen(expression);
+    if (size > serverBulkSize) {
+        std::cout << "Expression too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return -1;
+    }
+
+    memcpy(shared->bulk, expression, size);
+
+    return Call<int>(AddExpressionForceCall, (int)size);
+}
+
+void FalconClient::SetExpressionParameters(int i, const float* parameters, int numParameters) {
+    if (!parameters) return;
+
+    // Unused values are ignored by the server
+    float p[numExpressionParameters] = {};
+    for (int j = 0; j < numParameters && j < numExpressionParameters; j++) {
+        p[j] = parameters[j];
+    }
+
+    Send(SetExpressionParametersCall, i, numParameters, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+}
+
+void FalconClient::RemoveExpressionForce(int i) {
+    Send(RemoveExpressionForceCall, i);
+}
+
+void FalconClient::RemoveExpressionForces() {
+    Send(RemoveExpressionForcesCall);
+}
+
+
+// External kernel forces
+int FalconClient::LoadKernelLibrary(const char* fileName) {
+    if (!shared || !fileName) return -1;
+
+    size_t size = strlen(fileName);
+    if (size > serverBulkSize) return -1;
+
+    memcpy(shared->bulk, fileName, size);
+
+    return Call<int>(LoadKernelLibraryCall, (int)size);
+}
+
+int FalconClient::FindKernel(const char* name) {
+    if (!shared || !name) return -1;
+
+    size_t size = strlen(name);
+    if (size > serverBulkSize) return -1;
+
+    memcpy(shared->bulk, name, size);
+
+    return Call<int>(FindKernelCall, (int)size);
+}
+
+// Parameters past numParameters are zeroed by the server
+static KernelParameterValues PackKernelParameters(const float* parameters, int numParameters) {
+    KernelParameterValues p = {};
+    for (int j = 0; parameters && j < numParameters && j < FALCON_KERNEL_MAX_PARAMETERS; j++) {
+        p.values[j] = parameters[j];
+    }
+    return p;
+}
+
+int FalconClient::AddKernelForce(int kernel, const float* parameters, int numParameters) {
+    return Call<int>(AddKernelForceCall, kernel, numParameters, PackKernelParameters(parameters, numParameters));
+}
+
+void FalconClient::UpdateKernelForce(int i, const float* parameters, int numParameters) {
+    if (!parameters) return;
+
+    Send(UpdateKernelForceCall, i, numParameters, PackKernelParameters(parameters, numParameters));
+}
+
+void FalconClient::RemoveKernelForce(int i) {
+    Send(RemoveKernelForceCall, i);
+}
+
+void FalconClient::RemoveKernelForces() {
+    Send(RemoveKernelForcesCall);
+}
+
+KernelStats FalconClient::GetKernelStats(int kernel) {
+    return Call<KernelStats>(GetKernelStatsCall, kernel);
+}
+
+
+// Primitive colliders
+int FalconClient::AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+    return Call<int>(AddColliderCall, shape, extents, p, r, k, c);
+}
+
+void FalconClient::UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+    Send(UpdateColliderCall, i, shape, extents, p, r, k, c);
+}
+
+void FalconClient::RemoveCollider(int i) {
+    Send(RemoveColliderCall, i);
+}
+
+void FalconClient::RemoveColliders() {
+    Send(RemoveCollidersCall);
+}
+
+
+// Frames
+int FalconClient::AddFrame(int parent) {
+    return Call<int>(AddFrameCall, parent);
+}
+
+void FalconClient::SetFrames(const int* frames, const float* matrices, int n) {
+    if (!shared || !frames || !matrices || n <= 0) return;
+
+    size_t size = n * (sizeof(int) + 16 * sizeof(float));
+    if (size > serverBulkSize) {
+        std::cout << "Too many frames to send to the haptic server: " << n << std::endl;
+        return;
+    }
+
+    // The bulk area is free, as the last call using it returned
+    memcpy(shared->bulk, frames, n * sizeof(int));
+    memcpy(shared->bulk + n * sizeof(int), matrices, n * 16 * sizeof(float));
+
+    Call<bool>(SetFramesCall, n);
+}
+
+void FalconClient::RemoveFrame(int frame) {
+    Send(RemoveFrameCall, frame);
+}
+
+void FalconClient::RemoveFrames() {
+    Send(RemoveFramesCall);
+}
+
+void FalconClient::SetEffectFrame(int type, int i, int frame) {
+    Send(SetEffectFrameCall, type, i, frame);
+}
+
+
+// Force queries
+int FalconClient::EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads) {
+    if (!shared || !points || !forces || n <= 0) return 0;
+
+    size_t size = 2 * n * sizeof(Vector3);
+    if (size > serverBulkSize) {
+        std::cout << "Too many points to send to the haptic server: " << n << std::endl;
+        return 0;
+    }
+
+    // The bulk area is free, as the last call using it returned. Forces come back after the points.
+    memcpy(shared->bulk, points, n * sizeof(Vector3));
+
+    int evaluated = Call<int>(EvaluateForcesCall, n, numThreads);
+    memcpy(forces, shared->bulk + n * sizeof(Vector3), evaluated * sizeof(Vector3));
+
+    return evaluated;
+}
+
+
+// Multi-point probes
+void FalconClient::SetProbePoints(const Vector3* offsets, const float* radii, int n) {
+    if (!shared) return;
+    if (!offsets || n < 0) n = 0;
+    n = std::min(n, maxProbePoints);
+
+    // The bulk area is free, as the last call using it returned
+    memcpy(shared->bulk, offsets, n * sizeof(Vector3));
+    if (radii) {
+        memcpy(shared->bulk + n * sizeof(Vector3), radii, n * sizeof(float));
+    }
+
+    Call<bool>(SetProbePointsCall, n, radii != nullptr);
+}
+
+
+// Molecular force field
+void FalconClient::SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+    CallAtoms(SetForceFieldReceptorCall, p, sigma, epsilon, charge, n);
+}
+
+void FalconClient::SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+    CallAtoms(SetForceFieldLigandCall, p, sigma, epsilon, charge, n);
+}
+
+void FalconClient::SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads) {
+    Send(SetForceFieldCall, enable, cutoff, coulombConstant, forceScale, maxForce, maxStiffness, c, numThreads);
+}
+
+ForceFieldStats FalconClient::GetForceFieldStats() {
+    return Call<ForceFieldStats>(GetForceFieldStatsCall);
+}
+
+bool FalconClient::LoadSceneData(const void* data, int size) {
+    if (!shared || !data) return false;
+
+    if (size < 0 || (size_t)size > serverBulkSize) {
+        std::cout << "Scene too large to send to the haptic server: " << size << " bytes" << std::endl;
+        return false;
+    }
+
+    // The bulk area is free, as the last call using it returned
+    memcpy(shared->bulk, data, size);
+
+    return Call<bool>(LoadSceneDataCall, size);
+}
+
+int FalconClient::SaveSceneData(void* data, int size) {
+    if (!shared) return 0;
+
+    int room = data ? (int)std::min((size_t)(size > 0 ? size : 0), serverBulkSize) : 0;
+    int sceneSize = Call<int>(SaveSceneDataCall, room);
+
+    if ((size_t)sceneSize > serverBulkSize) {
+        std::cout << "Scene too large to receive from the haptic server: " << sceneSize << " bytes" << std::endl;
+        return 0;
+    }
+
+    if (data && sceneSize > 0 && sceneSize <= room) {
+        memcpy(data, shared->bulk, sceneSize);
+    }
+
+    return sceneSize;
+}
+
+
+template <class... A>
+void FalconClient::Send(ServerCallType type, const A&... args) {
+    static_assert(ArgumentSize<A...>::value <= serverCallArgumentSize, "Call arguments too large");
+
+    if (!shared) return;
+
+    Heartbeat();
+
+    // Wait for a free slot
+    if (write - shared->callRead.load(std::memory_order_acquire) >= (uint64_t)serverCallCapacity) {
+        if (!WaitForServer(write - serverCallCapacity + 1)) return;
+    }
+
+    ServerCall& call = shared->calls[write % serverCallCapacity];
+    call.type = type;
+    call.size = (uint32_t)ArgumentSize<A...>::value;
+    call.sequence = write + 1;
+    PackArguments(call.args, args...);
+
+    write++;
+    shared->callWrite.store(write, std::memory_order_release);
+}
+
+template <class R, class... A>
+R FalconClient::Call(ServerCallType type, const A&... args) {
+    static_assert(sizeof(R) <= serverReplySize, "Reply too large");
+
+    R result;
+    memset(&result, 0, sizeof(R));
+
+    Send(type, args...);
+    if (!shared || !WaitForServer(write)) return result;
+
+    // Everything up to this call is done, so the reply is for it
+    if (shared->replySequence.load(std::memory_order_acquire) == write) {
+        memcpy(&result, shared->reply, sizeof(R));
+    }
+
+    return result;
+}
+
+void FalconClient::CallAtoms(ServerCallType type, const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+    if (!shared) return;
+
+    size_t size = n * (sizeof(Vector3) + 3 * sizeof(float));
+    if (n < 0 || size > serverBulkSize) {
+        std::cout << "Too many atoms to send to the haptic server: " << n << std::endl;
+        return;
+    }
+
+    // The bulk area is free, as the last call using it returned
+    unsigned char* bulk = shared->bulk;
+    memcpy(bulk, p, n * sizeof(Vector3));
+    bulk += n * sizeof(Vector3);
+    memcpy(bulk, sigma, n * sizeof(float));
+    bulk += n * sizeof(float);
+    memcpy(bulk, epsilon, n * sizeof(float));
+    bulk += n * sizeof(float);
+    memcpy(bulk, charge, n * sizeof(float));
+
+    Call<bool>(type, n);
+}
+
+bool FalconClient::WaitForServer(uint64_t read) {
+    uint64_t heartbeat = shared->serverHeartbeat.load(std::memory_order_relaxed);
+    auto lastBeat = std::chrono::steady_clock::now();
+
+    while (shared->callRead.load(std::memory_order_acquire) < read) {
+        std::this_thread::yield();
+
+        // Give up if the server has stopped
+        uint64_t beat = shared->serverHeartbeat.load(std::memory_order_relaxed);
+        auto now = std::chrono::steady_clock::now();
+        if (beat != heartbeat) {
+            heartbeat = beat;
+            lastBeat = now;
+        }
+        else if (std::chrono::duration<double>(now - lastBeat).count() > serverTimeout) {
+            std::cout << "Haptic server " << name << " is not responding" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void FalconClient::Heartbeat() {
+    shared->clientHeartbeat.fetch_add(1, std::memory_order_relaxed);
+}
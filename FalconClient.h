@@ -0,0 +1,228 @@
+/*=========================================================================
+
+  Name:        FalconClient.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Client for an out-of-process haptic server. Initializing
+               maps the server's shared memory instead of opening the
+               device. Calls without a result are queued for the server
+               without waiting; calls with a result wait for its reply.
+               Device state is read from the shared state block.
+
+=========================================================================*/
+
+
+#ifndef FALCONCLIENT_H
+#define FALCONCLIENT_H
+
+
+#include "HapticServer.h"
+
+
+class FalconClient : public FalconInterface {
+public:
+    FalconClient(const char* name = HAPTIC_SERVER_DEFAULT_NAME);
+    virtual ~FalconClient();
+
+    // Map the server's shared memory and start a session. Fails if no server is running or another
+    // application is connected to it.
+    bool Initialize();
+    bool IsInitialized();
+
+    // Connecting doesn't wait on the device, so this initializes immediately. Both times in the status are the time
+    // taken to connect.
+    bool InitializeAsync();
+    InitializeStatus GetInitializeStatus();
+
+    // Real-time options are given on the server's command line, so this is ignored
+    void SetRealTime(bool enable, int cpu, int priority);
+
+    void SetServoRate(float hz);
+    void SetSubsteps(int n);
+
+    void SetPassivityControl(bool enable, float maxDamping);
+    PassivityStats GetPassivityStats();
+
+    void SetComputeBudget(bool enable, float budget, float nearRadius);
+    SchedulerStats GetSchedulerStats();
+
+    void SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon);
+    ForceCacheStats GetForceCacheStats();
+
+    ServoStats GetServoStats();
+    void ResetServoStats();
+
+    void SetTelemetry(bool enable);
+    EffectTelemetry GetEffectTelemetry(int type);
+    void ResetTelemetry();
+
+    void SetGraphicsWorkspace(Vector3 center, Vector3 size);
+    void SetGraphicsWorkspace(Vector3 center, Vector3 size, Quaternion rotation);
+
+    void ResetForces();
+
+    Vector3 GetPosition();
+    Vector3 GetForce();
+    Vector3 GetTorque();
+    bool GetButton(int button);
+
+    void UseForceFeedback(bool use);
+    void SetProxyPosition(Vector3 p);
+
+    int AddSimpleForce(Vector3 f);
+    void UpdateSimpleForce(int i, Vector3 f);
+    void RemoveSimpleForce(int i);
+    void RemoveSimpleForces();
+
+    int AddViscosity(float c, float w);
+    void UpdateViscosity(int i, float c, float w);
+    void RemoveViscosity(int i);
+    void RemoveViscosities();
+
+    int AddSurface(Vector3 p, Vector3 n, float k, float c);
+    void UpdateSurface(int i, Vector3 p, Vector3 n, float k, float c);
+    void RemoveSurface(int i);
+    void RemoveSurfaces();
+
+    int AddSpring(Vector3 p, float k, float c, float r, float m);
+    void UpdateSpring(int i, Vector3 p, float k, float c, float r, float m);
+    void RemoveSpring(int i);
+    void RemoveSprings();
+
+    int AddIntermolecularForce(Vector3 p, float k, float c, float r, float m);
+    void UpdateIntermolecularForce(int i, Vector3 p, float k, float c, float r, float m);
+    void RemoveIntermolecularForce(int i);
+    void RemoveIntermolecularForces();
+
+    int AddRandomForce(float minMag, float maxMag, float minTime, float maxTime);
+    void UpdateRandomForce(int i, float minMag, float maxMag, float minTime, float maxTime);
+    void RemoveRandomForce(int i);
+    void RemoveRandomForces();
+
+    int AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag);
+    void UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag);
+    void SetRigidBodyPose(int i, Vector3 p, Quaternion r);
+    RigidBodyPose GetRigidBodyPose(int i);
+    void GrabRigidBody(int i, bool grab);
+    void RemoveRigidBody(int i);
+    void RemoveRigidBodies();
+    void SetRigidBodyGravity(Vector3 g);
+
+    void SetEffectGroup(int type, int i, int group);
+    void SetGroupMask(unsigned int mask);
+    void SetGroupEnabled(int group, bool enable);
+    unsigned int GetGroupMask();
+
+    // Grids and meshes are copied through the bulk area, so are limited to its size
+    int AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c);
+    int AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c);
+    void UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c);
+    bool IsDistanceFieldReady(int i);
+    void RemoveDistanceField(int i);
+    void RemoveDistanceFields();
+
+    // Control points are copied through the bulk area, so are limited to its size
+    int AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+    void UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+    void RemovePathConstraint(int i);
+    void RemovePathConstraints();
+
+    // Profile forces are copied through the bulk area, so are limited to its size
+    int AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic);
+    void RemoveRadialProfile(int profile);
+    int AddRadialForce(Vector3 p, int profile, float scale, float c);
+    void UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c);
+    void RemoveRadialForce(int i);
+    void RemoveRadialForces();
+
+    // Wavetable samples are copied through the bulk area, so are limited to its size
+    int AddWavetable(const float* samples, int numSamples);
+    void RemoveWavetable(int wavetable);
+    int AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+    void UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+    void TriggerVibration(int i, float duration);
+    void ReleaseVibration(int i);
+    void RemoveVibration(int i);
+    void RemoveVibrations();
+
+    // Expressions are copied through the bulk area, so are limited to its size
+    int AddExpressionForce(const char* expression);
+    void SetExpressionParameters(int i, const float* parameters, int numParameters);
+    void RemoveExpressionForce(int i);
+    void RemoveExpressionForces();
+
+    // File and kernel names are copied through the bulk area. Libraries are loaded by the server process.
+    int LoadKernelLibrary(const char* fileName);
+    int FindKernel(const char* name);
+    int AddKernelForce(int kernel, const float* parameters, int numParameters);
+    void UpdateKernelForce(int i, const float* parameters, int numParameters);
+    void RemoveKernelForce(int i);
+    void RemoveKernelForces();
+    KernelStats GetKernelStats(int kernel);
+
+    int AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+    void UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+    void RemoveCollider(int i);
+    void RemoveColliders();
+
+    // Frame transforms are copied through the bulk area, waiting for the server
+    int AddFrame(int parent);
+    void SetFrames(const int* frames, const float* matrices, int n);
+    void RemoveFrame(int frame);
+    void RemoveFrames();
+    void SetEffectFrame(int type, int i, int frame);
+
+    // Points and forces are copied through the bulk area, so are limited to its size
+    int EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads);
+
+    // Offsets and radii are copied through the bulk area, waiting for the server
+    void SetProbePoints(const Vector3* offsets, const float* radii, int n);
+
+    void SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n);
+    void SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n);
+    void SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads);
+    ForceFieldStats GetForceFieldStats();
+
+    // Scenes are copied through the bulk area, so are limited to its size
+    bool LoadSceneData(const void* data, int size);
+    int SaveSceneData(void* data, int size);
+
+protected:
+    std::string name;
+    SharedMemory memory;
+    ServerShared* shared;
+
+    bool initialized;
+    uint32_t processId;
+
+    // Result of the last Initialize()
+    int initializeState;
+    float connectTime;
+
+    // Next call slot and sequence number
+    uint64_t write;
+
+
+    // Queue a call without waiting
+    template <class... A>
+    void Send(ServerCallType type, const A&... args);
+
+    // Queue a call and wait for its result. Returns a zeroed result if the server doesn't reply.
+    template <class R, class... A>
+    R Call(ServerCallType type, const A&... args);
+
+    // Copy atom arrays to the bulk area and wait for the server to take them
+    void CallAtoms(ServerCallType type, const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n);
+
+    // Wait for a free call slot, or for the server to finish everything queued. Returns false if the server has stopped.
+    bool WaitForServer(uint64_t read);
+
+    // Let the server know this process is still responsive
+    void Heartbeat();
+};
+
+
+#endif
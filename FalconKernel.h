@@ -0,0 +1,81 @@
+/*=========================================================================
+
+  Name:        FalconKernel.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: C interface for force kernels in external shared
+               libraries. A kernel computes the forces of a whole batch
+               of its effects per call, with each parameter in its own
+               array so the kernel can vectorize over effects. Effects
+               are added, updated and removed like built in effects.
+
+               Include this header in a kernel library and export
+               FalconGetKernels. Only plain C types cross the interface,
+               and structs are only ever extended at the end, with the
+               version raised.
+
+=========================================================================*/
+
+
+#ifndef FALCONKERNEL_H
+#define FALCONKERNEL_H
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define FALCON_KERNEL_VERSION 1
+
+/* Most parameters per effect, and most effects passed in one call */
+#define FALCON_KERNEL_MAX_PARAMETERS 16
+#define FALCON_KERNEL_BATCH_SIZE 64
+
+/* Probe state in graphics space, the same for every batch in a servo tick */
+typedef struct FalconKernelProbe {
+    double position[3];
+    double velocity[3];
+
+    /* Servo clock time at the end of the step, and the step length, in seconds */
+    double time;
+    double dt;
+} FalconKernelProbe;
+
+/* Effects to evaluate. parameters[j][i] is parameter j of effect i, for the kernel's parameters. The kernel writes
+   the graphics space force of effect i to force[0][i], force[1][i] and force[2][i]. */
+typedef struct FalconKernelBatch {
+    int count;
+    const double* parameters[FALCON_KERNEL_MAX_PARAMETERS];
+    double* force[3];
+} FalconKernelBatch;
+
+/* Called on the servo thread, so must not block, allocate or take locks. context is the kernel's own. */
+typedef void (*FalconKernelFunction)(void* context, const FalconKernelProbe* probe, const FalconKernelBatch* batch);
+
+typedef struct FalconKernel {
+    /* Unique name, used to find the kernel, copied when registered */
+    const char* name;
+
+    int numParameters;
+    FalconKernelFunction compute;
+    void* context;
+} FalconKernel;
+
+/* Exported by a kernel library as FalconGetKernels. Fill in up to maxKernels kernels and return how many there are,
+   or -1 if the library doesn't support the given FALCON_KERNEL_VERSION. The library stays loaded until the plugin is
+   shut down. */
+typedef int (*FalconGetKernelsFunction)(int version, FalconKernel* kernels, int maxKernels);
+
+#define FALCON_GET_KERNELS "FalconGetKernels"
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -12,27 +12,192 @@
 =========================================================================*/
 
 
+#ifdef _WIN32
 #define EXPORT_API __declspec(dllexport)
+#else
+#define EXPORT_API __attribute__((visibility("default")))
+#endif
 
 
 #include "Falcon.h"
+#include "FalconClient.h"
 
+#include <string>
 
-Falcon* falcon = nullptr;
+
+FalconInterface* falcon = nullptr;
+
+// Name of the haptic server to connect to, or empty to open the device in this process
+std::string hapticServer;
+
+
+FalconInterface* CreateFalcon() {
+    if (hapticServer.empty()) {
+        return new Falcon();
+    }
+    else {
+        return new FalconClient(hapticServer.c_str());
+    }
+}
 
 
 extern "C" {
 
     bool EXPORT_API Initialize() {  
-        if (falcon) {
+        if (falcon && falcon->IsInitialized()) {
             // Just in case CleanUp() wasn't called...
             delete falcon;
+            falcon = nullptr;
         }
         
-        falcon = new Falcon();
+        if (!falcon) {
+            falcon = CreateFalcon();
+        }
+
         return falcon->Initialize();
     }
 
+    bool EXPORT_API InitializeAsync() {
+        if (falcon && falcon->IsInitialized()) {
+            // Just in case CleanUp() wasn't called...
+            delete falcon;
+            falcon = nullptr;
+        }
+
+        if (!falcon) {
+            falcon = CreateFalcon();
+        }
+
+        return falcon->InitializeAsync();
+    }
+
+    InitializeStatus EXPORT_API GetInitializeStatus() {
+        if (falcon) {
+            return falcon->GetInitializeStatus();
+        }
+        else {
+            InitializeStatus status = {};
+            return status;
+        }
+    }
+
+    void EXPORT_API SetHapticServer(const char* name) {
+        // Set before Initialize(). Null or empty to open the device in this process.
+        hapticServer = name ? name : "";
+
+        if (falcon && !falcon->IsInitialized()) {
+            delete falcon;
+            falcon = nullptr;
+        }
+    }
+
+    void EXPORT_API SetRealTime(bool enable, int cpu, int priority) {
+        if (!falcon) {
+            // Real-time options must be set before Initialize()
+            falcon = CreateFalcon();
+        }
+
+        falcon->SetRealTime(enable, cpu, priority);
+    }
+
+    void EXPORT_API SetServoRate(float hz) {
+        if (falcon) {
+            falcon->SetServoRate(hz);
+        }
+    }
+
+    void EXPORT_API SetSubsteps(int n) {
+        if (falcon) {
+            falcon->SetSubsteps(n);
+        }
+    }
+
+    void EXPORT_API SetPassivityControl(bool enable, float maxDamping) {
+        if (falcon) {
+            falcon->SetPassivityControl(enable, maxDamping);
+        }
+    }
+
+    PassivityStats EXPORT_API GetPassivityStats() {
+        if (falcon) {
+            return falcon->GetPassivityStats();
+        }
+        else {
+            PassivityStats stats = {};
+            return stats;
+        }
+    }
+
+    void EXPORT_API SetComputeBudget(bool enable, float budget, float nearRadius) {
+        if (falcon) {
+            falcon->SetComputeBudget(enable, budget, nearRadius);
+        }
+    }
+
+    SchedulerStats EXPORT_API GetSchedulerStats() {
+        if (falcon) {
+            return falcon->GetSchedulerStats();
+        }
+        else {
+            SchedulerStats stats = {};
+            return stats;
+        }
+    }
+
+    void EXPORT_API SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon) {
+        if (falcon) {
+            falcon->SetForceCache(enable, positionEpsilon, velocityEpsilon);
+        }
+    }
+
+    ForceCacheStats EXPORT_API GetForceCacheStats() {
+        if (falcon) {
+            return falcon->GetForceCacheStats();
+        }
+        else {
+            ForceCacheStats stats = {};
+            return stats;
+        }
+    }
+
+    ServoStats EXPORT_API GetServoStats() {
+        if (falcon) {
+            return falcon->GetServoStats();
+        }
+        else {
+            ServoStats stats = {};
+            return stats;
+        }
+    }
+
+    void EXPORT_API ResetServoStats() {
+        if (falcon) {
+            falcon->ResetServoStats();
+        }
+    }
+
+    void EXPORT_API SetTelemetry(bool enable) {
+        if (falcon) {
+            falcon->SetTelemetry(enable);
+        }
+    }
+
+    EffectTelemetry EXPORT_API GetEffectTelemetry(int type) {
+        if (falcon) {
+            return falcon->GetEffectTelemetry(type);
+        }
+        else {
+            EffectTelemetry telemetry = {};
+            return telemetry;
+        }
+    }
+
+    void EXPORT_API ResetTelemetry() {
+        if (falcon) {
+            falcon->ResetTelemetry();
+        }
+    }
+
     void EXPORT_API CleanUp() {
         if (falcon) {
             delete falcon;
@@ -46,6 +211,12 @@ extern "C" {
         }
     }
 
+    void EXPORT_API SetGraphicsWorkspaceRotated(Vector3 center, Vector3 size, Quaternion rotation) {
+        if (falcon) {
+            falcon->SetGraphicsWorkspace(center, size, rotation);
+        }
+    }
+
 	void EXPORT_API ResetForces() {
 		if (falcon) {
 			falcon->ResetForces();
@@ -72,6 +243,16 @@ extern "C" {
         }
     }
 
+    Vector3 EXPORT_API GetTorque() {
+        if (falcon) {
+            return falcon->GetTorque();
+        }
+        else {
+            Vector3 v = { 0.0, 0.0, 0.0 };
+            return v;
+        }
+    }
+
     bool EXPORT_API GetButton(int button) {
         if (falcon) {
             return falcon->GetButton(button);
@@ -255,4 +436,488 @@ extern "C" {
             falcon->RemoveRandomForces();
         }
     }
+
+    // Rigid bodies
+    int EXPORT_API AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+        if (falcon) {
+            return falcon->AddRigidBody(p, r, mass, inertia, shape, extents, k, c, linearDrag, angularDrag);
+        }
+
+        return -1;
+    }
+
+    void EXPORT_API UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag) {
+        if (falcon) {
+            falcon->UpdateRigidBody(i, mass, inertia, shape, extents, k, c, linearDrag, angularDrag);
+        }
+    }
+
+    void EXPORT_API SetRigidBodyPose(int i, Vector3 p, Quaternion r) {
+        if (falcon) {
+            falcon->SetRigidBodyPose(i, p, r);
+        }
+    }
+
+    RigidBodyPose EXPORT_API GetRigidBodyPose(int i) {
+        if (falcon) {
+            return falcon->GetRigidBodyPose(i);
+        }
+        else {
+            RigidBodyPose pose = {};
+            pose.rotation.w = 1.0f;
+            return pose;
+        }
+    }
+
+    void EXPORT_API GrabRigidBody(int i, bool grab) {
+        if (falcon) {
+            falcon->GrabRigidBody(i, grab);
+        }
+    }
+
+    void EXPORT_API RemoveRigidBody(int i) {
+        if (falcon) {
+            falcon->RemoveRigidBody(i);
+        }
+    }
+
+    void EXPORT_API RemoveRigidBodies() {
+        if (falcon) {
+            falcon->RemoveRigidBodies();
+        }
+    }
+
+    void EXPORT_API SetRigidBodyGravity(Vector3 g) {
+        if (falcon) {
+            falcon->SetRigidBodyGravity(g);
+        }
+    }
+
+    // Effect groups
+    void EXPORT_API SetEffectGroup(int type, int i, int group) {
+        if (falcon) {
+            falcon->SetEffectGroup(type, i, group);
+        }
+    }
+
+    void EXPORT_API SetGroupMask(unsigned int mask) {
+        if (falcon) {
+            falcon->SetGroupMask(mask);
+        }
+    }
+
+    void EXPORT_API SetGroupEnabled(int group, bool enable) {
+        if (falcon) {
+            falcon->SetGroupEnabled(group, enable);
+        }
+    }
+
+    unsigned int EXPORT_API GetGroupMask() {
+        if (falcon) {
+            return falcon->GetGroupMask();
+        }
+        else {
+            return 0;
+        }
+    }
+
+    // Distance fields
+    int EXPORT_API AddDistanceField(const float* distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c) {
+        if (falcon) {
+            return falcon->AddDistanceField(distances, nx, ny, nz, origin, cellSize, p, r, k, c);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    int EXPORT_API AddDistanceFieldMesh(const Vector3* vertices, int numVertices, const int* triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c) {
+        if (falcon) {
+            return falcon->AddDistanceFieldMesh(vertices, numVertices, triangles, numTriangles, resolution, p, r, k, c);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c) {
+        if (falcon) {
+            falcon->UpdateDistanceField(i, p, r, k, c);
+        }
+    }
+
+    bool EXPORT_API IsDistanceFieldReady(int i) {
+        if (falcon) {
+            return falcon->IsDistanceFieldReady(i);
+        }
+        else {
+            return false;
+        }
+    }
+
+    void EXPORT_API RemoveDistanceField(int i) {
+        if (falcon) {
+            falcon->RemoveDistanceField(i);
+        }
+    }
+
+    void EXPORT_API RemoveDistanceFields() {
+        if (falcon) {
+            falcon->RemoveDistanceFields();
+        }
+    }
+
+    // Path constraints
+    int EXPORT_API AddPathConstraint(const Vector3* points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+        if (falcon) {
+            return falcon->AddPathConstraint(points, numPoints, spline, closed, p, r, k, c, radius, along);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along) {
+        if (falcon) {
+            falcon->UpdatePathConstraint(i, p, r, k, c, radius, along);
+        }
+    }
+
+    void EXPORT_API RemovePathConstraint(int i) {
+        if (falcon) {
+            falcon->RemovePathConstraint(i);
+        }
+    }
+
+    void EXPORT_API RemovePathConstraints() {
+        if (falcon) {
+            falcon->RemovePathConstraints();
+        }
+    }
+
+    // Radial forces
+    int EXPORT_API AddRadialProfile(const float* forces, int numSamples, float maxDistance, bool cubic) {
+        if (falcon) {
+            return falcon->AddRadialProfile(forces, numSamples, maxDistance, cubic);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API RemoveRadialProfile(int profile) {
+        if (falcon) {
+            falcon->RemoveRadialProfile(profile);
+        }
+    }
+
+    int EXPORT_API AddRadialForce(Vector3 p, int profile, float scale, float c) {
+        if (falcon) {
+            return falcon->AddRadialForce(p, profile, scale, c);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c) {
+        if (falcon) {
+            falcon->UpdateRadialForce(i, p, profile, scale, c);
+        }
+    }
+
+    void EXPORT_API RemoveRadialForce(int i) {
+        if (falcon) {
+            falcon->RemoveRadialForce(i);
+        }
+    }
+
+    void EXPORT_API RemoveRadialForces() {
+        if (falcon) {
+            falcon->RemoveRadialForces();
+        }
+    }
+
+    // Vibrations
+    int EXPORT_API AddWavetable(const float* samples, int numSamples) {
+        if (falcon) {
+            return falcon->AddWavetable(samples, numSamples);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API RemoveWavetable(int wavetable) {
+        if (falcon) {
+            falcon->RemoveWavetable(wavetable);
+        }
+    }
+
+    int EXPORT_API AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+        if (falcon) {
+            return falcon->AddVibration(wavetable, direction, amplitude, frequency, attack, decay, sustain, release);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release) {
+        if (falcon) {
+            falcon->UpdateVibration(i, wavetable, direction, amplitude, frequency, attack, decay, sustain, release);
+        }
+    }
+
+    void EXPORT_API TriggerVibration(int i, float duration) {
+        if (falcon) {
+            falcon->TriggerVibration(i, duration);
+        }
+    }
+
+    void EXPORT_API ReleaseVibration(int i) {
+        if (falcon) {
+            falcon->ReleaseVibration(i);
+        }
+    }
+
+    void EXPORT_API RemoveVibration(int i) {
+        if (falcon) {
+            falcon->RemoveVibration(i);
+        }
+    }
+
+    void EXPORT_API RemoveVibrations() {
+        if (falcon) {
+            falcon->RemoveVibrations();
+        }
+    }
+
+    // Expression forces
+    int EXPORT_API AddExpressionForce(const char* expression) {
+        if (falcon) {
+            return falcon->AddExpressionForce(expression);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API SetExpressionParameters(int i, const float* parameters, int numParameters) {
+        if (falcon) {
+            falcon->SetExpressionParameters(i, parameters, numParameters);
+        }
+    }
+
+    void EXPORT_API RemoveExpressionForce(int i) {
+        if (falcon) {
+            falcon->RemoveExpressionForce(i);
+        }
+    }
+
+    void EXPORT_API RemoveExpressionForces() {
+        if (falcon) {
+            falcon->RemoveExpressionForces();
+        }
+    }
+
+    // External kernel forces
+    int EXPORT_API LoadKernelLibrary(const char* fileName) {
+        if (falcon) {
+            return falcon->LoadKernelLibrary(fileName);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    int EXPORT_API FindKernel(const char* name) {
+        if (falcon) {
+            return falcon->FindKernel(name);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    int EXPORT_API AddKernelForce(int kernel, const float* parameters, int numParameters) {
+        if (falcon) {
+            return falcon->AddKernelForce(kernel, parameters, numParameters);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdateKernelForce(int i, const float* parameters, int numParameters) {
+        if (falcon) {
+            falcon->UpdateKernelForce(i, parameters, numParameters);
+        }
+    }
+
+    void EXPORT_API RemoveKernelForce(int i) {
+        if (falcon) {
+            falcon->RemoveKernelForce(i);
+        }
+    }
+
+    void EXPORT_API RemoveKernelForces() {
+        if (falcon) {
+            falcon->RemoveKernelForces();
+        }
+    }
+
+    KernelStats EXPORT_API GetKernelStats(int kernel) {
+        if (falcon) {
+            return falcon->GetKernelStats(kernel);
+        }
+        else {
+            KernelStats stats = {};
+            return stats;
+        }
+    }
+
+    // Primitive colliders
+    int EXPORT_API AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+        if (falcon) {
+            return falcon->AddCollider(shape, extents, p, r, k, c);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c) {
+        if (falcon) {
+            falcon->UpdateCollider(i, shape, extents, p, r, k, c);
+        }
+    }
+
+    void EXPORT_API RemoveCollider(int i) {
+        if (falcon) {
+            falcon->RemoveCollider(i);
+        }
+    }
+
+    void EXPORT_API RemoveColliders() {
+        if (falcon) {
+            falcon->RemoveColliders();
+        }
+    }
+
+    // Frames
+    int EXPORT_API AddFrame(int parent) {
+        if (falcon) {
+            return falcon->AddFrame(parent);
+        }
+        else {
+            return -1;
+        }
+    }
+
+    void EXPORT_API SetFrames(const int* frames, const float* matrices, int n) {
+        if (falcon) {
+            falcon->SetFrames(frames, matrices, n);
+        }
+    }
+
+    void EXPORT_API RemoveFrame(int frame) {
+        if (falcon) {
+            falcon->RemoveFrame(frame);
+        }
+    }
+
+    void EXPORT_API RemoveFrames() {
+        if (falcon) {
+            falcon->RemoveFrames();
+        }
+    }
+
+    void EXPORT_API SetEffectFrame(int type, int i, int frame) {
+        if (falcon) {
+            falcon->SetEffectFrame(type, i, frame);
+        }
+    }
+
+    // Force queries
+    int EXPORT_API EvaluateForces(const Vector3* points, Vector3* forces, int n, int numThreads) {
+        if (falcon) {
+            return falcon->EvaluateForces(points, forces, n, numThreads);
+        }
+        else {
+            return 0;
+        }
+    }
+
+    // Multi-point probes
+    void EXPORT_API SetProbePoints(const Vector3* offsets, const float* radii, int n) {
+        if (falcon) {
+            falcon->SetProbePoints(offsets, radii, n);
+        }
+    }
+
+    // Molecular force field
+    void EXPORT_API SetForceFieldReceptor(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+        if (falcon) {
+            falcon->SetForceFieldReceptor(p, sigma, epsilon, charge, n);
+        }
+    }
+
+    void EXPORT_API SetForceFieldLigand(const Vector3* p, const float* sigma, const float* epsilon, const float* charge, int n) {
+        if (falcon) {
+            falcon->SetForceFieldLigand(p, sigma, epsilon, charge, n);
+        }
+    }
+
+    void EXPORT_API SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads) {
+        if (falcon) {
+            falcon->SetForceField(enable, cutoff, coulombConstant, forceScale, maxForce, maxStiffness, c, numThreads);
+        }
+    }
+
+    ForceFieldStats EXPORT_API GetForceFieldStats() {
+        if (falcon) {
+            return falcon->GetForceFieldStats();
+        }
+        else {
+            ForceFieldStats stats = {};
+            return stats;
+        }
+    }
+
+    bool EXPORT_API LoadScene(const char* fileName) {
+        if (falcon) {
+            return falcon->LoadScene(fileName);
+        }
+        else {
+            return false;
+        }
+    }
+
+    bool EXPORT_API SaveScene(const char* fileName) {
+        if (falcon) {
+            return falcon->SaveScene(fileName);
+        }
+        else {
+            return false;
+        }
+    }
+
+    bool EXPORT_API LoadSceneData(const void* data, int size) {
+        if (falcon) {
+            return falcon->LoadSceneData(data, size);
+        }
+        else {
+            return false;
+        }
+    }
+
+    int EXPORT_API SaveSceneData(void* data, int size) {
+        if (falcon) {
+            return falcon->SaveSceneData(data, size);
+        }
+        else {
+            return 0;
+        }
+    }
 }
\ No newline at end of file
@@ -7,7 +7,18 @@
   Copyright:   The Renaissance Computing Institute (RENCI)
 
   Description: Class to contain and keep track of force effects and force
-               effect ids.
+               effect ids. Each effect is kept both as given by the
+               application (graphics space) and transformed to device
+               space for use in the servo loop.
+
+               The application thread owns the ids and the graphics space
+               effects. The servo thread owns a dense array of device space
+               effects, which it updates from a lock-free command queue, so
+               the servo loop never locks or allocates.
+
+               Each effect belongs to one of 32 groups. The dense array is
+               kept sorted by group, so the servo loop can iterate only the
+               groups that are enabled.
 
 =========================================================================*/
 
@@ -16,22 +27,66 @@
 #define FORCECONTAINER_H
 
 
-#include <unordered_map>
+#include <cstdint>
+#include <cstring>
 #include <forward_list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "CommandQueue.h"
+
+
+// Number of effect groups, one per bit of a group mask
+const int numEffectGroups = 32;
+
+// Index of the lowest set bit of a non-zero mask
+inline int LowestBit(uint32_t mask) {
+    int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+}
+
+
+// Copy parameters into an existing effect. Overload for effects that keep state in the servo loop.
+template <class T>
+void UpdateParameters(T& effect, const T& parameters) {
+    effect = parameters;
+}
 
 
 template <class T>
 class ForceContainer {
 public:
-    ForceContainer() {}
+    ForceContainer() : synchronous(true), numEffects(0), nextId(0), storage(nullptr), reserved(nullptr) {
+        // Start with enough room that small scenes never grow
+        Reserve(64);
+        ApplyCommands();
+    }
 
-    // Add a force effect. Return id for this effect
-    int Add(T forceEffect) {
+    // The servo thread must be stopped before destruction
+    ~ForceContainer() {
+        Synchronize();
+        FreeStorage(storage);
+        FreeRetired(true);
+    }
+
+    // Apply commands immediately when there is no servo thread to do it
+    void SetSynchronous(bool sync) {
+        synchronous = sync;
+        ApplyCommands();
+    }
+
+    // Add a force effect, given in graphics space and its device space transform, to group 0. Return id for this effect
+    int Add(T sourceEffect, T forceEffect) {
         int id;
 
         if (availableIds.empty()) {
             // Ids are all used, so add a new one
-            id = forceEffects.size();
+            id = nextId++;
         }
         else {
             // At least one id has been used and returned, so take one from the list
@@ -39,51 +94,626 @@ public:
             availableIds.pop_front();
         }
 
+        // Make sure the servo thread has room for it
+        numEffects++;
+        if (numEffects > capacity || nextId > capacity) {
+            Reserve(2 * capacity);
+        }
+
         // Set the force effect
-        forceEffects[id] = forceEffect;
+        if (id >= (int)sourceEffects.size()) {
+            sourceEffects.resize(id + 1);
+            sourceValid.resize(id + 1, 0);
+            sourceGroups.resize(id + 1, 0);
+        }
+        sourceEffects[id] = sourceEffect;
+        sourceValid[id] = 1;
+        sourceGroups[id] = 0;
+
+        Command c;
+        c.op = AddOp;
+        c.id = id;
+        c.group = 0;
+        c.effect = forceEffect;
+        Send(c);
 
         // Return the id
         return id;
     }
 
-    // Return a pointer to the force effect with the given id
-    T* Get(int id) {
-        return &forceEffects[id];
+    // Update the device space parameters of the force effect with the given id, keeping its servo state
+    void Update(int id, T forceEffect) {
+        if (!Valid(id)) return;
+
+        Command c;
+        c.op = UpdateOp;
+        c.id = id;
+        c.effect = forceEffect;
+        Send(c);
+    }
+
+    // Return a pointer to the graphics space force effect with the given id
+    T* GetSource(int id) {
+        return Valid(id) ? &sourceEffects[id] : nullptr;
     }
 
-    // Iterator at the front of the force effects
-    typename std::unordered_map<int, T>::iterator Begin() {
-        return forceEffects.begin();
+    // Move the force effect with the given id to another group, keeping its servo state
+    void SetGroup(int id, int group) {
+        if (!Valid(id) || group < 0 || group >= numEffectGroups || sourceGroups[id] == group) return;
+
+        sourceGroups[id] = (unsigned char)group;
+
+        Command c;
+        c.op = GroupOp;
+        c.id = id;
+        c.group = group;
+        Send(c);
     }
 
-    // Iterator at the end of the force effects
-    typename std::unordered_map<int, T>::iterator End() {
-        return forceEffects.end();
+    // Group of the force effect with the given id, or -1 if there is none
+    int GetGroup(int id) const {
+        return Valid(id) ? sourceGroups[id] : -1;
     }
 
     // Remove the force effect with the given id
     void Remove(int id) {
-        int num = forceEffects.erase(id);
+        if (Valid(id)) {
+            sourceValid[id] = 0;
 
-        if (num > 0) {
             // Valid id, so add it to the available id list
             availableIds.push_front(id);
+            numEffects--;
+
+            Command c;
+            c.op = RemoveOp;
+            c.id = id;
+            Send(c);
         }
     }
 
     // Remove all force effects
     void RemoveAll() {
-        forceEffects.clear();
-        availableIds.clear();   
+        sourceEffects.clear();
+        sourceValid.clear();
+        sourceGroups.clear();
+        availableIds.clear();
+        numEffects = 0;
+        nextId = 0;
+
+        Command c;
+        c.op = RemoveAllOp;
+        Send(c);
+    }
+
+    // Replace all force effects with n new ones, with ids 0 to n - 1. group(i) gives the group of effect i, and
+    // make(i, sourceEffect, forceEffect) fills it in in graphics space and its device space transform. The effects are
+    // written straight into new storage for the servo thread, which switches to it in one command.
+    template <class G, class F>
+    void Load(int n, G group, F make) {
+        if (n < 0) n = 0;
+
+        sourceEffects.resize(n);
+        sourceValid.assign(n, 1);
+        sourceGroups.resize(n);
+        availableIds.clear();
+        numEffects = n;
+        nextId = n;
+
+        int newCapacity = capacity;
+        while (newCapacity < n) newCapacity *= 2;
+
+        Storage* s = AllocateStorage(newCapacity);
+
+        // Count the effects in each group to find where the groups start, then place each effect in its group
+        int counts[numEffectGroups] = {};
+        for (int i = 0; i < n; i++) {
+            int g = group(i);
+            g = g < 0 || g >= numEffectGroups ? 0 : g;
+
+            sourceGroups[i] = (unsigned char)g;
+            counts[g]++;
+        }
+
+        int start = 0;
+        for (int g = 0; g < numEffectGroups; g++) {
+            int count = counts[g];
+            s->groupStart[g] = start;
+            if (count > 0) s->usedGroups |= 1u << g;
+
+            // Next slot in the group
+            counts[g] = start;
+            start += count;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int g = sourceGroups[i];
+            int slot = counts[g]++;
+            make(i, sourceEffects[i], s->effects[slot]);
+
+            s->ids[slot] = i;
+            s->slots[i] = slot;
+            s->groups[i] = (unsigned char)g;
+        }
+        s->size = n;
+
+        Hand(s, LoadOp);
+    }
+
+    // Number of force effects
+    int Count() const {
+        return numEffects;
+    }
+
+    // Call f(id, effect) on every graphics space force effect, in id order
+    template <class F>
+    void ForEachSource(F f) {
+        for (int id = 0; id < (int)sourceEffects.size(); id++) {
+            if (sourceValid[id]) f(id, sourceEffects[id]);
+        }
+    }
+
+    // Re-transform all force effects from graphics space with the given transform function.
+    // Done off the servo thread; the updates are published together so the servo thread sees them in one tick,
+    // unless there are more than fit in the command queue.
+    template <class F>
+    void Transform(F transform) {
+        for (int id = 0; id < (int)sourceEffects.size(); id++) {
+            if (!sourceValid[id]) continue;
+
+            Command c;
+            c.op = UpdateOp;
+            c.id = id;
+            transform(c.effect, sourceEffects[id]);
+
+            while (!commands.Push(c)) {
+                Flush();
+            }
+        }
+
+        Publish();
+    }
+
+    // Release data that device space effects point to, such as a shared table, once the servo thread has applied the
+    // commands sent so far. Call after removing or updating the effects that used it.
+    void Retire(std::shared_ptr<const void> data) {
+        retiredData.push_back(std::make_pair(std::move(data), commands.Pushed()));
+        FreeRetired(false);
+    }
+
+    // Servo thread: apply all pending commands
+    void Synchronize() {
+        commands.Consume([this](Command& c) { Apply(c); });
+    }
+
+    // Servo thread: dense array of device space force effects
+    T* Begin() {
+        return storage->effects;
+    }
+
+    T* End() {
+        return storage->effects + storage->size;
+    }
+
+    int Size() const {
+        return storage->size;
+    }
+
+    // Servo thread: call f(effect, index) for the effects in the groups enabled in mask, with index the effect's position
+    // in the dense array. Disabled groups are skipped without looking at their effects.
+    template <class F>
+    void ForEach(uint32_t mask, F f) {
+        uint32_t used = storage->usedGroups;
+
+        if ((mask & used) == used) {
+            for (int i = 0; i < storage->size; i++) {
+                f(storage->effects[i], i);
+            }
+            return;
+        }
+
+        for (uint32_t m = mask & used; m != 0; m &= m - 1) {
+            int g = LowestBit(m);
+            int end = GroupEnd(g);
+            for (int i = storage->groupStart[g]; i < end; i++) {
+                f(storage->effects[i], i);
+            }
+        }
+    }
+
+    // Servo thread: call f(effects, count) for each contiguous run of effects in the groups enabled in mask, for
+    // evaluating effects in batches. Effects in adjacent enabled groups are passed in one run.
+    template <class F>
+    void ForEachRun(uint32_t mask, F f) {
+        uint32_t used = storage->usedGroups;
+
+        if ((mask & used) == used) {
+            if (storage->size > 0) f(storage->effects, storage->size);
+            return;
+        }
+
+        int start = 0;
+        int end = 0;
+        for (uint32_t m = mask & used; m != 0; m &= m - 1) {
+            int g = LowestBit(m);
+            if (storage->groupStart[g] != end) {
+                if (end > start) f(storage->effects + start, end - start);
+                start = storage->groupStart[g];
+            }
+            end = GroupEnd(g);
+        }
+        if (end > start) f(storage->effects + start, end - start);
+    }
+
+    // Servo thread: number of effects in the groups enabled in mask
+    int Size(uint32_t mask) const {
+        uint32_t used = storage->usedGroups;
+        if ((mask & used) == used) return storage->size;
+
+        int n = 0;
+        for (uint32_t m = mask & used; m != 0; m &= m - 1) {
+            int g = LowestBit(m);
+            n += GroupEnd(g) - storage->groupStart[g];
+        }
+        return n;
+    }
+
+    // Servo thread: id of the effect at the given position in the dense array
+    int IdAt(int index) const {
+        return storage->ids[index];
+    }
+
+    // Servo thread: effects added or updated since the last ClearDirty(). If effects were removed or moved, all are
+    // considered dirty instead.
+    bool AllDirty() const {
+        return storage->allDirty;
+    }
+
+    int NumDirty() const {
+        return storage->numDirty;
+    }
+
+    T* Dirty(int i) {
+        return &storage->effects[storage->slots[storage->dirtyIds[i]]];
+    }
+
+    int DirtyGroup(int i) const {
+        return storage->groups[storage->dirtyIds[i]];
+    }
+
+    void ClearDirty() {
+        for (int i = 0; i < storage->numDirty; i++) {
+            storage->dirty[storage->dirtyIds[i]] = 0;
+        }
+        storage->numDirty = 0;
+        storage->allDirty = false;
     }
 
 protected:
-    // Map with an integer key id for force effects
-    std::unordered_map<int, T> forceEffects;
+    enum Op {
+        AddOp,
+        UpdateOp,
+        RemoveOp,
+        RemoveAllOp,
+        ReserveOp,
+        LoadOp,
+        GroupOp
+    };
+
+    // Servo thread storage. Allocated and freed on the application thread
+    struct Storage {
+        int capacity;
+        int size;
+
+        // Dense device space effects and their ids
+        T* effects;
+        int* ids;
+
+        // Position in the dense array and group for each id
+        int* slots;
+        unsigned char* groups;
+
+        // Start of each group in the dense array, which is sorted by group, and a bit for each group with effects
+        int groupStart[numEffectGroups];
+        uint32_t usedGroups;
+
+        // Dirty flag for each id, and the list of dirty ids
+        unsigned char* dirty;
+        int* dirtyIds;
+        int numDirty;
+        bool allDirty;
+    };
+
+    struct Command {
+        Op op;
+        int id;
+        int group;
+        T effect;
+        Storage* storage;
+    };
 
-    // List to keep track of ids that have been used and returned
+    // Apply commands on the application thread instead of the servo thread
+    bool synchronous;
+
+    // Application thread bookkeeping. Graphics space effects are indexed by id, as ids are reused and so stay dense.
+    std::vector<T> sourceEffects;
+    std::vector<unsigned char> sourceValid;
+    std::vector<unsigned char> sourceGroups;
     std::forward_list<int> availableIds;
+    int numEffects;
+    int nextId;
+    int capacity;
+
+    // Storage being used by the servo thread
+    Storage* storage;
+
+    // Most recent storage handed to the servo thread
+    Storage* reserved;
+
+    // Storage replaced on the servo thread, with the command count after which it can be freed
+    std::vector<std::pair<Storage*, uint64_t> > retired;
+
+    // Data released by the application, with the command count after which the servo thread no longer uses it
+    std::vector<std::pair<std::shared_ptr<const void>, uint64_t> > retiredData;
+
+    // Commands for the servo thread
+    CommandQueue<Command> commands;
+
+
+    bool Valid(int id) const {
+        return id >= 0 && id < (int)sourceValid.size() && sourceValid[id];
+    }
+
+    // Send a single command
+    void Send(const Command& c) {
+        while (!commands.Push(c)) {
+            Flush();
+        }
+
+        Publish();
+    }
+
+    // Publish pending commands, applying them here if synchronous
+    void Publish() {
+        commands.Publish();
+        ApplyCommands();
+        FreeRetired(false);
+    }
+
+    // Publish and wait for the servo thread to catch up
+    void Flush() {
+        commands.Publish();
+        while (!synchronous && !commands.Empty()) {
+            std::this_thread::yield();
+        }
+        ApplyCommands();
+    }
+
+    void ApplyCommands() {
+        if (synchronous) Synchronize();
+    }
+
+    // Allocate larger storage here and hand it to the servo thread, which copies its effects over
+    void Reserve(int newCapacity) {
+        Hand(AllocateStorage(newCapacity), ReserveOp);
+    }
+
+    Storage* AllocateStorage(int newCapacity) {
+        Storage* s = new Storage;
+        s->capacity = newCapacity;
+        s->size = 0;
+        s->effects = new T[newCapacity];
+        s->ids = new int[newCapacity];
+        s->slots = new int[newCapacity];
+        s->groups = new unsigned char[newCapacity];
+        s->dirty = new unsigned char[newCapacity];
+        s->dirtyIds = new int[newCapacity];
+        s->numDirty = 0;
+        s->allDirty = true;
+        for (int g = 0; g < numEffectGroups; g++) {
+            s->groupStart[g] = 0;
+        }
+        s->usedGroups = 0;
+
+        // Touch the memory now so the servo thread doesn't page fault on it
+        memset(static_cast<void*>(s->effects), 0, newCapacity * sizeof(T));
+        memset(s->ids, 0, newCapacity * sizeof(int));
+        memset(s->slots, -1, newCapacity * sizeof(int));
+        memset(s->groups, 0, newCapacity);
+        memset(s->dirty, 0, newCapacity);
+        memset(s->dirtyIds, 0, newCapacity * sizeof(int));
+
+        return s;
+    }
+
+    // Send new storage to the servo thread with a reserve or load command
+    void Hand(Storage* s, Op op) {
+        capacity = s->capacity;
+
+        Command c;
+        c.op = op;
+        c.storage = s;
+        while (!commands.Push(c)) {
+            Flush();
+        }
+
+        // The previous storage can be freed once the servo thread has switched
+        if (reserved) {
+            retired.push_back(std::make_pair(reserved, commands.Pushed()));
+        }
+        reserved = s;
+
+        Publish();
+    }
+
+    // Servo thread
+    void Apply(Command& c) {
+        switch (c.op) {
+        case AddOp:
+            Insert(c.id, c.group, c.effect);
+            break;
+
+        case UpdateOp: {
+            int slot = storage->slots[c.id];
+            if (slot >= 0) {
+                UpdateParameters(storage->effects[slot], c.effect);
+                MarkDirty(c.id);
+            }
+            break;
+        }
+
+        case RemoveOp:
+            if (storage->slots[c.id] >= 0) {
+                Erase(c.id);
+                storage->allDirty = true;
+            }
+            break;
+
+        case RemoveAllOp:
+            for (int i = 0; i < storage->size; i++) {
+                storage->slots[storage->ids[i]] = -1;
+            }
+            storage->size = 0;
+            for (int g = 0; g < numEffectGroups; g++) {
+                storage->groupStart[g] = 0;
+            }
+            storage->usedGroups = 0;
+            storage->allDirty = true;
+            break;
+
+        case ReserveOp: {
+            Storage* s = c.storage;
+            if (storage) {
+                s->size = storage->size;
+                for (int i = 0; i < storage->size; i++) {
+                    s->effects[i] = storage->effects[i];
+                    s->ids[i] = storage->ids[i];
+                    s->slots[s->ids[i]] = i;
+                    s->groups[s->ids[i]] = storage->groups[s->ids[i]];
+                }
+                for (int g = 0; g < numEffectGroups; g++) {
+                    s->groupStart[g] = storage->groupStart[g];
+                }
+                s->usedGroups = storage->usedGroups;
+            }
+
+            // Old storage is freed on the application thread
+            storage = s;
+            break;
+        }
+
+        case LoadOp:
+            // Already filled, and old storage is freed on the application thread
+            storage = c.storage;
+            break;
+
+        case GroupOp: {
+            // Move the effect, keeping its state
+            int slot = storage->slots[c.id];
+            if (slot < 0) break;
+
+            T effect = storage->effects[slot];
+            Erase(c.id);
+            Insert(c.id, c.group, effect);
+            storage->allDirty = true;
+            break;
+        }
+        }
+    }
+
+    // Servo thread: end of a group in the dense array
+    int GroupEnd(int g) const {
+        return g + 1 < numEffectGroups ? storage->groupStart[g + 1] : storage->size;
+    }
+
+    // Servo thread: move an effect within the dense array
+    void Move(int from, int to) {
+        storage->effects[to] = storage->effects[from];
+        storage->ids[to] = storage->ids[from];
+        storage->slots[storage->ids[to]] = to;
+    }
+
+    // Servo thread: add an effect at the end of its group, making room by moving the first effect of each later group
+    // to the end of that group
+    void Insert(int id, int group, const T& effect) {
+        int slot = storage->size++;
+        for (int g = numEffectGroups - 1; g > group; g--) {
+            int first = storage->groupStart[g];
+            if (first != slot) Move(first, slot);
+            slot = first;
+            storage->groupStart[g]++;
+        }
+
+        storage->effects[slot] = effect;
+        storage->ids[slot] = id;
+        storage->slots[id] = slot;
+        storage->groups[id] = (unsigned char)group;
+        storage->usedGroups |= 1u << group;
+        MarkDirty(id);
+    }
+
+    // Servo thread: remove an effect, filling the hole with the last effect of its group, and the hole that leaves with
+    // the last effect of each later group
+    void Erase(int id) {
+        int group = storage->groups[id];
+        int hole = storage->slots[id];
+
+        for (int g = group; g < numEffectGroups; g++) {
+            int last = GroupEnd(g) - 1;
+            if (last != hole) Move(last, hole);
+            hole = last;
+
+            if (g > group) storage->groupStart[g]--;
+        }
+
+        storage->size--;
+        storage->slots[id] = -1;
+
+        if (GroupEnd(group) == storage->groupStart[group]) {
+            storage->usedGroups &= ~(1u << group);
+        }
+    }
+
+    // Servo thread: add an id to the dirty list once
+    void MarkDirty(int id) {
+        if (!storage->dirty[id]) {
+            storage->dirty[id] = 1;
+            storage->dirtyIds[storage->numDirty++] = id;
+        }
+    }
+
+    // Free storage the servo thread is done with
+    void FreeRetired(bool all) {
+        for (auto it = retired.begin(); it != retired.end();) {
+            if (all || commands.Consumed() >= it->second) {
+                FreeStorage(it->first);
+                it = retired.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retiredData.size(); i++) {
+            if (!all && commands.Consumed() < retiredData[i].second) {
+                retiredData[kept++] = retiredData[i];
+            }
+        }
+        retiredData.resize(kept);
+    }
+
+    static void FreeStorage(Storage* s) {
+        if (!s) return;
+
+        delete [] s->effects;
+        delete [] s->ids;
+        delete [] s->slots;
+        delete [] s->groups;
+        delete [] s->dirty;
+        delete [] s->dirtyIds;
+        delete s;
+    }
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,534 @@
+/*=========================================================================
+
+  Name:        ForceField.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Molecular force field evaluated off the servo thread.
+
+=========================================================================*/
+
+
+#include "ForceField.h"
+
+#include "ServoClock.h"
+#include "VectorMath.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+namespace {
+    // Receptor cells searched around each ligand atom
+    const int numNeighbours = 27;
+
+    // Work items claimed by a thread at a time
+    const int chunkSize = 16;
+
+    // Most cells in the receptor grid, to bound memory for sparse receptors
+    const int maxCells = 1 << 22;
+
+    // Distance within which the linear model is used, as a fraction of the cutoff
+    const double modelRadius = 0.1;
+
+    // Distance, as a fraction of the Lennard-Jones radius, below which the pair force stops growing
+    const double softCore = 0.8;
+
+    // First and second derivatives of the Lennard-Jones plus Coulomb pair potential at r
+    void PairDerivatives(double r, double sigma, double epsilon, double qq, double& du, double& d2u) {
+        double sr2 = sigma * sigma / (r * r);
+        double sr6 = sr2 * sr2 * sr2;
+        double sr12 = sr6 * sr6;
+
+        du = 24.0 * epsilon / r * (sr6 - 2.0 * sr12) - qq / (r * r);
+        d2u = 24.0 * epsilon / (r * r) * (26.0 * sr12 - 7.0 * sr6) + 2.0 * qq / (r * r * r);
+    }
+}
+
+
+ForceField::ForceField() {
+    cutoff = 10.0;
+    coulombConstant = 332.06;
+    forceScale = 1.0;
+    maxForce = 0.0;
+    maxStiffness = 0.0;
+    damping = 0.0;
+    MatrixIdentity(toGraphics);
+    scale = 1.0;
+    dataVersion = 0;
+
+    for (int i = 0; i < 3; i++) {
+        probe[i] = 0.0;
+    }
+    probeTime = 0;
+
+    running = false;
+    poolGeneration = 0;
+    poolRemaining = 0;
+    nextItem = 0;
+    numItems = 0;
+    stopHelpers = false;
+    VectorSet(modelProbe, 0.0, 0.0, 0.0);
+
+    numModels = 0;
+    computeTimeSum = 0;
+    statsStart = 0;
+    lastPairs = 0;
+    modelAge = 0;
+    numThreads = 0;
+
+    BuildReceptor(receptor, receptorAtoms, cutoff);
+}
+
+ForceField::~ForceField() {
+    Stop();
+}
+
+void ForceField::SetReceptor(const std::vector<ForceFieldAtom>& atoms) {
+    receptorAtoms = atoms;
+
+    // Build here, so the workers only wait for the swap
+    double cellSize;
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        cellSize = cutoff;
+    }
+
+    Receptor r;
+    BuildReceptor(r, receptorAtoms, cellSize);
+
+    std::lock_guard<std::mutex> lock(dataMutex);
+    std::swap(receptor, r);
+    dataVersion++;
+}
+
+void ForceField::SetLigand(const std::vector<ForceFieldAtom>& atoms) {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    ligand = atoms;
+    dataVersion++;
+}
+
+void ForceField::SetParameters(double cutoff, double coulombConstant, double forceScale, double maxForce, double maxStiffness, double c) {
+    // Cell lists depend on the cutoff
+    Receptor r;
+    bool rebuild = cutoff != this->cutoff;
+    if (rebuild) {
+        BuildReceptor(r, receptorAtoms, cutoff);
+    }
+
+    std::lock_guard<std::mutex> lock(dataMutex);
+    if (rebuild) {
+        std::swap(receptor, r);
+    }
+    this->cutoff = cutoff;
+    this->coulombConstant = coulombConstant;
+    this->forceScale = forceScale;
+    this->maxForce = maxForce;
+    this->maxStiffness = maxStiffness;
+    damping = c;
+    dataVersion++;
+}
+
+void ForceField::SetTransform(const double toGraphics[16], double scale) {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    for (int i = 0; i < 16; i++) {
+        this->toGraphics[i] = toGraphics[i];
+    }
+    this->scale = scale;
+    dataVersion++;
+}
+
+void ForceField::Start(int numThreads) {
+    if (running) return;
+
+    if (numThreads <= 0) {
+        int hardware = (int)std::thread::hardware_concurrency();
+        numThreads = hardware > 3 ? hardware - 2 : 1;
+    }
+    this->numThreads = numThreads;
+
+    partials.resize(numThreads);
+    stopHelpers = false;
+
+    numModels = 0;
+    computeTimeSum = 0;
+    statsStart = ServoClock::NowNanoseconds();
+
+    running = true;
+    for (int i = 1; i < numThreads; i++) {
+        helpers.push_back(std::thread(&ForceField::RunHelper, this, i));
+    }
+    coordinator = std::thread(&ForceField::RunCoordinator, this);
+}
+
+void ForceField::Stop() {
+    if (!running) return;
+
+    // Stop the coordinator first, so helpers are never left with work it waits for
+    running = false;
+    coordinator.join();
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopHelpers = true;
+    }
+    poolStart.notify_all();
+
+    for (size_t i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+    helpers.clear();
+
+    // Publish an invalid model so a restart doesn't render a stale one
+    ForceFieldModel& model = models.Back();
+    model.valid = false;
+    models.Publish();
+}
+
+bool ForceField::IsRunning() {
+    return running;
+}
+
+ForceFieldStats ForceField::GetStats() {
+    ForceFieldStats stats;
+
+    int n = numModels.load();
+    double elapsed = (ServoClock::NowNanoseconds() - statsStart.load()) * 1e-9;
+
+    stats.updateRate = running && elapsed > 0.0 ? (float)(n / elapsed) : 0.0f;
+    stats.computeTime = n > 0 ? (float)(computeTimeSum.load() * 1e-3 / n) : 0.0f;
+    stats.modelAge = (float)(modelAge.load() * 1e-3);
+    stats.pairs = lastPairs.load();
+    stats.threads = running ? numThreads : 0;
+
+    return stats;
+}
+
+void ForceField::SetProbePosition(const double p[3], int64_t time) {
+    for (int i = 0; i < 3; i++) {
+        probe[i].store(p[i], std::memory_order_relaxed);
+    }
+    probeTime.store(time, std::memory_order_release);
+}
+
+const ForceFieldModel& ForceField::GetModel() {
+    models.Update();
+    return models.Front();
+}
+
+void ForceField::SetModelAge(int64_t age) {
+    modelAge.store(age, std::memory_order_relaxed);
+}
+
+
+void ForceField::BuildReceptor(Receptor& r, const std::vector<ForceFieldAtom>& atoms, double cellSize) {
+    int n = (int)atoms.size();
+
+    // Bounds
+    double min[3] = { 0.0, 0.0, 0.0 };
+    double max[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (i == 0 || atoms[i].p[j] < min[j]) min[j] = atoms[i].p[j];
+            if (i == 0 || atoms[i].p[j] > max[j]) max[j] = atoms[i].p[j];
+        }
+    }
+
+    // Cells at least the cutoff, so the neighbouring cells cover it, growing them for sparse receptors
+    r.cellSize = cellSize > 0.0 ? cellSize : 1.0;
+    for (;;) {
+        int64_t numCells = 1;
+        for (int j = 0; j < 3; j++) {
+            r.dims[j] = (int)((max[j] - min[j]) / r.cellSize) + 1;
+            numCells *= r.dims[j];
+        }
+        if (numCells <= maxCells) break;
+
+        r.cellSize *= 1.5;
+    }
+    VectorCopy(r.origin, min);
+
+    // Counting sort by cell
+    int numCells = r.dims[0] * r.dims[1] * r.dims[2];
+    std::vector<int> cells(n);
+    r.cellStart.assign(numCells + 1, 0);
+
+    for (int i = 0; i < n; i++) {
+        int c[3];
+        for (int j = 0; j < 3; j++) {
+            c[j] = (int)((atoms[i].p[j] - r.origin[j]) / r.cellSize);
+            c[j] = std::min(std::max(c[j], 0), r.dims[j] - 1);
+        }
+        cells[i] = (c[2] * r.dims[1] + c[1]) * r.dims[0] + c[0];
+        r.cellStart[cells[i] + 1]++;
+    }
+
+    for (int i = 0; i < numCells; i++) {
+        r.cellStart[i + 1] += r.cellStart[i];
+    }
+
+    r.x.resize(n);
+    r.y.resize(n);
+    r.z.resize(n);
+    r.sigma.resize(n);
+    r.sqrtEpsilon.resize(n);
+    r.charge.resize(n);
+
+    std::vector<int> next(r.cellStart.begin(), r.cellStart.end() - 1);
+    for (int i = 0; i < n; i++) {
+        int j = next[cells[i]]++;
+        r.x[j] = atoms[i].p[0];
+        r.y[j] = atoms[i].p[1];
+        r.z[j] = atoms[i].p[2];
+        r.sigma[j] = atoms[i].sigma;
+        r.sqrtEpsilon[j] = sqrt(atoms[i].epsilon);
+        r.charge[j] = atoms[i].charge;
+    }
+}
+
+
+void ForceField::RunCoordinator() {
+    uint64_t version = 0;
+    bool first = true;
+    ForceFieldModel lastModel = ForceFieldModel();
+    double lastProbe[3] = { 0.0, 0.0, 0.0 };
+
+    while (running) {
+        double p[3];
+        int64_t time = probeTime.load(std::memory_order_acquire);
+        for (int i = 0; i < 3; i++) {
+            p[i] = probe[i].load(std::memory_order_relaxed);
+        }
+
+        std::unique_lock<std::mutex> lock(dataMutex);
+
+        // Nothing to compute if neither the probe nor the molecules have changed, but the last model is still current
+        if (!first && version == dataVersion && p[0] == lastProbe[0] && p[1] == lastProbe[1] && p[2] == lastProbe[2]) {
+            lock.unlock();
+
+            ForceFieldModel& model = models.Back();
+            model = lastModel;
+            model.time = time;
+            models.Publish();
+
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        first = false;
+        version = dataVersion;
+        VectorCopy(lastProbe, p);
+
+        int64_t start = ServoClock::NowNanoseconds();
+
+        ForceFieldModel& model = models.Back();
+        model.valid = !ligand.empty() && !receptor.x.empty();
+        model.time = time;
+
+        if (model.valid) {
+            // Hand out the ligand atom and neighbour cell pairs
+            MatrixVectorMultiply(modelProbe, toGraphics, p);
+            numItems = (int)ligand.size() * numNeighbours;
+            nextItem = 0;
+
+            {
+                std::lock_guard<std::mutex> poolLock(poolMutex);
+                poolGeneration++;
+                poolRemaining = (int)helpers.size();
+            }
+            poolStart.notify_all();
+
+            ComputeItems(partials[0]);
+
+            {
+                std::unique_lock<std::mutex> poolLock(poolMutex);
+                poolDone.wait(poolLock, [this] { return poolRemaining == 0; });
+            }
+
+            // Sum the partial results, in graphics space
+            double f[3] = { 0.0, 0.0, 0.0 };
+            double k[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+            int pairs = 0;
+            for (size_t i = 0; i < partials.size(); i++) {
+                VectorAdd(f, f, partials[i].f);
+                for (int j = 0; j < 9; j++) {
+                    k[j] += partials[i].k[j];
+                }
+                pairs += partials[i].pairs;
+            }
+
+            // Forces map to effect space with the transpose of the linear part of toGraphics divided by the
+            // scale, as for other effects, so stiffness maps with the transpose on the left and the linear part on
+            // the right
+            VectorScale(f, f, forceScale);
+            MatrixTransposeDirectionMultiply(model.f0, toGraphics, f);
+            VectorScale(model.f0, model.f0, 1.0 / scale);
+
+            double km[9];
+            for (int row = 0; row < 3; row++) {
+                for (int col = 0; col < 3; col++) {
+                    km[row * 3 + col] = 0.0;
+                    for (int i = 0; i < 3; i++) {
+                        km[row * 3 + col] += k[row * 3 + i] * toGraphics[col * 4 + i];
+                    }
+                }
+            }
+
+            double norm = 0.0;
+            for (int row = 0; row < 3; row++) {
+                for (int col = 0; col < 3; col++) {
+                    double v = 0.0;
+                    for (int i = 0; i < 3; i++) {
+                        v += toGraphics[row * 4 + i] * km[i * 3 + col];
+                    }
+                    v *= forceScale / scale;
+
+                    model.k[row * 3 + col] = v;
+                    norm += v * v;
+                }
+            }
+
+            // Limit stiffness, which maps to effect space like spring constants
+            norm = sqrt(norm);
+            double limit = maxStiffness * scale;
+            if (norm > limit) {
+                for (int i = 0; i < 9; i++) {
+                    model.k[i] *= limit / norm;
+                }
+            }
+
+            VectorCopy(model.x0, p);
+            model.radius = modelRadius * cutoff / scale;
+            model.maxForce = maxForce;
+            model.c = damping * scale;
+
+            lastPairs.store(pairs, std::memory_order_relaxed);
+        }
+
+        lock.unlock();
+
+        lastModel = model;
+        models.Publish();
+
+        numModels.fetch_add(1, std::memory_order_relaxed);
+        computeTimeSum.fetch_add(ServoClock::NowNanoseconds() - start, std::memory_order_relaxed);
+    }
+}
+
+void ForceField::RunHelper(int index) {
+    uint64_t generation = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            poolStart.wait(lock, [&] { return poolGeneration != generation || stopHelpers; });
+
+            if (poolGeneration == generation) return;
+            generation = poolGeneration;
+        }
+
+        ComputeItems(partials[index]);
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (--poolRemaining == 0) {
+                poolDone.notify_one();
+            }
+        }
+    }
+}
+
+void ForceField::ComputeItems(Partial& partial) {
+    VectorSet(partial.f, 0.0, 0.0, 0.0);
+    for (int i = 0; i < 9; i++) {
+        partial.k[i] = 0.0;
+    }
+    partial.pairs = 0;
+
+    for (;;) {
+        int begin = nextItem.fetch_add(chunkSize, std::memory_order_relaxed);
+        if (begin >= numItems) break;
+
+        int end = std::min(begin + chunkSize, numItems);
+        for (int item = begin; item < end; item++) {
+            const ForceFieldAtom& atom = ligand[item / numNeighbours];
+            int neighbour = item % numNeighbours;
+
+            double a[3];
+            VectorAdd(a, modelProbe, atom.p);
+
+            // Neighbouring cell, skipping those outside the grid
+            int c[3];
+            bool inside = true;
+            for (int j = 0; j < 3; j++) {
+                c[j] = (int)floor((a[j] - receptor.origin[j]) / receptor.cellSize) + neighbour % 3 - 1;
+                neighbour /= 3;
+
+                inside = inside && c[j] >= 0 && c[j] < receptor.dims[j];
+            }
+            if (!inside) continue;
+
+            ComputeCell(partial, atom, a, (c[2] * receptor.dims[1] + c[1]) * receptor.dims[0] + c[0]);
+        }
+    }
+}
+
+void ForceField::ComputeCell(Partial& partial, const ForceFieldAtom& atom, const double a[3], int cell) {
+    const double rc2 = cutoff * cutoff;
+    const double sqrtEpsilon = sqrt(atom.epsilon);
+    const double q = coulombConstant * atom.charge;
+
+    const int end = receptor.cellStart[cell + 1];
+    for (int j = receptor.cellStart[cell]; j < end; j++) {
+        // Vector from the receptor atom to the ligand atom
+        double d[3];
+        d[0] = a[0] - receptor.x[j];
+        d[1] = a[1] - receptor.y[j];
+        d[2] = a[2] - receptor.z[j];
+
+        double r2 = VectorMagnitudeSquared(d);
+        if (r2 >= rc2 || r2 == 0.0) continue;
+
+        double r = sqrt(r2);
+        double sigma = 0.5 * (atom.sigma + receptor.sigma[j]);
+        double epsilon = sqrtEpsilon * receptor.sqrtEpsilon[j];
+        double qq = q * receptor.charge[j];
+
+        // Potential derivatives, with a soft core so overlapping atoms don't produce huge forces, and the force
+        // shifted to reach zero at the cutoff
+        double du, d2u;
+        double rMin = softCore * sigma;
+        if (r < rMin) {
+            PairDerivatives(rMin, sigma, epsilon, qq, du, d2u);
+            d2u = 0.0;
+        }
+        else {
+            PairDerivatives(r, sigma, epsilon, qq, du, d2u);
+        }
+
+        double duCutoff, d2uCutoff;
+        PairDerivatives(cutoff, sigma, epsilon, qq, duCutoff, d2uCutoff);
+        du -= duCutoff;
+
+        // Force on the ligand atom is -du along the unit vector n, and the stiffness is the negated Hessian,
+        // -(d2u n n^T + du / r (I - n n^T))
+        double n[3];
+        VectorScale(n, d, 1.0 / r);
+
+        partial.f[0] -= du * n[0];
+        partial.f[1] -= du * n[1];
+        partial.f[2] -= du * n[2];
+
+        double radial = d2u - du / r;
+        double tangential = du / r;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++) {
+                partial.k[row * 3 + col] -= radial * n[row] * n[col] + (row == col ? tangential : 0.0);
+            }
+        }
+
+        partial.pairs++;
+    }
+}
@@ -0,0 +1,208 @@
+/*=========================================================================
+
+  Name:        ForceField.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Molecular force field evaluated off the servo thread.
+               Lennard-Jones and Coulomb interactions between a ligand
+               attached to the probe and a large receptor are summed with
+               cell lists on a pool of worker threads, which publish a
+               local linear force model (force and stiffness about the
+               probe position they used). The servo thread evaluates the
+               latest model every tick and never waits for the workers.
+
+=========================================================================*/
+
+
+#ifndef FORCEFIELD_H
+#define FORCEFIELD_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TripleBuffer.h"
+
+
+// Struct to use for sending force field statistics to Unity
+struct ForceFieldStats {
+    // Models published per second, and mean time to compute one, in microseconds
+    float updateRate;
+    float computeTime;
+
+    // Age of the model used in the last servo tick, in microseconds
+    float modelAge;
+
+    // Atom pairs within the cutoff in the last model
+    int pairs;
+
+    // Worker threads
+    int threads;
+};
+
+
+// Atom in graphics space. Ligand positions are relative to the probe.
+struct ForceFieldAtom {
+    double p[3];
+
+    // Lennard-Jones radius and well depth, combined with Lorentz-Berthelot rules
+    double sigma;
+    double epsilon;
+
+    double charge;
+};
+
+
+// Local linear force model in effect space, where the servo thread evaluates forces: f(p) = f0 + k * (p - x0),
+// valid within radius of x0
+struct ForceFieldModel {
+    bool valid;
+    double x0[3];
+    double f0[3];
+
+    // Row-major stiffness matrix
+    double k[9];
+
+    double radius;
+    double maxForce;
+    double c;
+
+    // Servo clock time the model was computed for, in nanoseconds
+    int64_t time;
+};
+
+
+class ForceField {
+public:
+    ForceField();
+    ~ForceField();
+
+    // Application thread: set the molecules, building cell lists here. Can be called while running.
+    void SetReceptor(const std::vector<ForceFieldAtom>& atoms);
+    void SetLigand(const std::vector<ForceFieldAtom>& atoms);
+
+    // Application thread: interaction parameters, in graphics units.
+    // cutoff: Distance beyond which pairs are ignored. Forces are shifted to reach zero there.
+    // coulombConstant: Coulomb constant divided by the dielectric constant
+    // forceScale: Scale from force field units to graphics force units
+    // maxForce: Largest force the model may produce
+    // maxStiffness: Largest stiffness the model may have, limiting its Frobenius norm
+    // c: Damping coefficient
+    void SetParameters(double cutoff, double coulombConstant, double forceScale, double maxForce, double maxStiffness, double c);
+
+    // Application thread: transform from effect space to graphics space, and its mean scale
+    void SetTransform(const double toGraphics[16], double scale);
+
+    // Application thread: start or stop the worker threads. Zero threads uses all but two hardware threads.
+    void Start(int numThreads);
+    void Stop();
+    bool IsRunning();
+
+    ForceFieldStats GetStats();
+
+    // Servo thread: publish the probe position, in effect space, for the workers to use
+    void SetProbePosition(const double p[3], int64_t time);
+
+    // Servo thread: switch to the latest model, and return it
+    const ForceFieldModel& GetModel();
+
+    // Servo thread: record the age of the model used this tick
+    void SetModelAge(int64_t age);
+
+protected:
+    // Receptor atoms sorted by cell, with per-atom terms precomputed for the pair loop
+    struct Receptor {
+        std::vector<double> x, y, z;
+        std::vector<double> sigma;
+        std::vector<double> sqrtEpsilon;
+        std::vector<double> charge;
+
+        // Grid origin, cell size and dimensions, with the first atom of each cell and one past the end
+        double origin[3];
+        double cellSize;
+        int dims[3];
+        std::vector<int> cellStart;
+    };
+
+    // Per-worker partial sums, padded to avoid false sharing
+    struct alignas(64) Partial {
+        double f[3];
+        double k[9];
+        int pairs;
+    };
+
+    // Receptor as given, kept on the application thread for rebuilding the cell lists
+    std::vector<ForceFieldAtom> receptorAtoms;
+
+    // Molecules and parameters, guarded by dataMutex
+    std::mutex dataMutex;
+    Receptor receptor;
+    std::vector<ForceFieldAtom> ligand;
+    double cutoff;
+    double coulombConstant;
+    double forceScale;
+    double maxForce;
+    double maxStiffness;
+    double damping;
+    double toGraphics[16];
+    double scale;
+    uint64_t dataVersion;
+
+    // Probe position from the servo thread
+    std::atomic<double> probe[3];
+    std::atomic<int64_t> probeTime;
+
+    // Models for the servo thread
+    TripleBuffer<ForceFieldModel> models;
+
+    // Coordinating thread, which also computes, and helper threads
+    std::thread coordinator;
+    std::vector<std::thread> helpers;
+    std::atomic<bool> running;
+
+    // Work for the current model, handed to helpers by generation number
+    std::mutex poolMutex;
+    std::condition_variable poolStart;
+    std::condition_variable poolDone;
+    uint64_t poolGeneration;
+    int poolRemaining;
+    std::atomic<int> nextItem;
+    int numItems;
+    bool stopHelpers;
+    std::vector<Partial> partials;
+
+    // Probe position the current model is computed for, in graphics space
+    double modelProbe[3];
+
+    // Statistics
+    std::atomic<int> numModels;
+    std::atomic<int64_t> computeTimeSum;
+    std::atomic<int64_t> statsStart;
+    std::atomic<int> lastPairs;
+    std::atomic<int64_t> modelAge;
+    int numThreads;
+
+
+    // Sort atoms into cells at least the given size
+    static void BuildReceptor(Receptor& r, const std::vector<ForceFieldAtom>& atoms, double cellSize);
+
+    // Thread functions
+    void RunCoordinator();
+    void RunHelper(int index);
+
+    // Compute the partial sums for work items until none are left
+    void ComputeItems(Partial& partial);
+
+    // Add the force and stiffness on a ligand atom at a from the receptor atoms in one cell
+    void ComputeCell(Partial& partial, const ForceFieldAtom& atom, const double a[3], int cell);
+};
+
+
+#endif
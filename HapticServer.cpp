@@ -0,0 +1,556 @@
+/*=========================================================================
+
+  Name:        HapticServer.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Out-of-process haptic server. The server process owns the
+               device and its servo loop; a client in the application
+               process maps a shared memory region holding a ring of API
+               calls and a block of device state.
+
+=========================================================================*/
+
+
+#include "HapticServer.h"
+
+#include "ServoClock.h"
+
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+
+// Compile-time index lists for expanding unpacked arguments into a call
+template <int... I>
+struct Indices {};
+
+template <int N, int... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <int... I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> Type;
+};
+
+
+// Unpack a call's arguments. Braced initialization reads them in order.
+template <class... A>
+std::tuple<A...> UnpackArguments(const ServerCall& call) {
+    ArgumentReader reader(call.args);
+    return std::tuple<A...>{ reader.Next<A>()... };
+}
+
+template <class R, class... A, class... T, int... I>
+R ApplyArguments(Falcon& falcon, R (Falcon::*method)(A...), std::tuple<T...>& args, Indices<I...>) {
+    return (falcon.*method)(std::get<I>(args)...);
+}
+
+
+HapticServer::HapticServer() : shared(nullptr), running(false), clientForceFeedback(true) {
+}
+
+HapticServer::~HapticServer() {
+    if (shared) {
+        shared->magic = 0;
+    }
+}
+
+bool HapticServer::Initialize(const char* name, bool realTime, int cpu, int priority, float rate) {
+    // Refuse to replace a server that is still running
+    if (memory.Open(name, sizeof(ServerShared))) {
+        ServerShared* existing = static_cast<ServerShared*>(memory.Data());
+        if (existing->magic == serverMagic) {
+            uint64_t heartbeat = existing->serverHeartbeat.load(std::memory_order_acquire);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            if (existing->serverHeartbeat.load(std::memory_order_acquire) != heartbeat) {
+                std::cout << "A haptic server named " << name << " is already running" << std::endl;
+                memory.Close();
+                return false;
+            }
+        }
+
+        memory.Close();
+    }
+
+    if (!memory.Create(name, sizeof(ServerShared))) {
+        std::cout << "Could not create shared memory " << name << std::endl;
+        return false;
+    }
+
+    // Construct the shared layout in place. The region is zeroed, so counters and indices start at zero.
+    shared = new (memory.Data()) ServerShared;
+    shared->serverHeartbeat.store(0);
+    shared->deviceInitialized.store(false);
+    shared->owner.store(0);
+    shared->clientHeartbeat.store(0);
+    shared->clientStale.store(false);
+    shared->callWrite.store(0);
+    shared->callRead.store(0);
+    shared->replySequence.store(0);
+    shared->stateSequence.store(0);
+
+    // Open the device
+    falcon.SetRealTime(realTime, cpu, priority);
+    if (rate > 0.0f) falcon.SetServoRate(rate);
+
+    if (!falcon.Initialize()) {
+        return false;
+    }
+
+    shared->deviceInitialized.store(true);
+    PublishState();
+
+    // Clients check these before anything else
+    shared->version = serverVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    shared->magic = serverMagic;
+
+    return true;
+}
+
+void HapticServer::Run(int pollInterval, double clientTimeout) {
+    running = true;
+
+    double lastCallTime = ServoClock::Now();
+    uint64_t lastClientHeartbeat = shared->clientHeartbeat.load(std::memory_order_relaxed);
+    double lastClientTime = lastCallTime;
+
+    while (running) {
+        shared->serverHeartbeat.fetch_add(1, std::memory_order_release);
+
+        // Handle calls in order, freeing each slot as soon as it is done
+        uint64_t read = shared->callRead.load(std::memory_order_relaxed);
+        uint64_t write = shared->callWrite.load(std::memory_order_acquire);
+        bool busy = read != write;
+
+        for (; read != write; read++) {
+            Dispatch(shared->calls[read % serverCallCapacity]);
+            shared->callRead.store(read + 1, std::memory_order_release);
+        }
+
+        PublishState();
+
+        double now = ServoClock::Now();
+        if (busy) lastCallTime = now;
+
+        // Turn forces off while a connected client has stopped responding, and back on when it returns
+        uint64_t clientHeartbeat = shared->clientHeartbeat.load(std::memory_order_relaxed);
+        if (clientHeartbeat != lastClientHeartbeat || shared->owner.load(std::memory_order_relaxed) == 0) {
+            lastClientHeartbeat = clientHeartbeat;
+            lastClientTime = now;
+
+            if (shared->clientStale.load(std::memory_order_relaxed)) {
+                shared->clientStale.store(false);
+                falcon.UseForceFeedback(clientForceFeedback);
+                std::cout << "Client resumed" << std::endl;
+            }
+        }
+        else if (now - lastClientTime > clientTimeout && !shared->clientStale.load(std::memory_order_relaxed)) {
+            shared->clientStale.store(true);
+            falcon.UseForceFeedback(false);
+            std::cout << "Client not responding, turning forces off" << std::endl;
+        }
+
+        // Stay responsive while calls are arriving, then back off
+        if (now - lastCallTime < 0.001) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(pollInterval));
+        }
+    }
+}
+
+void HapticServer::Stop() {
+    running = false;
+}
+
+void HapticServer::Dispatch(const ServerCall& call) {
+    switch (call.type) {
+    case ConnectCall:
+        Connect();
+        Reply(call, shared->deviceInitialized.load());
+        break;
+
+    case DisconnectCall:
+        falcon.ResetForces();
+        falcon.SetForceField(false);
+        shared->owner.store(0, std::memory_order_release);
+        std::cout << "Client disconnected" << std::endl;
+        break;
+
+    case SetServoRateCall: Invoke(call, &Falcon::SetServoRate); break;
+    case SetSubstepsCall: Invoke(call, &Falcon::SetSubsteps); break;
+    case SetPassivityControlCall: Invoke(call, &Falcon::SetPassivityControl); break;
+    case GetPassivityStatsCall: Invoke(call, &Falcon::GetPassivityStats); break;
+    case SetComputeBudgetCall: Invoke(call, &Falcon::SetComputeBudget); break;
+    case GetSchedulerStatsCall: Invoke(call, &Falcon::GetSchedulerStats); break;
+    case SetForceCacheCall: Invoke(call, &Falcon::SetForceCache); break;
+    case GetForceCacheStatsCall: Invoke(call, &Falcon::GetForceCacheStats); break;
+    case GetServoStatsCall: Invoke(call, &Falcon::GetServoStats); break;
+    case ResetServoStatsCall: Invoke(call, &Falcon::ResetServoStats); break;
+    case SetTelemetryCall: Invoke(call, &Falcon::SetTelemetry); break;
+    case GetEffectTelemetryCall: Invoke(call, &Falcon::GetEffectTelemetry); break;
+    case ResetTelemetryCall: Invoke(call, &Falcon::ResetTelemetry); break;
+
+    case SetGraphicsWorkspaceCall:
+        Invoke(call, static_cast<void (Falcon::*)(Vector3, Vector3)>(&Falcon::SetGraphicsWorkspace));
+        break;
+
+    case SetGraphicsWorkspaceRotatedCall:
+        Invoke(call, static_cast<void (Falcon::*)(Vector3, Vector3, Quaternion)>(&Falcon::SetGraphicsWorkspace));
+        break;
+
+    case ResetForcesCall: Invoke(call, &Falcon::ResetForces); break;
+
+    case UseForceFeedbackCall:
+        // Remember the client's choice so it can be restored after a stall
+        clientForceFeedback = std::get<0>(UnpackArguments<bool>(call));
+        if (!shared->clientStale.load(std::memory_order_relaxed)) {
+            falcon.UseForceFeedback(clientForceFeedback);
+        }
+        break;
+
+    case SetProxyPositionCall: Invoke(call, &Falcon::SetProxyPosition); break;
+
+    case AddSimpleForceCall: Invoke(call, &Falcon::AddSimpleForce); break;
+    case UpdateSimpleForceCall: Invoke(call, &Falcon::UpdateSimpleForce); break;
+    case RemoveSimpleForceCall: Invoke(call, &Falcon::RemoveSimpleForce); break;
+    case RemoveSimpleForcesCall: Invoke(call, &Falcon::RemoveSimpleForces); break;
+
+    case AddViscosityCall: Invoke(call, &Falcon::AddViscosity); break;
+    case UpdateViscosityCall: Invoke(call, &Falcon::UpdateViscosity); break;
+    case RemoveViscosityCall: Invoke(call, &Falcon::RemoveViscosity); break;
+    case RemoveViscositiesCall: Invoke(call, &Falcon::RemoveViscosities); break;
+
+    case AddSurfaceCall: Invoke(call, &Falcon::AddSurface); break;
+    case UpdateSurfaceCall: Invoke(call, &Falcon::UpdateSurface); break;
+    case RemoveSurfaceCall: Invoke(call, &Falcon::RemoveSurface); break;
+    case RemoveSurfacesCall: Invoke(call, &Falcon::RemoveSurfaces); break;
+
+    case AddSpringCall: Invoke(call, &Falcon::AddSpring); break;
+    case UpdateSpringCall: Invoke(call, &Falcon::UpdateSpring); break;
+    case RemoveSpringCall: Invoke(call, &Falcon::RemoveSpring); break;
+    case RemoveSpringsCall: Invoke(call, &Falcon::RemoveSprings); break;
+
+    case AddIntermolecularForceCall: Invoke(call, &Falcon::AddIntermolecularForce); break;
+    case UpdateIntermolecularForceCall: Invoke(call, &Falcon::UpdateIntermolecularForce); break;
+    case RemoveIntermolecularForceCall: Invoke(call, &Falcon::RemoveIntermolecularForce); break;
+    case RemoveIntermolecularForcesCall: Invoke(call, &Falcon::RemoveIntermolecularForces); break;
+
+    case AddRandomForceCall: Invoke(call, &Falcon::AddRandomForce); break;
+    case UpdateRandomForceCall: Invoke(call, &Falcon::UpdateRandomForce); break;
+    case RemoveRandomForceCall: Invoke(call, &Falcon::RemoveRandomForce); break;
+    case RemoveRandomForcesCall: Invoke(call, &Falcon::RemoveRandomForces); break;
+
+    case AddRigidBodyCall: Invoke(call, &Falcon::AddRigidBody); break;
+    case UpdateRigidBodyCall: Invoke(call, &Falcon::UpdateRigidBody); break;
+    case SetRigidBodyPoseCall: Invoke(call, &Falcon::SetRigidBodyPose); break;
+    case GetRigidBodyPoseCall: Invoke(call, &Falcon::GetRigidBodyPose); break;
+    case GrabRigidBodyCall: Invoke(call, &Falcon::GrabRigidBody); break;
+    case RemoveRigidBodyCall: Invoke(call, &Falcon::RemoveRigidBody); break;
+    case RemoveRigidBodiesCall: Invoke(call, &Falcon::RemoveRigidBodies); break;
+    case SetRigidBodyGravityCall: Invoke(call, &Falcon::SetRigidBodyGravity); break;
+
+    case AddDistanceFieldCall: InvokeAddDistanceField(call); break;
+    case AddDistanceFieldMeshCall: InvokeAddDistanceFieldMesh(call); break;
+    case UpdateDistanceFieldCall: Invoke(call, &Falcon::UpdateDistanceField); break;
+    case IsDistanceFieldReadyCall: Invoke(call, &Falcon::IsDistanceFieldReady); break;
+    case RemoveDistanceFieldCall: Invoke(call, &Falcon::RemoveDistanceField); break;
+    case RemoveDistanceFieldsCall: Invoke(call, &Falcon::RemoveDistanceFields); break;
+
+    case AddPathConstraintCall: InvokeAddPathConstraint(call); break;
+    case UpdatePathConstraintCall: Invoke(call, &Falcon::UpdatePathConstraint); break;
+    case RemovePathConstraintCall: Invoke(call, &Falcon::RemovePathConstraint); break;
+    case RemovePathConstraintsCall: Invoke(call, &Falcon::RemovePathConstraints); break;
+
+    case AddRadialProfileCall: InvokeAddRadialProfile(call); break;
+    case RemoveRadialProfileCall: Invoke(call, &Falcon::RemoveRadialProfile); break;
+    case AddRadialForceCall: Invoke(call, &Falcon::AddRadialForce); break;
+    case UpdateRadialForceCall: Invoke(call, &Falcon::UpdateRadialForce); break;
+    case RemoveRadialForceCall: Invoke(call, &Falcon::RemoveRadialForce); break;
+    case RemoveRadialForcesCall: Invoke(call, &Falcon::RemoveRadialForces); break;
+
+    case AddWavetableCall: InvokeAddWavetable(call); break;
+    case RemoveWavetableCall: Invoke(call, &Falcon::RemoveWavetable); break;
+    case AddVibrationCall: Invoke(call, &Falcon::AddVibration); break;
+    case UpdateVibrationCall: Invoke(call, &Falcon::UpdateVibration); break;
+    case TriggerVibrationCall: Invoke(call, &Falcon::TriggerVibration); break;
+    case ReleaseVibrationCall: Invoke(call, &Falcon::ReleaseVibration); break;
+    case RemoveVibrationCall: Invoke(call, &Falcon::RemoveVibration); break;
+    case RemoveVibrationsCall: Invoke(call, &Falcon::RemoveVibrations); break;
+
+    case AddExpressionForceCall: InvokeAddExpressionForce(call); break;
+    case SetExpressionParametersCall: InvokeSetExpressionParameters(call); break;
+    case RemoveExpressionForceCall: Invoke(call, &Falcon::RemoveExpressionForce); break;
+    case RemoveExpressionForcesCall: Invoke(call, &Falcon::RemoveExpressionForces); break;
+    case LoadKernelLibraryCall: InvokeLoadKernelLibrary(call); break;
+    case FindKernelCall: InvokeFindKernel(call); break;
+    case AddKernelForceCall: InvokeAddKernelForce(call); break;
+    case UpdateKernelForceCall: InvokeUpdateKernelForce(call); break;
+    case RemoveKernelForceCall: Invoke(call, &Falcon::RemoveKernelForce); break;
+    case RemoveKernelForcesCall: Invoke(call, &Falcon::RemoveKernelForces); break;
+    case GetKernelStatsCall: Invoke(call, &Falcon::GetKernelStats); break;
+    case AddColliderCall: Invoke(call, &Falcon::AddCollider); break;
+    case UpdateColliderCall: Invoke(call, &Falcon::UpdateCollider); break;
+    case RemoveColliderCall: Invoke(call, &Falcon::RemoveCollider); break;
+    case RemoveCollidersCall: Invoke(call, &Falcon::RemoveColliders); break;
+
+    case AddFrameCall: Invoke(call, &Falcon::AddFrame); break;
+    case SetFramesCall: InvokeSetFrames(call); break;
+    case RemoveFrameCall: Invoke(call, &Falcon::RemoveFrame); break;
+    case RemoveFramesCall: Invoke(call, &Falcon::RemoveFrames); break;
+    case SetEffectFrameCall: Invoke(call, &Falcon::SetEffectFrame); break;
+
+    case EvaluateForcesCall: InvokeEvaluateForces(call); break;
+
+    case SetProbePointsCall: InvokeSetProbePoints(call); break;
+
+    case SetForceFieldReceptorCall: InvokeAtoms(call, &Falcon::SetForceFieldReceptor); break;
+    case SetForceFieldLigandCall: InvokeAtoms(call, &Falcon::SetForceFieldLigand); break;
+    case SetForceFieldCall: Invoke(call, &Falcon::SetForceField); break;
+    case GetForceFieldStatsCall: Invoke(call, &Falcon::GetForceFieldStats); break;
+
+    case LoadSceneDataCall: InvokeLoadScene(call); break;
+    case SaveSceneDataCall: InvokeSaveScene(call); break;
+
+    case SetEffectGroupCall: Invoke(call, &Falcon::SetEffectGroup); break;
+    case SetGroupMaskCall: Invoke(call, &Falcon::SetGroupMask); break;
+    case SetGroupEnabledCall: Invoke(call, &Falcon::SetGroupEnabled); break;
+    case GetGroupMaskCall: Invoke(call, &Falcon::GetGroupMask); break;
+
+    default:
+        std::cout << "Unknown call " << call.type << std::endl;
+        break;
+    }
+}
+
+template <class R, class... A>
+void HapticServer::Invoke(const ServerCall& call, R (Falcon::*method)(A...)) {
+    std::tuple<typename std::decay<A>::type...> args = UnpackArguments<typename std::decay<A>::type...>(call);
+    Reply(call, ApplyArguments(falcon, method, args, typename MakeIndices<sizeof...(A)>::Type()));
+}
+
+template <class... A>
+void HapticServer::Invoke(const ServerCall& call, void (Falcon::*method)(A...)) {
+    std::tuple<typename std::decay<A>::type...> args = UnpackArguments<typename std::decay<A>::type...>(call);
+    ApplyArguments(falcon, method, args, typename MakeIndices<sizeof...(A)>::Type());
+}
+
+void HapticServer::InvokeAtoms(const ServerCall& call, void (Falcon::*method)(const Vector3*, const float*, const float*, const float*, int)) {
+    // Positions, then sigma, epsilon and charge arrays
+    int n = std::get<0>(UnpackArguments<int>(call));
+
+    const unsigned char* bulk = shared->bulk;
+    const Vector3* p = reinterpret_cast<const Vector3*>(bulk);
+    const float* sigma = reinterpret_cast<const float*>(bulk + n * sizeof(Vector3));
+    const float* epsilon = sigma + n;
+    const float* charge = epsilon + n;
+
+    (falcon.*method)(p, sigma, epsilon, charge, n);
+
+    Reply(call, true);
+}
+
+void HapticServer::InvokeSetFrames(const ServerCall& call) {
+    // Ids, then matrices
+    int n = std::get<0>(UnpackArguments<int>(call));
+
+    const int* frames = reinterpret_cast<const int*>(shared->bulk);
+    const float* matrices = reinterpret_cast<const float*>(shared->bulk + n * sizeof(int));
+
+    falcon.SetFrames(frames, matrices, n);
+
+    Reply(call, true);
+}
+
+void HapticServer::InvokeEvaluateForces(const ServerCall& call) {
+    std::tuple<int, int> args = UnpackArguments<int, int>(call);
+    int n = std::get<0>(args);
+
+    const Vector3* points = reinterpret_cast<const Vector3*>(shared->bulk);
+    Vector3* forces = reinterpret_cast<Vector3*>(shared->bulk + n * sizeof(Vector3));
+
+    Reply(call, falcon.EvaluateForces(points, forces, n, std::get<1>(args)));
+}
+
+void HapticServer::InvokeSetProbePoints(const ServerCall& call) {
+    // Offsets, then radii if there are any
+    std::tuple<int, bool> args = UnpackArguments<int, bool>(call);
+    int n = std::get<0>(args);
+
+    const Vector3* offsets = reinterpret_cast<const Vector3*>(shared->bulk);
+    const float* radii = std::get<1>(args) ? reinterpret_cast<const float*>(shared->bulk + n * sizeof(Vector3)) : nullptr;
+
+    falcon.SetProbePoints(offsets, radii, n);
+
+    Reply(call, true);
+}
+
+void HapticServer::InvokeAddDistanceField(const ServerCall& call) {
+    std::tuple<int, int, int, Vector3, float, Vector3, Quaternion, float, float> args =
+        UnpackArguments<int, int, int, Vector3, float, Vector3, Quaternion, float, float>(call);
+
+    const float* distances = reinterpret_cast<const float*>(shared->bulk);
+
+    Reply(call, falcon.AddDistanceField(distances, std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args), std::get<4>(args),
+                                        std::get<5>(args), std::get<6>(args), std::get<7>(args), std::get<8>(args)));
+}
+
+void HapticServer::InvokeAddDistanceFieldMesh(const ServerCall& call) {
+    // Vertices, then triangles
+    std::tuple<int, int, int, Vector3, Quaternion, float, float> args =
+        UnpackArguments<int, int, int, Vector3, Quaternion, float, float>(call);
+
+    int numVertices = std::get<0>(args);
+    const Vector3* vertices = reinterpret_cast<const Vector3*>(shared->bulk);
+    const int* triangles = reinterpret_cast<const int*>(shared->bulk + numVertices * sizeof(Vector3));
+
+    Reply(call, falcon.AddDistanceFieldMesh(vertices, numVertices, triangles, std::get<1>(args), std::get<2>(args),
+                                            std::get<3>(args), std::get<4>(args), std::get<5>(args), std::get<6>(args)));
+}
+
+void HapticServer::InvokeAddPathConstraint(const ServerCall& call) {
+    std::tuple<int, bool, bool, Vector3, Quaternion, float, float, float, float> args =
+        UnpackArguments<int, bool, bool, Vector3, Quaternion, float, float, float, float>(call);
+
+    const Vector3* points = reinterpret_cast<const Vector3*>(shared->bulk);
+
+    Reply(call, falcon.AddPathConstraint(points, std::get<0>(args), std::get<1>(args), std::get<2>(args), std::get<3>(args),
+                                         std::get<4>(args), std::get<5>(args), std::get<6>(args), std::get<7>(args), std::get<8>(args)));
+}
+
+void HapticServer::InvokeAddRadialProfile(const ServerCall& call) {
+    std::tuple<int, float, bool> args = UnpackArguments<int, float, bool>(call);
+
+    const float* forces = reinterpret_cast<const float*>(shared->bulk);
+
+    Reply(call, falcon.AddRadialProfile(forces, std::get<0>(args), std::get<1>(args), std::get<2>(args)));
+}
+
+void HapticServer::InvokeAddWavetable(const ServerCall& call) {
+    int numSamples = std::get<0>(UnpackArguments<int>(call));
+
+    const float* samples = reinterpret_cast<const float*>(shared->bulk);
+
+    Reply(call, falcon.AddWavetable(samples, numSamples));
+}
+
+void HapticServer::InvokeAddExpressionForce(const ServerCall& call) {
+    int length = std::get<0>(UnpackArguments<int>(call));
+
+    std::string expression(shared->bulk, shared->bulk + length);
+
+    Reply(call, falcon.AddExpressionForce(expression.c_str()));
+}
+
+void HapticServer::InvokeSetExpressionParameters(const ServerCall& call) {
+    std::tuple<int, int, float, float, float, float, float, float, float, float> args =
+        UnpackArguments<int, int, float, float, float, float, float, float, float, float>(call);
+
+    static_assert(numExpressionParameters == 8, "Expression parameters must match the call arguments");
+    float parameters[numExpressionParameters] = {
+        std::get<2>(args), std::get<3>(args), std::get<4>(args), std::get<5>(args),
+        std::get<6>(args), std::get<7>(args), std::get<8>(args), std::get<9>(args)
+    };
+
+    falcon.SetExpressionParameters(std::get<0>(args), parameters, std::get<1>(args));
+}
+
+void HapticServer::InvokeLoadKernelLibrary(const ServerCall& call) {
+    int length = std::get<0>(UnpackArguments<int>(call));
+
+    std::string fileName(shared->bulk, shared->bulk + length);
+
+    Reply(call, falcon.LoadKernelLibrary(fileName.c_str()));
+}
+
+void HapticServer::InvokeFindKernel(const ServerCall& call) {
+    int length = std::get<0>(UnpackArguments<int>(call));
+
+    std::string name(shared->bulk, shared->bulk + length);
+
+    Reply(call, falcon.FindKernel(name.c_str()));
+}
+
+void HapticServer::InvokeAddKernelForce(const ServerCall& call) {
+    std::tuple<int, int, KernelParameterValues> args = UnpackArguments<int, int, KernelParameterValues>(call);
+
+    Reply(call, falcon.AddKernelForce(std::get<0>(args), std::get<2>(args).values, std::get<1>(args)));
+}
+
+void HapticServer::InvokeUpdateKernelForce(const ServerCall& call) {
+    std::tuple<int, int, KernelParameterValues> args = UnpackArguments<int, int, KernelParameterValues>(call);
+
+    falcon.UpdateKernelForce(std::get<0>(args), std::get<2>(args).values, std::get<1>(args));
+}
+
+void HapticServer::InvokeLoadScene(const ServerCall& call) {
+    int size = std::get<0>(UnpackArguments<int>(call));
+
+    Reply(call, falcon.LoadSceneData(shared->bulk, size));
+}
+
+void HapticServer::InvokeSaveScene(const ServerCall& call) {
+    // Only write the scene if the client has room for it
+    int size = std::get<0>(UnpackArguments<int>(call));
+
+    Reply(call, falcon.SaveSceneData(size > 0 ? shared->bulk : nullptr, size));
+}
+
+template <class R>
+void HapticServer::Reply(const ServerCall& call, const R& result) {
+    static_assert(sizeof(R) <= serverReplySize, "Reply too large");
+
+    memcpy(shared->reply, &result, sizeof(R));
+    shared->replySequence.store(call.sequence, std::memory_order_release);
+}
+
+void HapticServer::Connect() {
+    // Effects from a previous client that didn't disconnect are stale
+    falcon.ResetForces();
+    falcon.SetForceField(false);
+
+    clientForceFeedback = true;
+    falcon.UseForceFeedback(true);
+    shared->clientStale.store(false);
+
+    std::cout << "Client connected" << std::endl;
+}
+
+void HapticServer::PublishState() {
+    Vector3 p = falcon.GetPosition();
+    Vector3 f = falcon.GetForce();
+    Vector3 t = falcon.GetTorque();
+
+    int buttons = 0;
+    for (int i = 0; i < 4; i++) {
+        if (falcon.GetButton(i)) buttons |= 1 << i;
+    }
+
+    // Odd sequence while writing
+    unsigned int sequence = shared->stateSequence.load(std::memory_order_relaxed);
+    shared->stateSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    shared->position[0].store(p.x, std::memory_order_relaxed);
+    shared->position[1].store(p.y, std::memory_order_relaxed);
+    shared->position[2].store(p.z, std::memory_order_relaxed);
+    shared->force[0].store(f.x, std::memory_order_relaxed);
+    shared->force[1].store(f.y, std::memory_order_relaxed);
+    shared->force[2].store(f.z, std::memory_order_relaxed);
+    shared->torque[0].store(t.x, std::memory_order_relaxed);
+    shared->torque[1].store(t.y, std::memory_order_relaxed);
+    shared->torque[2].store(t.z, std::memory_order_relaxed);
+    shared->buttons.store(buttons, std::memory_order_relaxed);
+
+    shared->stateSequence.store(sequence + 2, std::memory_order_release);
+}
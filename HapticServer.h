@@ -0,0 +1,344 @@
+/*=========================================================================
+
+  Name:        HapticServer.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Out-of-process haptic server. The server process owns the
+               device and its servo loop; a client in the application
+               process maps a shared memory region holding a ring of API
+               calls and a block of device state. Calls without a result
+               are queued without waiting, calls with a result wait for
+               the server's reply, and position, force, torque and buttons are
+               read from the state block without a round trip, so pauses
+               in the application never reach the servo loop.
+
+=========================================================================*/
+
+
+#ifndef HAPTICSERVER_H
+#define HAPTICSERVER_H
+
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "Falcon.h"
+#include "SharedMemory.h"
+
+
+// Shared memory name used when none is given
+#define HAPTIC_SERVER_DEFAULT_NAME "FalconHapticServer"
+
+
+// API calls, one per FalconInterface method
+enum ServerCallType {
+    ConnectCall,
+    DisconnectCall,
+    SetServoRateCall,
+    SetSubstepsCall,
+    SetPassivityControlCall,
+    GetPassivityStatsCall,
+    SetComputeBudgetCall,
+    GetSchedulerStatsCall,
+    SetForceCacheCall,
+    GetForceCacheStatsCall,
+    GetServoStatsCall,
+    ResetServoStatsCall,
+    SetGraphicsWorkspaceCall,
+    SetGraphicsWorkspaceRotatedCall,
+    ResetForcesCall,
+    UseForceFeedbackCall,
+    SetProxyPositionCall,
+    AddSimpleForceCall,
+    UpdateSimpleForceCall,
+    RemoveSimpleForceCall,
+    RemoveSimpleForcesCall,
+    AddViscosityCall,
+    UpdateViscosityCall,
+    RemoveViscosityCall,
+    RemoveViscositiesCall,
+    AddSurfaceCall,
+    UpdateSurfaceCall,
+    RemoveSurfaceCall,
+    RemoveSurfacesCall,
+    AddSpringCall,
+    UpdateSpringCall,
+    RemoveSpringCall,
+    RemoveSpringsCall,
+    AddIntermolecularForceCall,
+    UpdateIntermolecularForceCall,
+    RemoveIntermolecularForceCall,
+    RemoveIntermolecularForcesCall,
+    AddRandomForceCall,
+    UpdateRandomForceCall,
+    RemoveRandomForceCall,
+    RemoveRandomForcesCall,
+    AddRigidBodyCall,
+    UpdateRigidBodyCall,
+    SetRigidBodyPoseCall,
+    GetRigidBodyPoseCall,
+    GrabRigidBodyCall,
+    RemoveRigidBodyCall,
+    RemoveRigidBodiesCall,
+    SetRigidBodyGravityCall,
+    SetForceFieldReceptorCall,
+    SetForceFieldLigandCall,
+    SetForceFieldCall,
+    GetForceFieldStatsCall,
+    LoadSceneDataCall,
+    SaveSceneDataCall,
+    SetEffectGroupCall,
+    SetGroupMaskCall,
+    SetGroupEnabledCall,
+    GetGroupMaskCall,
+    SetTelemetryCall,
+    GetEffectTelemetryCall,
+    ResetTelemetryCall,
+    AddDistanceFieldCall,
+    AddDistanceFieldMeshCall,
+    UpdateDistanceFieldCall,
+    IsDistanceFieldReadyCall,
+    RemoveDistanceFieldCall,
+    RemoveDistanceFieldsCall,
+    AddPathConstraintCall,
+    UpdatePathConstraintCall,
+    RemovePathConstraintCall,
+    RemovePathConstraintsCall,
+    AddRadialProfileCall,
+    RemoveRadialProfileCall,
+    AddRadialForceCall,
+    UpdateRadialForceCall,
+    RemoveRadialForceCall,
+    RemoveRadialForcesCall,
+    AddWavetableCall,
+    RemoveWavetableCall,
+    AddVibrationCall,
+    UpdateVibrationCall,
+    TriggerVibrationCall,
+    ReleaseVibrationCall,
+    RemoveVibrationCall,
+    RemoveVibrationsCall,
+    AddExpressionForceCall,
+    SetExpressionParametersCall,
+    RemoveExpressionForceCall,
+    RemoveExpressionForcesCall,
+    LoadKernelLibraryCall,
+    FindKernelCall,
+    AddKernelForceCall,
+    UpdateKernelForceCall,
+    RemoveKernelForceCall,
+    RemoveKernelForcesCall,
+    GetKernelStatsCall,
+    AddColliderCall,
+    UpdateColliderCall,
+    RemoveColliderCall,
+    RemoveCollidersCall,
+
+    AddFrameCall,
+    SetFramesCall,
+    RemoveFrameCall,
+    RemoveFramesCall,
+    SetEffectFrameCall,
+
+    EvaluateForcesCall,
+
+    SetProbePointsCall
+};
+
+
+// Size limits of the shared layout
+const int serverCallCapacity = 4096;
+const int serverCallArgumentSize = 112;
+const int serverReplySize = 128;
+const size_t serverBulkSize = 16 * 1024 * 1024;
+
+
+// One API call, with its arguments packed in order
+struct ServerCall {
+    uint32_t type;
+    uint32_t size;
+    uint64_t sequence;
+    unsigned char args[serverCallArgumentSize];
+};
+
+// Kernel effect parameters, small enough to pass by value in a call
+struct KernelParameterValues {
+    float values[FALCON_KERNEL_MAX_PARAMETERS];
+};
+
+
+// Layout of the shared memory region
+struct ServerShared {
+    // Set by the server once the rest is initialized
+    uint32_t magic;
+    uint32_t version;
+
+    // Incremented by the server every loop, and whether it has opened the device
+    std::atomic<uint64_t> serverHeartbeat;
+    std::atomic<bool> deviceInitialized;
+
+    // Process id of the connected client, zero if none. A client whose heartbeat has gone stale can be replaced.
+    std::atomic<uint32_t> owner;
+    std::atomic<uint64_t> clientHeartbeat;
+    std::atomic<bool> clientStale;
+
+    // Calls from the client, consumed in order by the server
+    alignas(64) std::atomic<uint64_t> callWrite;
+    alignas(64) std::atomic<uint64_t> callRead;
+    ServerCall calls[serverCallCapacity];
+
+    // Result of the most recent call with a result, tagged with its sequence number
+    alignas(64) std::atomic<uint64_t> replySequence;
+    unsigned char reply[serverReplySize];
+
+    // Device state in graphics space, written by the server with a sequence lock
+    alignas(64) std::atomic<unsigned int> stateSequence;
+    std::atomic<float> position[3];
+    std::atomic<float> force[3];
+    std::atomic<float> torque[3];
+    std::atomic<int> buttons;
+
+    // Array arguments of the call being made. Only used by calls with a result, so it is free again once they return.
+    alignas(64) unsigned char bulk[serverBulkSize];
+};
+
+const uint32_t serverMagic = 0x4e434c46;
+const uint32_t serverVersion = 2;
+
+
+// Pack arguments into a call, in order
+inline void PackArguments(unsigned char*) {}
+
+template <class T, class... Rest>
+void PackArguments(unsigned char* p, const T& value, const Rest&... rest) {
+    memcpy(p, &value, sizeof(T));
+    PackArguments(p + sizeof(T), rest...);
+}
+
+template <class... T>
+struct ArgumentSize;
+
+template <>
+struct ArgumentSize<> {
+    static const size_t value = 0;
+};
+
+template <class T, class... Rest>
+struct ArgumentSize<T, Rest...> {
+    static const size_t value = sizeof(T) + ArgumentSize<Rest...>::value;
+};
+
+// Read packed arguments back, in order
+class ArgumentReader {
+public:
+    ArgumentReader(const unsigned char* args) : p(args) {}
+
+    template <class T>
+    T Next() {
+        T value;
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+protected:
+    const unsigned char* p;
+};
+
+
+class HapticServer {
+public:
+    HapticServer();
+    ~HapticServer();
+
+    // Create the shared memory region and open the device. Fails if another server with the name is running.
+    // Real-time options and rate are as for Falcon; a rate of zero keeps the default.
+    bool Initialize(const char* name, bool realTime, int cpu, int priority, float rate);
+
+    // Serve calls until Stop() is called
+    // pollInterval: Sleep between checks for calls once idle, in microseconds
+    // clientTimeout: Time without a client heartbeat after which forces are turned off until it returns, in seconds
+    void Run(int pollInterval, double clientTimeout);
+    void Stop();
+
+protected:
+    SharedMemory memory;
+    ServerShared* shared;
+
+    Falcon falcon;
+
+    std::atomic<bool> running;
+
+    // Force feedback as requested by the client, which is overridden while the client is stale
+    bool clientForceFeedback;
+
+
+    // Handle one call
+    void Dispatch(const ServerCall& call);
+
+    // Call a Falcon method with the call's arguments, replying with the result if there is one
+    template <class R, class... A>
+    void Invoke(const ServerCall& call, R (Falcon::*method)(A...));
+
+    template <class... A>
+    void Invoke(const ServerCall& call, void (Falcon::*method)(A...));
+
+    // Set the molecules of the force field from arrays in the bulk area
+    void InvokeAtoms(const ServerCall& call, void (Falcon::*method)(const Vector3*, const float*, const float*, const float*, int));
+
+    // Add a distance field from a grid or mesh in the bulk area
+    void InvokeAddDistanceField(const ServerCall& call);
+    void InvokeAddDistanceFieldMesh(const ServerCall& call);
+
+    // Add a path constraint with control points in the bulk area
+    void InvokeAddPathConstraint(const ServerCall& call);
+
+    // Add a radial profile with forces in the bulk area
+    void InvokeAddRadialProfile(const ServerCall& call);
+
+    // Add a vibration wavetable with samples in the bulk area
+    void InvokeAddWavetable(const ServerCall& call);
+
+    // Add an expression force with its expression in the bulk area
+    void InvokeAddExpressionForce(const ServerCall& call);
+
+    // Set expression parameters sent as numExpressionParameters separate values
+    void InvokeSetExpressionParameters(const ServerCall& call);
+
+    // Load a kernel library or find a kernel, with the file or kernel name in the bulk area
+    void InvokeLoadKernelLibrary(const ServerCall& call);
+    void InvokeFindKernel(const ServerCall& call);
+
+    // Add or update a kernel force with its parameters passed by value
+    void InvokeAddKernelForce(const ServerCall& call);
+    void InvokeUpdateKernelForce(const ServerCall& call);
+
+    // Set frame transforms from ids and matrices in the bulk area
+    void InvokeSetFrames(const ServerCall& call);
+
+    // Evaluate forces at points in the bulk area, writing the forces after them
+    void InvokeEvaluateForces(const ServerCall& call);
+
+    // Set probe points from offsets and radii in the bulk area
+    void InvokeSetProbePoints(const ServerCall& call);
+
+    // Load a scene from the bulk area, or save the scene to it
+    void InvokeLoadScene(const ServerCall& call);
+    void InvokeSaveScene(const ServerCall& call);
+
+    template <class R>
+    void Reply(const ServerCall& call, const R& result);
+
+    // Start a new session, clearing effects left by a previous client
+    void Connect();
+
+    // Publish the device state
+    void PublishState();
+};
+
+
+#endif
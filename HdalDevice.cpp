@@ -0,0 +1,151 @@
+/*=========================================================================
+
+  Name:        HdalDevice.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Device backend using Novint's HDAL.
+
+=========================================================================*/
+
+
+#include "HdalDevice.h"
+
+#include "ServoCheck.h"
+#include "ServoClock.h"
+
+#include <iostream>
+
+
+HdalDevice::HdalDevice() {
+    deviceHandle = HDL_INVALID_HANDLE;
+    servoOp = HDL_INVALID_HANDLE;
+    started = false;
+
+    for (int i = 0; i < 6; i++) {
+        workspace[i] = 0.0;
+    }
+
+    tick = nullptr;
+    userData = nullptr;
+    servoThread = nullptr;
+}
+
+bool HdalDevice::Open() {
+    // Initialize the device
+    deviceHandle = hdlInitNamedDevice("DEFAULT");
+
+    if (deviceHandle == HDL_INVALID_HANDLE) {
+        return false;
+    }
+
+        
+    // Now that the device is initialized, start the servo thread.
+    hdlStart();
+    started = true;
+
+    if (hdlGetError() != HDL_NO_ERROR) {
+        std::cout << "Could not start the servo thread" << std::endl;
+        return false;
+    }
+
+
+    // Make the device current.  All subsequent calls will be directed to the current device.
+    hdlMakeCurrent(deviceHandle);
+
+    if (hdlGetError() != HDL_NO_ERROR) {
+        std::cout << "Could not make device current" << std::endl;
+        return false;
+    }
+
+
+    // Get the extents of the device workspace
+    hdlDeviceWorkspace(workspace);
+
+    if (hdlGetError() != HDL_NO_ERROR) {
+        std::cout << "Could not get device workspace" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void HdalDevice::Close() {
+    if (started) {
+        hdlStop();
+        started = false;
+    }
+
+    if (deviceHandle != HDL_INVALID_HANDLE) {
+        hdlUninitDevice(deviceHandle);
+        deviceHandle = HDL_INVALID_HANDLE;
+    }
+}
+
+void HdalDevice::GetWorkspace(double w[6]) {
+    for (int i = 0; i < 6; i++) {
+        w[i] = workspace[i];
+    }
+}
+
+bool HdalDevice::StartServo(void (*tickFunction)(void*), void* tickData, ServoThread& thread) {
+    tick = tickFunction;
+    userData = tickData;
+    servoThread = &thread;
+
+    // Make the device current for this thread too, in case the device was opened on another
+    hdlMakeCurrent(deviceHandle);
+
+    // Set up callback function
+    servoOp = hdlCreateServoOp(ServoCB, this, false);
+    if (servoOp == HDL_INVALID_HANDLE) {
+        std::cout << "Invalid servo op handle" << std::endl;
+    }
+
+    if (hdlGetError() != HDL_NO_ERROR) {
+        std::cout << "Could not create servo op" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void HdalDevice::StopServo(ServoThread&) {
+    if (servoOp != HDL_INVALID_HANDLE) {
+        hdlDestroyServoOp(servoOp);
+        servoOp = HDL_INVALID_HANDLE;
+    }
+}
+
+void HdalDevice::GetPosition(double p[3]) {
+    hdlToolPosition(p);
+}
+
+int HdalDevice::GetButtons() {
+    int buttons;
+    hdlToolButtons(&buttons);
+    return buttons;
+}
+
+void HdalDevice::SetForce(const double f[3], double) {
+    double force[3] = { f[0], f[1], f[2] };
+    hdlSetToolForce(force);
+}
+
+HDLServoOpExitCode HdalDevice::ServoCB(void* userData) {
+    // Get pointer to device object
+    HdalDevice* device = static_cast<HdalDevice*>(userData);
+
+    // Call the tick, keeping timing statistics for HDAL's servo thread
+    int64_t start = ServoClock::NowNanoseconds();
+    {
+        ServoCheck::Tick check;
+        device->tick(device->userData);
+    }
+    device->servoThread->RecordTick(start, 0, ServoClock::NowNanoseconds() - start, 1000000);
+
+    // Make sure to continue processing
+    return HDL_SERVOOP_CONTINUE;
+}
@@ -0,0 +1,68 @@
+/*=========================================================================
+
+  Name:        HdalDevice.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Device backend using Novint's HDAL, which runs its own
+               1 kHz servo thread.
+
+=========================================================================*/
+
+
+#ifndef HDALDEVICE_H
+#define HDALDEVICE_H
+
+
+#include <hdl/hdl.h>
+
+#include "ServoThread.h"
+
+
+class HdalDevice {
+public:
+    HdalDevice();
+
+    // Open and close the device
+    bool Open();
+    void Close();
+
+    // Device workspace as (minx, miny, minz, maxx, maxy, maxz), in meters
+    void GetWorkspace(double workspace[6]);
+
+    // Run tick(userData) from HDAL's servo thread, recording its timing in servoThread
+    bool StartServo(void (*tick)(void*), void* userData, ServoThread& servoThread);
+    void StopServo(ServoThread& servoThread);
+
+    // Servo thread: device state
+    void GetPosition(double p[3]);
+    int GetButtons();
+
+    // Servo thread: apply a force. HDAL keeps its own time step.
+    void SetForce(const double f[3], double dt);
+
+protected:
+    // Handle to device
+    HDLDeviceHandle deviceHandle;
+
+    // Handle to haptic callback
+    HDLServoOpExitCode servoOp;
+
+    // Whether hdlStart() has been called
+    bool started;
+
+    double workspace[6];
+
+    // Tick to call from the servo callback
+    void (*tick)(void*);
+    void* userData;
+    ServoThread* servoThread;
+
+    // Continuous servo callback function
+    static HDLServoOpExitCode ServoCB(void* userData);
+};
+
+
+#endif
@@ -0,0 +1,127 @@
+/*=========================================================================
+
+  Name:        MappedFile.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Read-only file mapped into this process.
+
+=========================================================================*/
+
+
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile() : data(nullptr), size(0) {
+#if defined(_WIN32)
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* fileName) {
+    Close();
+
+    file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        Close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        Close();
+        return false;
+    }
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        Close();
+        return false;
+    }
+
+    size = (size_t)fileSize.QuadPart;
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+
+    data = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* fileName) {
+    Close();
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        Close();
+        return false;
+    }
+
+    data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        Close();
+        return false;
+    }
+
+    size = (size_t)info.st_size;
+
+    // The whole file is about to be read, so start reading it in now
+    madvise(data, size, MADV_WILLNEED);
+
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data) munmap(data, size);
+    if (fd >= 0) close(fd);
+
+    data = nullptr;
+    fd = -1;
+    size = 0;
+}
+
+#endif
+
+const void* MappedFile::Data() {
+    return data;
+}
+
+size_t MappedFile::Size() {
+    return size;
+}
@@ -0,0 +1,47 @@
+/*=========================================================================
+
+  Name:        MappedFile.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Read-only file mapped into this process, so it can be read
+               without copying it into memory first.
+
+=========================================================================*/
+
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+
+#include <cstddef>
+
+
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map a file. Fails if it doesn't exist or is empty.
+    bool Open(const char* fileName);
+    void Close();
+
+    const void* Data();
+    size_t Size();
+
+protected:
+    void* data;
+    size_t size;
+
+#if defined(_WIN32)
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+};
+
+
+#endif
@@ -0,0 +1,155 @@
+/*=========================================================================
+
+  Name:        NiFalconDevice.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Device backend talking to the Falcon directly over USB with
+               libnifalcon.
+
+=========================================================================*/
+
+
+#include "NiFalconDevice.h"
+
+#include "ServoClock.h"
+
+#include <falcon/firmware/FalconFirmwareNovintSDK.h>
+#include <falcon/grip/FalconGripFourButton.h>
+#include <falcon/kinematic/FalconKinematicStamper.h>
+#include <falcon/util/FalconFirmwareBinaryNvent.h>
+
+#include <iostream>
+
+
+namespace {
+    // Roughly the Falcon's workspace, in meters
+    const double workspaceExtent = 0.06;
+
+    // The kinematics put the center of the workspace this far along z, in meters.
+    // Positions are shifted so the workspace is centered on the origin, as with HDAL.
+    const double workspaceCenterZ = 0.11;
+
+    // Time allowed for the user to home the device
+    const double homingTimeout = 30.0;
+}
+
+
+NiFalconDevice::NiFalconDevice() {
+    open = false;
+}
+
+bool NiFalconDevice::Open() {
+    device.setFalconFirmware<libnifalcon::FalconFirmwareNovintSDK>();
+    device.setFalconKinematic<libnifalcon::FalconKinematicStamper>();
+    device.setFalconGrip<libnifalcon::FalconGripFourButton>();
+
+    // Open the first device
+    unsigned int count = 0;
+    device.getDeviceCount(count);
+
+    if (count == 0 || !device.open(0)) {
+        return false;
+    }
+
+    open = true;
+
+
+    // The firmware is lost whenever the device loses power
+    if (!device.isFirmwareLoaded()) {
+        for (int i = 0; i < 10; i++) {
+            if (device.getFalconFirmware()->loadFirmware(true, NOVINT_FALCON_NVENT_FIRMWARE_SIZE, const_cast<uint8_t*>(NOVINT_FALCON_NVENT_FIRMWARE))) break;
+        }
+
+        if (!device.isFirmwareLoaded()) {
+            std::cout << "Could not load device firmware" << std::endl;
+            Close();
+            return false;
+        }
+    }
+
+
+    // Positions are relative to where the encoders were when powered on until the device is homed
+    if (!Home(homingTimeout)) {
+        std::cout << "Could not home device" << std::endl;
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void NiFalconDevice::Close() {
+    if (open) {
+        device.close();
+        open = false;
+    }
+}
+
+void NiFalconDevice::GetWorkspace(double workspace[6]) {
+    for (int i = 0; i < 3; i++) {
+        workspace[i] = -workspaceExtent;
+        workspace[i + 3] = workspaceExtent;
+    }
+}
+
+bool NiFalconDevice::StartServo(void (*tick)(void*), void* userData, ServoThread& servoThread) {
+    return servoThread.Start(tick, userData);
+}
+
+void NiFalconDevice::StopServo(ServoThread& servoThread) {
+    servoThread.Stop();
+}
+
+void NiFalconDevice::GetPosition(double p[3]) {
+    auto position = device.getPosition();
+
+    p[0] = position[0];
+    p[1] = position[1];
+    p[2] = position[2] - workspaceCenterZ;
+}
+
+int NiFalconDevice::GetButtons() {
+    // The four button grip uses the same bits as HDAL
+    return (int)device.getFalconGrip()->getDigitalInputs();
+}
+
+void NiFalconDevice::SetForce(const double f[3], double) {
+    decltype(device.getPosition()) force;
+    force[0] = f[0];
+    force[1] = f[1];
+    force[2] = f[2];
+
+    device.setForce(force);
+    device.runIOLoop();
+}
+
+bool NiFalconDevice::Home(double timeout) {
+    auto firmware = device.getFalconFirmware();
+
+    firmware->setHomingMode(true);
+    firmware->setLEDStatus(libnifalcon::FalconFirmware::RED_LED);
+
+    bool prompted = false;
+    int64_t start = ServoClock::NowNanoseconds();
+
+    while (!firmware->isHomed()) {
+        if ((ServoClock::NowNanoseconds() - start) * 1e-9 > timeout) {
+            return false;
+        }
+
+        if (!prompted) {
+            std::cout << "Move the grip all the way in and out to home the device" << std::endl;
+            prompted = true;
+        }
+
+        device.runIOLoop();
+    }
+
+    firmware->setLEDStatus(libnifalcon::FalconFirmware::GREEN_LED);
+    device.runIOLoop();
+
+    return true;
+}
@@ -0,0 +1,57 @@
+/*=========================================================================
+
+  Name:        NiFalconDevice.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Device backend talking to the Falcon directly over USB with
+               libnifalcon, for platforms without HDAL. libnifalcon has
+               no servo thread of its own, so USB I/O is done each tick
+               from the plugin's servo thread.
+
+=========================================================================*/
+
+
+#ifndef NIFALCONDEVICE_H
+#define NIFALCONDEVICE_H
+
+
+#include <falcon/core/FalconDevice.h>
+
+#include "ServoThread.h"
+
+
+class NiFalconDevice {
+public:
+    NiFalconDevice();
+
+    // Open the first Falcon, loading its firmware and homing it if needed, and close it
+    bool Open();
+    void Close();
+
+    // Device workspace as (minx, miny, minz, maxx, maxy, maxz), in meters
+    void GetWorkspace(double workspace[6]);
+
+    // Run tick(userData) from servoThread
+    bool StartServo(void (*tick)(void*), void* userData, ServoThread& servoThread);
+    void StopServo(ServoThread& servoThread);
+
+    // Servo thread: device state as of the last I/O
+    void GetPosition(double p[3]);
+    int GetButtons();
+
+    // Servo thread: send a force and read back the device state
+    void SetForce(const double f[3], double dt);
+
+protected:
+    libnifalcon::FalconDevice device;
+    bool open;
+
+    // Run the I/O loop until the device has been homed or the timeout passes, in seconds
+    bool Home(double timeout);
+};
+
+
+#endif
@@ -0,0 +1,233 @@
+/*=========================================================================
+
+  Name:        Scene.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Binary scene format, for loading a whole scene of effects
+               in one call. A header is followed by a table of sections,
+               one per effect type, each pointing to packed records of the
+               effect's parameters in graphics space, as given to its Add
+               call, followed by its effect group. Variable length data,
+               such as distance grid samples, is kept in the data section
+               and found from records by its byte offset there. Kernel
+               forces aren't saved, as their kernels belong to the process
+               that registered them. All values are 32-bit and
+               little-endian.
+
+=========================================================================*/
+
+
+#ifndef SCENE_H
+#define SCENE_H
+
+
+#include <cstdint>
+
+
+const uint32_t sceneMagic = 0x4e435346;
+const uint32_t sceneVersion = 1;
+
+
+enum SceneSectionType {
+    SceneSimpleForces,
+    SceneViscosities,
+    SceneSurfaces,
+    SceneSprings,
+    SceneIntermolecularForces,
+    SceneRandomForces,
+    SceneRigidBodies,
+    SceneRigidBodyGravity,
+    SceneColliders,
+    SceneData,
+    SceneDistanceFields,
+    ScenePathConstraints,
+    SceneRadialProfiles,
+    SceneRadialForces,
+    SceneWavetables,
+    SceneVibrations,
+    SceneExpressionForces,
+    SceneFrames,
+    NumSceneSectionTypes
+};
+
+
+struct SceneHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numSections;
+    uint32_t reserved;
+};
+
+// Records start at offset bytes from the start of the scene
+struct SceneSection {
+    uint32_t type;
+    uint32_t count;
+    uint32_t recordSize;
+    uint32_t offset;
+};
+
+
+// Records. Effect records end with the effect's group, and may be written without it by earlier versions, in which
+// case the effects are in group 0. Records of effects that can be in frames then have the effect's frame, or -1 for
+// graphics space, which effects are in if their records are without it.
+struct SceneSimpleForce {
+    float f[3];
+    int32_t group;
+};
+
+struct SceneViscosity {
+    float c;
+    float w;
+    int32_t group;
+};
+
+struct SceneSurface {
+    float p[3];
+    float n[3];
+    float k;
+    float c;
+    int32_t group;
+    int32_t frame;
+};
+
+// Springs and intermolecular forces
+struct SceneSpring {
+    float p[3];
+    float k;
+    float c;
+    float r;
+    float m;
+    int32_t group;
+    int32_t frame;
+};
+
+struct SceneRandomForce {
+    float minMag;
+    float maxMag;
+    float minTime;
+    float maxTime;
+    int32_t group;
+};
+
+struct SceneRigidBody {
+    float p[3];
+    float q[4];
+    float mass;
+    float inertia[3];
+    int32_t shape;
+    float extents[3];
+    float k;
+    float c;
+    float linearDrag;
+    float angularDrag;
+    int32_t group;
+};
+
+struct SceneGravity {
+    float g[3];
+};
+
+struct SceneCollider {
+    int32_t shape;
+    float extents[3];
+    float p[3];
+    float q[4];
+    float k;
+    float c;
+    int32_t group;
+};
+
+// The data section's records are single bytes. Data starts at offsets that are multiples of 4.
+
+// Distance fields, with the grid's dims[0] * dims[1] * dims[2] samples at samples in the data section, x varying
+// fastest. A grid still being built from a mesh is saved with no samples, so the field renders no force when loaded.
+struct SceneDistanceField {
+    int32_t dims[3];
+    float origin[3];
+    float cellSize;
+    uint32_t samples;
+    float p[3];
+    float q[4];
+    float k;
+    float c;
+    int32_t group;
+};
+
+// Path constraints, with the numPoints vertices of the path as built, x, y, z for each, at points in the data section.
+// Closed paths repeat their first vertex at the end, so the vertices load as straight segments along the same path.
+struct ScenePathConstraint {
+    uint32_t numPoints;
+    uint32_t points;
+    float p[3];
+    float q[4];
+    float k;
+    float c;
+    float r;
+    float along;
+    int32_t group;
+};
+
+// Radial profiles, first the profile pool with profile ids as record indices, then any that radial forces still use
+// after their removal from the pool. pooled is 1 for profiles in the pool, and records of removed ids are zero. The
+// numSamples forces are at forces in the data section.
+struct SceneRadialProfile {
+    int32_t pooled;
+    uint32_t numSamples;
+    uint32_t forces;
+    float maxDistance;
+    int32_t cubic;
+};
+
+// Radial forces, with the index of their profile's record
+struct SceneRadialForce {
+    float p[3];
+    uint32_t profile;
+    float scale;
+    float c;
+    int32_t group;
+};
+
+// Vibration wavetables, first the wavetable pool with wavetable ids as record indices, then any that vibrations still
+// use after their removal from the pool. pooled is 1 for wavetables in the pool, and records of built in waveforms and
+// removed ids are zero. The numSamples samples of one period are at samples in the data section.
+struct SceneWavetable {
+    int32_t pooled;
+    uint32_t numSamples;
+    uint32_t samples;
+};
+
+// Vibrations, with the index of their wavetable's record, or the built in waveform. Vibrations load untriggered.
+struct SceneVibration {
+    uint32_t wavetable;
+    float direction[3];
+    float amplitude;
+    float frequency;
+    float attack;
+    float decay;
+    float sustain;
+    float release;
+    int32_t group;
+};
+
+// Expression forces, with the length bytes of the expression's text at text in the data section, and parameters u0 to
+// u7. The time since the effect was added restarts when loaded.
+struct SceneExpressionForce {
+    uint32_t length;
+    uint32_t text;
+    float parameters[8];
+    int32_t group;
+};
+
+// Frames, with frame ids as record indices. Records of removed ids have used 0. local is the column-major transform to
+// the parent frame, or to graphics space if parent is -1.
+struct SceneFrame {
+    int32_t used;
+    int32_t parent;
+    float local[16];
+};
+
+
+#endif
@@ -0,0 +1,93 @@
+/*=========================================================================
+
+  Name:        FalconServer.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Standalone haptic server. Owns the device and runs its
+               servo loop in this process, serving the plugin through
+               shared memory, so the application only maps the server's
+               memory at startup and its pauses and crashes can't stall
+               the servo loop.
+
+=========================================================================*/
+
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+
+#include "HapticServer.h"
+
+
+HapticServer* server = nullptr;
+
+void Interrupt(int) {
+    if (server) server->Stop();
+}
+
+void printUsage(char** argv) {
+	printf("Usage: %s [-option value ...]\n", argv[0]);
+	printf("Options:\n");
+	printf("\tname <name>\t\tShared memory name (default %s)\n", HAPTIC_SERVER_DEFAULT_NAME);
+	printf("\trealtime <cpu> <priority>\tReal-time servo thread, pinned to cpu (-1 for none)\n");
+	printf("\trate <hz>\t\tServo rate, for devices without their own servo thread\n");
+	printf("\tpoll <us>\t\tSleep between checks for calls once idle (default 100)\n");
+	printf("\ttimeout <s>\t\tTurn forces off after the application stops responding this long (default 1)\n");
+}
+
+int main(int argc, char** argv) {
+	const char* name = HAPTIC_SERVER_DEFAULT_NAME;
+	bool realTime = false;
+	int cpu = -1;
+	int priority = 80;
+	float rate = 0.0f;
+	int poll = 100;
+	double timeout = 1.0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-name") == 0 && i + 1 < argc) {
+			name = argv[++i];
+		}
+		else if (strcmp(argv[i], "-realtime") == 0 && i + 2 < argc) {
+			realTime = true;
+			cpu = atoi(argv[++i]);
+			priority = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) {
+			rate = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-poll") == 0 && i + 1 < argc) {
+			poll = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc) {
+			timeout = atof(argv[++i]);
+		}
+		else {
+			printUsage(argv);
+			return 1;
+		}
+	}
+
+	server = new HapticServer();
+
+	if (!server->Initialize(name, realTime, cpu, priority, rate)) {
+		delete server;
+		return 1;
+	}
+
+	std::signal(SIGINT, Interrupt);
+	std::signal(SIGTERM, Interrupt);
+
+	printf("Haptic server %s running\n", name);
+
+	server->Run(poll, timeout);
+
+	delete server;
+	server = nullptr;
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*=========================================================================
+
+  Name:        ServoCheck.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Debug check that the servo tick never allocates or locks.
+
+=========================================================================*/
+
+
+#include "ServoCheck.h"
+
+#ifdef FALCON_SERVO_CHECKS
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+
+namespace {
+    thread_local bool inServoTick = false;
+
+    void Fail(const char* what) {
+        // No allocation here, since that is what we are checking for
+        inServoTick = false;
+        fputs("ServoCheck: ", stderr);
+        fputs(what, stderr);
+        fputs(" in servo tick\n", stderr);
+        abort();
+    }
+
+    void* Allocate(size_t size) {
+        if (inServoTick) Fail("allocation");
+
+        void* p = malloc(size ? size : 1);
+        if (!p) throw std::bad_alloc();
+
+        return p;
+    }
+}
+
+
+void ServoCheck::Enter() {
+    inServoTick = true;
+}
+
+void ServoCheck::Leave() {
+    inServoTick = false;
+}
+
+
+#ifndef _WIN32
+namespace {
+    typedef int (*MutexLock)(pthread_mutex_t*);
+
+    // Looked up on first use, without a function static, whose guard may itself lock
+    std::atomic<MutexLock> nextMutexLock(nullptr);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    if (inServoTick) Fail("lock");
+
+    MutexLock next = nextMutexLock.load(std::memory_order_acquire);
+    if (!next) {
+        next = reinterpret_cast<MutexLock>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        if (!next) abort();
+        nextMutexLock.store(next, std::memory_order_release);
+    }
+
+    return next(mutex);
+}
+#endif
+
+
+void* operator new(size_t size) {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return Allocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    if (inServoTick) Fail("allocation");
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    if (inServoTick) Fail("allocation");
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+    if (p && inServoTick) Fail("deallocation");
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    if (p && inServoTick) Fail("deallocation");
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete[](p);
+}
+
+#endif
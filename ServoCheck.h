@@ -0,0 +1,47 @@
+/*=========================================================================
+
+  Name:        ServoCheck.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Debug check that the servo tick never allocates or locks.
+               Enabled by defining FALCON_SERVO_CHECKS, which replaces the
+               global allocation operators, and on POSIX systems
+               pthread_mutex_lock(), which std::mutex locks with, with
+               versions that abort when called from inside a servo tick.
+               Compiles to nothing otherwise.
+
+               Replacing these only takes effect in the module that defines
+               them, so this catches allocations and locks in executables
+               that link Falcon directly, such as FalconTest. Windows has
+               no way to replace the lock, so only allocation is checked
+               there.
+
+=========================================================================*/
+
+
+#ifndef SERVOCHECK_H
+#define SERVOCHECK_H
+
+
+namespace ServoCheck {
+#ifdef FALCON_SERVO_CHECKS
+    // Mark entering and leaving the servo tick on this thread
+    void Enter();
+    void Leave();
+#else
+    inline void Enter() {}
+    inline void Leave() {}
+#endif
+
+    // Scope for one servo tick
+    struct Tick {
+        Tick() { Enter(); }
+        ~Tick() { Leave(); }
+    };
+}
+
+
+#endif
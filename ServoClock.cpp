@@ -0,0 +1,96 @@
+/*=========================================================================
+
+  Name:        ServoClock.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Monotonic clock for the servo loop.
+
+=========================================================================*/
+
+
+#include "ServoClock.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(FALCON_USE_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define SERVOCLOCK_TSC
+#endif
+
+
+namespace {
+#if defined(_WIN32)
+    double ticksPerSecond = 0.0;
+#endif
+
+#if defined(SERVOCLOCK_TSC)
+    // Conversion from time stamp counter ticks to nanoseconds
+    uint64_t tscStart = 0;
+    int64_t tscStartNanoseconds = 0;
+    double nanosecondsPerTick = 0.0;
+#endif
+}
+
+
+void ServoClock::Initialize() {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    ticksPerSecond = (double)frequency.QuadPart;
+#endif
+
+#if defined(SERVOCLOCK_TSC)
+    // Calibrate over 10 ms. Assumes an invariant TSC, as on all recent x86 processors.
+    uint64_t tsc0 = __rdtsc();
+    int64_t ns0 = SystemNanoseconds();
+
+    int64_t ns1 = ns0;
+    while (ns1 - ns0 < 10000000) {
+        ns1 = SystemNanoseconds();
+    }
+    uint64_t tsc1 = __rdtsc();
+
+    nanosecondsPerTick = (double)(ns1 - ns0) / (double)(tsc1 - tsc0);
+    tscStart = tsc1;
+    tscStartNanoseconds = ns1;
+#endif
+}
+
+int64_t ServoClock::NowNanoseconds() {
+#if defined(SERVOCLOCK_TSC)
+    if (nanosecondsPerTick > 0.0) {
+        return tscStartNanoseconds + (int64_t)((__rdtsc() - tscStart) * nanosecondsPerTick);
+    }
+#endif
+
+    return SystemNanoseconds();
+}
+
+int64_t ServoClock::SystemNanoseconds() {
+#if defined(_WIN32)
+    if (ticksPerSecond == 0.0) {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        ticksPerSecond = (double)frequency.QuadPart;
+    }
+
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    return (int64_t)(count.QuadPart * (1e9 / ticksPerSecond));
+#else
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+double ServoClock::Now() {
+    return NowNanoseconds() * 1e-9;
+}
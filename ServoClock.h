@@ -0,0 +1,42 @@
+/*=========================================================================
+
+  Name:        ServoClock.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Monotonic clock for the servo loop. Uses the time stamp
+               counter when FALCON_USE_TSC is defined on x86, calibrated
+               against CLOCK_MONOTONIC, otherwise CLOCK_MONOTONIC on Linux
+               and the performance counter on Windows. Reading the clock
+               never locks, allocates or makes a system call on Linux.
+
+=========================================================================*/
+
+
+#ifndef SERVOCLOCK_H
+#define SERVOCLOCK_H
+
+
+#include <cstdint>
+
+
+namespace ServoClock {
+    // Calibrate the clock. Called once before starting the servo loop; safe to call again.
+    void Initialize();
+
+    // Current time in seconds since an arbitrary epoch
+    double Now();
+
+    // Current time in nanoseconds since an arbitrary epoch
+    int64_t NowNanoseconds();
+
+    // Current time in nanoseconds on the system's monotonic clock, which the servo thread sleeps on. The time stamp
+    // counter drifts from it after calibration, so deadlines and how late they were met use this, and the time stamp
+    // counter only measures durations.
+    int64_t SystemNanoseconds();
+}
+
+
+#endif
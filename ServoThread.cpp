@@ -0,0 +1,275 @@
+/*=========================================================================
+
+  Name:        ServoThread.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Dedicated servo thread for devices that don't provide their
+               own.
+
+=========================================================================*/
+
+
+#include "ServoThread.h"
+
+#include "ServoCheck.h"
+#include "ServoClock.h"
+
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+
+namespace {
+    // Percentile from a histogram with 1 us bins
+    float HistogramPercentile(const std::atomic<uint32_t>* histogram, int numBins, int total, double fraction) {
+        if (total == 0) return 0.0f;
+
+        uint64_t target = (uint64_t)(fraction * total);
+        uint64_t count = 0;
+        for (int i = 0; i < numBins; i++) {
+            count += histogram[i].load(std::memory_order_relaxed);
+            if (count > target) return (float)i;
+        }
+
+        return (float)(numBins - 1);
+    }
+
+    // Single writer, so a relaxed load and store is enough
+    void Increment(std::atomic<uint32_t>& a) {
+        a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void Max(std::atomic<int64_t>& a, int64_t v) {
+        if (v > a.load(std::memory_order_relaxed)) a.store(v, std::memory_order_relaxed);
+    }
+}
+
+
+ServoThread::ServoThread() {
+    cpu = -1;
+    priority = 0;
+    lockMemory = false;
+
+    period = 1000000;
+    running = false;
+
+    tick = nullptr;
+    userData = nullptr;
+
+    resetRequested = false;
+    ClearStats();
+}
+
+ServoThread::~ServoThread() {
+    Stop();
+}
+
+void ServoThread::SetRealTime(int cpu, int priority, bool lockMemory) {
+    this->cpu = cpu;
+    this->priority = priority;
+    this->lockMemory = lockMemory;
+}
+
+void ServoThread::SetRate(double hz) {
+    period = (int64_t)(1e9 / hz);
+    lastPeriod = period.load();
+}
+
+double ServoThread::GetRate() {
+    return 1e9 / period.load();
+}
+
+bool ServoThread::Start(void (*tick)(void*), void* userData) {
+    if (running) return false;
+
+    this->tick = tick;
+    this->userData = userData;
+
+    ServoClock::Initialize();
+
+#if defined(__linux__)
+    if (lockMemory) {
+        // Lock all memory, and keep freed memory in the process so later allocations don't fault
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            std::cout << "Could not lock memory" << std::endl;
+        }
+
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+#endif
+
+    running = true;
+    thread = std::thread(&ServoThread::Run, this);
+
+    return true;
+}
+
+void ServoThread::Stop() {
+    if (!running) return;
+
+    running = false;
+    thread.join();
+}
+
+bool ServoThread::IsRunning() {
+    return running;
+}
+
+ServoStats ServoThread::GetStats() {
+    ServoStats stats = {};
+    stats.requestedRate = (float)(1e9 / lastPeriod.load());
+
+    // Nothing since a reset the servo thread hasn't applied yet
+    if (resetRequested.load()) return stats;
+
+    int n = numTicks.load();
+
+    stats.ticks = n;
+    stats.missedDeadlines = missedDeadlines.load();
+
+    int64_t elapsed = lastTickStart.load() - firstTickStart.load();
+    stats.achievedRate = n > 1 && elapsed > 0 ? (float)((n - 1) * 1e9 / elapsed) : 0.0f;
+
+    stats.meanLatency = n > 0 ? (float)(latencySum.load() / n * 1e-3) : 0.0f;
+    stats.p99Latency = HistogramPercentile(latencyHistogram, numBins, n, 0.99);
+    stats.maxLatency = (float)(maxLatency.load() * 1e-3);
+
+    stats.meanTickTime = n > 0 ? (float)(tickTimeSum.load() / n * 1e-3) : 0.0f;
+    stats.p99TickTime = HistogramPercentile(tickTimeHistogram, numBins, n, 0.99);
+    stats.p999TickTime = HistogramPercentile(tickTimeHistogram, numBins, n, 0.999);
+    stats.maxTickTime = (float)(maxTickTime.load() * 1e-3);
+
+    return stats;
+}
+
+void ServoThread::ResetStats() {
+    resetRequested = true;
+}
+
+void ServoThread::ClearStats() {
+    for (int i = 0; i < numBins; i++) {
+        latencyHistogram[i] = 0;
+        tickTimeHistogram[i] = 0;
+    }
+
+    latencySum = 0;
+    tickTimeSum = 0;
+    maxLatency = 0;
+    maxTickTime = 0;
+    numTicks = 0;
+    missedDeadlines = 0;
+
+    firstTickStart = 0;
+    lastTickStart = 0;
+    lastPeriod = period.load();
+}
+
+void ServoThread::RecordTick(int64_t start, int64_t latency, int64_t tickTime, int64_t period) {
+    if (resetRequested.load(std::memory_order_relaxed)) {
+        ClearStats();
+        resetRequested.store(false, std::memory_order_release);
+    }
+
+    if (numTicks.load(std::memory_order_relaxed) == 0) {
+        firstTickStart.store(start, std::memory_order_relaxed);
+    }
+    lastTickStart.store(start, std::memory_order_relaxed);
+    lastPeriod.store(period, std::memory_order_relaxed);
+
+    int64_t latencyBin = latency / 1000;
+    int64_t tickTimeBin = tickTime / 1000;
+
+    Increment(latencyHistogram[latencyBin < 0 ? 0 : latencyBin < numBins ? latencyBin : numBins - 1]);
+    Increment(tickTimeHistogram[tickTimeBin < numBins ? tickTimeBin : numBins - 1]);
+
+    latencySum.store(latencySum.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+    tickTimeSum.store(tickTimeSum.load(std::memory_order_relaxed) + tickTime, std::memory_order_relaxed);
+    Max(maxLatency, latency);
+    Max(maxTickTime, tickTime);
+
+    // Missed if the tick finished after the next one was due
+    if (latency + tickTime > period) {
+        missedDeadlines.store(missedDeadlines.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    numTicks.store(numTicks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void ServoThread::ConfigureThread() {
+#if defined(__linux__)
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            std::cout << "Could not set servo thread affinity" << std::endl;
+        }
+    }
+
+    if (priority > 0) {
+        sched_param param;
+        param.sched_priority = priority;
+
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            std::cout << "Could not set servo thread priority" << std::endl;
+        }
+    }
+
+    if (lockMemory) {
+        // Pre-fault the stack so the tick never takes a page fault on it
+        volatile unsigned char stack[256 * 1024];
+        memset((void*)stack, 0, sizeof(stack));
+    }
+#endif
+}
+
+void ServoThread::Run() {
+    ConfigureThread();
+
+    // Deadlines are on the clock the thread sleeps on, and tick times on the servo clock
+    int64_t next = ServoClock::SystemNanoseconds();
+
+    while (running.load(std::memory_order_relaxed)) {
+        int64_t p = period.load(std::memory_order_relaxed);
+        next += p;
+
+        // Sleep until the next tick is due
+#if defined(__linux__)
+        timespec t;
+        t.tv_sec = next / 1000000000;
+        t.tv_nsec = next % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr);
+#else
+        while (ServoClock::SystemNanoseconds() < next) {
+            std::this_thread::yield();
+        }
+#endif
+
+        int64_t wake = ServoClock::SystemNanoseconds();
+        int64_t start = ServoClock::NowNanoseconds();
+        {
+            ServoCheck::Tick check;
+            tick(userData);
+        }
+        int64_t tickTime = ServoClock::NowNanoseconds() - start;
+
+        RecordTick(wake, wake - next, tickTime, p);
+
+        // Don't try to catch up after a long stall, just skip the missed ticks
+        if (wake + tickTime - next > 4 * p) {
+            next = wake + tickTime;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/*=========================================================================
+
+  Name:        ServoThread.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Dedicated servo thread for devices that don't provide their
+               own, calling a tick function at a fixed rate. In real-time
+               mode on Linux the thread is pinned to a CPU, runs with
+               SCHED_FIFO priority, and all memory is locked and
+               pre-faulted. Keeps tick latency statistics without
+               allocating or locking.
+
+=========================================================================*/
+
+
+#ifndef SERVOTHREAD_H
+#define SERVOTHREAD_H
+
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+
+// Struct to use for sending servo timing statistics to Unity. Times in microseconds.
+struct ServoStats {
+    int ticks;
+    int missedDeadlines;
+
+    // Tick rates in Hz
+    float requestedRate;
+    float achievedRate;
+
+    // Time from the scheduled wake-up to the start of the tick
+    float meanLatency;
+    float p99Latency;
+    float maxLatency;
+
+    // Time spent in the tick
+    float meanTickTime;
+    float p99TickTime;
+    float p999TickTime;
+    float maxTickTime;
+};
+
+
+class ServoThread {
+public:
+    ServoThread();
+    ~ServoThread();
+
+    // Real-time options, set before Start().
+    // cpu: CPU to pin the thread to. Negative for no affinity.
+    // priority: SCHED_FIFO priority, 1 to 99. Zero or negative for the default scheduler.
+    // lockMemory: Lock all current and future memory and pre-fault the stack.
+    void SetRealTime(int cpu, int priority, bool lockMemory);
+
+    // Tick rate in Hz
+    void SetRate(double hz);
+    double GetRate();
+
+    // Start calling tick(userData) at the set rate
+    bool Start(void (*tick)(void*), void* userData);
+    void Stop();
+    bool IsRunning();
+
+    // Timing statistics since the last reset. The reset is applied by the next tick recorded, and no ticks are
+    // reported until then.
+    ServoStats GetStats();
+    void ResetStats();
+
+    // Record timing for a tick that started at the given time, including ticks driven by another thread, e.g. HDAL's
+    void RecordTick(int64_t start, int64_t latency, int64_t tickTime, int64_t period);
+
+protected:
+    // Real-time options
+    int cpu;
+    int priority;
+    bool lockMemory;
+
+    // Period in nanoseconds
+    std::atomic<int64_t> period;
+
+    // Thread state
+    std::thread thread;
+    std::atomic<bool> running;
+
+    void (*tick)(void*);
+    void* userData;
+
+    // Histograms of latency and tick time with 1 us bins, the last bin catching everything above
+    static const int numBins = 2048;
+    std::atomic<uint32_t> latencyHistogram[numBins];
+    std::atomic<uint32_t> tickTimeHistogram[numBins];
+    std::atomic<int64_t> latencySum;
+    std::atomic<int64_t> tickTimeSum;
+    std::atomic<int64_t> maxLatency;
+    std::atomic<int64_t> maxTickTime;
+    std::atomic<int> numTicks;
+    std::atomic<int> missedDeadlines;
+
+    // Set by ResetStats() for the thread recording ticks to clear the statistics, so only that thread writes them
+    std::atomic<bool> resetRequested;
+
+    // Start of the first and most recent tick, for the achieved rate
+    std::atomic<int64_t> firstTickStart;
+    std::atomic<int64_t> lastTickStart;
+    std::atomic<int64_t> lastPeriod;
+
+    // Clear the statistics, on the thread recording ticks once it has started
+    void ClearStats();
+
+    // Thread function
+    void Run();
+
+    // Apply real-time options to the calling thread
+    void ConfigureThread();
+};
+
+
+#endif
@@ -0,0 +1,67 @@
+/*=========================================================================
+
+  Name:        SharedLibrary.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Shared library loaded into this process at run time.
+
+=========================================================================*/
+
+
+#include "SharedLibrary.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+
+SharedLibrary::SharedLibrary() : handle(nullptr) {
+}
+
+SharedLibrary::~SharedLibrary() {
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool SharedLibrary::Open(const char* fileName) {
+    Close();
+
+    handle = LoadLibraryA(fileName);
+    return handle != nullptr;
+}
+
+void SharedLibrary::Close() {
+    if (handle) FreeLibrary((HMODULE)handle);
+    handle = nullptr;
+}
+
+void* SharedLibrary::Symbol(const char* name) {
+    return handle ? (void*)GetProcAddress((HMODULE)handle, name) : nullptr;
+}
+
+#else
+
+bool SharedLibrary::Open(const char* fileName) {
+    Close();
+
+    // Resolve everything now, so a missing symbol fails here rather than in the servo loop
+    handle = dlopen(fileName, RTLD_NOW | RTLD_LOCAL);
+    return handle != nullptr;
+}
+
+void SharedLibrary::Close() {
+    if (handle) dlclose(handle);
+    handle = nullptr;
+}
+
+void* SharedLibrary::Symbol(const char* name) {
+    return handle ? dlsym(handle, name) : nullptr;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*=========================================================================
+
+  Name:        SharedLibrary.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Shared library loaded into this process at run time.
+
+=========================================================================*/
+
+
+#ifndef SHAREDLIBRARY_H
+#define SHAREDLIBRARY_H
+
+
+class SharedLibrary {
+public:
+    SharedLibrary();
+    ~SharedLibrary();
+
+    // Load a library, by path or by name from the system's search path
+    bool Open(const char* fileName);
+    void Close();
+
+    // Address of an exported symbol, or nullptr
+    void* Symbol(const char* name);
+
+protected:
+    void* handle;
+};
+
+
+#endif
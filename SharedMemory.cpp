@@ -0,0 +1,185 @@
+/*=========================================================================
+
+  Name:        SharedMemory.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Named shared memory region mapped into this process. Uses
+               a named file mapping on Windows and POSIX shared memory
+               elsewhere.
+
+=========================================================================*/
+
+
+#include "SharedMemory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+
+SharedMemory::SharedMemory() : data(nullptr), size(0), created(false) {
+#if defined(_WIN32)
+    handle = nullptr;
+#else
+    fd = -1;
+#endif
+}
+
+SharedMemory::~SharedMemory() {
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool SharedMemory::Create(const char* regionName, size_t regionSize) {
+    Close();
+
+    // Windows removes the mapping when the last handle closes, so nothing can be left over
+    handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                (DWORD)((unsigned long long)regionSize >> 32), (DWORD)regionSize, regionName);
+    if (!handle) return false;
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        // Another server is running
+        CloseHandle(handle);
+        handle = nullptr;
+        return false;
+    }
+
+    data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, regionSize);
+    if (!data) {
+        Close();
+        return false;
+    }
+
+    // New mappings are zeroed; touch the pages now so neither side faults on them later
+    memset(data, 0, regionSize);
+
+    name = regionName;
+    size = regionSize;
+    created = true;
+
+    return true;
+}
+
+bool SharedMemory::Open(const char* regionName, size_t regionSize) {
+    Close();
+
+    handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, regionName);
+    if (!handle) return false;
+
+    data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, regionSize);
+    if (!data) {
+        Close();
+        return false;
+    }
+
+    name = regionName;
+    size = regionSize;
+
+    return true;
+}
+
+void SharedMemory::Close() {
+    if (data) UnmapViewOfFile(data);
+    if (handle) CloseHandle(handle);
+
+    data = nullptr;
+    handle = nullptr;
+    size = 0;
+    created = false;
+}
+
+#else
+
+bool SharedMemory::Create(const char* regionName, size_t regionSize) {
+    Close();
+
+    // POSIX names start with a slash
+    std::string posixName = std::string("/") + regionName;
+
+    shm_unlink(posixName.c_str());
+    fd = shm_open(posixName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return false;
+
+    if (ftruncate(fd, regionSize) != 0) {
+        shm_unlink(posixName.c_str());
+        Close();
+        return false;
+    }
+
+    data = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        shm_unlink(posixName.c_str());
+        Close();
+        return false;
+    }
+
+    // New regions are zeroed; touch the pages now so neither side faults on them later
+    memset(data, 0, regionSize);
+
+    name = posixName;
+    size = regionSize;
+    created = true;
+
+    return true;
+}
+
+bool SharedMemory::Open(const char* regionName, size_t regionSize) {
+    Close();
+
+    std::string posixName = std::string("/") + regionName;
+
+    fd = shm_open(posixName.c_str(), O_RDWR, 0600);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < regionSize) {
+        Close();
+        return false;
+    }
+
+    data = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        Close();
+        return false;
+    }
+
+    name = posixName;
+    size = regionSize;
+
+    return true;
+}
+
+void SharedMemory::Close() {
+    if (data) munmap(data, size);
+    if (fd >= 0) close(fd);
+    if (created) shm_unlink(name.c_str());
+
+    data = nullptr;
+    fd = -1;
+    size = 0;
+    created = false;
+}
+
+#endif
+
+void* SharedMemory::Data() {
+    return data;
+}
+
+size_t SharedMemory::Size() {
+    return size;
+}
@@ -0,0 +1,55 @@
+/*=========================================================================
+
+  Name:        SharedMemory.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Named shared memory region mapped into this process. Uses
+               a named file mapping on Windows and POSIX shared memory
+               elsewhere.
+
+=========================================================================*/
+
+
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+
+#include <cstddef>
+#include <string>
+
+
+class SharedMemory {
+public:
+    SharedMemory();
+    ~SharedMemory();
+
+    // Create a zeroed region with the given name, replacing any left over from a process that exited without closing it
+    bool Create(const char* name, size_t size);
+
+    // Map an existing region. Fails if it doesn't exist or is smaller than size.
+    bool Open(const char* name, size_t size);
+
+    // Unmap the region, removing the name if this process created it
+    void Close();
+
+    void* Data();
+    size_t Size();
+
+protected:
+    std::string name;
+    void* data;
+    size_t size;
+    bool created;
+
+#if defined(_WIN32)
+    void* handle;
+#else
+    int fd;
+#endif
+};
+
+
+#endif
@@ -0,0 +1,118 @@
+/*=========================================================================
+
+  Name:        SimulatedDevice.cpp
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Simulated Falcon for running without hardware.
+
+=========================================================================*/
+
+
+#include "SimulatedDevice.h"
+
+
+namespace {
+    // Roughly the Falcon's workspace, in meters
+    const double workspaceExtent = 0.06;
+
+    // Roughly the Falcon's maximum force, in Newtons
+    const double maxForce = 9.0;
+}
+
+
+SimulatedDevice::SimulatedDevice() {
+    for (int i = 0; i < 3; i++) {
+        handPos[i] = 0.0;
+        publishedPos[i] = 0.0;
+        pos[i] = 0.0;
+        vel[i] = 0.0;
+    }
+
+    buttons = 0;
+
+    // A relaxed grip on a light end effector
+    handK = 200.0;
+    handC = 5.0;
+    mass = 0.1;
+}
+
+bool SimulatedDevice::Open() {
+    for (int i = 0; i < 3; i++) {
+        pos[i] = handPos[i];
+        vel[i] = 0.0;
+        publishedPos[i] = pos[i];
+    }
+
+    return true;
+}
+
+void SimulatedDevice::Close() {
+}
+
+void SimulatedDevice::GetWorkspace(double workspace[6]) {
+    for (int i = 0; i < 3; i++) {
+        workspace[i] = -workspaceExtent;
+        workspace[i + 3] = workspaceExtent;
+    }
+}
+
+bool SimulatedDevice::StartServo(void (*tick)(void*), void* userData, ServoThread& servoThread) {
+    return servoThread.Start(tick, userData);
+}
+
+void SimulatedDevice::StopServo(ServoThread& servoThread) {
+    servoThread.Stop();
+}
+
+void SimulatedDevice::GetPosition(double p[3]) {
+    for (int i = 0; i < 3; i++) {
+        p[i] = publishedPos[i].load(std::memory_order_relaxed);
+    }
+}
+
+int SimulatedDevice::GetButtons() {
+    return buttons.load(std::memory_order_relaxed);
+}
+
+void SimulatedDevice::SetForce(const double f[3], double dt) {
+    // Guard against the first tick and long stalls
+    if (dt <= 0.0 || dt > 0.01) dt = 0.001;
+
+    double k = handK.load(std::memory_order_relaxed);
+    double c = handC.load(std::memory_order_relaxed);
+    double m = mass.load(std::memory_order_relaxed);
+
+    // Semi-implicit Euler
+    for (int i = 0; i < 3; i++) {
+        double fi = f[i] > maxForce ? maxForce : f[i] < -maxForce ? -maxForce : f[i];
+        double a = (fi + k * (handPos[i].load(std::memory_order_relaxed) - pos[i]) - c * vel[i]) / m;
+
+        vel[i] += a * dt;
+        pos[i] += vel[i] * dt;
+
+        // Mechanical limits
+        if (pos[i] < -workspaceExtent) { pos[i] = -workspaceExtent; vel[i] = 0.0; }
+        if (pos[i] > workspaceExtent) { pos[i] = workspaceExtent; vel[i] = 0.0; }
+
+        publishedPos[i].store(pos[i], std::memory_order_relaxed);
+    }
+}
+
+void SimulatedDevice::SetHandPosition(const double p[3]) {
+    for (int i = 0; i < 3; i++) {
+        handPos[i].store(p[i], std::memory_order_relaxed);
+    }
+}
+
+void SimulatedDevice::SetButtons(int b) {
+    buttons = b;
+}
+
+void SimulatedDevice::SetHandParameters(double k, double c, double m) {
+    handK = k;
+    handC = c;
+    mass = m;
+}
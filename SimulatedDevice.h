@@ -0,0 +1,73 @@
+/*=========================================================================
+
+  Name:        SimulatedDevice.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Simulated Falcon for running without hardware. The end
+               effector is a point mass held by a spring-damper "hand"
+               whose target position is set by the application, and is
+               pushed by the force written each servo tick. Safe to drive
+               from the application thread while the servo thread runs.
+
+=========================================================================*/
+
+
+#ifndef SIMULATEDDEVICE_H
+#define SIMULATEDDEVICE_H
+
+
+#include <atomic>
+
+#include "ServoThread.h"
+
+
+class SimulatedDevice {
+public:
+    SimulatedDevice();
+
+    // Open and close the device
+    bool Open();
+    void Close();
+
+    // Device workspace as (minx, miny, minz, maxx, maxy, maxz), in meters
+    void GetWorkspace(double workspace[6]);
+
+    // Run tick(userData) from servoThread
+    bool StartServo(void (*tick)(void*), void* userData, ServoThread& servoThread);
+    void StopServo(ServoThread& servoThread);
+
+    // Servo thread: device state
+    void GetPosition(double p[3]);
+    int GetButtons();
+
+    // Servo thread: apply a force for the time step dt, advancing the simulation
+    void SetForce(const double f[3], double dt);
+
+    // Application thread: hand target position and buttons
+    void SetHandPosition(const double p[3]);
+    void SetButtons(int buttons);
+
+    // Application thread: hand stiffness and damping, and end effector mass
+    void SetHandParameters(double k, double c, double mass);
+
+protected:
+    // Hand, set from the application thread
+    std::atomic<double> handPos[3];
+    std::atomic<int> buttons;
+    std::atomic<double> handK;
+    std::atomic<double> handC;
+    std::atomic<double> mass;
+
+    // End effector, only touched by the servo thread
+    double pos[3];
+    double vel[3];
+
+    // Published end effector position for reading from other threads
+    std::atomic<double> publishedPos[3];
+};
+
+
+#endif
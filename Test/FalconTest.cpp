@@ -1,26 +1,844 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "Falcon.h"
+#include "ServoCheck.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+// Falcon with access to what the harness needs from the servo side
+class TestFalcon : public Falcon {
+public:
+	// Last force published by the servo thread, in device space (N)
+	void GetDeviceForce(double f[3]) {
+		DeviceState state;
+		ReadState(state);
+
+		for (int i = 0; i < 3; i++) {
+			f[i] = state.force[i];
+		}
+	}
+
+	// Device workspace center and half extent, in meters
+	void GetDeviceWorkspace(double center[3], double extent[3]) {
+		for (int i = 0; i < 3; i++) {
+			center[i] = (workspace[i] + workspace[i + 3]) / 2.0;
+			extent[i] = fabs(workspace[i + 3] - workspace[i]) / 2.0;
+		}
+	}
+
+	// Run the passivity observer and controller on a force about to be sent, as the servo loop does each tick
+	void ControlPassivity(double f[3], const double displacement[3], const double velocity[3], double dt) {
+		ApplyPassivityControl(f, displacement, velocity, dt);
+		for (int i = 0; i < 3; i++) {
+			sentForce[i] = f[i];
+		}
+	}
+
+	// Move the simulated user's hand. A real device is moved by its user instead.
+	void SetHandPosition(const double p[3]) {
+#ifdef FALCON_SIMULATED_DEVICE
+		device.SetHandPosition(p);
+#endif
+	}
+};
+
+
+// Pass/fail thresholds for each checked phase
+struct Thresholds {
+	// Whether to check timing. Timing only means something on a real-time setup, so by default it is only checked
+	// with -realtime, or when a timing threshold is given.
+	bool checkTiming;
+
+	// Servo tick latency and tick time, in microseconds
+	float p99Latency;
+	float p999TickTime;
+
+	// Missed deadlines per phase
+	int missedDeadlines;
+
+	// Largest change in device force between consecutive ticks, in Newtons
+	float forceJump;
+};
+
+// Results of one phase
+struct PhaseResult {
+	std::string name;
+	double duration;
+	long long operations;
+	ServoStats stats;
+	double forceJump;
+	bool checkForce;
+	bool passed;
+};
+
+
+// Default scenario, used when no script is given. One command per line:
+//   springs <n> <k>            Add n springs at random positions
+//   surfaces <n> <k>           Add n surfaces below the workspace
+//   intermolecular <n> <k>     Add n intermolecular forces far from the probe, which exert no force
+//   viscosity <c>              Add a viscosity
+//   idle <seconds>             Let the servo loop run
+//   storm <seconds>            Update every effect with its own parameters as fast as possible
+//   churn <seconds>            Remove and re-add the intermolecular forces as fast as possible
+//   workspace <seconds>        Set the same graphics workspace as fast as possible
+//   reset                      Remove all effects
+// Phases that can't change the force (idle, storm, churn, workspace) are checked for force continuity.
+const char* defaultScript =
+	"springs 200 0.05\n"
+	"surfaces 20 5\n"
+	"intermolecular 500 1\n"
+	"viscosity 0.01\n"
+	"idle 1\n"
+	"storm 3\n"
+	"churn 3\n"
+	"workspace 3\n"
+	"idle 1\n";
+
+
+class StressHarness {
+public:
+	StressHarness(TestFalcon* falcon, const Thresholds& thresholds)
+		: falcon(falcon), thresholds(thresholds), random(1), running(false), sampling(false), forceJump(0.0) {
+		center.x = center.y = center.z = 0.0f;
+		size.x = size.y = size.z = 10.0f;
+	}
+
+	// Run the scenario, printing a line per phase. Returns true if every checked phase passed.
+	bool Run(const std::string& script) {
+		falcon->SetGraphicsWorkspace(center, size);
+
+		// Move the hand and sample the force for the whole run
+		running = true;
+		std::thread hand(&StressHarness::MoveHand, this);
+		std::thread sampler(&StressHarness::SampleForce, this);
+
+		if (!thresholds.checkTiming) {
+			printf("Timing is reported but not checked without -realtime\n");
+		}
+
+		printf("%-16s %8s %10s %8s %7s %9s %9s %9s %9s %10s %s\n",
+			"phase", "time(s)", "ops/s", "ticks", "missed", "p99lat", "maxlat", "p999tick", "maxtick", "jump(N)", "result");
+
+		bool passed = true;
+		std::istringstream lines(script);
+		std::string line;
+
+		while (std::getline(lines, line)) {
+			std::istringstream words(line);
+			std::string command;
+			if (!(words >> command) || command[0] == '#') continue;
+
+			double a = 0.0, b = 0.0;
+			words >> a >> b;
+
+			if (command == "springs") AddSprings((int)a, (float)b);
+			else if (command == "surfaces") AddSurfaces((int)a, (float)b);
+			else if (command == "intermolecular") AddIntermolecularForces((int)a, (float)b);
+			else if (command == "viscosity") falcon->AddViscosity((float)a);
+			else if (command == "reset") {
+				falcon->ResetForces();
+				springs.clear();
+				surfaces.clear();
+				intermolecularForces.clear();
+			}
+			else if (command == "idle" || command == "storm" || command == "churn" || command == "workspace") {
+				PhaseResult result = RunPhase(command, a);
+				Print(result);
+				passed = passed && result.passed;
+			}
+			else {
+				printf("Unknown command: %s\n", line.c_str());
+				passed = false;
+			}
+		}
+
+		running = false;
+		hand.join();
+		sampler.join();
+
+		printf("%s\n", passed ? "PASS" : "FAIL");
+
+		return passed;
+	}
+
+protected:
+	struct SpringEffect {
+		int id;
+		Vector3 p;
+		float k;
+	};
+
+	struct SurfaceEffect {
+		int id;
+		Vector3 p;
+		Vector3 n;
+		float k;
+	};
+
+	TestFalcon* falcon;
+	Thresholds thresholds;
+	std::mt19937 random;
+
+	Vector3 center;
+	Vector3 size;
+
+	std::vector<SpringEffect> springs;
+	std::vector<SurfaceEffect> surfaces;
+	std::vector<SpringEffect> intermolecularForces;
+
+	std::atomic<bool> running;
+
+	// Force sampling, reset at the start of each phase
+	std::atomic<bool> sampling;
+	std::atomic<double> forceJump;
+
+
+	float Uniform(float min, float max) {
+		return std::uniform_real_distribution<float>(min, max)(random);
+	}
+
+	void AddSprings(int n, float k) {
+		for (int i = 0; i < n; i++) {
+			SpringEffect s;
+			s.p.x = Uniform(-2.0f, 2.0f);
+			s.p.y = Uniform(-2.0f, 2.0f);
+			s.p.z = Uniform(-2.0f, 2.0f);
+			s.k = k;
+			s.id = falcon->AddSpring(s.p, s.k, 0.0f);
+			springs.push_back(s);
+		}
+	}
+
+	void AddSurfaces(int n, float k) {
+		for (int i = 0; i < n; i++) {
+			SurfaceEffect s;
+			s.p.x = s.p.z = 0.0f;
+			s.p.y = -size.y;
+			s.n.x = Uniform(-0.1f, 0.1f);
+			s.n.y = 1.0f;
+			s.n.z = Uniform(-0.1f, 0.1f);
+			s.k = k;
+			s.id = falcon->AddSurface(s.p, s.n, s.k, 0.0f);
+			surfaces.push_back(s);
+		}
+	}
+
+	void AddIntermolecularForces(int n, float k) {
+		for (int i = 0; i < n; i++) {
+			intermolecularForces.push_back(AddFarIntermolecularForce(k));
+		}
+	}
+
+	// Intermolecular force beyond its maximum length from anywhere in the workspace
+	SpringEffect AddFarIntermolecularForce(float k) {
+		SpringEffect s;
+		s.p.x = Uniform(10.0f * size.x, 20.0f * size.x);
+		s.p.y = Uniform(-size.y, size.y);
+		s.p.z = Uniform(-size.z, size.z);
+		s.k = k;
+		s.id = falcon->AddIntermolecularForce(s.p, s.k, 0.0f, 0.1f, 0.2f);
+		return s;
+	}
+
+	PhaseResult RunPhase(const std::string& name, double duration) {
+		PhaseResult result;
+		result.name = name;
+		result.operations = 0;
+		result.checkForce = true;
+
+		// Let the servo thread take effects added since the last phase
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+		falcon->ResetServoStats();
+		forceJump = 0.0;
+		sampling = true;
+
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::microseconds((long long)(duration * 1e6));
 
-#include <hdlu/hdlu.h>
+		while (std::chrono::steady_clock::now() < end) {
+			if (name == "idle") {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			else if (name == "storm") {
+				for (size_t i = 0; i < springs.size(); i++) {
+					falcon->UpdateSpring(springs[i].id, springs[i].p, springs[i].k, 0.0f);
+				}
+				for (size_t i = 0; i < surfaces.size(); i++) {
+					falcon->UpdateSurface(surfaces[i].id, surfaces[i].p, surfaces[i].n, surfaces[i].k, 0.0f);
+				}
+				for (size_t i = 0; i < intermolecularForces.size(); i++) {
+					SpringEffect& s = intermolecularForces[i];
+					falcon->UpdateIntermolecularForce(s.id, s.p, s.k, 0.0f, 0.1f, 0.2f);
+				}
+				result.operations += springs.size() + surfaces.size() + intermolecularForces.size();
+			}
+			else if (name == "churn") {
+				if (intermolecularForces.empty()) break;
 
-double pos[3];
-double force[3];
+				int i = std::uniform_int_distribution<int>(0, (int)intermolecularForces.size() - 1)(random);
+				falcon->RemoveIntermolecularForce(intermolecularForces[i].id);
+				intermolecularForces[i] = AddFarIntermolecularForce(intermolecularForces[i].k);
+				result.operations += 2;
+			}
+			else if (name == "workspace") {
+				falcon->SetGraphicsWorkspace(center, size);
+				result.operations++;
+			}
+		}
 
-// On-demand servo callback function
-HDLServoOpExitCode PosCB(void* userData) {
-    hdlToolPosition(pos);
-    return HDL_SERVOOP_EXIT;
+		sampling = false;
+		result.duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.stats = falcon->GetServoStats();
+		result.forceJump = forceJump;
+
+		bool timingPassed =
+			result.stats.p99Latency <= thresholds.p99Latency &&
+			result.stats.p999TickTime <= thresholds.p999TickTime &&
+			result.stats.missedDeadlines <= thresholds.missedDeadlines;
+
+		result.passed =
+			(!thresholds.checkTiming || timingPassed) &&
+			(!result.checkForce || result.forceJump <= thresholds.forceJump);
+
+		return result;
+	}
+
+	void Print(const PhaseResult& r) {
+		printf("%-16s %8.2f %10.0f %8d %7d %9.1f %9.1f %9.1f %9.1f %10.4f %s\n",
+			r.name.c_str(), r.duration, r.operations / r.duration, r.stats.ticks, r.stats.missedDeadlines,
+			r.stats.p99Latency, r.stats.maxLatency, r.stats.p999TickTime, r.stats.maxTickTime, r.forceJump,
+			r.passed ? "pass" : "FAIL");
+	}
+
+	// Simulated user: move the hand slowly around a circle in the device workspace
+	void MoveHand() {
+		double c[3], extent[3];
+		falcon->GetDeviceWorkspace(c, extent);
+
+		auto start = std::chrono::steady_clock::now();
+		while (running) {
+			double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double a = 2.0 * 3.14159265358979 * 0.5 * t;
+
+			double p[3];
+			p[0] = c[0] + 0.3 * extent[0] * cos(a);
+			p[1] = c[1] + 0.3 * extent[1] * sin(a);
+			p[2] = c[2];
+			falcon->SetHandPosition(p);
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// Track the largest change in force between consecutive ticks
+	void SampleForce() {
+		double last[3];
+		falcon->GetDeviceForce(last);
+
+		while (running) {
+			double f[3];
+			falcon->GetDeviceForce(f);
+
+			if (f[0] != last[0] || f[1] != last[1] || f[2] != last[2]) {
+				double d[3] = { f[0] - last[0], f[1] - last[1], f[2] - last[2] };
+				double jump = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+				if (sampling && jump > forceJump) {
+					forceJump = jump;
+				}
+
+				last[0] = f[0];
+				last[1] = f[1];
+				last[2] = f[2];
+			}
+
+			// Several samples per tick, without taking a core from the servo thread
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+};
+
+
+// Native kernels for the benchmark, with the same parameters as the expressions
+void SpringKernel(void*, const FalconKernelProbe* probe, const FalconKernelBatch* batch) {
+	const double* p = probe->position;
+	const double* v = probe->velocity;
+	for (int i = 0; i < batch->count; i++) {
+		double dx = p[0] - batch->parameters[0][i];
+		double dy = p[1] - batch->parameters[1][i];
+		double dz = p[2] - batch->parameters[2][i];
+		double d = sqrt(dx * dx + dy * dy + dz * dz);
+		double s = d > 0.0 ? -batch->parameters[3][i] * (d - batch->parameters[5][i]) / d : 0.0;
+		double c = batch->parameters[4][i];
+		batch->force[0][i] = s * dx - c * v[0];
+		batch->force[1][i] = s * dy - c * v[1];
+		batch->force[2][i] = s * dz - c * v[2];
+	}
+}
+
+void SurfaceKernel(void*, const FalconKernelProbe* probe, const FalconKernelBatch* batch) {
+	const double* p = probe->position;
+	const double* v = probe->velocity;
+	for (int i = 0; i < batch->count; i++) {
+		double d = (p[0] - batch->parameters[0][i]) * batch->parameters[3][i] +
+		           (p[1] - batch->parameters[1][i]) * batch->parameters[4][i] +
+		           (p[2] - batch->parameters[2][i]) * batch->parameters[5][i];
+		double s = d < 0.0 ? -d * batch->parameters[6][i] : 0.0;
+		double c = d < 0.0 ? batch->parameters[7][i] : 0.0;
+		for (int j = 0; j < 3; j++) {
+			batch->force[j][i] = s * batch->parameters[3 + j][i] - c * v[j];
+		}
+	}
 }
 
-// On-demand servo callback function
-HDLServoOpExitCode ForCB(void* userData) {
-    hdlSetToolForce(force);
-    return HDL_SERVOOP_EXIT;
+// Built in effects timed against expressions and native kernels giving the same force, with parameters u0 to u7 as
+// listed for each
+struct BenchmarkKernel {
+	const char* name;
+	int type;
+	const char* expression;
+	FalconKernelFunction compute;
+};
+
+const BenchmarkKernel benchmarkKernels[] = {
+	// Position, k, c, rest length
+	{ "spring", SpringEffect,
+		"dx = px - u0; dy = py - u1; dz = pz - u2\n"
+		"d = sqrt(dx * dx + dy * dy + dz * dz)\n"
+		"s = -u3 * (d - u5) / d\n"
+		"fx = s * dx - u4 * vx; fy = s * dy - u4 * vy; fz = s * dz - u4 * vz",
+		SpringKernel },
+
+	// Position, normal, k, c
+	{ "surface", SurfaceEffect,
+		"d = (px - u0) * u3 + (py - u1) * u4 + (pz - u2) * u5\n"
+		"s = if(d < 0, -d * u6, 0); c = if(d < 0, u7, 0)\n"
+		"fx = s * u3 - c * vx; fy = s * u4 - c * vy; fz = s * u5 - c * vz",
+		SurfaceKernel }
+};
+
+// Time per effect of one type, in nanoseconds, after letting the servo thread take the effects
+double TimeEffects(TestFalcon* falcon, int type, double duration) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	falcon->ResetTelemetry();
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)(duration * 1e6)));
+
+	EffectTelemetry t = falcon->GetEffectTelemetry(type);
+	return t.evaluated > 0 ? t.meanTime * 1e3 / t.evaluated : 0.0;
+}
+
+// Print the servo loop time per effect of each built in kernel, its expression and its native kernel
+void RunBenchmark(TestFalcon* falcon, int count, double duration) {
+	Vector3 center;
+	center.x = center.y = center.z = 0.0f;
+
+	Vector3 size;
+	size.x = size.y = size.z = 10.0f;
+
+	falcon->SetGraphicsWorkspace(center, size);
+	falcon->SetTelemetry(true);
+
+	// Hold the hand still, below the surfaces
+	double c[3], extent[3];
+	falcon->GetDeviceWorkspace(c, extent);
+	falcon->SetHandPosition(c);
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> uniform(-2.0f, 2.0f);
+
+	printf("%d effects, %.1f s each\n", count, duration);
+	printf("%-10s %14s %16s %12s %8s\n", "kernel", "built in(ns)", "expression(ns)", "native(ns)", "ratio");
+
+	for (size_t i = 0; i < sizeof(benchmarkKernels) / sizeof(benchmarkKernels[0]); i++) {
+		const BenchmarkKernel& kernel = benchmarkKernels[i];
+
+		std::vector<std::vector<float> > parameters;
+		for (int j = 0; j < count; j++) {
+			std::vector<float> u;
+			if (kernel.type == SpringEffect) {
+				Vector3 p = { uniform(random), uniform(random), uniform(random) };
+				float u0[] = { p.x, p.y, p.z, 0.001f, 0.0001f, 0.0f };
+				u.assign(u0, u0 + 6);
+				falcon->AddSpring(p, u0[3], u0[4]);
+			}
+			else {
+				Vector3 p = { 0.0f, size.y, 0.0f };
+				Vector3 n = { 0.0f, 1.0f, 0.0f };
+				float u0[] = { p.x, p.y, p.z, n.x, n.y, n.z, 0.001f, 0.0001f };
+				u.assign(u0, u0 + 8);
+				falcon->AddSurface(p, n, u0[6], u0[7]);
+			}
+			parameters.push_back(u);
+		}
+
+		double builtIn = TimeEffects(falcon, kernel.type, duration);
+		falcon->ResetForces();
+
+		for (int j = 0; j < count; j++) {
+			int id = falcon->AddExpressionForce(kernel.expression);
+			falcon->SetExpressionParameters(id, &parameters[j][0], (int)parameters[j].size());
+		}
+
+		double expression = TimeEffects(falcon, ExpressionForceEffect, duration);
+		falcon->ResetForces();
+
+		int id = falcon->FindKernel(kernel.name);
+		if (id < 0) {
+			FalconKernel k = { kernel.name, numExpressionParameters, kernel.compute, NULL };
+			id = falcon->RegisterKernel(k);
+		}
+
+		for (int j = 0; j < count; j++) {
+			falcon->AddKernelForce(id, &parameters[j][0], (int)parameters[j].size());
+		}
+
+		double native = TimeEffects(falcon, KernelForceEffect, duration);
+		falcon->ResetForces();
+
+		printf("%-10s %14.1f %16.1f %12.1f %8.2f\n", kernel.name, builtIn, expression, native, builtIn > 0.0 ? expression / builtIn : 0.0);
+	}
+}
+
+// Print the time to evaluate a 64^3 grid of points with force queries, on one thread and on the default workers
+void RunQueryBenchmark(TestFalcon* falcon, int count) {
+	Vector3 center;
+	center.x = center.y = center.z = 0.0f;
+
+	Vector3 size;
+	size.x = size.y = size.z = 10.0f;
+
+	falcon->SetGraphicsWorkspace(center, size);
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> uniform(-4.0f, 4.0f);
+
+	// Springs, surfaces and radial forces, the types evaluated across points together
+	float profile[] = { 4.0f, 2.0f, 1.0f, 0.5f, 0.0f };
+	int radialProfile = falcon->AddRadialProfile(profile, 5, 2.0f, true);
+
+	for (int i = 0; i < count; i++) {
+		Vector3 p = { uniform(random), uniform(random), uniform(random) };
+		Vector3 n = { 0.0f, 1.0f, 0.0f };
+
+		falcon->AddSpring(p, 0.01f, 0.0f, 0.5f, 3.0f);
+		falcon->AddSurface(p, n, 0.01f, 0.0f);
+		falcon->AddRadialForce(p, radialProfile, 0.1f, 0.0f);
+	}
+
+	const int side = 64;
+	std::vector<Vector3> points(side * side * side);
+	std::vector<Vector3> forces(points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		points[i].x = -5.0f + 10.0f * (i % side) / (side - 1);
+		points[i].y = -5.0f + 10.0f * (i / side % side) / (side - 1);
+		points[i].z = -5.0f + 10.0f * (i / (side * side)) / (side - 1);
+	}
+
+	printf("%d springs, surfaces and radial forces, %d points\n", count, (int)points.size());
+	printf("%-10s %10s %14s\n", "threads", "time(ms)", "points/s");
+
+	int threads[] = { 1, 0 };
+	for (int i = 0; i < 2; i++) {
+		const int repeats = 3;
+		auto start = std::chrono::steady_clock::now();
+		for (int j = 0; j < repeats; j++) {
+			falcon->EvaluateForces(&points[0], &forces[0], (int)points.size(), threads[i]);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+		printf("%-10s %10.1f %14.0f\n", threads[i] > 0 ? "1" : "default", seconds * 1e3, points.size() / seconds);
+	}
+
+	falcon->ResetForces();
+}
+
+// Print the servo loop time per tick of surfaces and springs with probes of increasing numbers of points
+void RunProbeBenchmark(TestFalcon* falcon, int count, double duration) {
+	Vector3 center;
+	center.x = center.y = center.z = 0.0f;
+
+	Vector3 size;
+	size.x = size.y = size.z = 10.0f;
+
+	falcon->SetGraphicsWorkspace(center, size);
+	falcon->SetTelemetry(true);
+
+	// Hold the hand still at the center of the workspace
+	double c[3], extent[3];
+	falcon->GetDeviceWorkspace(c, extent);
+	falcon->SetHandPosition(c);
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> uniform(-2.0f, 2.0f);
+
+	// Surfaces through the center, so some of the points touch each one
+	for (int i = 0; i < count; i++) {
+		Vector3 p = { 0.0f, 0.0f, 0.0f };
+		Vector3 n = { uniform(random), uniform(random), uniform(random) };
+		Vector3 s = { uniform(random), uniform(random), uniform(random) };
+
+		falcon->AddSurface(p, n, 0.001f, 0.0001f);
+		falcon->AddSpring(s, 0.001f, 0.0001f);
+	}
+
+	printf("%d surfaces and springs, %.1f s each\n", count, duration);
+	printf("%-8s %14s %14s\n", "points", "surfaces(us)", "springs(us)");
+
+	int numPoints[] = { 0, 1, 8, 16, 32, maxProbePoints };
+	for (size_t i = 0; i < sizeof(numPoints) / sizeof(numPoints[0]); i++) {
+		// Spheres along a shaft
+		std::vector<Vector3> offsets(maxProbePoints);
+		std::vector<float> radii(maxProbePoints);
+		for (int j = 0; j < numPoints[i]; j++) {
+			offsets[j].x = 0.0f;
+			offsets[j].y = 2.0f * j / maxProbePoints;
+			offsets[j].z = 0.0f;
+			radii[j] = 0.05f;
+		}
+		falcon->SetProbePoints(&offsets[0], &radii[0], numPoints[i]);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		falcon->ResetTelemetry();
+		std::this_thread::sleep_for(std::chrono::microseconds((long long)(duration * 1e6)));
+
+		EffectTelemetry surfaces = falcon->GetEffectTelemetry(SurfaceEffect);
+		EffectTelemetry springs = falcon->GetEffectTelemetry(SpringEffect);
+
+		printf("%-8d %14.1f %14.1f\n", numPoints[i], surfaces.meanTime, springs.meanTime);
+	}
+
+	falcon->SetProbePoints(NULL, NULL, 0);
+	falcon->ResetForces();
+}
+
+// Check that effects act as they would in graphics space when the graphics workspace has other proportions than the
+// device's, holding the probe at a proxy position so the published force is exact, and that force queries agree
+bool RunWorkspaceTest(TestFalcon* falcon) {
+	Vector3 center = { 0.0f, 0.0f, 0.0f };
+	Vector3 size = { 4.0f, 2.0f, 2.0f };
+	falcon->SetGraphicsWorkspace(center, size);
+	falcon->UseForceFeedback(false);
+
+	enum { Simple, Spring, Surface };
+
+	struct Case {
+		const char* name;
+		int type;
+		Vector3 p;
+		Vector3 n;
+		Vector3 probe;
+		Vector3 expected;
+	};
+
+	const float k = 2.0f;
+	const float diagonal = 0.70710678f;
+
+	Case cases[] = {
+		{ "simple force", Simple, { 1.0f, 2.0f, 3.0f }, {}, { 0.0f, 0.0f, 0.0f }, { 1.0f, 2.0f, 3.0f } },
+		{ "spring along x", Spring, { 0.0f, 0.0f, 0.0f }, {}, { 0.5f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f } },
+		{ "spring along y", Spring, { 0.0f, 0.0f, 0.0f }, {}, { 0.0f, 0.5f, 0.0f }, { 0.0f, -1.0f, 0.0f } },
+		{ "spring along z", Spring, { 0.0f, 0.0f, 0.0f }, {}, { 0.0f, 0.0f, 0.5f }, { 0.0f, 0.0f, -1.0f } },
+		{ "surface along x", Surface, { 0.3f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.2f, 0.0f, 0.0f }, { 0.2f, 0.0f, 0.0f } },
+		{ "surface along y", Surface, { 0.0f, 0.3f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.2f, 0.0f }, { 0.0f, 0.2f, 0.0f } },
+		{ "diagonal surface", Surface, { 0.0f, 0.0f, 0.0f }, { diagonal, diagonal, 0.0f }, { -0.1f, -0.1f, 0.0f }, { 0.2f, 0.2f, 0.0f } }
+	};
+
+	printf("Graphics workspace %.0f x %.0f x %.0f\n", size.x, size.y, size.z);
+	printf("%-20s %-30s %-30s %-30s %s\n", "effect", "force", "query", "expected", "result");
+
+	bool passed = true;
+	for (const Case& c : cases) {
+		falcon->ResetForces();
+		falcon->SetProxyPosition(c.probe);
+
+		if (c.type == Simple) falcon->AddSimpleForce(c.p);
+		else if (c.type == Spring) falcon->AddSpring(c.p, k, 0.0f);
+		else falcon->AddSurface(c.p, c.n, k, 0.0f);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+		Vector3 f = falcon->GetForce();
+		Vector3 q;
+		falcon->EvaluateForces(&c.probe, &q, 1, 1);
+
+		float error = std::max(fabs(f.x - c.expected.x), std::max(fabs(f.y - c.expected.y), fabs(f.z - c.expected.z)));
+		float queryError = std::max(fabs(q.x - c.expected.x), std::max(fabs(q.y - c.expected.y), fabs(q.z - c.expected.z)));
+		bool ok = error < 1e-3f && queryError < 1e-3f;
+
+		char force[64], query[64], expected[64];
+		snprintf(force, sizeof(force), "(%.4f, %.4f, %.4f)", f.x, f.y, f.z);
+		snprintf(query, sizeof(query), "(%.4f, %.4f, %.4f)", q.x, q.y, q.z);
+		snprintf(expected, sizeof(expected), "(%.4f, %.4f, %.4f)", c.expected.x, c.expected.y, c.expected.z);
+		printf("%-20s %-30s %-30s %-30s %s\n", c.name, force, query, expected, ok ? "pass" : "FAIL");
+
+		passed = passed && ok;
+	}
+
+	printf("%s\n", passed ? "PASS" : "FAIL");
+
+	falcon->ResetForces();
+	falcon->UseForceFeedback(true);
+
+	return passed;
+}
+
+// Sampled stiff spring on a point mass, with the servo tick jittering and the force held between ticks. The mass moves
+// exactly under each held force, so any energy it gains comes from sampling. Returns the mass's final energy as a
+// fraction of its initial energy, and the lowest energy the passivity observer saw.
+double SimulateSampledSpring(float maxDamping, double& minObserved) {
+	const double mass = 0.1;
+	const double k = 200.0;
+
+	TestFalcon falcon;
+	falcon.SetPassivityControl(true, maxDamping);
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> interval(0.0005, 0.002);
+
+	double x = 0.005, v = 0.0;
+	double oldX = x;
+	double dt = 0.001;
+	double f[3] = { -k * x, 0.0, 0.0 };
+	double initial = 0.5 * k * x * x;
+
+	minObserved = 0.0;
+
+	for (double t = 0.0; t < 2.0; t += dt) {
+		// Hold the force for the next tick, which comes after a jittered interval
+		double a = f[0] / mass;
+		dt = interval(random);
+		x += v * dt + 0.5 * a * dt * dt;
+		v += a * dt;
+
+		// Sample the position and compute the next force
+		double displacement[3] = { x - oldX, 0.0, 0.0 };
+		double velocity[3] = { displacement[0] / dt, 0.0, 0.0 };
+		f[0] = -k * x;
+		f[1] = f[2] = 0.0;
+		falcon.ControlPassivity(f, displacement, velocity, dt);
+		oldX = x;
+
+		minObserved = std::min(minObserved, (double)falcon.GetPassivityStats().observedEnergy);
+	}
+
+	return (0.5 * mass * v * v + 0.5 * k * x * x) / initial;
+}
+
+// Check that the passivity observer catches the energy a sampled spring injects under tick jitter, and that the
+// controller removes it
+bool RunPassivityTest() {
+	double observedOff, observedOn;
+	double energyOff = SimulateSampledSpring(0.0f, observedOff);
+	double energyOn = SimulateSampledSpring(100.0f, observedOn);
+
+	bool detected = observedOff < 0.0 && energyOff > 1.0;
+	bool passive = energyOn <= 1.0;
+
+	printf("%-24s %12s %14s %s\n", "controller", "energy gain", "min observed", "result");
+	printf("%-24s %12.3f %14.2e %s\n", "observer only", energyOff, observedOff, detected ? "pass" : "FAIL");
+	printf("%-24s %12.3f %14.2e %s\n", "observer and damping", energyOn, observedOn, passive ? "pass" : "FAIL");
+	printf("%s\n", detected && passive ? "PASS" : "FAIL");
+
+	return detected && passive;
+}
+
+// Run a function in a child process, returning true if it aborted
+#if defined(FALCON_SERVO_CHECKS) && !defined(_WIN32)
+template <class F>
+bool Aborts(F f) {
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Keep the expected abort message out of the output
+		if (!freopen("/dev/null", "w", stderr)) _exit(2);
+		f();
+		_exit(0);
+	}
+
+	int status;
+	if (pid < 0 || waitpid(pid, &status, 0) != pid) return false;
+
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+#endif
+
+// Check that the servo checks abort on allocating or locking inside a tick, and only there
+bool RunServoCheckTest() {
+#if defined(FALCON_SERVO_CHECKS) && !defined(_WIN32)
+	struct Case {
+		const char* name;
+		bool expected;
+		bool aborted;
+	};
+
+	std::mutex mutex;
+
+	Case cases[] = {
+		{ "lock outside tick", false, Aborts([&] {
+			std::lock_guard<std::mutex> lock(mutex);
+		}) },
+		{ "lock in tick", true, Aborts([&] {
+			ServoCheck::Tick check;
+			std::lock_guard<std::mutex> lock(mutex);
+		}) },
+		{ "allocation outside tick", false, Aborts([] {
+			int* volatile p = new int(0);
+			delete p;
+		}) },
+		{ "allocation in tick", true, Aborts([] {
+			ServoCheck::Tick check;
+			int* volatile p = new int(0);
+			delete p;
+		}) }
+	};
+
+	bool passed = true;
+	for (const Case& c : cases) {
+		bool ok = c.aborted == c.expected;
+		printf("%-24s %-8s %s\n", c.name, c.aborted ? "aborted" : "ran", ok ? "pass" : "FAIL");
+		passed = passed && ok;
+	}
+
+	printf("%s\n", passed ? "PASS" : "FAIL");
+
+	return passed;
+#else
+	printf("Servo checks are not compiled in. Configure with FALCON_SERVO_CHECKS on a POSIX system.\n");
+
+	return false;
+#endif
 }
 
 void printUsage(char** argv) {
-	printf("Usage: %s -option\n", argv[0]);
+	printf("Usage: %s -option [-duration seconds]\n", argv[0]);
+	printf("       %s -stress [-script file] [-rate hz] [-realtime cpu priority] [-threshold value ...]\n", argv[0]);
+	printf("       %s -benchmark [-count n] [-duration seconds]\n", argv[0]);
+	printf("       %s -query [-count n]\n", argv[0]);
+	printf("       %s -probe [-count n] [-duration seconds]\n", argv[0]);
+	printf("       %s -servocheck\n", argv[0]);
+	printf("       %s -passivity\n", argv[0]);
+	printf("       %s -workspace\n", argv[0]);
 	printf("Options:\n");
 	printf("\tsimple\n");
 	printf("\tviscosity\n");
@@ -28,17 +846,176 @@ void printUsage(char** argv) {
 	printf("\tspring\n");
 	printf("\tintermolecular\n");
 	printf("\trandom\n");
+	printf("\tstress\t\t\tRun a stress scenario and exit with 0 if it passes\n");
+	printf("\tbenchmark\t\tTime expression forces and native kernels against the built in effects they reproduce,\n");
+	printf("\t\t\t\tfor 2 seconds each unless a duration is given\n");
+	printf("\tquery\t\t\tTime force queries on a 64^3 grid, with 100 effects of each type unless a count is given\n");
+	printf("\tprobe\t\t\tTime surfaces and springs with multi-point probes of up to 64 points, with 100 of each\n");
+	printf("\t\t\t\tfor 1 second each unless a count or duration is given\n");
+	printf("\tservocheck\t\tCheck that locking or allocating in a servo tick aborts, with FALCON_SERVO_CHECKS\n");
+	printf("\tpassivity\t\tCheck that the passivity observer and controller catch and remove the energy a sampled\n");
+	printf("\t\t\t\tspring injects under tick jitter\n");
+	printf("\tworkspace\t\tCheck that simple forces, springs and surfaces act as in graphics space in a graphics\n");
+	printf("\t\t\t\tworkspace with other proportions than the device's, and that force queries agree\n");
+	printf("Thresholds:\n");
+	printf("\tTiming thresholds are only checked with -realtime, or when one is given. The defaults assume the real-time\n");
+	printf("\tsetup in README.md; the force jump is always checked.\n");
+	printf("\tmaxLatency <us>\t\t99th percentile servo tick latency (default 200)\n");
+	printf("\tmaxTickTime <us>\t99.9th percentile servo tick time (default 500)\n");
+	printf("\tmaxMissed <n>\t\tMissed deadlines per phase (default 10)\n");
+	printf("\tmaxForceJump <N>\tForce change between ticks (default 0.5)\n");
+}
+
+// Print the device state until the duration is up
+void RunDemo(Falcon* falcon, double duration) {
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(duration * 1e6));
+
+	while (std::chrono::steady_clock::now() < end) {
+		Vector3 p = falcon->GetPosition();
+		Vector3 f = falcon->GetForce();
+
+		bool b0 = falcon->GetButton(0);
+		bool b1 = falcon->GetButton(1);
+		bool b2 = falcon->GetButton(2);
+		bool b3 = falcon->GetButton(3);
+
+		printf("---------------------------------\n");
+		printf("Position: %f %f %f\n", p.x, p.y, p.z);
+		printf("Force: %f %f %f\n", f.x, f.y, f.z);
+		printf("Buttons: %d %d %d %d\n", b0, b1, b2, b3);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
 }
 
 int main(int argc, char** argv) {
-	if (argc != 2) {
+	const char* option = argc > 1 ? argv[1] : "";
+	double duration = 10.0;
+	bool durationGiven = false;
+	int count = 1000;
+	bool countGiven = false;
+	std::string script = defaultScript;
+	float rate = 0.0f;
+	bool realTime = false;
+	int cpu = -1;
+	int priority = 80;
+
+	Thresholds thresholds;
+	thresholds.checkTiming = false;
+	thresholds.p99Latency = 200.0f;
+	thresholds.p999TickTime = 500.0f;
+	thresholds.missedDeadlines = 10;
+	thresholds.forceJump = 0.5f;
+
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc) {
+			duration = atof(argv[++i]);
+			durationGiven = true;
+		}
+		else if (strcmp(argv[i], "-count") == 0 && i + 1 < argc) {
+			count = atoi(argv[++i]);
+			countGiven = true;
+		}
+		else if (strcmp(argv[i], "-script") == 0 && i + 1 < argc) {
+			std::ifstream file(argv[++i]);
+			if (!file) {
+				printf("Could not read %s\n", argv[i]);
+				return 1;
+			}
+			std::stringstream contents;
+			contents << file.rdbuf();
+			script = contents.str();
+		}
+		else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) {
+			rate = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-realtime") == 0 && i + 2 < argc) {
+			realTime = true;
+			cpu = atoi(argv[++i]);
+			priority = atoi(argv[++i]);
+			thresholds.checkTiming = true;
+		}
+		else if (strcmp(argv[i], "-maxLatency") == 0 && i + 1 < argc) {
+			thresholds.p99Latency = (float)atof(argv[++i]);
+			thresholds.checkTiming = true;
+		}
+		else if (strcmp(argv[i], "-maxTickTime") == 0 && i + 1 < argc) {
+			thresholds.p999TickTime = (float)atof(argv[++i]);
+			thresholds.checkTiming = true;
+		}
+		else if (strcmp(argv[i], "-maxMissed") == 0 && i + 1 < argc) {
+			thresholds.missedDeadlines = atoi(argv[++i]);
+			thresholds.checkTiming = true;
+		}
+		else if (strcmp(argv[i], "-maxForceJump") == 0 && i + 1 < argc) {
+			thresholds.forceJump = (float)atof(argv[++i]);
+		}
+		else {
+			printUsage(argv);
+			return 1;
+		}
+	}
+
+	if (argc < 2) {
 		printUsage(argv);
 		printf("\nNo option provided, defaulting to simple\n");
 	}
 
+	// Needs no device
+	if (strcmp(option, "-servocheck") == 0) {
+		return RunServoCheckTest() ? 0 : 1;
+	}
+
+	if (strcmp(option, "-passivity") == 0) {
+		return RunPassivityTest() ? 0 : 1;
+	}
+
 	// Initialize Falcon
-	Falcon* falcon = new Falcon();
-	falcon->Initialize();
+	TestFalcon* falcon = new TestFalcon();
+	falcon->SetRealTime(realTime, cpu, priority);
+	if (rate > 0.0f) falcon->SetServoRate(rate);
+
+	if (!falcon->Initialize()) {
+		delete falcon;
+		return 1;
+	}
+
+	if (strcmp(option, "-stress") == 0) {
+		StressHarness harness(falcon, thresholds);
+		bool passed = harness.Run(script);
+
+		delete falcon;
+		return passed ? 0 : 1;
+	}
+
+	if (strcmp(option, "-benchmark") == 0) {
+		// Shorter by default than the demos, as each kernel is timed three times
+		RunBenchmark(falcon, count, durationGiven ? duration : 2.0);
+
+		delete falcon;
+		return 0;
+	}
+
+	if (strcmp(option, "-query") == 0) {
+		RunQueryBenchmark(falcon, countGiven ? count : 100);
+
+		delete falcon;
+		return 0;
+	}
+
+	if (strcmp(option, "-workspace") == 0) {
+		bool passed = RunWorkspaceTest(falcon);
+
+		delete falcon;
+		return passed ? 0 : 1;
+	}
+
+	if (strcmp(option, "-probe") == 0) {
+		RunProbeBenchmark(falcon, countGiven ? count : 100, durationGiven ? duration : 1.0);
+
+		delete falcon;
+		return 0;
+	}
 
 	Vector3 center;
 	center.x = center.y = center.z = 0.0;
@@ -49,7 +1026,7 @@ int main(int argc, char** argv) {
 	falcon->SetGraphicsWorkspace(center, size);
 
 	// Create force effect
-	if (argc != 2 || strcmp(argv[1], "-simple") == 0) {
+	if (argc < 2 || strcmp(option, "-simple") == 0) {
 		// Simple force
 		Vector3 f;
 		f.x = f.z = 0.0;
@@ -57,10 +1034,10 @@ int main(int argc, char** argv) {
 
 		falcon->AddSimpleForce(f);
 	}
-	else if (strcmp(argv[1], "-viscosity") == 0) {
+	else if (strcmp(option, "-viscosity") == 0) {
 		falcon->AddViscosity(0.5);
 	}
-	else if (strcmp(argv[1], "-surface") == 0) {
+	else if (strcmp(option, "-surface") == 0) {
 		Vector3 p;
 		p.x = p.y = p.z = 0.0;
 
@@ -70,19 +1047,19 @@ int main(int argc, char** argv) {
 
 		falcon->AddSurface(p, n, 20.0f, 0.01f);
 	}
-	else if (strcmp(argv[1], "-spring") == 0) {
+	else if (strcmp(option, "-spring") == 0) {
 		Vector3 p;
 		p.x = p.y = p.z = 0.0;
 
 		falcon->AddSpring(p, 2.0f, 0.01f);
 	}
-	else if (strcmp(argv[1], "-intermolecular") == 0) {
+	else if (strcmp(option, "-intermolecular") == 0) {
 		Vector3 p;
 		p.x = p.y = p.z = 0.0f;
 
 		falcon->AddIntermolecularForce(p, 10.0f, 0.01f, 2.0f, 4.0f);
 	}
-	else if (strcmp(argv[1], "-random") == 0) {
+	else if (strcmp(option, "-random") == 0) {
 		falcon->AddRandomForce(1.0f, 5.0f, 0.01f, 0.1f);
 	}
 	else {
@@ -97,20 +1074,9 @@ int main(int argc, char** argv) {
 		falcon->AddSimpleForce(f);
 	}
 
-    while (1) {
-		Vector3 p = falcon->GetPosition();
-        Vector3 f = falcon->GetForce();
+	RunDemo(falcon, duration);
 
-		bool b0 = falcon->GetButton(0);
-		bool b1 = falcon->GetButton(1);
-		bool b2 = falcon->GetButton(2);
-		bool b3 = falcon->GetButton(3);
-		
-		printf("---------------------------------\n");
-		printf("Position: %f %f %f\n", p.x, p.y, p.z);
-        printf("Force: %f %f %f\n", f.x, f.y, f.z);
-		printf("Buttons: %d %d %d %d\n", b0, b1, b2, b3);		
-    }
+	delete falcon;
 
-    return 0;
-}
\ No newline at end of file
+	return 0;
+}
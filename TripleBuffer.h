@@ -0,0 +1,71 @@
+/*=========================================================================
+
+  Name:        TripleBuffer.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Lock-free, single-writer single-reader triple buffer for
+               publishing snapshots to the servo thread. The writer never
+               waits for the reader and the reader always sees the most
+               recently published snapshot, without locking or copying.
+
+=========================================================================*/
+
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+
+#include <atomic>
+
+
+template <class T>
+class TripleBuffer {
+public:
+    TripleBuffer() : back(0), middle(1), front(2) {
+        buffers[0] = buffers[1] = buffers[2] = T();
+    }
+
+    // Writer: buffer to fill before publishing
+    T& Back() {
+        return buffers[back];
+    }
+
+    // Writer: publish the back buffer, taking the unused one in exchange
+    void Publish() {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader: switch to the most recently published buffer. Return true if there was a new one.
+    bool Update() {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit)) return false;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    // Reader: current buffer
+    const T& Front() const {
+        return buffers[front];
+    }
+
+protected:
+    static const int indexMask = 3;
+    static const int freshBit = 4;
+
+    T buffers[3];
+
+    // Writer's buffer
+    int back;
+
+    // Buffer being exchanged, with the fresh bit set when it was published and not yet taken
+    std::atomic<int> middle;
+
+    // Reader's buffer
+    int front;
+};
+
+
+#endif
@@ -15,11 +15,147 @@ using System.Runtime.InteropServices;
 
 
 public class Falcon : MonoBehaviour {
+	// Initialization status. Times in milliseconds.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct InitializeStatus {
+		public int state;
+		public float openTime;
+		public float firstForceTime;
+	}
+
+	// Initialization stages
+	public const int InitializeIdle = 0;
+	public const int InitializeOpening = 1;
+	public const int InitializeStarting = 2;
+	public const int InitializeReady = 3;
+	public const int InitializeFailed = 4;
+
+	// Servo tick timing statistics. Times in microseconds.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ServoStats {
+		public int ticks;
+		public int missedDeadlines;
+		public float requestedRate;
+		public float achievedRate;
+		public float meanLatency;
+		public float p99Latency;
+		public float maxLatency;
+		public float meanTickTime;
+		public float p99TickTime;
+		public float p999TickTime;
+		public float maxTickTime;
+	}
+
+	// Passivity controller statistics. Energies in Joules, damping in Ns/m.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct PassivityStats {
+		public float observedEnergy;
+		public float tickDissipated;
+		public float totalDissipated;
+		public float damping;
+		public float maxDampingApplied;
+		public int activeTicks;
+	}
+
+	// Compute budget scheduler statistics. Times in microseconds.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct SchedulerStats {
+		public int level;
+		public int heldEffects;
+		public int farEffects;
+		public float tickCost;
+		public float estimatedCost;
+		public float budget;
+	}
+
+	// Force cache statistics
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ForceCacheStats {
+		public float hitRate;
+		public float totalHitRate;
+		public int hits;
+		public int misses;
+	}
+
+	// Per effect type telemetry. Times in microseconds, force in graphics space.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct EffectTelemetry {
+		public int ticks;
+		public int evaluated;
+		public float tickTime;
+		public float meanTime;
+		public float maxTime;
+		public Vector3 force;
+	}
+
+	// External kernel timing. Times in microseconds.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct KernelStats {
+		public int ticks;
+		public int evaluated;
+		public int calls;
+		public float tickTime;
+		public float meanTime;
+		public float maxTime;
+	}
+
+	// Rigid body pose
+	[StructLayout(LayoutKind.Sequential)]
+	public struct RigidBodyPose {
+		public Vector3 position;
+		public Quaternion rotation;
+	}
+
+	// Molecular force field statistics. Times in microseconds.
+	[StructLayout(LayoutKind.Sequential)]
+	public struct ForceFieldStats {
+		public float updateRate;
+		public float computeTime;
+		public float modelAge;
+		public int pairs;
+		public int threads;
+	}
+
+	// Rigid body collision shapes
+	public const int RigidBodySphere = 0;
+	public const int RigidBodyBox = 1;
+
+	// Collider shapes
+	public const int ColliderSphere = 0;
+	public const int ColliderBox = 1;
+	public const int ColliderCapsule = 2;
+
+	// Effect types, for SetEffectGroup and GetEffectTelemetry
+	public const int SimpleForceEffect = 0;
+	public const int ViscosityEffect = 1;
+	public const int SurfaceEffect = 2;
+	public const int SpringEffect = 3;
+	public const int IntermolecularForceEffect = 4;
+	public const int RandomForceEffect = 5;
+	public const int RigidBodyEffect = 6;
+	public const int DistanceFieldEffect = 7;
+	public const int PathConstraintEffect = 8;
+	public const int RadialForceEffect = 9;
+	public const int VibrationEffect = 10;
+	public const int ExpressionForceEffect = 11;
+	public const int KernelForceEffect = 12;
+	public const int ColliderEffect = 13;
+	public const int ForceFieldEffect = 14;
+	public const int NumEffectTypes = 15;
+
+	// Built in vibration wavetables
+	public const int SineWave = 0;
+	public const int SquareWave = 1;
+	public const int SawtoothWave = 2;
+
 	// Position
 	public Vector3 position = Vector3.zero;
 	
 	// Displayed force
 	public Vector3 force = Vector3.zero;
+
+	// Torque of the displayed force about the device position, from a multi-point probe
+	public Vector3 torque = Vector3.zero;
 	
 	// Buttons
 	public bool[] buttons;
@@ -27,16 +163,76 @@ public class Falcon : MonoBehaviour {
 	// Use force feedback or not
 	public bool useForceFeedback = true;
 
+	// Haptic server to connect to, or empty to open the device in this process
+	public string hapticServer = "";
+
+	// Set once the device is ready
+	public bool initialized = false;
+
 	// Load functions from DLL
 	[DllImport ("FalconUnityPlugin")]
 	private static extern bool Initialize();	
+
+	[DllImport ("FalconUnityPlugin")]
+	private static extern bool InitializeAsync();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern InitializeStatus GetInitializeStatus();
 	
 	[DllImport ("FalconUnityPlugin")]
 	private static extern void CleanUp();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetHapticServer(string name);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetRealTime(bool enable, int cpu, int priority);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetServoRate(float hz);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetSubsteps(int n);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetPassivityControl(bool enable, float maxDamping);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern PassivityStats GetPassivityStats();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetComputeBudget(bool enable, float budget, float nearRadius);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern SchedulerStats GetSchedulerStats();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetForceCache(bool enable, float positionEpsilon, float velocityEpsilon);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern ForceCacheStats GetForceCacheStats();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern ServoStats GetServoStats();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void ResetServoStats();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetTelemetry(bool enable);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern EffectTelemetry GetEffectTelemetry(int type);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void ResetTelemetry();
 	
 	[DllImport ("FalconUnityPlugin")]
 	private static extern void SetGraphicsWorkspace(Vector3 center, Vector3 size);
 
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetGraphicsWorkspaceRotated(Vector3 center, Vector3 size, Quaternion rotation);
+
 	[DllImport ("FalconUnityPlugin")]
 	private static extern void ResetForces();
 	
@@ -45,6 +241,9 @@ public class Falcon : MonoBehaviour {
 
 	[DllImport ("FalconUnityPlugin")]
 	private static extern Vector3 GetForce();
+
+	[DllImport ("FalconUnityPlugin")]
+	private static extern Vector3 GetTorque();
 	
 	[DllImport ("FalconUnityPlugin")]
 	private static extern bool GetButton(int button);
@@ -140,21 +339,257 @@ public class Falcon : MonoBehaviour {
 
 	[DllImport ("FalconUnityPlugin")]
 	public static extern void RemoveRandomForces();	
+
+	// Rigid bodies
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddRigidBody(Vector3 p, Quaternion r, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateRigidBody(int i, float mass, Vector3 inertia, int shape, Vector3 extents, float k, float c, float linearDrag, float angularDrag);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetRigidBodyPose(int i, Vector3 p, Quaternion r);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern RigidBodyPose GetRigidBodyPose(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void GrabRigidBody(int i, bool grab);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveRigidBody(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveRigidBodies();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetRigidBodyGravity(Vector3 g);
+
+	// Effect groups. Every effect is in one of 32 groups, group 0 when added, and only effects in enabled groups are
+	// evaluated. Turning a group off keeps its effects and their state.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetEffectGroup(int type, int i, int group);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetGroupMask(uint mask);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetGroupEnabled(int group, bool enable);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern uint GetGroupMask();
+
+	// Signed distance fields. Distances are negative inside, x varying fastest, in the shape's local space.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddDistanceField(float[] distances, int nx, int ny, int nz, Vector3 origin, float cellSize, Vector3 p, Quaternion r, float k, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddDistanceFieldMesh(Vector3[] vertices, int numVertices, int[] triangles, int numTriangles, int resolution, Vector3 p, Quaternion r, float k, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateDistanceField(int i, Vector3 p, Quaternion r, float k, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern bool IsDistanceFieldReady(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveDistanceField(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveDistanceFields();
+
+	// Path constraints. Points are in the path's local space; along pushes towards the last point.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddPathConstraint(Vector3[] points, int numPoints, bool spline, bool closed, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdatePathConstraint(int i, Vector3 p, Quaternion r, float k, float c, float radius, float along);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemovePathConstraint(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemovePathConstraints();
+
+	// Radial forces. A profile gives force against distance, positive pushing away, shared by any number of radial forces.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddRadialProfile(float[] forces, int numSamples, float maxDistance, bool cubic);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveRadialProfile(int profile);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddRadialForce(Vector3 p, int profile, float scale, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateRadialForce(int i, Vector3 p, int profile, float scale, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveRadialForce(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveRadialForces();
+
+	// Vibrations, generated at servo rate. Silent until triggered; a duration of 0 holds until released.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddWavetable(float[] samples, int numSamples);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveWavetable(int wavetable);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddVibration(int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateVibration(int i, int wavetable, Vector3 direction, float amplitude, float frequency, float attack, float decay, float sustain, float release);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void TriggerVibration(int i, float duration);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void ReleaseVibration(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveVibration(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveVibrations();
+
+	// Expression forces, from statements setting fx, fy and fz in terms of px, py, pz, vx, vy, vz, t and u0 to u7,
+	// for example "fx = -u0 * px; fy = -u0 * py; fz = -u0 * pz". Returns -1 if the expression doesn't compile.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddExpressionForce(string expression);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetExpressionParameters(int i, float[] parameters, int numParameters);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveExpressionForce(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveExpressionForces();
+
+	// External kernel forces, from native libraries exporting FalconGetKernels as in FalconKernel.h. Kernels are
+	// found by name; each effect passes up to 16 parameters to its kernel.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int LoadKernelLibrary(string fileName);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int FindKernel(string name);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddKernelForce(int kernel, float[] parameters, int numParameters);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateKernelForce(int i, float[] parameters, int numParameters);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveKernelForce(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveKernelForces();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern KernelStats GetKernelStats(int kernel);
+
+	// Primitive colliders, found near the probe through a grid so large scenes of them are cheap. Spheres have radius
+	// extents.x, boxes half extents, and capsules radius extents.x and half the distance between the centers of their
+	// ends extents.y, along their local y axis.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddCollider(int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void UpdateCollider(int i, int shape, Vector3 extents, Vector3 p, Quaternion r, float k, float c);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveCollider(int i);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveColliders();
+
+	// Frames. Surfaces, springs and intermolecular forces in a frame have parameters in its local space, and move with
+	// it. Pass localToWorldMatrix for frames without a parent, and the transform relative to the parent otherwise.
+	// Removing a frame moves its children and effects to its parent without moving them, apart from any scale.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int AddFrame(int parent);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetFrames(int[] frames, Matrix4x4[] matrices, int n);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveFrame(int frame);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void RemoveFrames();
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetEffectFrame(int type, int i, int frame);
+
+	// Force queries, evaluating the effects without state at many points for drawing force fields, without touching
+	// the servo loop. Damping doesn't contribute. Zero threads uses all but two hardware threads.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int EvaluateForces(Vector3[] points, [Out] Vector3[] forces, int n, int numThreads);
+
+	// Multi-point probes, sampling the probe at up to 64 points or spheres offset from the device position, for tools
+	// with extent. Surfaces, springs, intermolecular forces, distance fields, radial forces and colliders act on every
+	// point, and spheres touch surfaces, distance fields and colliders at their radius. Null radii for points, and
+	// zero points for a single point probe. Set the offsets again to turn the tool.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetProbePoints(Vector3[] offsets, float[] radii, int n);
+
+	// Molecular force field
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetForceFieldReceptor(Vector3[] p, float[] sigma, float[] epsilon, float[] charge, int n);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetForceFieldLigand(Vector3[] p, float[] sigma, float[] epsilon, float[] charge, int n);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern void SetForceField(bool enable, float cutoff, float coulombConstant, float forceScale, float maxForce, float maxStiffness, float c, int numThreads);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern ForceFieldStats GetForceFieldStats();
+
+	// Scenes. Loading replaces all effects, giving the effects of each type ids 0 to n - 1 in the order saved.
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern bool LoadScene(string fileName);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern bool SaveScene(string fileName);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern bool LoadSceneData(byte[] data, int size);
+
+	[DllImport ("FalconUnityPlugin")]
+	public static extern int SaveSceneData(byte[] data, int size);
 	
 	void Awake() {		
 		// Initialize buttons
 		buttons = new bool[] { false, false, false, false };
 
-		if (Initialize()) {
+		SetHapticServer(hapticServer);
+
+		// Open the device without blocking. The workspace and effects can be set while it opens.
+		if (InitializeAsync()) {
 			Renderer renderer = GetComponent<Renderer> ();
 			SetGraphicsWorkspace(renderer.bounds.center, 
 			                     renderer.bounds.size);
 
-			UpdateState();
-
 			UseForceFeedback(useForceFeedback);
-
-			Debug.Log("Falcon success");
 		}
 		else {
 			Debug.Log("Falcon failure");
@@ -167,6 +602,19 @@ public class Falcon : MonoBehaviour {
 	}
 	
 	void FixedUpdate() {
+		if (!initialized) {
+			InitializeStatus status = GetInitializeStatus();
+
+			if (status.state == InitializeReady) {
+				initialized = true;
+				Debug.Log("Falcon success, first force after " + status.firstForceTime + " ms");
+			}
+			else if (status.state == InitializeFailed) {
+				Debug.Log("Falcon failure");
+				enabled = false;
+			}
+		}
+
 		UpdateState();
 	}
 
@@ -176,6 +624,7 @@ public class Falcon : MonoBehaviour {
 		
 		// Update force
 		force = GetForce();
+		torque = GetTorque();
 		
 		// Update buttons
 		for (int i = 0; i < buttons.Length; i++) {
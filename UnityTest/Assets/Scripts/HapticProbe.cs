@@ -14,6 +14,14 @@ public class HapticProbe : MonoBehaviour {
 	// The Falcon device
 	private Falcon falcon;
 
+	// Each effect is added once, in its own group, and turned on and off by enabling its group, which keeps its state
+	private const int simpleForceGroup = 1;
+	private const int viscosityGroup = 2;
+	private const int surfaceGroup = 3;
+	private const int springGroup = 4;
+	private const int intermolecularForceGroup = 5;
+	private const int randomForceGroup = 6;
+
 	// Simple force
 	private int simpleForceIndex = -1;
 	public bool useSimpleForce = false;
@@ -26,14 +34,17 @@ public class HapticProbe : MonoBehaviour {
 	// Surface
 	private int surfaceIndex = -1;
 	public bool useSurface = false;
+	private bool surfaceEnabled = false;
 
 	// Spring
 	private int springIndex = -1;
 	public bool useSpring = false;
+	private bool springEnabled = false;
 
 	// Intermolecular force
 	private int intermolecularForceIndex = -1;
 	public bool useIntermolecularForce = false;
+	private bool intermolecularForceEnabled = false;
 
 	// Random
 	private int randomForceIndex = -1;
@@ -49,7 +60,28 @@ public class HapticProbe : MonoBehaviour {
 
 		SetPosition();
 
+		// Add the effects with their groups off
+		for (int group = simpleForceGroup; group <= randomForceGroup; group++) {
+			Falcon.SetGroupEnabled (group, false);
+		}
+
 		simpleForceIndex = Falcon.AddSimpleForce (simpleForce);
+		Falcon.SetEffectGroup (Falcon.SimpleForceEffect, simpleForceIndex, simpleForceGroup);
+
+		viscosityIndex = Falcon.AddViscosity (0.5f, 0.25f);
+		Falcon.SetEffectGroup (Falcon.ViscosityEffect, viscosityIndex, viscosityGroup);
+
+		surfaceIndex = Falcon.AddSurface (transform.position, new Vector3(0.0f, 1.0f, 0.0f), 20.0f, 0.01f);
+		Falcon.SetEffectGroup (Falcon.SurfaceEffect, surfaceIndex, surfaceGroup);
+
+		springIndex = Falcon.AddSpring (transform.position, 2.0f, 0.01f, 0.0f, -1.0f);
+		Falcon.SetEffectGroup (Falcon.SpringEffect, springIndex, springGroup);
+
+		intermolecularForceIndex = Falcon.AddIntermolecularForce (transform.position, 10.0f, 0.01f, 2.0f, 4.0f);
+		Falcon.SetEffectGroup (Falcon.IntermolecularForceEffect, intermolecularForceIndex, intermolecularForceGroup);
+
+		randomForceIndex = Falcon.AddRandomForce (1.0f, 5.0f, 0.01f, 0.1f);
+		Falcon.SetEffectGroup (Falcon.RandomForceEffect, randomForceIndex, randomForceGroup);
 	}
 	
 	void FixedUpdate () {
@@ -58,62 +90,36 @@ public class HapticProbe : MonoBehaviour {
 
 		// Update simple force
 		if (useSimpleForce) {
-			if (simpleForceIndex < 0) {
-				simpleForceIndex = Falcon.AddSimpleForce (simpleForce);
-			} 
-			else {
-				Falcon.UpdateSimpleForce (simpleForceIndex, simpleForce);
-			}
-		} 
-		else if (simpleForceIndex >= 0) {
-			Falcon.RemoveSimpleForce (simpleForceIndex);
-			simpleForceIndex = -1;
+			Falcon.UpdateSimpleForce (simpleForceIndex, simpleForce);
 		}
+		Falcon.SetGroupEnabled (simpleForceGroup, useSimpleForce);
 
 		// Update viscosity
-		if (useViscosity && viscosityIndex < 0) {
-			viscosityIndex = Falcon.AddViscosity (0.5f, 0.25f);
-		} 
-		else if (!useViscosity && viscosityIndex >= 0) {
-			Falcon.RemoveViscosity (viscosityIndex);
-			viscosityIndex = -1;
-		}
+		Falcon.SetGroupEnabled (viscosityGroup, useViscosity);
 
-		// Update surface
-		if (useSurface && surfaceIndex < 0) {
-			surfaceIndex = Falcon.AddSurface (transform.position, new Vector3(0.0f, 1.0f, 0.0f), 20.0f, 0.01f);
-		} 
-		else if (!useSurface && surfaceIndex >= 0) {
-			Falcon.RemoveSurface (surfaceIndex);
-			surfaceIndex = -1;
+		// Update surface, anchored where the probe is when turned on
+		if (useSurface && !surfaceEnabled) {
+			Falcon.UpdateSurface (surfaceIndex, transform.position, new Vector3(0.0f, 1.0f, 0.0f), 20.0f, 0.01f);
 		}
+		surfaceEnabled = useSurface;
+		Falcon.SetGroupEnabled (surfaceGroup, useSurface);
 
 		// Update spring
-		if (useSpring && springIndex < 0) {
-			springIndex = Falcon.AddSpring (transform.position, 2.0f, 0.01f, 0.0f, -1.0f);
-		} 
-		else if (!useSpring && springIndex >= 0) {
-			Falcon.RemoveSpring (springIndex);
-			springIndex = -1;
+		if (useSpring && !springEnabled) {
+			Falcon.UpdateSpring (springIndex, transform.position, 2.0f, 0.01f, 0.0f, -1.0f);
 		}
+		springEnabled = useSpring;
+		Falcon.SetGroupEnabled (springGroup, useSpring);
 
 		// Update intermolecular
-		if (useIntermolecularForce && intermolecularForceIndex < 0) {
-			intermolecularForceIndex = Falcon.AddIntermolecularForce (transform.position, 10.0f, 0.01f, 2.0f, 4.0f);
-		} 
-		else if (!useIntermolecularForce && intermolecularForceIndex >= 0) {
-			Falcon.RemoveIntermolecularForce (intermolecularForceIndex);
-			intermolecularForceIndex = -1;
+		if (useIntermolecularForce && !intermolecularForceEnabled) {
+			Falcon.UpdateIntermolecularForce (intermolecularForceIndex, transform.position, 10.0f, 0.01f, 2.0f, 4.0f);
 		}
+		intermolecularForceEnabled = useIntermolecularForce;
+		Falcon.SetGroupEnabled (intermolecularForceGroup, useIntermolecularForce);
 
 		// Update Random
-		if (useRandomForce && randomForceIndex < 0) {
-			randomForceIndex = Falcon.AddRandomForce (1.0f, 5.0f, 0.01f, 0.1f);
-		} 
-		else if (!useRandomForce && randomForceIndex >= 0) {
-			Falcon.RemoveRandomForce (randomForceIndex);
-			randomForceIndex = -1;
-		}
+		Falcon.SetGroupEnabled (randomForceGroup, useRandomForce);
 	}
 
 	void SetPosition() {
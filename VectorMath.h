@@ -0,0 +1,282 @@
+/*=========================================================================
+
+  Name:        VectorMath.h
+
+  Author:      David Borland, The Renaissance Computing Institute (RENCI)
+
+  Copyright:   The Renaissance Computing Institute (RENCI)
+
+  Description: Vector, matrix and quaternion utility functions shared by
+               the servo loop and the worker threads.
+
+=========================================================================*/
+
+
+#ifndef VECTORMATH_H
+#define VECTORMATH_H
+
+
+#include <cmath>
+#include <cstdio>
+
+
+inline void VectorSet(double result[3], double x, double y, double z) {
+    result[0] = x;
+    result[1] = y;
+    result[2] = z;
+}
+
+inline void VectorCopy(double result[3], const double v[3]) {
+    result[0] = v[0];
+    result[1] = v[1];
+    result[2] = v[2];
+}
+
+inline void VectorAdd(double result[3], const double v1[3], const double v2[3]) {
+    result[0] = v1[0] + v2[0];
+    result[1] = v1[1] + v2[1];
+    result[2] = v1[2] + v2[2];
+}
+
+inline void VectorSubtract(double result[3], const double v1[3], const double v2[3]) {
+    result[0] = v1[0] - v2[0];
+    result[1] = v1[1] - v2[1];
+    result[2] = v1[2] - v2[2];
+}
+
+inline void VectorScale(double result[3], const double v[3], double s) {
+    result[0] = v[0] * s;
+    result[1] = v[1] * s;
+    result[2] = v[2] * s;
+}
+
+inline double VectorMagnitudeSquared(const double v[3]) {
+    return v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+}
+
+inline double VectorMagnitude(const double v[3]) {
+    return sqrt(VectorMagnitudeSquared(v));
+}
+
+inline void VectorNormalize(double result[3], const double v[3]) {
+    // Zero length vectors stay zero, so a probe sitting exactly on an anchor doesn't produce NaN forces
+    double m = VectorMagnitude(v);
+    VectorScale(result, v, m > 0.0 ? 1.0 / m : 0.0);
+}
+
+inline double VectorDotProduct(const double v1[3], const double v2[3]) {
+    return v1[0]*v2[0] + v1[1]*v2[1] + v1[2]*v2[2];
+}
+
+inline void VectorCrossProduct(double result[3], const double v1[3], const double v2[3]) {
+    double r[3];
+    r[0] = v1[1] * v2[2] - v1[2] * v2[1];
+    r[1] = v1[2] * v2[0] - v1[0] * v2[2];
+    r[2] = v1[0] * v2[1] - v1[1] * v2[0];
+
+    VectorCopy(result, r);
+}
+
+inline void VectorRemoveComponent(double result[3], const double v[3], const double axis[3]) {
+    // Axis should be normalized
+    double d = VectorDotProduct(v, axis);
+    result[0] = v[0] - d * axis[0];
+    result[1] = v[1] - d * axis[1];
+    result[2] = v[2] - d * axis[2];
+}
+
+inline void VectorLerp(double result[3], const double v1[3], const double v2[3], double a) {
+    result[0] = v1[0] + a * (v2[0] - v1[0]);
+    result[1] = v1[1] + a * (v2[1] - v1[1]);
+    result[2] = v1[2] + a * (v2[2] - v1[2]);
+}
+
+inline void VectorPrint(const double v[3]) {
+    printf("%f, %f, %f\n", v[0], v[1], v[2]);
+}
+
+// Matrices are 4x4 affine transforms stored in column-major order, as used by HDAL
+inline void MatrixVectorMultiply(double result[3], const double m[16], const double v[3]) {
+    double r[3];
+    r[0] = m[0]  * v[0] +
+           m[4]  * v[1] +
+           m[8]  * v[2] +
+           m[12];
+    
+    r[1] = m[1]  * v[0] +
+           m[5]  * v[1] +
+           m[9]  * v[2] +
+           m[13];
+
+    r[2] = m[2]  * v[0] +
+           m[6]  * v[1] +
+           m[10] * v[2] +
+           m[14];
+
+    VectorCopy(result, r);
+}
+
+inline void MatrixDirectionMultiply(double result[3], const double m[16], const double v[3]) {
+    // Linear part only
+    double r[3];
+    r[0] = m[0] * v[0] + m[4] * v[1] + m[8]  * v[2];
+    r[1] = m[1] * v[0] + m[5] * v[1] + m[9]  * v[2];
+    r[2] = m[2] * v[0] + m[6] * v[1] + m[10] * v[2];
+
+    VectorCopy(result, r);
+}
+
+inline void MatrixTransposeDirectionMultiply(double result[3], const double m[16], const double v[3]) {
+    // Transpose of linear part only
+    double r[3];
+    r[0] = m[0] * v[0] + m[1] * v[1] + m[2]  * v[2];
+    r[1] = m[4] * v[0] + m[5] * v[1] + m[6]  * v[2];
+    r[2] = m[8] * v[0] + m[9] * v[1] + m[10] * v[2];
+
+    VectorCopy(result, r);
+}
+
+inline void MatrixIdentity(double result[16]) {
+    for (int i = 0; i < 16; i++) {
+        result[i] = i % 4 == i / 4 ? 1.0 : 0.0;
+    }
+}
+
+inline void MatrixScale(double result[16], double s) {
+    // Uniform scale of the linear part
+    MatrixIdentity(result);
+    result[0] = result[5] = result[10] = s;
+}
+
+inline void MatrixMultiply(double result[16], const double m1[16], const double m2[16]) {
+    double r[16];
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) {
+            r[col * 4 + row] = m1[row]      * m2[col * 4] +
+                               m1[4 + row]  * m2[col * 4 + 1] +
+                               m1[8 + row]  * m2[col * 4 + 2] +
+                               m1[12 + row] * m2[col * 4 + 3];
+        }
+    }
+
+    for (int i = 0; i < 16; i++) {
+        result[i] = r[i];
+    }
+}
+
+inline double MatrixDeterminant(const double m[16]) {
+    // Determinant of linear part
+    return m[0] * (m[5] * m[10] - m[9] * m[6]) -
+           m[4] * (m[1] * m[10] - m[9] * m[2]) +
+           m[8] * (m[1] * m[6]  - m[5] * m[2]);
+}
+
+inline void MatrixInvertAffine(double result[16], const double m[16]) {
+    // Invert linear part using the adjugate
+    double invDet = 1.0 / MatrixDeterminant(m);
+
+    double r[16];
+    r[0]  =  (m[5] * m[10] - m[9] * m[6]) * invDet;
+    r[1]  = -(m[1] * m[10] - m[9] * m[2]) * invDet;
+    r[2]  =  (m[1] * m[6]  - m[5] * m[2]) * invDet;
+    r[4]  = -(m[4] * m[10] - m[8] * m[6]) * invDet;
+    r[5]  =  (m[0] * m[10] - m[8] * m[2]) * invDet;
+    r[6]  = -(m[0] * m[6]  - m[4] * m[2]) * invDet;
+    r[8]  =  (m[4] * m[9]  - m[8] * m[5]) * invDet;
+    r[9]  = -(m[0] * m[9]  - m[8] * m[1]) * invDet;
+    r[10] =  (m[0] * m[5]  - m[4] * m[1]) * invDet;
+
+    // Translation is the negated, inverse-transformed translation
+    r[3] = r[7] = r[11] = 0.0;
+    r[15] = 1.0;
+
+    double t[3];
+    VectorSet(t, -m[12], -m[13], -m[14]);
+    MatrixDirectionMultiply(t, r, t);
+    r[12] = t[0];
+    r[13] = t[1];
+    r[14] = t[2];
+
+    for (int i = 0; i < 16; i++) {
+        result[i] = r[i];
+    }
+}
+
+inline void MatrixTranspose(double result[16], const double m[16]) {
+    // Transpose of linear part, for inverting rotations. No translation.
+    MatrixIdentity(result);
+    for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++) {
+            result[col * 4 + row] = m[row * 4 + col];
+        }
+    }
+}
+
+inline void QuaternionToMatrix(double result[16], const double q[4]) {
+    // Quaternion is (x, y, z, w). No translation.
+    double x = q[0], y = q[1], z = q[2], w = q[3];
+
+    MatrixIdentity(result);
+    result[0]  = 1.0 - 2.0 * (y * y + z * z);
+    result[1]  = 2.0 * (x * y + z * w);
+    result[2]  = 2.0 * (x * z - y * w);
+    result[4]  = 2.0 * (x * y - z * w);
+    result[5]  = 1.0 - 2.0 * (x * x + z * z);
+    result[6]  = 2.0 * (y * z + x * w);
+    result[8]  = 2.0 * (x * z + y * w);
+    result[9]  = 2.0 * (y * z - x * w);
+    result[10] = 1.0 - 2.0 * (x * x + y * y);
+}
+
+inline void MatrixToQuaternion(double result[4], const double m[16]) {
+    // Rotation part of the matrix, choosing the largest diagonal term for precision
+    double trace = m[0] + m[5] + m[10];
+
+    if (trace > 0.0) {
+        double s = 0.5 / sqrt(trace + 1.0);
+        result[3] = 0.25 / s;
+        result[0] = (m[6] - m[9]) * s;
+        result[1] = (m[8] - m[2]) * s;
+        result[2] = (m[1] - m[4]) * s;
+    }
+    else if (m[0] > m[5] && m[0] > m[10]) {
+        double s = 2.0 * sqrt(1.0 + m[0] - m[5] - m[10]);
+        result[3] = (m[6] - m[9]) / s;
+        result[0] = 0.25 * s;
+        result[1] = (m[4] + m[1]) / s;
+        result[2] = (m[8] + m[2]) / s;
+    }
+    else if (m[5] > m[10]) {
+        double s = 2.0 * sqrt(1.0 + m[5] - m[0] - m[10]);
+        result[3] = (m[8] - m[2]) / s;
+        result[0] = (m[4] + m[1]) / s;
+        result[1] = 0.25 * s;
+        result[2] = (m[9] + m[6]) / s;
+    }
+    else {
+        double s = 2.0 * sqrt(1.0 + m[10] - m[0] - m[5]);
+        result[3] = (m[1] - m[4]) / s;
+        result[0] = (m[8] + m[2]) / s;
+        result[1] = (m[9] + m[6]) / s;
+        result[2] = 0.25 * s;
+    }
+}
+
+inline void QuaternionIntegrate(double q[4], const double w[3], double dt) {
+    // q += 0.5 * (w, 0) * q * dt, then renormalize
+    double h = 0.5 * dt;
+    double x = q[0], y = q[1], z = q[2], s = q[3];
+
+    q[0] += h * ( w[0] * s + w[1] * z - w[2] * y);
+    q[1] += h * (-w[0] * z + w[1] * s + w[2] * x);
+    q[2] += h * ( w[0] * y - w[1] * x + w[2] * s);
+    q[3] += h * (-w[0] * x - w[1] * y - w[2] * z);
+
+    double m = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++) {
+        q[i] /= m;
+    }
+}
+
+
+#endif